@@ -11,103 +11,164 @@
 #include "bme280_reader.h"
 #include <stdio.h>
 #include <string.h>
-#include "driver/i2c.h"
-#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "hal.h"
+#include "nvs.h"
+#include "esp_rom_crc.h"
 #include "tcpip_sender.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "metrics.h"
+#include "power_manager.h"
+#include "sensor_hub.h"
 
 #include "sdkconfig.h" // generated by "make menuconfig"
 
-#define SDA_PIN             GPIO_NUM_21
-#define SCL_PIN             GPIO_NUM_22
-#define I2C_PORT_NUMBER     I2C_NUM_0
-
-#define I2C_MASTER_ACK      0
-#define I2C_MASTER_NACK     1
-#define I2C_CLOCK_SPEED     1000000
-
-static bme280_calib_data m_calibData;
-static bme280_raw_data m_rawData;
-
-static void bme280_i2c_master_init()
+#define BME280_READY_POLL_COUNT 10
+#define BME280_READY_POLL_MS    1
+// sensors probed by init unless bme280_reader_set_devices() is called
+#if CONFIG_WEATHER_BME280_SECOND
+#define BME280_DEFAULT_DEVICES  2
+#else
+#define BME280_DEFAULT_DEVICES  1
+#endif
+// chip id reads before sensor is treated as not connected
+#define BME280_PROBE_COUNT      10
+// prints average CPU cycles of compensating and storing one reading
+#define BME280_PRINT_CYCLES         0
+#define BME280_CYCLES_READING_COUNT 60
+
+#define BME280_NVS_NAMESPACE    "bme280"
+#define BME280_CALIB_TP_SIZE    (BME280_REGISTER_DIG_H1 - BME280_REGISTER_DIG_T1 + 1)
+#define BME280_CALIB_H_SIZE     (BME280_REGISTER_DIG_H6 - BME280_REGISTER_DIG_H2 + 1)
+
+/*
+* Calibration data stored to NVS
+*/
+typedef struct
 {
-    i2c_config_t i2c_config = {
-        .mode = I2C_MODE_MASTER,
-        .sda_io_num = SDA_PIN,
-        .scl_io_num = SCL_PIN,
-        .sda_pullup_en = GPIO_PULLUP_ENABLE,
-        .scl_pullup_en = GPIO_PULLUP_ENABLE,
-        .master.clk_speed = I2C_CLOCK_SPEED
-    };
-    i2c_param_config(I2C_PORT_NUMBER, &i2c_config);
-    i2c_driver_install(I2C_PORT_NUMBER, I2C_MODE_MASTER, 0, 0, 0);
-}
+    bme280_calib_data calib;
+    uint32_t crc;
+} bme280_calib_cache;
 
-bool bme280_I2C_bus_write(uint8_t reg_addr, uint8_t reg_data)
+typedef enum
 {
-    esp_err_t espRc;
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (BME280_ADDRESS << 1) | I2C_MASTER_WRITE, true);
-
-    i2c_master_write_byte(cmd, reg_addr, true);
-    i2c_master_write(cmd, &reg_data, 1, true);
-    i2c_master_stop(cmd);
-
-    espRc = i2c_master_cmd_begin(I2C_PORT_NUMBER, cmd, 10/portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
-
-    return espRc == ESP_OK;
+    Bme280PhaseStart = 0,   // forced measurement is started
+    Bme280PhaseRead,        // status is polled and data is read
+} bme280_phase;
+
+/*
+* State of one sensor
+*/
+typedef struct
+{
+    bme280_device_config config;
+    bme280_calib_data calib;
+    bme280_raw_data raw;
+} bme280_device;
+
+// sensors that are probed by init, missing ones are skipped
+static bme280_device m_devices[BME280_MAX_DEVICES] = {
+    { .config = { 0, CONFIG_WEATHER_BME280_ADDRESS, SensorTypeTemperature, SensorTypeHumid, SensorTypePresure } },
+#if CONFIG_WEATHER_BME280_SECOND
+    { .config = { 0, CONFIG_WEATHER_BME280_SECOND_ADDRESS, SensorTypeTemperature2, SensorTypeHumid2,
+                  SensorTypePresure2 } },
+#endif
+};
+static size_t m_deviceCount = BME280_DEFAULT_DEVICES;
+// bit mask of devices found by init
+static uint32_t m_present = 0;
+// forced measurement state, used only by sensor hub task
+static bme280_phase m_phase = Bme280PhaseStart;
+static uint32_t m_measuring = 0;
+static uint32_t m_ready = 0;
+static int m_pollCount = 0;
+// time from start of sample period to next run
+static uint32_t m_cycleMs = 0;
+static bme280_config m_config = {
+    .osrs_t = BME280_OVERSAMPLING_1,
+    .osrs_p = BME280_OVERSAMPLING_1,
+    .osrs_h = BME280_OVERSAMPLING_1,
+    .mode = BME280_MODE_FORCED,
+    .standby = BME280_STANDBY_1000_MS,
+    .filter = BME280_FILTER_OFF,
+    .sample_period_ms = 1000,
+};
+
+static bool bme280_I2C_bus_write(const bme280_device *device, uint8_t reg_addr, uint8_t reg_data)
+{
+    return hal_i2c_write(device->config.port, device->config.address, reg_addr, &reg_data, 1);
 }
 
-
-static bool bme280_I2C_bus_read(uint8_t register_address, uint8_t *data_out, uint8_t data_size)
+static bool bme280_I2C_bus_read(const bme280_device *device, uint8_t register_address, uint8_t *data_out,
+                                uint8_t data_size)
 {
-    esp_err_t espRc;
-
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (BME280_ADDRESS << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write_byte(cmd, register_address, true);
-
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (BME280_ADDRESS << 1) | I2C_MASTER_READ, true);
-
-    if (data_size > 1) {
-        i2c_master_read(cmd, data_out, data_size-1, I2C_MASTER_ACK);
-    }
-    i2c_master_read_byte(cmd, data_out+data_size-1, I2C_MASTER_NACK);
-    i2c_master_stop(cmd);
-
-    espRc = i2c_master_cmd_begin(I2C_PORT_NUMBER, cmd, 10/portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
-
-    return espRc == ESP_OK;
+    return hal_i2c_read(device->config.port, device->config.address, register_address, data_out, data_size);
 }
 
-static uint16_t bme280_I2C_bus_read_16(uint8_t register_address)
+/*!
+ *	@brief bme280_I2C_bus_batch
+ *	accesses same register of every device in mask, with one command link
+ *	per port. If link fails, transfers are retried one by one, so one missing
+ *	sensor doesn't fail others.
+ *
+ *  \param data BME280_MAX_DEVICES blocks of size bytes, block of device index
+ *  is used
+ *  \return mask of devices whose transfer succeeded
+ */
+static uint32_t bme280_I2C_bus_batch(uint32_t devices, bool write, uint8_t reg, uint8_t *data, size_t size)
 {
-    uint8_t data[2];
-    if (!bme280_I2C_bus_read(register_address, data, 2)) {
-        return 0;
+    HalI2cTransfer transfers[BME280_MAX_DEVICES];
+    uint8_t index[BME280_MAX_DEVICES];
+    uint32_t done = 0;
+    size_t count, i;
+    uint8_t port;
+
+    for (port=0;port<HAL_I2C_PORT_COUNT;port++) {
+        count = 0;
+        for (i=0;i<m_deviceCount;i++) {
+            if ((devices & (1u << i)) == 0 || m_devices[i].config.port != port) {
+                continue;
+            }
+            transfers[count].m_address = m_devices[i].config.address;
+            transfers[count].m_reg = reg;
+            transfers[count].m_write = write;
+            transfers[count].m_data = data + i * size;
+            transfers[count].m_size = size;
+            index[count++] = (uint8_t)i;
+        }
+        if (count == 0) {
+            continue;
+        }
+        if (hal_i2c_transfer(port, transfers, count)) {
+            for (i=0;i<count;i++) {
+                done |= 1u << index[i];
+            }
+            continue;
+        }
+        if (count == 1) {
+            continue;
+        }
+        for (i=0;i<count;i++) {
+            if (hal_i2c_transfer(port, &transfers[i], 1)) {
+                done |= 1u << index[i];
+            }
+        }
     }
-    uint16_t ret;
-    memcpy(&ret, data, 2);
-    return ret;
-
+    return done;
 }
 
-static uint8_t bme280_I2C_bus_read_8(uint8_t register_address)
+static uint16_t bme280_get_u16(const uint8_t *data)
 {
-    uint8_t ret = 0;
-    bme280_I2C_bus_read(register_address, &ret, 1);
-    return ret;
+    return (uint16_t)(data[0] | (data[1] << 8));
 }
 
 /*!
- *	@brief bme280_reader_calibration
+ *	@brief bme280_reader_decode_calibration
  *	calibration parameters used for calculation in the registers
+ *	tp is burst read from 0x88..0xA1 and h from 0xE1..0xE7
  *
  *  parameter | Register address |   bit
  *------------|------------------|----------------
@@ -131,58 +192,334 @@ static uint8_t bme280_I2C_bus_read_8(uint8_t register_address)
  *	dig_H6    |         0xE7     | from 0 to 7
  *
  */
-static void bme280_reader_calibration()
-{
-    m_calibData.dig_T1 = (uint16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_T1);
-    m_calibData.dig_T2 = (int16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_T2);
-    m_calibData.dig_T3 = (int16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_T3);
-
-    m_calibData.dig_P1 = (uint16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_P1);
-    m_calibData.dig_P2 = (int16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_P2);
-    m_calibData.dig_P3 = (int16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_P3);
-    m_calibData.dig_P4 = (int16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_P4);
-    m_calibData.dig_P5 = (int16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_P5);
-    m_calibData.dig_P6 = (int16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_P6);
-    m_calibData.dig_P7 = (int16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_P7);
-    m_calibData.dig_P8 = (int16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_P8);
-    m_calibData.dig_P9 = (int16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_P9);
-
-    m_calibData.dig_H1 = (uint8_t)bme280_I2C_bus_read_8(BME280_REGISTER_DIG_H1);
-    m_calibData.dig_H2 = (int16_t)bme280_I2C_bus_read_16(BME280_REGISTER_DIG_H2);
-    m_calibData.dig_H3 = (uint8_t)bme280_I2C_bus_read_8(BME280_REGISTER_DIG_H3);
-    m_calibData.dig_H4 = (bme280_I2C_bus_read_8(BME280_REGISTER_DIG_H4) << 4) | (bme280_I2C_bus_read_8(BME280_REGISTER_DIG_H4+1) & 0xF);
-    m_calibData.dig_H5 = (bme280_I2C_bus_read_8(BME280_REGISTER_DIG_H5+1) << 4) | (bme280_I2C_bus_read_8(BME280_REGISTER_DIG_H5) >> 4);
-    m_calibData.dig_H6 = (int8_t)bme280_I2C_bus_read_8(BME280_REGISTER_DIG_H6);
+static void bme280_reader_decode_calibration(const uint8_t *tp, const uint8_t *h, bme280_calib_data *calib)
+{
+    memset(calib, 0, sizeof(bme280_calib_data));
+    calib->dig_T1 = bme280_get_u16(tp + BME280_REGISTER_DIG_T1 - BME280_REGISTER_DIG_T1);
+    calib->dig_T2 = (int16_t)bme280_get_u16(tp + BME280_REGISTER_DIG_T2 - BME280_REGISTER_DIG_T1);
+    calib->dig_T3 = (int16_t)bme280_get_u16(tp + BME280_REGISTER_DIG_T3 - BME280_REGISTER_DIG_T1);
+
+    calib->dig_P1 = bme280_get_u16(tp + BME280_REGISTER_DIG_P1 - BME280_REGISTER_DIG_T1);
+    calib->dig_P2 = (int16_t)bme280_get_u16(tp + BME280_REGISTER_DIG_P2 - BME280_REGISTER_DIG_T1);
+    calib->dig_P3 = (int16_t)bme280_get_u16(tp + BME280_REGISTER_DIG_P3 - BME280_REGISTER_DIG_T1);
+    calib->dig_P4 = (int16_t)bme280_get_u16(tp + BME280_REGISTER_DIG_P4 - BME280_REGISTER_DIG_T1);
+    calib->dig_P5 = (int16_t)bme280_get_u16(tp + BME280_REGISTER_DIG_P5 - BME280_REGISTER_DIG_T1);
+    calib->dig_P6 = (int16_t)bme280_get_u16(tp + BME280_REGISTER_DIG_P6 - BME280_REGISTER_DIG_T1);
+    calib->dig_P7 = (int16_t)bme280_get_u16(tp + BME280_REGISTER_DIG_P7 - BME280_REGISTER_DIG_T1);
+    calib->dig_P8 = (int16_t)bme280_get_u16(tp + BME280_REGISTER_DIG_P8 - BME280_REGISTER_DIG_T1);
+    calib->dig_P9 = (int16_t)bme280_get_u16(tp + BME280_REGISTER_DIG_P9 - BME280_REGISTER_DIG_T1);
+
+    calib->dig_H1 = tp[BME280_REGISTER_DIG_H1 - BME280_REGISTER_DIG_T1];
+    calib->dig_H2 = (int16_t)bme280_get_u16(h + BME280_REGISTER_DIG_H2 - BME280_REGISTER_DIG_H2);
+    calib->dig_H3 = h[BME280_REGISTER_DIG_H3 - BME280_REGISTER_DIG_H2];
+    calib->dig_H4 = (int16_t)((int8_t)h[BME280_REGISTER_DIG_H4 - BME280_REGISTER_DIG_H2] * 16
+                              | (h[BME280_REGISTER_DIG_H4 + 1 - BME280_REGISTER_DIG_H2] & 0xF));
+    calib->dig_H5 = (int16_t)((int8_t)h[BME280_REGISTER_DIG_H5 + 1 - BME280_REGISTER_DIG_H2] * 16
+                              | (h[BME280_REGISTER_DIG_H5 - BME280_REGISTER_DIG_H2] >> 4));
+    calib->dig_H6 = (int8_t)h[BME280_REGISTER_DIG_H6 - BME280_REGISTER_DIG_H2];
 }
 
-void bme280_reader_init()
+/*!
+ *	@brief bme280_reader_calibration_valid
+ *	failed or missing bus read gives 0x00 or 0xFF bytes, those are never
+ *	valid for dig_T1 or dig_P1
+ */
+static bool bme280_reader_calibration_valid(const bme280_calib_data *calib)
+{
+    return calib->dig_T1 != 0 && calib->dig_T1 != 0xFFFF
+        && calib->dig_P1 != 0 && calib->dig_P1 != 0xFFFF;
+}
+
+static bool bme280_reader_calibration_from_bus(const bme280_device *device, bme280_calib_data *calib)
+{
+    uint8_t tp[BME280_CALIB_TP_SIZE];
+    uint8_t h[BME280_CALIB_H_SIZE];
+
+    if (!bme280_I2C_bus_read(device, BME280_REGISTER_DIG_T1, tp, sizeof(tp))) {
+        return false;
+    }
+    if (!bme280_I2C_bus_read(device, BME280_REGISTER_DIG_H2, h, sizeof(h))) {
+        return false;
+    }
+    bme280_reader_decode_calibration(tp, h, calib);
+    return bme280_reader_calibration_valid(calib);
+}
+
+/*!
+ *	@brief bme280_reader_calibration_key
+ *	every BME280 has same chip id, so key tells only place of sensor. Sensor
+ *	that is changed to same place is found by bme280_reader_calibration_cacheable().
+ */
+static void bme280_reader_calibration_key(const bme280_device *device, char *key, size_t size)
+{
+    snprintf(key, size, "cal_%u_%02x", device->config.port, device->config.address);
+}
+
+/*!
+ *	@brief bme280_reader_calibration_cacheable
+ *	sensor can be changed only while power is off, so cache is used only
+ *	after software reset and deep sleep wakeup, when power has stayed on
+ */
+static bool bme280_reader_calibration_cacheable(void)
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+    return reason == ESP_RST_SW || reason == ESP_RST_DEEPSLEEP;
+}
+
+static bool bme280_reader_calibration_from_nvs(const bme280_device *device, bme280_calib_data *calib)
+{
+    nvs_handle_t handle;
+    bme280_calib_cache cache;
+    size_t size = sizeof(cache);
+    char key[16];
+    esp_err_t err;
+
+    if (nvs_open(BME280_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    bme280_reader_calibration_key(device, key, sizeof(key));
+    err = nvs_get_blob(handle, key, &cache, &size);
+    nvs_close(handle);
+
+    if (err != ESP_OK || size != sizeof(cache)) {
+        return false;
+    }
+    if (cache.crc != esp_rom_crc32_le(0, (const uint8_t *)&cache.calib, sizeof(cache.calib))
+        || !bme280_reader_calibration_valid(&cache.calib)) {
+        printf("bme280 cached calibration is corrupted, reading from sensor\n");
+        return false;
+    }
+    *calib = cache.calib;
+    return true;
+}
+
+static void bme280_reader_calibration_to_nvs(const bme280_device *device, const bme280_calib_data *calib)
+{
+    nvs_handle_t handle;
+    bme280_calib_cache cache;
+    char key[16];
+
+    if (nvs_open(BME280_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    memset(&cache, 0, sizeof(cache));
+    cache.calib = *calib;
+    cache.crc = esp_rom_crc32_le(0, (const uint8_t *)&cache.calib, sizeof(cache.calib));
+    bme280_reader_calibration_key(device, key, sizeof(key));
+    if (nvs_set_blob(handle, key, &cache, sizeof(cache)) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+/*!
+ *	@brief bme280_reader_calibration
+ *	calibration is read from NVS cache when power has stayed on since it
+ *	was stored and dig_T1 of sensor matches it, otherwise from sensor with
+ *	two burst reads (0x88..0xA1 and 0xE1..0xE7), and then stored to cache
+ */
+static bool bme280_reader_calibration(bme280_device *device)
+{
+    uint8_t t1[2];
+
+    // capture must have calibration, so it is always read from sensor then
+    if (HAL_CAPTURE_MODE != HAL_CAPTURE_RECORD
+        && bme280_reader_calibration_cacheable()
+        && bme280_reader_calibration_from_nvs(device, &device->calib)
+        && bme280_I2C_bus_read(device, BME280_REGISTER_DIG_T1, t1, sizeof(t1))
+        && device->calib.dig_T1 == bme280_get_u16(t1)) {
+        return true;
+    }
+    for (int i=0;i<10;i++) {
+        if (bme280_reader_calibration_from_bus(device, &device->calib)) {
+            bme280_reader_calibration_to_nvs(device, &device->calib);
+            return true;
+        }
+        vTaskDelay(1);
+    }
+    printf("bme280 0x%02x calibration read failed\n", device->config.address);
+    return false;
+}
+
+void bme280_reader_set_config(const bme280_config *config)
+{
+    m_config = *config;
+    if (m_config.osrs_t == BME280_OVERSAMPLING_SKIP) {
+        // temperature is needed for pressure and humidity compensation
+        m_config.osrs_t = BME280_OVERSAMPLING_1;
+    }
+    if (m_config.sample_period_ms == 0) {
+        m_config.sample_period_ms = sensor_registry_get(SensorTypeTemperature)->m_samplePeriodMs;
+    }
+}
+
+static uint8_t bme280_reader_get_ctrl_meas(bme280_mode mode)
+{
+    return (uint8_t)((m_config.osrs_t << 5) | (m_config.osrs_p << 2) | mode);
+}
+
+/*!
+ *	@brief bme280_reader_configure
+ *	writes sampling configuration to sensor
+ *  ctrl_hum is effective only after ctrl_meas write, and config register
+ *  writes can be ignored in normal mode, so sensor is put to sleep first
+ */
+static void bme280_reader_configure(const bme280_device *device)
+{
+    bme280_I2C_bus_write(device, BME280_REGISTER_CONTROL, bme280_reader_get_ctrl_meas(BME280_MODE_SLEEP));
+    bme280_I2C_bus_write(device, BME280_REGISTER_CONTROLHUMID, (uint8_t)m_config.osrs_h);
+    bme280_I2C_bus_write(device, BME280_REGISTER_CONFIG, (uint8_t)((m_config.standby << 5) | (m_config.filter << 2)));
+    if (m_config.mode == BME280_MODE_NORMAL) {
+        bme280_I2C_bus_write(device, BME280_REGISTER_CONTROL, bme280_reader_get_ctrl_meas(BME280_MODE_NORMAL));
+    }
+}
+
+static uint32_t bme280_reader_oversampling_count(bme280_oversampling osrs)
+{
+    if (osrs == BME280_OVERSAMPLING_SKIP) {
+        return 0;
+    }
+    return 1 << (osrs - 1);
+}
+
+/*!
+ *	@brief bme280_reader_measurement_time_us
+ *	maximum measurement time from datasheet chapter 9.1
+ *  1.25 + 2.3 * T_os + (2.3 * P_os + 0.575) + (2.3 * H_os + 0.575) ms
+ */
+static uint32_t bme280_reader_measurement_time_us()
+{
+    uint32_t ret = 1250 + 2300 * bme280_reader_oversampling_count(m_config.osrs_t);
+    if (m_config.osrs_p != BME280_OVERSAMPLING_SKIP) {
+        ret += 2300 * bme280_reader_oversampling_count(m_config.osrs_p) + 575;
+    }
+    if (m_config.osrs_h != BME280_OVERSAMPLING_SKIP) {
+        ret += 2300 * bme280_reader_oversampling_count(m_config.osrs_h) + 575;
+    }
+    return ret;
+}
+
+/*!
+ *	@brief bme280_reader_start_forced
+ *	starts measurement of all devices in mask, conversions run in parallel
+ *	so one wait covers all sensors
+ *
+ *  \return mask of devices that started measurement
+ */
+static uint32_t bme280_reader_start_forced(uint32_t devices)
+{
+    uint8_t ctrl[BME280_MAX_DEVICES];
+
+    memset(ctrl, bme280_reader_get_ctrl_meas(BME280_MODE_FORCED), sizeof(ctrl));
+    return bme280_I2C_bus_batch(devices, true, BME280_REGISTER_CONTROL, ctrl, 1);
+}
+
+/*!
+ *	@brief bme280_reader_poll_ready
+ *	reads status of devices in mask, devices that don't answer are removed
+ *	from mask
+ *
+ *  \return mask of devices whose measurement is ready
+ */
+static uint32_t bme280_reader_poll_ready(uint32_t *devices)
+{
+    uint8_t status[BME280_MAX_DEVICES];
+    uint32_t ready = 0;
+    size_t i;
+
+    *devices = bme280_I2C_bus_batch(*devices, false, BME280_REGISTER_STATUS, status, 1);
+    for (i=0;i<m_deviceCount;i++) {
+        if ((*devices & (1u << i)) && (status[i] & BME280_STATUS_MEASURING) == 0) {
+            ready |= 1u << i;
+        }
+    }
+    return ready;
+}
+
+/*!
+ *	@brief bme280_reader_set_devices
+ *	replaces default device list, must be called before init
+ */
+bool bme280_reader_set_devices(const bme280_device_config *devices, size_t count)
+{
+    size_t i;
+
+    if (count == 0 || count > BME280_MAX_DEVICES) {
+        return false;
+    }
+    memset(m_devices, 0, sizeof(m_devices));
+    for (i=0;i<count;i++) {
+        if (devices[i].port >= HAL_I2C_PORT_COUNT) {
+            return false;
+        }
+        m_devices[i].config = devices[i];
+    }
+    m_deviceCount = count;
+    return true;
+}
+
+/*!
+ *	@brief bme280_reader_probe
+ *	initializes bus of the device and checks that sensor answers
+ */
+static bool bme280_reader_probe(bme280_device *device)
 {
-    bme280_i2c_master_init();
     uint8_t data = 0;
-    for (int i=0;i<10;i++)
+
+    if (!hal_i2c_init(device->config.port)) {
+        return false;
+    }
+    for (int i=0;i<BME280_PROBE_COUNT;i++)
     {
         data = 0;
-        bme280_I2C_bus_read(BME280_REGISTER_CHIPID, &data, sizeof(data));
+        bme280_I2C_bus_read(device, BME280_REGISTER_CHIPID, &data, sizeof(data));
         if (data == BME280_REGISTER_CHIPID_READ_VALUE) {
             break;
         }
         vTaskDelay(1);
     }
-    bme280_reader_calibration();
+    if (data != BME280_REGISTER_CHIPID_READ_VALUE) {
+        printf("bme280 0x%02x on port %u not found\n", device->config.address, device->config.port);
+        return false;
+    }
+    if (!bme280_reader_calibration(device)) {
+        return false;
+    }
+    bme280_reader_configure(device);
+    return true;
+}
+
+void bme280_reader_init()
+{
+    size_t i;
+
+    m_present = 0;
+    for (i=0;i<m_deviceCount;i++) {
+        if (bme280_reader_probe(&m_devices[i])) {
+            m_present |= 1u << i;
+        }
+    }
 }
 
-static float compensateTemperature(int32_t t_fine) {
-    float T  = (t_fine * 5 + 128) >> 8;
-    return T/100;
+/*!
+ * \brief compensateTemperature
+ * \return temperature in 0.01 C
+ */
+static int32_t compensateTemperature(int32_t t_fine) {
+    return (t_fine * 5 + 128) >> 8;
 }
 
-static int32_t getTemperatureCalibration(bme280_calib_data *cal, int32_t adc_T) {
+static int32_t getTemperatureCalibration(const bme280_calib_data *cal, int32_t adc_T) {
     int32_t var1  = ((((adc_T>>3) - ((int32_t)cal->dig_T1 <<1))) * ((int32_t)cal->dig_T2)) >> 11;
     int32_t var2  = (((((adc_T>>4) - ((int32_t)cal->dig_T1)) * ((adc_T>>4) - ((int32_t)cal->dig_T1))) >> 12) * ((int32_t)cal->dig_T3)) >> 14;
     return var1 + var2;
 }
 
-static float compensatePressure(int32_t adc_P, bme280_calib_data *cal, int32_t t_fine) {
+/*!
+ * \brief compensatePressure
+ * \return pressure in Pa as Q24.8 fixed point
+ */
+static int32_t compensatePressure(int32_t adc_P, const bme280_calib_data *cal, int32_t t_fine) {
     int64_t var1, var2, p;
     var1 = ((int64_t)t_fine) - 128000;
     var2 = var1 * var1 * (int64_t)cal->dig_P6;
@@ -200,11 +537,15 @@ static float compensatePressure(int32_t adc_P, bme280_calib_data *cal, int32_t t
     var2 = (((int64_t)cal->dig_P8) * p) >> 19;
 
     p = ((p + var1 + var2) >> 8) + (((int64_t)cal->dig_P7)<<4);
-    return (float)p/256;
+    return (int32_t)(p);
 }
 
 
-static float compensateHumidity(int32_t adc_H, bme280_calib_data *cal, int32_t t_fine)
+/*!
+ * \brief compensateHumidity
+ * \return relative humidity in % as Q22.10 fixed point
+ */
+static int32_t compensateHumidity(int32_t adc_H, const bme280_calib_data *cal, int32_t t_fine)
 {
     int32_t v_x1_u32r;
     v_x1_u32r = (t_fine - ((int32_t)76800));
@@ -220,52 +561,208 @@ static float compensateHumidity(int32_t adc_H, bme280_calib_data *cal, int32_t t
 
     v_x1_u32r = (v_x1_u32r < 0) ? 0 : v_x1_u32r;
     v_x1_u32r = (v_x1_u32r > 419430400) ? 419430400 : v_x1_u32r;
-    float h = (v_x1_u32r>>12);
-    return  h / 1024.0;
+    return v_x1_u32r>>12;
 }
 
-void bme280_reader_task()
+/*!
+ * \brief bme280_reader_compensate
+ * converts raw values with integer compensation, no float math
+ */
+void bme280_reader_compensate(const bme280_calib_data *calib, const bme280_raw_data *raw, bme280_values *values)
 {
-    uint8_t data[8];
-    while (1) {
-        vTaskDelay(1);
+    int32_t t_fine = getTemperatureCalibration(calib, (int32_t)(raw->temperature));
+    values->temperature = compensateTemperature(t_fine);
+    values->humidity = compensateHumidity((int32_t)(raw->humidity), calib, t_fine);
+    values->pressure = compensatePressure((int32_t)(raw->pressure), calib, t_fine);
+}
+
+static void bme280_reader_process_data(bme280_device *device, const uint8_t *data, int64_t sampleUs)
+{
+    bme280_raw_data *raw = &device->raw;
+
+    raw->timestamp_us = sampleUs;
+
+    raw->pmsb = data[0];
+    raw->plsb = data[1];
+    raw->pxsb = data[2];
+    raw->tmsb = data[3];
+    raw->tlsb = data[4];
+    raw->txsb = data[5];
+    raw->hmsb = data[6];
+    raw->hlsb = data[7];
+
+    raw->temperature = 0;
+    raw->temperature = (raw->temperature | raw->tmsb) << 8;
+    raw->temperature = (raw->temperature | raw->tlsb) << 8;
+    raw->temperature = (raw->temperature | raw->txsb) >> 4;
+
+    raw->pressure = 0;
+    raw->pressure = (raw->pressure | raw->pmsb) << 8;
+    raw->pressure = (raw->pressure | raw->plsb) << 8;
+    raw->pressure = (raw->pressure | raw->pxsb) >> 4;
+
+    raw->humidity = 0;
+    raw->humidity = (raw->humidity | raw->hmsb) << 8;
+    raw->humidity = (raw->humidity | raw->hlsb);
+
+    bme280_values values;
+    bme280_reader_compensate(&device->calib, raw, &values);
+    tcpip_setNewValueAt(device->config.temperature, values.temperature, raw->timestamp_us);
+    if (m_config.osrs_h != BME280_OVERSAMPLING_SKIP) {
+        tcpip_setNewValueAt(device->config.humid, values.humidity, raw->timestamp_us);
+    }
+    if (m_config.osrs_p != BME280_OVERSAMPLING_SKIP) {
+        tcpip_setNewValueAt(device->config.pressure, values.pressure, raw->timestamp_us);
+    }
+}
+
+/*!
+ * \brief bme280_reader_feed
+ * handles register burst that is not read from sensor, e.g. replayed bus
+ * capture. Calibration blocks and measurement data of configured devices
+ * are used, other registers and devices are ignored.
+ */
+void bme280_reader_feed(uint8_t port, uint8_t address, uint8_t reg, const uint8_t *data, size_t size)
+{
+    static uint8_t calibTP[BME280_MAX_DEVICES][BME280_CALIB_TP_SIZE];
+    static bool calibTPSet[BME280_MAX_DEVICES];
+    bme280_device *device = NULL;
+    size_t i;
+
+    for (i=0;i<m_deviceCount;i++) {
+        if (m_devices[i].config.port == port && m_devices[i].config.address == address) {
+            device = &m_devices[i];
+            break;
+        }
+    }
+    if (device == NULL) {
+        return;
+    }
+    switch (reg) {
+        case BME280_REGISTER_DIG_T1:
+            if (size == sizeof(calibTP[i])) {
+                memcpy(calibTP[i], data, size);
+                calibTPSet[i] = true;
+            }
+            break;
+        case BME280_REGISTER_DIG_H2:
+            if (size == BME280_CALIB_H_SIZE && calibTPSet[i]) {
+                bme280_reader_decode_calibration(calibTP[i], data, &device->calib);
+            }
+            break;
+        case BME280_REGISTER_PRESSUREDATA:
+            if (size == BME280_RAW_DATA_SIZE && bme280_reader_calibration_valid(&device->calib)) {
+                bme280_reader_process_data(device, data, esp_timer_get_time());
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+#if BME280_PRINT_CYCLES
+static void bme280_reader_measure_process_data(bme280_device *device, const uint8_t *data, int64_t sampleUs)
+{
+    static uint32_t cycles = 0;
+    static uint32_t count = 0;
+    uint32_t start = esp_cpu_get_cycle_count();
+
+    bme280_reader_process_data(device, data, sampleUs);
+    cycles += esp_cpu_get_cycle_count() - start;
+    if (++count == BME280_CYCLES_READING_COUNT) {
+        printf("BME280 reading: %" PRIu32 " cycles\n", cycles / count);
+        cycles = 0;
+        count = 0;
+    }
+}
+#endif
+
+/*!
+ * \brief bme280_reader_read
+ * reads data registers of devices, registers of sensors on same port are
+ * read with one command link
+ */
+static void bme280_reader_read(uint32_t devices)
+{
+    static uint8_t data[BME280_MAX_DEVICES][BME280_RAW_DATA_SIZE];
+    int64_t sampleUs;
+    size_t i;
+
+    devices = bme280_I2C_bus_batch(devices, false, BME280_REGISTER_PRESSUREDATA, &data[0][0],
+                                   BME280_RAW_DATA_SIZE);
+    sampleUs = esp_timer_get_time();
+    for (i=0;i<m_deviceCount;i++) {
+        if ((devices & (1u << i)) == 0) {
+            continue;
+        }
+#if BME280_PRINT_CYCLES
+        bme280_reader_measure_process_data(&m_devices[i], data[i], sampleUs);
+#else
+        bme280_reader_process_data(&m_devices[i], data[i], sampleUs);
+#endif
+    }
+}
+
+/*!
+ * \brief bme280_reader_run
+ * sensor hub job, all sensors are read in one pass. In forced mode
+ * measurements are started together, and hub runs other jobs while they
+ * convert.
+ *
+ * \return ms to next run
+ */
+static uint32_t bme280_reader_run(void *context)
+{
+    uint32_t period = m_config.sample_period_ms > 0 ? m_config.sample_period_ms : 1;
+    uint32_t pending, answered;
 
-        bme280_I2C_bus_write(0xf2, 0x01);
-        bme280_I2C_bus_write(0xf4, 0x25);
-        if (bme280_I2C_bus_read(BME280_REGISTER_PRESSUREDATA, data, 8)) {
-            m_rawData.pmsb = data[0];
-            m_rawData.plsb = data[1];
-            m_rawData.pxsb = data[2];
-            m_rawData.tmsb = data[3];
-            m_rawData.tlsb = data[4];
-            m_rawData.txsb = data[5];
-            m_rawData.hmsb = data[6];
-            m_rawData.hlsb = data[7];
-
-            m_rawData.temperature = 0;
-            m_rawData.temperature = (m_rawData.temperature | m_rawData.tmsb) << 8;
-            m_rawData.temperature = (m_rawData.temperature | m_rawData.tlsb) << 8;
-            m_rawData.temperature = (m_rawData.temperature | m_rawData.txsb) >> 4;
-
-            m_rawData.pressure = 0;
-            m_rawData.pressure = (m_rawData.pressure | m_rawData.pmsb) << 8;
-            m_rawData.pressure = (m_rawData.pressure | m_rawData.plsb) << 8;
-            m_rawData.pressure = (m_rawData.pressure | m_rawData.pxsb) >> 4;
-
-            m_rawData.humidity = 0;
-            m_rawData.humidity = (m_rawData.humidity | m_rawData.hmsb) << 8;
-            m_rawData.humidity = (m_rawData.humidity | m_rawData.hlsb);
-
-            int32_t t_fine = getTemperatureCalibration(&m_calibData, m_rawData.temperature);
-            float t = compensateTemperature(t_fine); // C
-            float p = compensatePressure(m_rawData.pressure, &m_calibData, t_fine);
-            float h = compensateHumidity(m_rawData.humidity, &m_calibData, t_fine);
- //           printf("Temp: %f Presure: %f Humid: %f %ld\n", t, p, h, m_rawData.temperature);
-
-            tcpip_setNewValue(SensorTypeTemperature, (double)(t));
-            tcpip_setNewValue(SensorTypeHumid, (double)(h));
-            tcpip_setNewValue(SensorTypePresure, (double)(p));
+    (void)context;
+    if (m_config.mode == BME280_MODE_NORMAL) {
+        bme280_reader_read(m_present);
+        return period;
+    }
+    if (m_phase == Bme280PhaseStart) {
+        m_measuring = bme280_reader_start_forced(m_present);
+        if (m_measuring == 0) {
+            return period;
         }
+        m_ready = 0;
+        m_pollCount = 0;
+        m_phase = Bme280PhaseRead;
+        m_cycleMs = bme280_reader_measurement_time_us() / 1000 + 1;
+        return m_cycleMs;
+    }
+    pending = m_measuring & ~m_ready;
+    answered = pending;
+    m_ready |= bme280_reader_poll_ready(&answered);
+    // devices that don't answer are left out of this pass
+    m_measuring &= ~(pending & ~answered);
+    if (m_ready != m_measuring && ++m_pollCount < BME280_READY_POLL_COUNT) {
+        m_cycleMs += BME280_READY_POLL_MS;
+        return BME280_READY_POLL_MS;
+    }
+    bme280_reader_read(m_ready);
+    m_phase = Bme280PhaseStart;
+    return m_cycleMs < period ? period - m_cycleMs : 0;
+}
+
+/*!
+ * \brief bme280_reader_start
+ * adds reading of sensors found by init to sensor hub, every
+ * sample_period_ms
+ */
+void bme280_reader_start()
+{
+    uint32_t firstDelayMs = 0;
+
+    if (m_present == 0) {
+        printf("no bme280 found\n");
+        return;
     }
-	vTaskDelete(NULL);
+#if POWER_SAVE
+    // sample at start of wake windows
+    firstDelayMs = power_ticksToWakeWindow(0) * portTICK_PERIOD_MS;
+#endif
+    m_phase = Bme280PhaseStart;
+    sensor_hub_addJob("bme280", bme280_reader_run, NULL, firstDelayMs);
 }
@@ -13,10 +13,18 @@
 #define BME280_READER_H
 
 #include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sensor_registry.h"
 
 // values can be found from https://www.mouser.com/datasheet/2/783/BST-BME280-DS002-1509607.pdf
 
+// SDO pin low, default sensors are set in Kconfig
 #define BME280_ADDRESS                0x76
+// SDO pin high
+#define BME280_ADDRESS_SECONDARY      0x77
+// devices are selected with bit mask
+#define BME280_MAX_DEVICES            4
 
 #define BME280_REGISTER_DIG_T1        0x88
 #define BME280_REGISTER_DIG_T2        0x8A
@@ -43,14 +51,96 @@
 #define BME280_RESET                  0xB6
 #define BME280_REGISTER_CAL26         0xE1
 #define BME280_REGISTER_CONTROLHUMID  0xF2
+#define BME280_REGISTER_STATUS        0xF3
 #define BME280_REGISTER_CONTROL       0xF4
 #define BME280_REGISTER_CONFIG        0xF5
 #define BME280_REGISTER_PRESSUREDATA  0xF7
 #define BME280_REGISTER_TEMPDATA      0xFA
 #define BME280_REGISTER_HUMIDDATA     0xFD
 
+#define BME280_STATUS_MEASURING       0x08
+#define BME280_RAW_DATA_SIZE          8
+
 #define MEAN_SEA_LEVEL_PRESSURE       1013
 
+/*
+* Oversampling of one channel, ctrl_hum osrs_h, ctrl_meas osrs_t and osrs_p
+*/
+typedef enum
+{
+  BME280_OVERSAMPLING_SKIP = 0,
+  BME280_OVERSAMPLING_1 = 1,
+  BME280_OVERSAMPLING_2 = 2,
+  BME280_OVERSAMPLING_4 = 3,
+  BME280_OVERSAMPLING_8 = 4,
+  BME280_OVERSAMPLING_16 = 5,
+} bme280_oversampling;
+
+/*
+* Sensor mode, ctrl_meas mode
+*/
+typedef enum
+{
+  BME280_MODE_SLEEP = 0,
+  BME280_MODE_FORCED = 1,
+  BME280_MODE_NORMAL = 3,
+} bme280_mode;
+
+/*
+* Standby time between measurements in normal mode, config t_sb
+*/
+typedef enum
+{
+  BME280_STANDBY_0_5_MS = 0,
+  BME280_STANDBY_62_5_MS = 1,
+  BME280_STANDBY_125_MS = 2,
+  BME280_STANDBY_250_MS = 3,
+  BME280_STANDBY_500_MS = 4,
+  BME280_STANDBY_1000_MS = 5,
+  BME280_STANDBY_10_MS = 6,
+  BME280_STANDBY_20_MS = 7,
+} bme280_standby;
+
+/*
+* IIR filter coefficient, config filter
+*/
+typedef enum
+{
+  BME280_FILTER_OFF = 0,
+  BME280_FILTER_2 = 1,
+  BME280_FILTER_4 = 2,
+  BME280_FILTER_8 = 3,
+  BME280_FILTER_16 = 4,
+} bme280_filter;
+
+/*
+* Sampling configuration
+* sample_period_ms is how often values are read from sensor (and in forced
+* mode how often measurement is started)
+*/
+typedef struct
+{
+  bme280_oversampling osrs_t;
+  bme280_oversampling osrs_p;
+  bme280_oversampling osrs_h;
+  bme280_mode mode;
+  bme280_standby standby;
+  bme280_filter filter;
+  uint32_t sample_period_ms;
+} bme280_config;
+
+/*
+* One sensor on I2C bus and sensor types its values are sent as
+*/
+typedef struct
+{
+  uint8_t port;
+  uint8_t address;
+  SensorType temperature;
+  SensorType humid;
+  SensorType pressure;
+} bme280_device_config;
+
 /*
 * Immutable calibration data read from bme280
 */
@@ -97,9 +187,26 @@ typedef struct
     uint32_t temperature;
     uint32_t pressure;
     uint32_t humidity;
+
+    int64_t timestamp_us;   // esp_timer time when data was read
 } bme280_raw_data;
 
+/*
+* Compensated values of one reading in fixed point formats of datasheet
+* integer compensation
+*/
+typedef struct
+{
+    int32_t temperature;    // 0.01 C
+    int32_t humidity;       // %RH, Q22.10
+    int32_t pressure;       // Pa, Q24.8
+} bme280_values;
+
+void bme280_reader_compensate(const bme280_calib_data *calib, const bme280_raw_data *raw, bme280_values *values);
+void bme280_reader_set_config(const bme280_config *config);
+bool bme280_reader_set_devices(const bme280_device_config *devices, size_t count);
 void bme280_reader_init();
-void bme280_reader_task();
+void bme280_reader_start();
+void bme280_reader_feed(uint8_t port, uint8_t address, uint8_t reg, const uint8_t *data, size_t size);
 
 #endif // BME280_READER_H
\ No newline at end of file
@@ -0,0 +1,223 @@
+/*!
+ * \file
+ * \brief file bus_capture.c
+ *
+ * capture of raw sensor bus data and replay of it
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "bus_capture.h"
+#include <string.h>
+
+static void bus_capture_writeU32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)(value);
+    buffer[1] = (uint8_t)(value >> 8);
+    buffer[2] = (uint8_t)(value >> 16);
+    buffer[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t bus_capture_readU32(const uint8_t *buffer)
+{
+    return (uint32_t)(buffer[0]) | ((uint32_t)(buffer[1]) << 8) |
+           ((uint32_t)(buffer[2]) << 16) | ((uint32_t)(buffer[3]) << 24);
+}
+
+/*!
+ * \brief bus_capture_erase
+ * sectors are erased only when capture reaches them, so starting capture
+ * doesn't wait for whole partition to be erased
+ */
+static bool bus_capture_erase(BusCapture *capture, uint32_t end)
+{
+    while (capture->m_erased < end) {
+        if (capture->m_erased + BUS_CAPTURE_SECTOR_SIZE > capture->m_flash.size ||
+            !capture->m_flash.erase(capture->m_flash.context, capture->m_erased, BUS_CAPTURE_SECTOR_SIZE)) {
+            return false;
+        }
+        capture->m_erased += BUS_CAPTURE_SECTOR_SIZE;
+    }
+    return true;
+}
+
+/*!
+ * \brief bus_capture_init
+ * starts new capture, old capture on flash is overwritten
+ */
+bool bus_capture_init(BusCapture *capture, const BusCaptureFlash *flash)
+{
+    uint8_t header[BUS_CAPTURE_HEADER_SIZE];
+
+    memset(capture, 0, sizeof(BusCapture));
+    capture->m_flash = *flash;
+    capture->m_full = true;
+    if (!bus_capture_erase(capture, BUS_CAPTURE_HEADER_SIZE)) {
+        return false;
+    }
+    memset(header, 0, sizeof(header));
+    bus_capture_writeU32(header, BUS_CAPTURE_MAGIC);
+    header[4] = BUS_CAPTURE_VERSION;
+    if (!flash->write(flash->context, 0, header, sizeof(header))) {
+        return false;
+    }
+    capture->m_offset = BUS_CAPTURE_HEADER_SIZE;
+    capture->m_full = false;
+    return true;
+}
+
+static bool bus_capture_write(BusCapture *capture, BusCaptureType type, uint8_t address, uint8_t reg,
+                              const uint8_t *data, size_t size, uint32_t timestamp)
+{
+    uint8_t record[BUS_CAPTURE_RECORD_SIZE + BUS_CAPTURE_MAX_DATA];
+    uint32_t recordSize = BUS_CAPTURE_RECORD_SIZE + (uint32_t)(size);
+
+    if (capture->m_full) {
+        return false;
+    }
+    if (!bus_capture_erase(capture, capture->m_offset + recordSize)) {
+        // capture is kept as it is when flash is full
+        capture->m_full = true;
+        return false;
+    }
+    record[0] = (uint8_t)(type);
+    record[1] = address;
+    record[2] = reg;
+    record[3] = (uint8_t)(size);
+    bus_capture_writeU32(record + 4, timestamp);
+    memcpy(record + BUS_CAPTURE_RECORD_SIZE, data, size);
+    if (!capture->m_flash.write(capture->m_flash.context, capture->m_offset, record, recordSize)) {
+        capture->m_full = true;
+        return false;
+    }
+    capture->m_offset += recordSize;
+    return true;
+}
+
+bool bus_capture_i2cRead(BusCapture *capture, uint8_t address, uint8_t reg, const uint8_t *data, size_t size,
+                         uint32_t timestamp)
+{
+    if (size > BUS_CAPTURE_MAX_DATA) {
+        return false;
+    }
+    return bus_capture_write(capture, BusCaptureTypeI2cRead, address, reg, data, size, timestamp);
+}
+
+bool bus_capture_uartRx(BusCapture *capture, const uint8_t *data, size_t size, uint32_t timestamp)
+{
+    size_t part;
+
+    while (size > 0) {
+        part = size > BUS_CAPTURE_MAX_DATA ? BUS_CAPTURE_MAX_DATA : size;
+        if (!bus_capture_write(capture, BusCaptureTypeUartRx, 0, 0, data, part, timestamp)) {
+            return false;
+        }
+        data += part;
+        size -= part;
+    }
+    return true;
+}
+
+/*!
+ * \brief bus_capture_replay
+ * gives every record of capture to handler as fast as possible, timestamps
+ * of records are given to handler but not waited
+ *
+ * \return count of replayed records
+ */
+uint32_t bus_capture_replay(const BusCaptureFlash *flash, const BusCaptureHandler *handler)
+{
+    uint8_t record[BUS_CAPTURE_RECORD_SIZE];
+    uint8_t data[BUS_CAPTURE_MAX_DATA];
+    uint32_t offset = BUS_CAPTURE_HEADER_SIZE;
+    uint32_t count = 0;
+    uint32_t timestamp;
+    size_t size;
+
+    if (!flash->read(flash->context, 0, record, BUS_CAPTURE_HEADER_SIZE) ||
+        bus_capture_readU32(record) != BUS_CAPTURE_MAGIC || record[4] != BUS_CAPTURE_VERSION) {
+        return 0;
+    }
+    while (offset + BUS_CAPTURE_RECORD_SIZE <= flash->size) {
+        if (!flash->read(flash->context, offset, record, sizeof(record)) || record[0] == BusCaptureTypeEnd) {
+            break;
+        }
+        size = record[3];
+        timestamp = bus_capture_readU32(record + 4);
+        offset += BUS_CAPTURE_RECORD_SIZE;
+        if (offset + size > flash->size || !flash->read(flash->context, offset, data, size)) {
+            break;
+        }
+        offset += (uint32_t)(size);
+        switch (record[0]) {
+            case BusCaptureTypeI2cRead:
+                if (handler->i2cRead != NULL) {
+                    handler->i2cRead(handler->context, record[1], record[2], data, size, timestamp);
+                }
+                break;
+            case BusCaptureTypeUartRx:
+                if (handler->uartRx != NULL) {
+                    handler->uartRx(handler->context, data, size, timestamp);
+                }
+                break;
+            default:
+                break;
+        }
+        count++;
+    }
+    return count;
+}
+
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"
+
+static bool bus_capture_partitionRead(void *context, uint32_t address, void *data, size_t size)
+{
+    return esp_partition_read((const esp_partition_t *)context, address, data, size) == ESP_OK;
+}
+
+static bool bus_capture_partitionWrite(void *context, uint32_t address, const void *data, size_t size)
+{
+    return esp_partition_write((const esp_partition_t *)context, address, data, size) == ESP_OK;
+}
+
+static bool bus_capture_partitionErase(void *context, uint32_t address, size_t size)
+{
+    return esp_partition_erase_range((const esp_partition_t *)context, address, size) == ESP_OK;
+}
+
+static bool bus_capture_partitionFlash(const char *label, BusCaptureFlash *flash)
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                ESP_PARTITION_SUBTYPE_ANY, label);
+    if (partition == NULL) {
+        return false;
+    }
+    flash->read = bus_capture_partitionRead;
+    flash->write = bus_capture_partitionWrite;
+    flash->erase = bus_capture_partitionErase;
+    flash->context = (void *)partition;
+    flash->size = partition->size;
+    return true;
+}
+
+bool bus_capture_initPartition(BusCapture *capture, const char *label)
+{
+    BusCaptureFlash flash;
+    if (!bus_capture_partitionFlash(label, &flash)) {
+        return false;
+    }
+    return bus_capture_init(capture, &flash);
+}
+
+uint32_t bus_capture_replayPartition(const char *label, const BusCaptureHandler *handler)
+{
+    BusCaptureFlash flash;
+    if (!bus_capture_partitionFlash(label, &flash)) {
+        return 0;
+    }
+    return bus_capture_replay(&flash, handler);
+}
+#endif
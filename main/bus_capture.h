@@ -0,0 +1,85 @@
+/*!
+ * \file
+ * \brief file bus_capture.h
+ *
+ * capture of raw sensor bus data and replay of it
+ *
+ * header (8 bytes):         u32 magic, u8 version, 3 bytes reserved
+ * record (8 bytes + data):  u8 type, u8 I2C address (bit 7 is port), u8 register,
+ *                           u8 data size, u32 timestamp (ms since boot),
+ *                           data
+ * type 0xFF is erased flash, end of capture. UART data longer than
+ * BUS_CAPTURE_MAX_DATA is split to several records.
+ *
+ * Not thread safe, caller serializes captures from several tasks.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef BUS_CAPTURE_H
+#define BUS_CAPTURE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BUS_CAPTURE_PARTITION_LABEL "capture"
+#define BUS_CAPTURE_SECTOR_SIZE     4096
+#define BUS_CAPTURE_MAGIC           0x42434150
+#define BUS_CAPTURE_VERSION         1
+#define BUS_CAPTURE_HEADER_SIZE     8
+#define BUS_CAPTURE_RECORD_SIZE     8
+#define BUS_CAPTURE_MAX_DATA        255
+// I2C addresses are 7 bits, so port fits to the highest bit of address field
+#define BUS_CAPTURE_I2C_ADDRESS(port, address)  ((uint8_t)(((port) << 7) | ((address) & 0x7F)))
+#define BUS_CAPTURE_I2C_PORT(field)             ((uint8_t)((field) >> 7))
+
+typedef enum
+{
+    BusCaptureTypeI2cRead = 1,      // register burst read from I2C device
+    BusCaptureTypeUartRx = 2,       // bytes received from UART
+    BusCaptureTypeEnd = 0xFF,
+} BusCaptureType;
+
+/*
+* Flash access, partition on device, file on host
+*/
+typedef struct
+{
+    bool (*read)(void *context, uint32_t address, void *data, size_t size);
+    bool (*write)(void *context, uint32_t address, const void *data, size_t size);
+    bool (*erase)(void *context, uint32_t address, size_t size);
+    void *context;
+    uint32_t size;
+} BusCaptureFlash;
+
+typedef struct
+{
+    BusCaptureFlash m_flash;
+    uint32_t m_offset;      // next record is written here
+    uint32_t m_erased;      // flash is erased up to here
+    bool m_full;
+} BusCapture;
+
+/*
+* Receivers of replayed records, NULL handler skips records of that type
+*/
+typedef struct
+{
+    void (*i2cRead)(void *context, uint8_t address, uint8_t reg, const uint8_t *data, size_t size,
+                    uint32_t timestamp);
+    void (*uartRx)(void *context, const uint8_t *data, size_t size, uint32_t timestamp);
+    void *context;
+} BusCaptureHandler;
+
+bool bus_capture_init(BusCapture *capture, const BusCaptureFlash *flash);
+bool bus_capture_initPartition(BusCapture *capture, const char *label);
+bool bus_capture_i2cRead(BusCapture *capture, uint8_t address, uint8_t reg, const uint8_t *data, size_t size,
+                         uint32_t timestamp);
+bool bus_capture_uartRx(BusCapture *capture, const uint8_t *data, size_t size, uint32_t timestamp);
+uint32_t bus_capture_replay(const BusCaptureFlash *flash, const BusCaptureHandler *handler);
+uint32_t bus_capture_replayPartition(const char *label, const BusCaptureHandler *handler);
+
+#endif // BUS_CAPTURE_H
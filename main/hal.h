@@ -0,0 +1,74 @@
+/*!
+ * \file
+ * \brief file hal.h
+ *
+ * hardware abstraction of buses used by sensor readers
+ * Readers use only these functions to access hardware, so they can be
+ * built on other targets by giving another implementation of this header.
+ * hal_esp32.c implements this with ESP-IDF drivers, hal_host.c with
+ * simulated sensors for host tests and benchmarks.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+
+#define HAL_WAIT_FOREVER    UINT32_MAX
+#define HAL_I2C_PORT_COUNT  2
+
+// raw bus data capture, see bus_capture.h
+#define HAL_CAPTURE_OFF     0
+#define HAL_CAPTURE_RECORD  1   // I2C reads and UART data are stored to capture partition
+#define HAL_CAPTURE_REPLAY  2   // capture is replayed to readers instead of reading sensors
+#if CONFIG_WEATHER_HAL_CAPTURE_RECORD
+#define HAL_CAPTURE_MODE    HAL_CAPTURE_RECORD
+#elif CONFIG_WEATHER_HAL_CAPTURE_REPLAY
+#define HAL_CAPTURE_MODE    HAL_CAPTURE_REPLAY
+#else
+#define HAL_CAPTURE_MODE    HAL_CAPTURE_OFF
+#endif
+
+typedef enum
+{
+    HalUartEventNone = 0,   // timeout, no data
+    HalUartEventData,       // data is buffered
+    HalUartEventOverflow,   // data was lost, buffers are flushed
+} HalUartEvent;
+
+/*
+* One register access of I2C transaction, several of them can be run with
+* one command link by hal_i2c_transfer()
+*/
+typedef struct
+{
+    uint8_t m_address;
+    uint8_t m_reg;
+    bool m_write;       // data is written to register, otherwise burst read
+    uint8_t *m_data;
+    size_t m_size;
+} HalI2cTransfer;
+
+// I2C master, register addressed devices on port 0..HAL_I2C_PORT_COUNT-1
+bool hal_i2c_init(uint8_t port);
+bool hal_i2c_write(uint8_t port, uint8_t address, uint8_t reg, const uint8_t *data, size_t size);
+bool hal_i2c_read(uint8_t port, uint8_t address, uint8_t reg, uint8_t *data, size_t size);
+bool hal_i2c_transfer(uint8_t port, const HalI2cTransfer *transfers, size_t count);
+
+// UART receiving sensor data
+bool hal_uart_init(uint32_t baudRate, size_t rxThreshold);
+HalUartEvent hal_uart_wait(uint32_t timeoutMs, size_t *length);
+void hal_uart_wake(void);
+int hal_uart_read(uint8_t *data, size_t size);
+int hal_uart_write(const uint8_t *data, size_t size);
+
+bool hal_capture_init(void);
+
+#endif // HAL_H
@@ -0,0 +1,368 @@
+/*!
+ * \file
+ * \brief file hal_esp32.c
+ *
+ * hardware abstraction with ESP-IDF I2C and UART drivers
+ * I2C is built only with BME280 and UART only with PMS5003 enabled in
+ * Kconfig, so driver of a disabled sensor is not linked.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "hal.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "driver/i2c.h"
+#include "driver/uart.h"
+#include "esp_timer.h"
+#include "bus_capture.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+
+#define SDA_PIN             CONFIG_WEATHER_I2C_SDA_PIN
+#define SCL_PIN             CONFIG_WEATHER_I2C_SCL_PIN
+// second port is installed only when a sensor is configured to it
+#define SDA1_PIN            CONFIG_WEATHER_I2C1_SDA_PIN
+#define SCL1_PIN            CONFIG_WEATHER_I2C1_SCL_PIN
+
+#define I2C_MASTER_ACK      0
+#define I2C_MASTER_NACK     1
+#define I2C_CLOCK_SPEED     CONFIG_WEATHER_I2C_CLOCK_HZ
+#define I2C_TIMEOUT_MS      10
+// command link of a port is built to static buffer, one transfer takes at
+// most 8 commands (start, address, register, start, address, read, read, stop)
+#define I2C_MAX_TRANSFERS   CONFIG_WEATHER_I2C_MAX_TRANSFERS
+#define I2C_LINK_SIZE       I2C_LINK_RECOMMENDED_SIZE(2 * I2C_MAX_TRANSFERS)
+
+#define TXD_PIN             CONFIG_WEATHER_PMS5003_TX_PIN
+#define RXD_PIN             CONFIG_WEATHER_PMS5003_RX_PIN
+#define UART                UART_NUM_2
+// driver buffer must be larger than UART FIFO, frames are read when line goes idle
+#define UART_RX_BUF_SIZE    CONFIG_WEATHER_UART_RX_BUFFER_SIZE
+
+// 1 = task sleeps on UART driver event queue, 0 = poll UART buffer every tick
+#define HAL_UART_USE_EVENTS 1
+#define HAL_UART_QUEUE_SIZE 10
+// rx timeout in symbols (one symbol ~1ms on 9600bps), fires after frame ends
+#define HAL_UART_RX_TIMEOUT 3
+
+#if CONFIG_WEATHER_SENSOR_PMS5003
+#if HAL_UART_USE_EVENTS
+static QueueHandle_t m_uartQueue = NULL;
+#endif
+static size_t m_uartRxThreshold = 1;
+#endif
+#if CONFIG_WEATHER_SENSOR_BME280
+static bool m_i2cInstalled[HAL_I2C_PORT_COUNT];
+// used only by the task that reads the port
+static uint8_t m_i2cLink[HAL_I2C_PORT_COUNT][I2C_LINK_SIZE];
+#endif
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_RECORD
+static BusCapture m_capture;
+static SemaphoreHandle_t m_captureLock = NULL;
+#endif
+
+/*!
+ * \brief hal_capture_init
+ * starts capture of bus data when HAL_CAPTURE_RECORD is set, must be called
+ * before readers are started
+ */
+bool hal_capture_init(void)
+{
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_RECORD
+    m_captureLock = xSemaphoreCreateMutex();
+    if (m_captureLock == NULL) {
+        return false;
+    }
+    return bus_capture_initPartition(&m_capture, BUS_CAPTURE_PARTITION_LABEL);
+#else
+    return true;
+#endif
+}
+
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_RECORD
+static uint32_t hal_capture_timestamp()
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+#if CONFIG_WEATHER_SENSOR_BME280
+static void hal_capture_i2cRead(uint8_t port, uint8_t address, uint8_t reg, const uint8_t *data, size_t size)
+{
+    if (m_captureLock == NULL) {
+        return;
+    }
+    xSemaphoreTake(m_captureLock, portMAX_DELAY);
+    bus_capture_i2cRead(&m_capture, BUS_CAPTURE_I2C_ADDRESS(port, address), reg, data, size,
+                        hal_capture_timestamp());
+    xSemaphoreGive(m_captureLock);
+}
+#endif
+
+#if CONFIG_WEATHER_SENSOR_PMS5003
+static void hal_capture_uartRx(const uint8_t *data, size_t size)
+{
+    if (m_captureLock == NULL) {
+        return;
+    }
+    xSemaphoreTake(m_captureLock, portMAX_DELAY);
+    bus_capture_uartRx(&m_capture, data, size, hal_capture_timestamp());
+    xSemaphoreGive(m_captureLock);
+}
+#endif
+#endif
+
+#if CONFIG_WEATHER_SENSOR_BME280
+/*!
+ * \brief hal_i2c_init
+ * installs driver of the port, later calls for same port do nothing
+ */
+bool hal_i2c_init(uint8_t port)
+{
+    if (port >= HAL_I2C_PORT_COUNT) {
+        return false;
+    }
+    if (m_i2cInstalled[port]) {
+        return true;
+    }
+    i2c_config_t i2c_config = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = port == 0 ? SDA_PIN : SDA1_PIN,
+        .scl_io_num = port == 0 ? SCL_PIN : SCL1_PIN,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master.clk_speed = I2C_CLOCK_SPEED
+    };
+    if (i2c_param_config((i2c_port_t)port, &i2c_config) != ESP_OK) {
+        return false;
+    }
+    m_i2cInstalled[port] = i2c_driver_install((i2c_port_t)port, I2C_MODE_MASTER, 0, 0, 0) == ESP_OK;
+    return m_i2cInstalled[port];
+}
+
+static void hal_i2c_metrics(int64_t start, esp_err_t espRc)
+{
+    metrics_addLatency(MetricLatencyI2c, (uint32_t)(esp_timer_get_time() - start));
+    if (espRc != ESP_OK) {
+        metrics_add(MetricI2cErrors, 1);
+    }
+}
+
+static void hal_i2c_addTransfer(i2c_cmd_handle_t cmd, const HalI2cTransfer *transfer)
+{
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (transfer->m_address << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, transfer->m_reg, true);
+
+    if (transfer->m_write) {
+        i2c_master_write(cmd, transfer->m_data, transfer->m_size, true);
+    } else {
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (transfer->m_address << 1) | I2C_MASTER_READ, true);
+        if (transfer->m_size > 1) {
+            i2c_master_read(cmd, transfer->m_data, transfer->m_size-1, I2C_MASTER_ACK);
+        }
+        i2c_master_read_byte(cmd, transfer->m_data+transfer->m_size-1, I2C_MASTER_NACK);
+    }
+    i2c_master_stop(cmd);
+}
+
+/*!
+ * \brief hal_i2c_transfer
+ * runs transfers with one command link, so driver is entered once for all
+ * of them. If any device doesn't acknowledge, or there are more than
+ * I2C_MAX_TRANSFERS transfers, whole link fails and caller can retry
+ * transfers one by one. Link is built to static buffer of the port, so
+ * nothing is allocated.
+ */
+bool hal_i2c_transfer(uint8_t port, const HalI2cTransfer *transfers, size_t count)
+{
+    int64_t start = esp_timer_get_time();
+    esp_err_t espRc;
+    i2c_cmd_handle_t cmd;
+    size_t i;
+
+    if (port >= HAL_I2C_PORT_COUNT || count == 0 || count > I2C_MAX_TRANSFERS) {
+        return false;
+    }
+    for (i=0;i<count;i++) {
+        if (transfers[i].m_size == 0) {
+            return false;
+        }
+    }
+    cmd = i2c_cmd_link_create_static(m_i2cLink[port], sizeof(m_i2cLink[port]));
+    if (cmd == NULL) {
+        return false;
+    }
+    for (i=0;i<count;i++) {
+        hal_i2c_addTransfer(cmd, &transfers[i]);
+    }
+    espRc = i2c_master_cmd_begin((i2c_port_t)port, cmd, count*I2C_TIMEOUT_MS/portTICK_PERIOD_MS);
+    i2c_cmd_link_delete_static(cmd);
+    hal_i2c_metrics(start, espRc);
+
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_RECORD
+    for (i=0;i<count && espRc == ESP_OK;i++) {
+        if (!transfers[i].m_write) {
+            hal_capture_i2cRead(port, transfers[i].m_address, transfers[i].m_reg, transfers[i].m_data,
+                                transfers[i].m_size);
+        }
+    }
+#endif
+    return espRc == ESP_OK;
+}
+
+bool hal_i2c_write(uint8_t port, uint8_t address, uint8_t reg, const uint8_t *data, size_t size)
+{
+    const HalI2cTransfer transfer = {
+        .m_address = address,
+        .m_reg = reg,
+        .m_write = true,
+        .m_data = (uint8_t *)data,
+        .m_size = size,
+    };
+    return hal_i2c_transfer(port, &transfer, 1);
+}
+
+bool hal_i2c_read(uint8_t port, uint8_t address, uint8_t reg, uint8_t *data, size_t size)
+{
+    const HalI2cTransfer transfer = {
+        .m_address = address,
+        .m_reg = reg,
+        .m_write = false,
+        .m_data = data,
+        .m_size = size,
+    };
+    return hal_i2c_transfer(port, &transfer, 1);
+}
+#endif
+
+#if CONFIG_WEATHER_SENSOR_PMS5003
+/*!
+ * \brief hal_uart_init
+ *
+ * \param rxThreshold data event is raised when this many bytes are received
+ * or when line goes idle
+ */
+bool hal_uart_init(uint32_t baudRate, size_t rxThreshold)
+{
+    const uart_config_t uart_config = {
+        .baud_rate = (int)(baudRate),
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+#if CONFIG_PM_ENABLE
+        // REF_TICK keeps baud rate when APB frequency is scaled
+        .source_clk = UART_SCLK_REF_TICK,
+#endif
+    };
+    m_uartRxThreshold = rxThreshold > 0 ? rxThreshold : 1;
+    uart_set_wakeup_threshold(UART, 3);
+    uart_param_config(UART, &uart_config);
+    uart_set_pin(UART, TXD_PIN, RXD_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+#if HAL_UART_USE_EVENTS
+    if (uart_driver_install(UART, UART_RX_BUF_SIZE, 0, HAL_UART_QUEUE_SIZE, &m_uartQueue, 0) != ESP_OK) {
+        return false;
+    }
+    // UART pattern detection only matches repeated same character, so
+    // frame header can't be used as pattern. Instead data event is
+    // raised when threshold is in FIFO or when line goes idle after frame.
+    uart_set_rx_full_threshold(UART, (int)(m_uartRxThreshold));
+    uart_set_rx_timeout(UART, HAL_UART_RX_TIMEOUT);
+    return true;
+#else
+    return uart_driver_install(UART, UART_RX_BUF_SIZE, 0, 0, NULL, 0) == ESP_OK;
+#endif
+}
+
+static HalUartEvent hal_uart_buffered(size_t minimum, size_t *length)
+{
+    if (uart_get_buffered_data_len(UART, length) == ESP_OK && *length >= minimum) {
+        return HalUartEventData;
+    }
+    *length = 0;
+    return HalUartEventNone;
+}
+
+#if HAL_UART_USE_EVENTS
+/*!
+ * \brief hal_uart_wait
+ * blocks until UART driver raises event or timeout
+ *
+ * \param length bytes buffered when event is HalUartEventData
+ */
+HalUartEvent hal_uart_wait(uint32_t timeoutMs, size_t *length)
+{
+    uart_event_t event;
+    TickType_t timeout = timeoutMs == HAL_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs);
+
+    *length = 0;
+    if (xQueueReceive(m_uartQueue, &event, timeout) != pdTRUE) {
+        return HalUartEventNone;
+    }
+    switch (event.type) {
+        case UART_DATA:
+            return hal_uart_buffered(1, length);
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            // data is lost anyway, start from clean state
+            uart_flush_input(UART);
+            xQueueReset(m_uartQueue);
+            return HalUartEventOverflow;
+        default:
+            break;
+    }
+    return HalUartEventNone;
+}
+#else
+/*!
+ * \brief hal_uart_wait
+ * polls UART buffer once per tick, timeout is ignored
+ */
+HalUartEvent hal_uart_wait(uint32_t timeoutMs, size_t *length)
+{
+    (void)timeoutMs;
+    vTaskDelay(1);
+    return hal_uart_buffered(m_uartRxThreshold, length);
+}
+#endif
+
+/*!
+ * \brief hal_uart_wake
+ * makes hal_uart_wait() return HalUartEventNone before its timeout, can be
+ * called from other task
+ */
+void hal_uart_wake(void)
+{
+#if HAL_UART_USE_EVENTS
+    // event type that UART driver never sends
+    const uart_event_t event = { .type = UART_EVENT_MAX };
+
+    if (m_uartQueue != NULL) {
+        xQueueSend(m_uartQueue, &event, 0);
+    }
+#endif
+}
+
+int hal_uart_read(uint8_t *data, size_t size)
+{
+    int rxBytes = uart_read_bytes(UART, data, size, 0);
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_RECORD
+    if (rxBytes > 0) {
+        hal_capture_uartRx(data, (size_t)(rxBytes));
+    }
+#endif
+    return rxBytes;
+}
+
+int hal_uart_write(const uint8_t *data, size_t size)
+{
+    return uart_write_bytes(UART, data, size);
+}
+#endif
@@ -0,0 +1,565 @@
+/*!
+ * \file
+ * \brief file hal_host.c
+ *
+ * hardware abstraction of host build with simulated sensors
+ * BME280 devices at 0x76 and 0x77 of both I2C ports answer with chip id,
+ * calibration of datasheet example and measurements that drift around
+ * raw values of the example. PMS5003 on UART streams frames in active mode
+ * and answers sleep, mode and read commands. Data that is not read before
+ * HAL_HOST_UART_BUFFER_SIZE bytes are buffered is lost like with UART
+ * driver. Readers built against this run unchanged on host.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "hal_host.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "bme280_reader.h"
+#include "psm_reader.h"
+#include "psm_parser.h"
+#include "bus_capture.h"
+#include "metrics.h"
+#include "host_platform.h"
+
+#define HAL_HOST_BME280_FIRST       0x76
+#define HAL_HOST_BME280_COUNT       2
+#define HAL_HOST_REGISTER_COUNT     256
+
+/*
+* Register file of one simulated BME280
+*/
+typedef struct
+{
+    bool m_present;
+    uint8_t m_reg[HAL_HOST_REGISTER_COUNT];
+    int64_t m_readyUs;          // forced measurement is ready at this time
+    bool m_measuring;
+    int32_t m_adcT;
+    int32_t m_adcP;
+    int32_t m_adcH;
+} HalHostBme280;
+
+static HalHostBme280 m_bme280[HAL_I2C_PORT_COUNT][HAL_HOST_BME280_COUNT];
+static bool m_bme280Initialized = false;
+static atomic_uint m_bme280MeasureUs = 0;
+static atomic_uint m_bme280Measurements = 0;
+// I2C of both ports is used only by sensor hub task, lock covers tests
+static pthread_mutex_t m_i2cLock = PTHREAD_MUTEX_INITIALIZER;
+
+// simulated PMS5003, protected by m_uartLock
+static pthread_mutex_t m_uartLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_uartChanged;
+static bool m_uartInstalled = false;
+static uint8_t m_uartBuffer[HAL_HOST_UART_BUFFER_SIZE];
+static size_t m_uartBuffered = 0;
+static bool m_uartOverflow = false;
+static bool m_uartWake = false;
+static bool m_psmAsleep = false;
+static bool m_psmPassive = false;
+static uint32_t m_psmFramePeriodUs = HAL_HOST_PMS5003_FRAME_PERIOD_US;
+static int64_t m_psmNextFrameUs = 0;
+static uint16_t m_psmPm[3] = { 5, 8, 12 };
+static atomic_uint m_psmFrames = 0;
+
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_RECORD
+static BusCapture m_capture;
+static pthread_mutex_t m_captureLock = PTHREAD_MUTEX_INITIALIZER;
+static bool m_captureReady = false;
+#endif
+
+bool hal_capture_init(void)
+{
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_RECORD
+    m_captureReady = bus_capture_initPartition(&m_capture, BUS_CAPTURE_PARTITION_LABEL);
+    return m_captureReady;
+#else
+    return true;
+#endif
+}
+
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_RECORD
+static void hal_capture_i2cRead(uint8_t port, uint8_t address, uint8_t reg, const uint8_t *data, size_t size)
+{
+    if (!m_captureReady) {
+        return;
+    }
+    pthread_mutex_lock(&m_captureLock);
+    bus_capture_i2cRead(&m_capture, BUS_CAPTURE_I2C_ADDRESS(port, address), reg, data, size,
+                        (uint32_t)(esp_timer_get_time() / 1000));
+    pthread_mutex_unlock(&m_captureLock);
+}
+
+static void hal_capture_uartRx(const uint8_t *data, size_t size)
+{
+    if (!m_captureReady) {
+        return;
+    }
+    pthread_mutex_lock(&m_captureLock);
+    bus_capture_uartRx(&m_capture, data, size, (uint32_t)(esp_timer_get_time() / 1000));
+    pthread_mutex_unlock(&m_captureLock);
+}
+#endif
+
+static void hal_host_put16(uint8_t *reg, uint16_t value)
+{
+    reg[0] = (uint8_t)(value);
+    reg[1] = (uint8_t)(value >> 8);
+}
+
+/*!
+ * \brief hal_host_initBme280
+ * calibration and raw values of datasheet compensation example, raw values
+ * 519888 and 415148 give 25.08 C and 1006.53 hPa
+ */
+static void hal_host_initBme280(HalHostBme280 *device)
+{
+    uint8_t *reg = device->m_reg;
+
+    memset(reg, 0, HAL_HOST_REGISTER_COUNT);
+    hal_host_put16(reg + BME280_REGISTER_DIG_T1, 27504);
+    hal_host_put16(reg + BME280_REGISTER_DIG_T2, 26435);
+    hal_host_put16(reg + BME280_REGISTER_DIG_T3, (uint16_t)(-1000));
+    hal_host_put16(reg + BME280_REGISTER_DIG_P1, 36477);
+    hal_host_put16(reg + BME280_REGISTER_DIG_P2, (uint16_t)(-10685));
+    hal_host_put16(reg + BME280_REGISTER_DIG_P3, 3024);
+    hal_host_put16(reg + BME280_REGISTER_DIG_P4, 2855);
+    hal_host_put16(reg + BME280_REGISTER_DIG_P5, 140);
+    hal_host_put16(reg + BME280_REGISTER_DIG_P6, (uint16_t)(-7));
+    hal_host_put16(reg + BME280_REGISTER_DIG_P7, 15500);
+    hal_host_put16(reg + BME280_REGISTER_DIG_P8, (uint16_t)(-14600));
+    hal_host_put16(reg + BME280_REGISTER_DIG_P9, 6000);
+    reg[BME280_REGISTER_DIG_H1] = 75;
+    hal_host_put16(reg + BME280_REGISTER_DIG_H2, 362);
+    reg[BME280_REGISTER_DIG_H3] = 0;
+    // dig_H4 324 and dig_H5 50 share register 0xE5
+    reg[BME280_REGISTER_DIG_H4] = (uint8_t)(324 >> 4);
+    reg[BME280_REGISTER_DIG_H4 + 1] = (uint8_t)((324 & 0xF) | ((50 & 0xF) << 4));
+    reg[BME280_REGISTER_DIG_H5 + 1] = (uint8_t)(50 >> 4);
+    reg[BME280_REGISTER_DIG_H6] = 30;
+    reg[BME280_REGISTER_CHIPID] = BME280_REGISTER_CHIPID_READ_VALUE;
+    device->m_adcT = 519888;
+    device->m_adcP = 415148;
+    device->m_adcH = 28000;
+}
+
+static HalHostBme280 *hal_host_findBme280(uint8_t port, uint8_t address)
+{
+    size_t i, p;
+
+    if (!m_bme280Initialized) {
+        for (p=0;p<HAL_I2C_PORT_COUNT;p++) {
+            for (i=0;i<HAL_HOST_BME280_COUNT;i++) {
+                hal_host_initBme280(&m_bme280[p][i]);
+                m_bme280[p][i].m_present = true;
+            }
+        }
+        m_bme280Initialized = true;
+    }
+    if (port >= HAL_I2C_PORT_COUNT || address < HAL_HOST_BME280_FIRST
+        || address >= HAL_HOST_BME280_FIRST + HAL_HOST_BME280_COUNT) {
+        return NULL;
+    }
+    return &m_bme280[port][address - HAL_HOST_BME280_FIRST];
+}
+
+static int32_t hal_host_drift(int32_t value, int32_t step)
+{
+    return value + (int32_t)(esp_random() % (uint32_t)(2 * step + 1)) - step;
+}
+
+/*!
+ * \brief hal_host_measureBme280
+ * stores next measurement to data registers 0xF7..0xFE
+ */
+static void hal_host_measureBme280(HalHostBme280 *device)
+{
+    uint8_t *data = device->m_reg + BME280_REGISTER_PRESSUREDATA;
+
+    device->m_adcT = hal_host_drift(device->m_adcT, 64);
+    device->m_adcP = hal_host_drift(device->m_adcP, 64);
+    device->m_adcH = hal_host_drift(device->m_adcH, 32);
+    data[0] = (uint8_t)(device->m_adcP >> 12);
+    data[1] = (uint8_t)(device->m_adcP >> 4);
+    data[2] = (uint8_t)(device->m_adcP << 4);
+    data[3] = (uint8_t)(device->m_adcT >> 12);
+    data[4] = (uint8_t)(device->m_adcT >> 4);
+    data[5] = (uint8_t)(device->m_adcT << 4);
+    data[6] = (uint8_t)(device->m_adcH >> 8);
+    data[7] = (uint8_t)(device->m_adcH);
+    atomic_fetch_add(&m_bme280Measurements, 1);
+}
+
+static void hal_host_updateBme280(HalHostBme280 *device)
+{
+    uint8_t mode = device->m_reg[BME280_REGISTER_CONTROL] & 0x03;
+
+    if (device->m_measuring && esp_timer_get_time() >= device->m_readyUs) {
+        device->m_measuring = false;
+        hal_host_measureBme280(device);
+        // forced mode returns to sleep after measurement
+        device->m_reg[BME280_REGISTER_CONTROL] &= (uint8_t)(~0x03);
+    }
+    if (mode == BME280_MODE_NORMAL) {
+        hal_host_measureBme280(device);
+    }
+    device->m_reg[BME280_REGISTER_STATUS] = device->m_measuring ? BME280_STATUS_MEASURING : 0;
+}
+
+static void hal_host_writeBme280(HalHostBme280 *device, uint8_t reg, const uint8_t *data, size_t size)
+{
+    size_t i;
+
+    for (i=0;i<size && reg + i < HAL_HOST_REGISTER_COUNT;i++) {
+        device->m_reg[reg + i] = data[i];
+    }
+    if (reg == BME280_REGISTER_CONTROL && (data[0] & 0x03) != BME280_MODE_SLEEP
+        && (data[0] & 0x03) != BME280_MODE_NORMAL) {
+        device->m_measuring = true;
+        device->m_readyUs = esp_timer_get_time() + atomic_load(&m_bme280MeasureUs);
+    }
+}
+
+static void hal_host_readBme280(HalHostBme280 *device, uint8_t reg, uint8_t *data, size_t size)
+{
+    size_t i;
+
+    hal_host_updateBme280(device);
+    for (i=0;i<size;i++) {
+        data[i] = reg + i < HAL_HOST_REGISTER_COUNT ? device->m_reg[reg + i] : 0;
+    }
+}
+
+bool hal_i2c_init(uint8_t port)
+{
+    return port < HAL_I2C_PORT_COUNT;
+}
+
+/*!
+ * \brief hal_i2c_transfer
+ * runs transfers in order, transfer to missing device fails link like
+ * missing ACK, transfers before it are done
+ */
+bool hal_i2c_transfer(uint8_t port, const HalI2cTransfer *transfers, size_t count)
+{
+    int64_t start = esp_timer_get_time();
+    HalHostBme280 *device;
+    bool ok = port < HAL_I2C_PORT_COUNT && count > 0;
+    size_t i;
+
+    pthread_mutex_lock(&m_i2cLock);
+    for (i=0;i<count && ok;i++) {
+        device = hal_host_findBme280(port, transfers[i].m_address);
+        if (device == NULL || !device->m_present || transfers[i].m_size == 0) {
+            ok = false;
+        } else if (transfers[i].m_write) {
+            hal_host_writeBme280(device, transfers[i].m_reg, transfers[i].m_data, transfers[i].m_size);
+        } else {
+            hal_host_readBme280(device, transfers[i].m_reg, transfers[i].m_data, transfers[i].m_size);
+        }
+    }
+    pthread_mutex_unlock(&m_i2cLock);
+    metrics_addLatency(MetricLatencyI2c, (uint32_t)(esp_timer_get_time() - start));
+    if (!ok) {
+        metrics_add(MetricI2cErrors, 1);
+    }
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_RECORD
+    for (i=0;i<count && ok;i++) {
+        if (!transfers[i].m_write) {
+            hal_capture_i2cRead(port, transfers[i].m_address, transfers[i].m_reg, transfers[i].m_data,
+                                transfers[i].m_size);
+        }
+    }
+#endif
+    return ok;
+}
+
+bool hal_i2c_write(uint8_t port, uint8_t address, uint8_t reg, const uint8_t *data, size_t size)
+{
+    const HalI2cTransfer transfer = {
+        .m_address = address,
+        .m_reg = reg,
+        .m_write = true,
+        .m_data = (uint8_t *)data,
+        .m_size = size,
+    };
+    return hal_i2c_transfer(port, &transfer, 1);
+}
+
+bool hal_i2c_read(uint8_t port, uint8_t address, uint8_t reg, uint8_t *data, size_t size)
+{
+    const HalI2cTransfer transfer = {
+        .m_address = address,
+        .m_reg = reg,
+        .m_write = false,
+        .m_data = data,
+        .m_size = size,
+    };
+    return hal_i2c_transfer(port, &transfer, 1);
+}
+
+void hal_host_setBme280Present(uint8_t port, uint8_t address, bool present)
+{
+    HalHostBme280 *device;
+
+    pthread_mutex_lock(&m_i2cLock);
+    device = hal_host_findBme280(port, address);
+    if (device != NULL) {
+        device->m_present = present;
+    }
+    pthread_mutex_unlock(&m_i2cLock);
+}
+
+/*!
+ * \brief hal_host_setBme280MeasureTime
+ * time from forced measurement start to ready status, default 0
+ */
+void hal_host_setBme280MeasureTime(uint32_t us)
+{
+    atomic_store(&m_bme280MeasureUs, us);
+}
+
+uint32_t hal_host_bme280Measurements(void)
+{
+    return atomic_load(&m_bme280Measurements);
+}
+
+/*!
+ * \brief hal_host_uartSend
+ * sensor sends bytes to UART, bytes that don't fit to buffer are lost
+ */
+static void hal_host_uartSend(const uint8_t *data, size_t size)
+{
+    if (m_uartBuffered + size > sizeof(m_uartBuffer)) {
+        m_uartOverflow = true;
+        return;
+    }
+    memcpy(m_uartBuffer + m_uartBuffered, data, size);
+    m_uartBuffered += size;
+}
+
+static void hal_host_psmFrame(uint8_t *frame, uint16_t length, const uint16_t *words)
+{
+    uint16_t checksum = 0;
+    size_t size = 4 + length, i;
+
+    frame[0] = FIXED_CHAR0;
+    frame[1] = FIXED_CHAR1;
+    frame[2] = (uint8_t)(length >> 8);
+    frame[3] = (uint8_t)(length);
+    for (i=0;i<(size_t)(length/2 - 1);i++) {
+        frame[4 + 2*i] = (uint8_t)(words[i] >> 8);
+        frame[5 + 2*i] = (uint8_t)(words[i]);
+    }
+    for (i=0;i<size-2;i++) {
+        checksum += frame[i];
+    }
+    frame[size - 2] = (uint8_t)(checksum >> 8);
+    frame[size - 1] = (uint8_t)(checksum);
+}
+
+/*!
+ * \brief hal_host_psmSendFrame
+ * sends data frame, PM values drift so that every frame has new values
+ */
+static void hal_host_psmSendFrame(void)
+{
+    uint16_t words[(PSM_FRAME_SIZE - 4) / 2 - 1];
+    uint8_t frame[PSM_FRAME_SIZE];
+    size_t i;
+
+    for (i=0;i<3;i++) {
+        m_psmPm[i] = (uint16_t)(m_psmPm[i] < 2 ? m_psmPm[i] + 1 : hal_host_drift(m_psmPm[i], 2));
+    }
+    memset(words, 0, sizeof(words));
+    for (i=0;i<3;i++) {
+        words[i] = m_psmPm[i];          // standard
+        words[3 + i] = m_psmPm[i];      // environmental
+    }
+    for (i=6;i<12;i++) {
+        words[i] = (uint16_t)(esp_random() % 2000);
+    }
+    hal_host_psmFrame(frame, PSM_FRAME_SIZE - 4, words);
+    hal_host_uartSend(frame, sizeof(frame));
+    atomic_fetch_add(&m_psmFrames, 1);
+}
+
+/*!
+ * \brief hal_host_psmStream
+ * sends frames that are due in active mode
+ */
+static void hal_host_psmStream(int64_t now)
+{
+    if (m_psmAsleep || m_psmPassive) {
+        m_psmNextFrameUs = now + m_psmFramePeriodUs;
+        return;
+    }
+    while (m_psmNextFrameUs <= now) {
+        hal_host_psmSendFrame();
+        m_psmNextFrameUs += m_psmFramePeriodUs;
+    }
+}
+
+bool hal_uart_init(uint32_t baudRate, size_t rxThreshold)
+{
+    pthread_condattr_t attr;
+
+    pthread_mutex_lock(&m_uartLock);
+    if (!m_uartInstalled) {
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&m_uartChanged, &attr);
+        pthread_condattr_destroy(&attr);
+        m_uartInstalled = true;
+    }
+    m_uartBuffered = 0;
+    m_uartOverflow = false;
+    m_psmNextFrameUs = esp_timer_get_time() + m_psmFramePeriodUs;
+    pthread_mutex_unlock(&m_uartLock);
+    return true;
+}
+
+/*!
+ * \brief hal_uart_wait
+ * blocks until sensor has sent data, timeout or hal_uart_wake()
+ */
+HalUartEvent hal_uart_wait(uint32_t timeoutMs, size_t *length)
+{
+    int64_t deadline = timeoutMs == HAL_WAIT_FOREVER ? INT64_MAX
+                                                     : esp_timer_get_time() + (int64_t)(timeoutMs) * 1000;
+    HalUartEvent event = HalUartEventNone;
+    struct timespec until;
+    int64_t now, wakeUs;
+
+    *length = 0;
+    pthread_mutex_lock(&m_uartLock);
+    while (1) {
+        now = esp_timer_get_time();
+        hal_host_psmStream(now);
+        if (m_uartOverflow) {
+            // data is lost anyway, start from clean state
+            m_uartOverflow = false;
+            m_uartBuffered = 0;
+            event = HalUartEventOverflow;
+            break;
+        }
+        if (m_uartBuffered > 0) {
+            *length = m_uartBuffered;
+            event = HalUartEventData;
+            break;
+        }
+        if (m_uartWake || now >= deadline) {
+            break;
+        }
+        wakeUs = m_psmAsleep || m_psmPassive ? deadline : m_psmNextFrameUs;
+        wakeUs = wakeUs < deadline ? wakeUs : deadline;
+        if (wakeUs == INT64_MAX) {
+            pthread_cond_wait(&m_uartChanged, &m_uartLock);
+            host_countWakeup();
+            continue;
+        }
+        // esp_timer time is monotonic clock from process start
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        wakeUs -= now;
+        until.tv_sec += (time_t)(wakeUs / 1000000);
+        until.tv_nsec += (long)(wakeUs % 1000000) * 1000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&m_uartChanged, &m_uartLock, &until);
+        host_countWakeup();
+    }
+    m_uartWake = false;
+    pthread_mutex_unlock(&m_uartLock);
+    return event;
+}
+
+void hal_uart_wake(void)
+{
+    if (!m_uartInstalled) {
+        return;
+    }
+    pthread_mutex_lock(&m_uartLock);
+    m_uartWake = true;
+    pthread_cond_signal(&m_uartChanged);
+    pthread_mutex_unlock(&m_uartLock);
+}
+
+int hal_uart_read(uint8_t *data, size_t size)
+{
+    size_t part;
+
+    pthread_mutex_lock(&m_uartLock);
+    part = size < m_uartBuffered ? size : m_uartBuffered;
+    memcpy(data, m_uartBuffer, part);
+    memmove(m_uartBuffer, m_uartBuffer + part, m_uartBuffered - part);
+    m_uartBuffered -= part;
+    pthread_mutex_unlock(&m_uartLock);
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_RECORD
+    if (part > 0) {
+        hal_capture_uartRx(data, part);
+    }
+#endif
+    return (int)(part);
+}
+
+/*!
+ * \brief hal_uart_write
+ * handles commands to sensor: sleep/wakeup, passive/active mode and read
+ * of one frame in passive mode. Mode change is answered with reply frame.
+ */
+int hal_uart_write(const uint8_t *data, size_t size)
+{
+    uint8_t reply[4 + PSM_REPLY_LENGTH];
+    uint16_t replyWords[1];
+
+    if (size != PSM_COMMAND_SIZE || data[0] != FIXED_CHAR0 || data[1] != FIXED_CHAR1) {
+        return (int)(size);
+    }
+    pthread_mutex_lock(&m_uartLock);
+    hal_host_psmStream(esp_timer_get_time());
+    switch (data[2]) {
+        case PSM_COMMAND_SLEEP:
+            m_psmAsleep = data[4] == PSM_SLEEP;
+            m_psmNextFrameUs = esp_timer_get_time() + m_psmFramePeriodUs;
+            break;
+        case PSM_COMMAND_MODE:
+            m_psmPassive = data[4] == PSM_MODE_PASSIVE;
+            m_psmNextFrameUs = esp_timer_get_time() + m_psmFramePeriodUs;
+            replyWords[0] = (uint16_t)((data[2] << 8) | data[4]);
+            hal_host_psmFrame(reply, PSM_REPLY_LENGTH, replyWords);
+            hal_host_uartSend(reply, sizeof(reply));
+            break;
+        case PSM_COMMAND_READ:
+            if (!m_psmAsleep && m_psmPassive) {
+                hal_host_psmSendFrame();
+            }
+            break;
+        default:
+            break;
+    }
+    pthread_cond_signal(&m_uartChanged);
+    pthread_mutex_unlock(&m_uartLock);
+    return (int)(size);
+}
+
+void hal_host_setPms5003FramePeriod(uint32_t us)
+{
+    pthread_mutex_lock(&m_uartLock);
+    m_psmFramePeriodUs = us > 0 ? us : 1;
+    m_psmNextFrameUs = esp_timer_get_time() + m_psmFramePeriodUs;
+    pthread_mutex_unlock(&m_uartLock);
+}
+
+uint32_t hal_host_pms5003Frames(void)
+{
+    return atomic_load(&m_psmFrames);
+}
@@ -0,0 +1,31 @@
+/*!
+ * \file
+ * \brief file hal_host.h
+ *
+ * controls of simulated sensors of hal_host.c, used by host tests and
+ * benchmarks in test/
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "hal.h"
+
+// PMS5003 streams one frame per second in active mode
+#define HAL_HOST_PMS5003_FRAME_PERIOD_US    1000000
+// bytes simulated UART buffers before data is lost
+#define HAL_HOST_UART_BUFFER_SIZE           256
+
+void hal_host_setBme280Present(uint8_t port, uint8_t address, bool present);
+void hal_host_setBme280MeasureTime(uint32_t us);
+void hal_host_setPms5003FramePeriod(uint32_t us);
+uint32_t hal_host_bme280Measurements(void);
+uint32_t hal_host_pms5003Frames(void);
+
+#endif // HAL_HOST_H
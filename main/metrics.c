@@ -0,0 +1,202 @@
+/*!
+ * \file
+ * \brief file metrics.c
+ *
+ * runtime counters and latency histograms of pipeline stages
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "metrics.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+/*
+* Metrics updated on one core
+*/
+typedef struct
+{
+    atomic_uint m_counter[MetricCounterCount];
+    atomic_uint m_latency[MetricLatencyCount][METRICS_LATENCY_BUCKETS];
+} MetricsCore;
+
+static MetricsCore m_core[METRICS_CORE_COUNT];
+static const uint32_t m_latencyBaseUs[] = {
+    [MetricLatencyI2c]          = METRICS_LATENCY_BASE_I2C_US,
+    [MetricLatencySend]         = METRICS_LATENCY_BASE_SEND_US,
+    [MetricLatencySampleToSend] = METRICS_LATENCY_BASE_SAMPLE_TO_SEND_US,
+    [MetricLatencyClockSync]    = METRICS_LATENCY_BASE_CLOCK_SYNC_US,
+    [MetricLatencyHubLateness]  = METRICS_LATENCY_BASE_HUB_LATENESS_US,
+};
+// base 0 would put every latency to one bucket
+_Static_assert(sizeof(m_latencyBaseUs) / sizeof(m_latencyBaseUs[0]) == MetricLatencyCount, "base of every latency");
+_Static_assert(METRICS_LATENCY_BASE_I2C_US > 0 && METRICS_LATENCY_BASE_SEND_US > 0
+               && METRICS_LATENCY_BASE_SAMPLE_TO_SEND_US > 0 && METRICS_LATENCY_BASE_CLOCK_SYNC_US > 0
+               && METRICS_LATENCY_BASE_HUB_LATENESS_US > 0, "latency bases are nonzero");
+static TaskHandle_t m_task[METRICS_MAX_TASKS];
+static atomic_uint m_taskCount;
+#if configGENERATE_RUN_TIME_STATS && configUSE_TRACE_FACILITY
+// run time counters of previous snapshot, used only by snapshot caller
+static uint32_t m_taskRunTime[METRICS_MAX_TASKS];
+#endif
+static int64_t m_snapshotTime = 0;
+
+static MetricsCore *metrics_core()
+{
+    BaseType_t core = xPortGetCoreID();
+    return &m_core[core < METRICS_CORE_COUNT ? core : 0];
+}
+
+void metrics_add(MetricCounter counter, uint32_t value)
+{
+    if (value > 0) {
+        atomic_fetch_add_explicit(&metrics_core()->m_counter[counter], value, memory_order_relaxed);
+    }
+}
+
+void metrics_addLatency(MetricLatency latency, uint32_t us)
+{
+    uint32_t bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS - 1 && us >= (m_latencyBaseUs[latency] << bucket)) {
+        bucket++;
+    }
+    atomic_fetch_add_explicit(&metrics_core()->m_latency[latency][bucket], 1, memory_order_relaxed);
+}
+
+/*!
+ * \brief metrics_registerTaskHandle
+ * adds task to stack high-water marks and duty cycles of snapshot
+ */
+void metrics_registerTaskHandle(TaskHandle_t task)
+{
+    unsigned int index = atomic_fetch_add_explicit(&m_taskCount, 1, memory_order_relaxed);
+    if (index < METRICS_MAX_TASKS) {
+        m_task[index] = task;
+    }
+}
+
+void metrics_registerTask(void)
+{
+    metrics_registerTaskHandle(xTaskGetCurrentTaskHandle());
+}
+
+static uint16_t metrics_duty(size_t index, int64_t elapsedUs)
+{
+#if configGENERATE_RUN_TIME_STATS && configUSE_TRACE_FACILITY
+    TaskStatus_t status;
+    uint32_t runTime;
+
+    vTaskGetInfo(m_task[index], &status, pdFALSE, eRunning);
+    // run time counter is esp_timer us
+    runTime = (uint32_t)(status.ulRunTimeCounter) - m_taskRunTime[index];
+    m_taskRunTime[index] = (uint32_t)(status.ulRunTimeCounter);
+    if (elapsedUs <= 0) {
+        return 0;
+    }
+    return (uint16_t)((uint64_t)(runTime) * 1000 / (uint64_t)(elapsedUs));
+#else
+    (void)index;
+    (void)elapsedUs;
+    return 0;
+#endif
+}
+
+/*!
+ * \brief metrics_snapshot
+ * sums counters of all cores, counters run from boot and wrap around.
+ * Duty cycles are since previous snapshot, so only one task takes them.
+ */
+void metrics_snapshot(MetricsSnapshot *snapshot)
+{
+    unsigned int taskCount = atomic_load_explicit(&m_taskCount, memory_order_relaxed);
+    int64_t now = esp_timer_get_time();
+    int64_t elapsedUs = now - m_snapshotTime;
+    size_t core, i, j;
+
+    memset(snapshot, 0, sizeof(MetricsSnapshot));
+    for (core=0;core<METRICS_CORE_COUNT;core++) {
+        for (i=0;i<MetricCounterCount;i++) {
+            snapshot->m_counter[i] += atomic_load_explicit(&m_core[core].m_counter[i], memory_order_relaxed);
+        }
+        for (i=0;i<MetricLatencyCount;i++) {
+            for (j=0;j<METRICS_LATENCY_BUCKETS;j++) {
+                snapshot->m_latency[i][j] += atomic_load_explicit(&m_core[core].m_latency[i][j],
+                                                                  memory_order_relaxed);
+            }
+        }
+    }
+    for (i=0;i<taskCount && i<METRICS_MAX_TASKS;i++) {
+        if (m_task[i] == NULL) {
+            continue;
+        }
+        strncpy(snapshot->m_taskName[snapshot->m_taskCount], pcTaskGetName(m_task[i]), METRICS_TASK_NAME_SIZE - 1);
+        // ESP-IDF gives stack high-water mark in bytes
+        snapshot->m_stackFree[snapshot->m_taskCount] = (uint32_t)(uxTaskGetStackHighWaterMark(m_task[i]));
+        snapshot->m_duty[snapshot->m_taskCount] = metrics_duty(i, elapsedUs);
+        snapshot->m_taskCount++;
+    }
+    snapshot->m_heapFree = (uint32_t)(heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    snapshot->m_heapMinFree = (uint32_t)(heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    m_snapshotTime = now;
+}
+
+/*!
+ * \brief metrics_printMemory
+ * prints least free stack of registered tasks and internal heap. Doesn't
+ * touch duty cycles of snapshot, so it can be called from any task.
+ */
+void metrics_printMemory(void)
+{
+    unsigned int taskCount = atomic_load_explicit(&m_taskCount, memory_order_relaxed);
+    size_t i;
+
+    printf("memory: heap free %" PRIu32 " least free %" PRIu32 "\n",
+           (uint32_t)(heap_caps_get_free_size(MALLOC_CAP_INTERNAL)),
+           (uint32_t)(heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL)));
+    for (i=0;i<taskCount && i<METRICS_MAX_TASKS;i++) {
+        if (m_task[i] != NULL) {
+            printf("memory: %s stack free %" PRIu32 "\n", pcTaskGetName(m_task[i]),
+                   (uint32_t)(uxTaskGetStackHighWaterMark(m_task[i])));
+        }
+    }
+}
+
+static void metrics_memoryReportCallback(void *arg)
+{
+    (void)arg;
+    metrics_printMemory();
+}
+
+/*!
+ * \brief metrics_startMemoryReport
+ * prints memory report now and then every periodMs from esp_timer task,
+ * periodMs 0 prints only now. Tasks register themselves when they start,
+ * so report at boot may miss some of them.
+ */
+void metrics_startMemoryReport(uint32_t periodMs)
+{
+    const esp_timer_create_args_t args = {
+        .callback = metrics_memoryReportCallback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "memory_report",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_handle_t timer;
+
+    metrics_printMemory();
+    if (periodMs == 0) {
+        return;
+    }
+    if (esp_timer_create(&args, &timer) != ESP_OK
+        || esp_timer_start_periodic(timer, (uint64_t)(periodMs) * 1000) != ESP_OK) {
+        printf("memory report timer failed\n");
+    }
+}
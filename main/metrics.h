@@ -0,0 +1,91 @@
+/*!
+ * \file
+ * \brief file metrics.h
+ *
+ * runtime counters and latency histograms of pipeline stages
+ * Every core updates its own copy of counters with relaxed atomics, so
+ * updating never blocks or contends with other core. Copies are summed
+ * when snapshot is taken.
+ * Duty cycle of tasks needs CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS,
+ * idle tasks of cores are registered to give idle percentage.
+ * Memory report prints least free stack of tasks and free and least free
+ * internal heap to console, so sizes of static stacks and buffers can be
+ * trimmed from a running device.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define METRICS_CORE_COUNT          2
+#define METRICS_LATENCY_BUCKETS     8
+// bucket i of histogram counts latencies below its base << i, last one the
+// rest. Bases of MetricLatency histograms in us, every latency needs one:
+#define METRICS_LATENCY_BASE_I2C_US             64
+#define METRICS_LATENCY_BASE_SEND_US            64
+#define METRICS_LATENCY_BASE_SAMPLE_TO_SEND_US  16384
+#define METRICS_LATENCY_BASE_CLOCK_SYNC_US      2048
+#define METRICS_LATENCY_BASE_HUB_LATENESS_US    128
+#define METRICS_MAX_TASKS           6
+#define METRICS_TASK_NAME_SIZE      16
+
+typedef enum
+{
+    MetricPsmWakeups = 0,       // psm task wakeups
+    MetricPsmFrames,            // frames parsed
+    MetricPsmChecksumFails,     // frames dropped for checksum
+    MetricPsmDiscardedBytes,    // bytes skipped to find frame start
+    MetricUartOverflows,        // UART data lost
+    MetricI2cErrors,            // failed I2C transactions
+    MetricSlotRetries,          // value slot was written while it was read
+    MetricSlotSkips,            // value slot read gave up, left to next send
+    MetricSendFails,            // failed send() calls
+    MetricReconnects,           // connects to server
+    MetricDatagramRetransmits,  // UDP datagrams sent again for missing ack
+    MetricDatagramLost,         // UDP datagrams given up without ack
+    MetricValuesSuppressed,     // new values not sent, within deadband of last sent value
+    MetricHubOverruns,          // sensor hub job ran past its next deadline
+    MetricCounterCount,
+} MetricCounter;
+
+// new latency needs its base in m_latencyBaseUs of metrics.c
+typedef enum
+{
+    MetricLatencyI2c = 0,       // one I2C transaction
+    MetricLatencySend,          // one send() call
+    MetricLatencySampleToSend,  // sensor sample taken to its send() done
+    MetricLatencyClockSync,     // round trip of clock sync with server
+    MetricLatencyHubLateness,   // sensor hub job started after its deadline
+    MetricLatencyCount,
+} MetricLatency;
+
+typedef struct
+{
+    uint32_t m_counter[MetricCounterCount];
+    uint32_t m_latency[MetricLatencyCount][METRICS_LATENCY_BUCKETS];
+    uint8_t m_taskCount;
+    char m_taskName[METRICS_MAX_TASKS][METRICS_TASK_NAME_SIZE];
+    uint32_t m_stackFree[METRICS_MAX_TASKS];    // least free stack seen, bytes
+    uint16_t m_duty[METRICS_MAX_TASKS];         // run time since previous snapshot, 1/1000
+    uint32_t m_heapFree;                        // free internal heap, bytes
+    uint32_t m_heapMinFree;                     // least free internal heap since boot, bytes
+} MetricsSnapshot;
+
+void metrics_add(MetricCounter counter, uint32_t value);
+void metrics_addLatency(MetricLatency latency, uint32_t us);
+void metrics_registerTask(void);
+void metrics_registerTaskHandle(TaskHandle_t task);
+void metrics_snapshot(MetricsSnapshot *snapshot);
+void metrics_printMemory(void);
+void metrics_startMemoryReport(uint32_t periodMs);
+
+#endif // METRICS_H
@@ -0,0 +1,62 @@
+/*!
+ * \file
+ * \brief file power_manager.c
+ *
+ * low power mode: dynamic frequency scaling, tickless idle and Wi-Fi modem
+ * sleep
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "power_manager.h"
+#include <stdio.h>
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_pm.h"
+#include "metrics.h"
+#include "sdkconfig.h"
+
+/*!
+ * \brief power_init
+ * configures power management when POWER_SAVE is set, and registers idle
+ * tasks to metrics so idle percentage of cores is reported
+ */
+bool power_init(void)
+{
+    UBaseType_t core;
+
+    for (core=0;core<portNUM_PROCESSORS;core++) {
+        metrics_registerTaskHandle(xTaskGetIdleTaskHandleForCPU(core));
+    }
+#if POWER_SAVE && CONFIG_PM_ENABLE
+    esp_pm_config_t config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = POWER_MIN_CPU_FREQ_MHZ,
+        .light_sleep_enable = POWER_LIGHT_SLEEP,
+    };
+    if (esp_pm_configure(&config) != ESP_OK) {
+        printf("power management configuration failed\n");
+        return false;
+    }
+    return true;
+#elif POWER_SAVE
+    printf("power save needs CONFIG_PM_ENABLE\n");
+    return false;
+#else
+    return true;
+#endif
+}
+
+/*!
+ * \brief power_ticksToWakeWindow
+ * ticks until offsetMs after start of next wake window, windows are aligned
+ * to boot time
+ */
+TickType_t power_ticksToWakeWindow(uint32_t offsetMs)
+{
+    uint32_t now = (uint32_t)(esp_timer_get_time() / 1000) - offsetMs;
+    uint32_t remaining = POWER_WAKE_PERIOD_MS - now % POWER_WAKE_PERIOD_MS;
+    return (TickType_t)(remaining / portTICK_PERIOD_MS);
+}
@@ -0,0 +1,42 @@
+/*!
+ * \file
+ * \brief file power_manager.h
+ *
+ * low power mode: dynamic frequency scaling, tickless idle and Wi-Fi modem
+ * sleep. Sensor readings and sends are grouped to wake windows, so CPU and
+ * radio can idle between them.
+ * Turned on with CONFIG_WEATHER_POWER_SAVE, which selects CONFIG_PM_ENABLE
+ * and CONFIG_FREERTOS_USE_TICKLESS_IDLE. Off, sends are coalesced.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#if CONFIG_WEATHER_POWER_SAVE
+#define POWER_SAVE                  1
+#else
+#define POWER_SAVE                  0
+#endif
+// CPU runs on XTAL frequency when all tasks are idle
+#define POWER_MIN_CPU_FREQ_MHZ      40
+// PMS5003 is on UART2, which can't wake ESP32 from light sleep, so frames
+// would be lost if automatic light sleep was enabled
+#define POWER_LIGHT_SLEEP           0
+// sensors are read at start of every wake window and values are sent
+// POWER_SEND_OFFSET_MS later, when readings are ready
+#define POWER_WAKE_PERIOD_MS        1000
+#define POWER_SEND_OFFSET_MS        50
+
+bool power_init(void);
+TickType_t power_ticksToWakeWindow(uint32_t offsetMs);
+
+#endif // POWER_MANAGER_H
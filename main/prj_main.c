@@ -13,29 +13,54 @@
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "psm_reader.h"
 #include "wifi_connect.h"
 #include "bme280_reader.h"
 #include "tcpip_sender.h"
+#include "hal.h"
+#include "bus_capture.h"
+#include "power_manager.h"
+#include "sensor_hub.h"
+#include "metrics.h"
 
-void psm_task(void *arg) {
-    psm_init();
-    printf("psm start reading\n");
-    psm_reader();
-    vTaskDelay(1);
-    printf("psm reading failed somehow, this should not happen\n");
-    fflush(stdout);
-    esp_restart();
-}
+// stack sizes in bytes, stacks and task control blocks are static so that
+// their memory is counted at link time and tasks can't fail to start
+#define SENDER_STACK_SIZE           CONFIG_WEATHER_SENDER_STACK_SIZE
+#define SENDER_PRIORITY             3
+#define CAPTURE_REPLAY_STACK_SIZE   CONFIG_WEATHER_CAPTURE_REPLAY_STACK_SIZE
+#define CAPTURE_REPLAY_PRIORITY     10
+// sensors are enabled in Kconfig, without any there is no sensor hub task
+#define USE_SENSOR_HUB              (CONFIG_WEATHER_SENSOR_BME280 || CONFIG_WEATHER_SENSOR_PMS5003)
+
+static StackType_t m_senderStack[SENDER_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t m_senderTask;
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_REPLAY
+static StackType_t m_replayStack[CAPTURE_REPLAY_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t m_replayTask;
+#elif USE_SENSOR_HUB
+static StackType_t m_hubStack[SENSOR_HUB_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t m_hubTask;
+#endif
 
-void bme280_task(void *arg) {
+#if USE_SENSOR_HUB
+void sensor_hub_task(void *arg) {
+#if CONFIG_WEATHER_SENSOR_BME280
     bme280_reader_init();
-    bme280_reader_task();
+    bme280_reader_start();
+#endif
+#if CONFIG_WEATHER_SENSOR_PMS5003
+    psm_init();
+    printf("psm start reading\n");
+    psm_reader_start();
+#endif
+    sensor_hub_run();
     vTaskDelay(1);
-    printf("bme280 reading failed somehow, this should not happen\n");
+    printf("sensor reading failed somehow, this should not happen\n");
     fflush(stdout);
     esp_restart();
 }
+#endif
 
 void tcpip_sender_task(void *arg) {
     tcpip_sender_init();
@@ -44,11 +69,56 @@ void tcpip_sender_task(void *arg) {
     esp_restart();
 }
 
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_REPLAY
+static void capture_replay_i2cRead(void *context, uint8_t address, uint8_t reg, const uint8_t *data, size_t size,
+                                   uint32_t timestamp)
+{
+#if CONFIG_WEATHER_SENSOR_BME280
+    bme280_reader_feed(BUS_CAPTURE_I2C_PORT(address), address & 0x7F, reg, data, size);
+#endif
+}
+
+static void capture_replay_uartRx(void *context, const uint8_t *data, size_t size, uint32_t timestamp)
+{
+#if CONFIG_WEATHER_SENSOR_PMS5003
+    psm_reader_feed(data, size);
+#endif
+}
+
+void capture_replay_task(void *arg) {
+    const BusCaptureHandler handler = {
+        .i2cRead = capture_replay_i2cRead,
+        .uartRx = capture_replay_uartRx,
+        .context = NULL,
+    };
+    int64_t start = esp_timer_get_time();
+    uint32_t count;
+
+#if CONFIG_WEATHER_SENSOR_PMS5003
+    psm_init_parser();
+#endif
+    count = bus_capture_replayPartition(BUS_CAPTURE_PARTITION_LABEL, &handler);
+    printf("replayed %" PRIu32 " capture records in %" PRId64 " us\n", count, esp_timer_get_time() - start);
+    vTaskDelete(NULL);
+}
+#endif
+
 void app_main(void)
 {
     printf("Start prj-weather-sensor!\n");
+    power_init();
     wifi_connect();
-    xTaskCreate(&tcpip_sender_task, "tcpip_sender_task", 2048*3, NULL, 3, NULL);
-    xTaskCreate(&bme280_task, "bme280_task", 2048, NULL, 10, NULL);
-    xTaskCreatePinnedToCore(&psm_task, "psm_task", 2048, NULL, 10, NULL, 1);
+    xTaskCreateStatic(&tcpip_sender_task, "tcpip_sender_task", sizeof(m_senderStack), NULL, SENDER_PRIORITY,
+                      m_senderStack, &m_senderTask);
+#if HAL_CAPTURE_MODE == HAL_CAPTURE_REPLAY
+    xTaskCreateStatic(&capture_replay_task, "capture_replay_task", sizeof(m_replayStack), NULL,
+                      CAPTURE_REPLAY_PRIORITY, m_replayStack, &m_replayTask);
+#elif USE_SENSOR_HUB
+    if (!hal_capture_init()) {
+        printf("bus capture partition is missing\n");
+    }
+    xTaskCreateStaticPinnedToCore(&sensor_hub_task, "sensor_hub_task", sizeof(m_hubStack), NULL,
+                                  SENSOR_HUB_PRIORITY, m_hubStack, &m_hubTask, SENSOR_HUB_CORE);
+#endif
+    metrics_startMemoryReport(CONFIG_WEATHER_MEMORY_REPORT_PERIOD_MS);
 }
@@ -0,0 +1,172 @@
+/*!
+ * \file
+ * \brief file psm_parser.c
+ *
+ * pms5003 stream parser and ring buffer
+ * Bytes are parsed directly from ring buffer, parser state is kept between
+ * calls so frame can be split to any number of reads. Besides data frames
+ * 8 byte replies to commands are recognized.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+#include "psm_parser.h"
+#include <string.h>
+
+_Static_assert((PSM_RING_BUF_SIZE & (PSM_RING_BUF_SIZE - 1)) == 0, "PSM_RING_BUF_SIZE must be power of two");
+
+void psm_parser_init(PsmParser *parser)
+{
+    memset(parser, 0, sizeof(PsmParser));
+    parser->m_state = PsmParserStateChar0;
+}
+
+/*!
+ * \brief psm_parser_resync
+ * forgets frame that is being parsed, e.g. after ring is cleared
+ */
+void psm_parser_resync(PsmParser *parser)
+{
+    parser->m_state = PsmParserStateChar0;
+    parser->m_offset = 0;
+}
+
+/*!
+ * \brief psm_parser_dropFrame
+ * drops only first byte of frame, next FIXED_CHAR0 can be inside dropped
+ * frame, e.g. when noise looked like frame start right before real frame
+ */
+static void psm_parser_dropFrame(PsmParser *parser, PsmRingBuffer *ring)
+{
+    psm_ring_consume(ring, 1);
+    parser->m_discardedByteCount++;
+    psm_parser_resync(parser);
+}
+
+/*!
+ * \brief psm_parser_parse
+ * parses bytes of ring until one full frame is found or all bytes are
+ * parsed. Bytes before frame and bytes of frame are consumed from ring when
+ * frame is complete, bytes of incomplete frame are left to ring.
+ *
+ * \param parser parser state
+ * \param ring bytes to parse
+ * \param frameOut parsed frame, set only when true is returned
+ * \return true when frame was parsed and checksum was ok
+ */
+bool psm_parser_parse(PsmParser *parser, PsmRingBuffer *ring, struct PMSData *frameOut)
+{
+    uint8_t byte;
+
+    while (ring->m_head - ring->m_tail > parser->m_offset) {
+        byte = ring->m_data[(ring->m_tail + parser->m_offset) & (PSM_RING_BUF_SIZE - 1)];
+        switch (parser->m_state) {
+            case PsmParserStateChar0:
+                if (byte == FIXED_CHAR0) {
+                    parser->m_state = PsmParserStateChar1;
+                    parser->m_offset = 1;
+                } else {
+                    psm_ring_consume(ring, 1);
+                    parser->m_discardedByteCount++;
+                }
+                break;
+            case PsmParserStateChar1:
+                if (byte == FIXED_CHAR1) {
+                    parser->m_state = PsmParserStateBody;
+                    parser->m_offset = 2;
+                    parser->m_index = 0;
+                    parser->m_bodySize = PSM_FRAME_BODY_SIZE;
+                    parser->m_checksum = FIXED_CHAR0 + FIXED_CHAR1;
+                } else {
+                    psm_parser_dropFrame(parser, ring);
+                }
+                break;
+            case PsmParserStateBody:
+                if ((parser->m_index & 1) == 0) {
+                    parser->m_words[parser->m_index >> 1] = (uint16_t)(byte << 8);
+                } else {
+                    parser->m_words[parser->m_index >> 1] |= byte;
+                }
+                if (parser->m_index < parser->m_bodySize - 2) {
+                    parser->m_checksum += byte;
+                }
+                parser->m_index++;
+                parser->m_offset++;
+
+                if (parser->m_index == 2) {
+                    if (parser->m_words[0] == PSM_REPLY_LENGTH) {
+                        parser->m_bodySize = PSM_REPLY_BODY_SIZE;
+                    } else if (parser->m_words[0] != PSM_FRAME_LENGTH) {
+                        psm_parser_dropFrame(parser, ring);
+                    }
+                } else if (parser->m_index == parser->m_bodySize) {
+                    if (parser->m_words[parser->m_bodySize/2 - 1] != parser->m_checksum) {
+                        parser->m_checksumFailCount++;
+                        psm_parser_dropFrame(parser, ring);
+                        break;
+                    }
+                    psm_ring_consume(ring, parser->m_offset);
+                    psm_parser_resync(parser);
+                    if (parser->m_bodySize == PSM_REPLY_BODY_SIZE) {
+                        parser->m_replyCommand = (uint8_t)(parser->m_words[1] >> 8);
+                        parser->m_replyData = (uint8_t)(parser->m_words[1]);
+                        parser->m_replyCount++;
+                        break;
+                    }
+                    memcpy(frameOut, parser->m_words, PSM_FRAME_BODY_SIZE);
+                    parser->m_frameCount++;
+                    return true;
+                }
+                break;
+            default:
+                psm_parser_resync(parser);
+                break;
+        }
+    }
+    return false;
+}
+
+void psm_ring_init(PsmRingBuffer *ring)
+{
+    ring->m_head = 0;
+    ring->m_tail = 0;
+}
+
+/*!
+ * \brief psm_ring_getWritable
+ * returns continuous free space from ring buffer, data can be read there
+ * directly and committed with psm_ring_commit()
+ */
+size_t psm_ring_getWritable(PsmRingBuffer *ring, uint8_t **dataOut)
+{
+    uint32_t position = ring->m_head & (PSM_RING_BUF_SIZE - 1);
+    uint32_t freeSize = PSM_RING_BUF_SIZE - (ring->m_head - ring->m_tail);
+    uint32_t continuous = PSM_RING_BUF_SIZE - position;
+    *dataOut = ring->m_data + position;
+    return freeSize < continuous ? freeSize : continuous;
+}
+
+void psm_ring_commit(PsmRingBuffer *ring, size_t size)
+{
+    ring->m_head += (uint32_t)size;
+}
+
+/*!
+ * \brief psm_ring_getReadable
+ * returns continuous readable data from ring buffer, used bytes are released
+ * with psm_ring_consume()
+ */
+size_t psm_ring_getReadable(PsmRingBuffer *ring, const uint8_t **dataOut)
+{
+    uint32_t position = ring->m_tail & (PSM_RING_BUF_SIZE - 1);
+    uint32_t usedSize = ring->m_head - ring->m_tail;
+    uint32_t continuous = PSM_RING_BUF_SIZE - position;
+    *dataOut = ring->m_data + position;
+    return usedSize < continuous ? usedSize : continuous;
+}
+
+void psm_ring_consume(PsmRingBuffer *ring, size_t size)
+{
+    ring->m_tail += (uint32_t)size;
+}
@@ -0,0 +1,78 @@
+/*!
+ * \file
+ * \brief file psm_parser.h
+ *
+ * pms5003 stream parser and ring buffer
+ * Bytes are parsed directly from ring buffer, parser state is kept between
+ * calls so frame can be split to any number of reads. Bytes of frame that
+ * is being parsed stay in ring until frame is complete, so when frame is
+ * dropped, parsing starts again from the byte after its start.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+#ifndef PSM_PARSER_H
+#define PSM_PARSER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "psm_reader.h"
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#define PSM_FRAME_SIZE          32
+#define PSM_FRAME_BODY_SIZE     (PSM_FRAME_SIZE - 2)
+#define PSM_FRAME_LENGTH        28      // framelen value of data frame (13 data words + checksum)
+#define PSM_REPLY_LENGTH        4       // framelen value of command reply (command, data, checksum)
+#define PSM_REPLY_BODY_SIZE     (PSM_REPLY_LENGTH + 2)
+// must be power of two, holds few frames because UART driver buffers too
+#ifdef CONFIG_WEATHER_PSM_RING_SIZE
+#define PSM_RING_BUF_SIZE       CONFIG_WEATHER_PSM_RING_SIZE
+#else
+#define PSM_RING_BUF_SIZE       128
+#endif
+
+typedef enum
+{
+    PsmParserStateChar0 = 0,
+    PsmParserStateChar1,
+    PsmParserStateBody,
+} PsmParserState;
+
+typedef struct
+{
+    PsmParserState m_state;
+    uint8_t m_offset;               // bytes of current frame parsed from ring tail
+    uint8_t m_index;                // bytes received after FIXED_CHAR0 & FIXED_CHAR1
+    uint8_t m_bodySize;             // bytes of current frame after FIXED_CHAR0 & FIXED_CHAR1
+    uint16_t m_checksum;            // running checksum of received bytes
+    uint16_t m_words[PSM_FRAME_BODY_SIZE/2];
+    uint32_t m_frameCount;
+    uint32_t m_checksumFailCount;
+    uint32_t m_discardedByteCount;
+    uint32_t m_replyCount;          // command replies received
+    uint8_t m_replyCommand;         // command and data of latest reply
+    uint8_t m_replyData;
+} PsmParser;
+
+typedef struct
+{
+    uint8_t m_data[PSM_RING_BUF_SIZE];
+    uint32_t m_head;                // write position, free running
+    uint32_t m_tail;                // read position, free running
+} PsmRingBuffer;
+
+void psm_parser_init(PsmParser *parser);
+void psm_parser_resync(PsmParser *parser);
+bool psm_parser_parse(PsmParser *parser, PsmRingBuffer *ring, struct PMSData *frameOut);
+
+void psm_ring_init(PsmRingBuffer *ring);
+size_t psm_ring_getWritable(PsmRingBuffer *ring, uint8_t **dataOut);
+void psm_ring_commit(PsmRingBuffer *ring, size_t size);
+size_t psm_ring_getReadable(PsmRingBuffer *ring, const uint8_t **dataOut);
+void psm_ring_consume(PsmRingBuffer *ring, size_t size);
+
+#endif // PSM_PARSER_H
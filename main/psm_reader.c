@@ -11,119 +11,306 @@
  * \author Timo Hannukkala <timohannukkala@hotmail.com>
  */
 #include "psm_reader.h"
+#include "psm_parser.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
-#include "driver/gpio.h"
-#include "driver/uart.h"
+#include "esp_timer.h"
+#include "hal.h"
+#include "sensor_registry.h"
 #include "tcpip_sender.h"
+#include "metrics.h"
+#include "sensor_hub.h"
+#include "sdkconfig.h"
 
-static const int RX_BUF_SIZE = 1024*2;
-#define RX_DATA_BUF_SIZE 2056
+#define PSM_BAUD_RATE               CONFIG_WEATHER_PMS5003_BAUD_RATE
 
-#define TXD_PIN (GPIO_NUM_17)
-#define RXD_PIN (GPIO_NUM_16)
+// 1 = sensor is woken up every PSM_SCHEDULE_PERIOD_MS, read in passive mode
+//     and put back to sleep, 0 = sensor streams frames all the time
+#if CONFIG_WEATHER_PMS5003_SCHEDULE
+#define PSM_USE_SCHEDULE            1
+#else
+#define PSM_USE_SCHEDULE            0
+#endif
+#define PSM_SCHEDULE_PERIOD_MS      CONFIG_WEATHER_PMS5003_PERIOD_MS
+// fan needs this long after wakeup for stable readings (datasheet 30 s)
+#define PSM_SETTLE_TIME_MS          30000
+#define PSM_SAMPLE_FRAME_COUNT      3
+#define PSM_FRAME_TIMEOUT_MS        1000
+// reply to read command is checked this often, frame takes 33 ms on 9600 bps
+#define PSM_READ_POLL_MS            100
+// environmental PM and particle counts are registered as sensors too,
+// otherwise only standard PM values are sent
+#if CONFIG_WEATHER_PMS5003_ALL_FIELDS
+#define PSM_SEND_ALL_FIELDS         1
+#else
+#define PSM_SEND_ALL_FIELDS         0
+#endif
 
-#define UART UART_NUM_2
+typedef enum
+{
+    PsmPhaseWake = 0,           // sensor is woken up and fan settles
+    PsmPhaseRead,               // frames are read with read commands
+} PsmPhase;
 
+/*
+* Frame field that is registered to sensor registry at startup
+*/
+typedef struct
+{
+    size_t m_offset;            // offset in struct PMSData
+    char m_code;
+    const char *m_unit;
+} PsmField;
 
-static uint8_t m_psmData[RX_DATA_BUF_SIZE];
-static uint32_t m_psmDataIndex = 0;
+static PsmRingBuffer m_psmRing;
+static PsmParser m_psmParser;
 static struct PMSData m_psmParsedData;
+// frames received while fan settles are parsed but not published
+static bool m_publishFrames = true;
+#if PSM_USE_SCHEDULE
+// schedule state, used only by sensor hub task
+static PsmPhase m_phase = PsmPhaseWake;
+static int m_readCount = 0;
+static uint32_t m_readFrameCount = 0;
+static uint32_t m_readWaitMs = 0;
+// time from start of schedule period to next run
+static uint32_t m_periodMs = 0;
+#endif
+#if PSM_SEND_ALL_FIELDS
+static const PsmField m_extraFields[] = {
+    { offsetof(struct PMSData, pm10_env),        'd', "ug/m3" },
+    { offsetof(struct PMSData, pm25_env),        'e', "ug/m3" },
+    { offsetof(struct PMSData, pm100_env),       'f', "ug/m3" },
+    { offsetof(struct PMSData, particles_03um),  'g', "1/0.1L" },
+    { offsetof(struct PMSData, particles_05um),  'i', "1/0.1L" },
+    { offsetof(struct PMSData, particles_10um),  'j', "1/0.1L" },
+    { offsetof(struct PMSData, particles_25um),  'k', "1/0.1L" },
+    { offsetof(struct PMSData, particles_50um),  'l', "1/0.1L" },
+    { offsetof(struct PMSData, particles_100um), 'm', "1/0.1L" },
+};
+#define PSM_EXTRA_FIELD_COUNT       (sizeof(m_extraFields) / sizeof(m_extraFields[0]))
+static SensorType m_extraTypes[PSM_EXTRA_FIELD_COUNT];
+static bool m_extraRegistered = false;
 
-void psm_init(void) 
+/*!
+ * \brief psm_registerFields
+ * registers extra frame fields once, with period of standard PM values
+ */
+static void psm_registerFields(void)
 {
-    const uart_config_t uart_config = {
-        .baud_rate = 9600,
-        .data_bits = UART_DATA_8_BITS,
-        .parity = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE
-    };
-    uart_set_wakeup_threshold(UART, 3);
-    uart_param_config(UART, &uart_config);
-    uart_set_pin(UART, TXD_PIN, RXD_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
-    uart_driver_install(UART, RX_BUF_SIZE * 2, 0, 0, NULL, 0);
-}
+    const SensorDescriptor *pm = sensor_registry_get(SensorTypePM10);
+    SensorDescriptor descriptor = *pm;
+    size_t i;
 
-static bool psm_setParticles(uint8_t *psmData, uint32_t size)
-{
-    uint16_t buffer_u16[15];
-    if (size < 30) {
-        return false;
+    if (m_extraRegistered) {
+        return;
     }
-    for (uint8_t i = 0; i < 15; i++) {
-        buffer_u16[i] = psmData[1 + i * 2];
-        buffer_u16[i] += (psmData[i * 2] << 8);
+    for (i=0;i<PSM_EXTRA_FIELD_COUNT;i++) {
+        descriptor.m_code = m_extraFields[i].m_code;
+        descriptor.m_unit = m_extraFields[i].m_unit;
+        m_extraTypes[i] = sensor_registry_register(&descriptor);
     }
+    m_extraRegistered = true;
+}
+#endif
+
+void psm_init_parser(void)
+{
+    psm_ring_init(&m_psmRing);
+    psm_parser_init(&m_psmParser);
+#if PSM_SEND_ALL_FIELDS
+    psm_registerFields();
+#endif
+}
 
-    memcpy(&m_psmParsedData, (void *)buffer_u16, 30);
+void psm_init(void) 
+{
+    psm_init_parser();
+    hal_uart_init(PSM_BAUD_RATE, PSM_FRAME_SIZE);
+}
+
+static void psm_setParticles()
+{
 /*    printf ("%d %d %d %d . %d %d %d %d %d %d\n", m_psmParsedData.framelen,
         m_psmParsedData.pm10_standard, m_psmParsedData.pm25_standard, m_psmParsedData.pm100_standard,
         m_psmParsedData.particles_03um, m_psmParsedData.particles_05um, m_psmParsedData.particles_10um,
         m_psmParsedData.particles_25um, m_psmParsedData.particles_50um, m_psmParsedData.particles_100um
     );*/
 
-    tcpip_setNewValue(SensorTypePM10, (double)(m_psmParsedData.pm10_standard));
-    tcpip_setNewValue(SensorTypePM25, (double)(m_psmParsedData.pm25_standard));
-    tcpip_setNewValue(SensorTypePM100, (double)(m_psmParsedData.pm100_standard));
-    return true;
+    int64_t sampleUs = m_psmParsedData.timestamp_us;
+
+    tcpip_setNewValueAt(SensorTypePM10, (int32_t)(m_psmParsedData.pm10_standard), sampleUs);
+    tcpip_setNewValueAt(SensorTypePM25, (int32_t)(m_psmParsedData.pm25_standard), sampleUs);
+    tcpip_setNewValueAt(SensorTypePM100, (int32_t)(m_psmParsedData.pm100_standard), sampleUs);
+#if PSM_SEND_ALL_FIELDS
+    for (size_t i=0;i<PSM_EXTRA_FIELD_COUNT;i++) {
+        const uint16_t *field = (const uint16_t *)((const uint8_t *)&m_psmParsedData + m_extraFields[i].m_offset);
+        tcpip_setNewValueAt(m_extraTypes[i], (int32_t)(*field), sampleUs);
+    }
+#endif
 }
 
-static void psm_removeByteFromBegin()
+/*!
+ * \brief psm_parseData
+ * parses buffered data, frames are stamped with time their bytes were read
+ */
+static void psm_parseData(int64_t readUs)
 {
-    uint32_t i;
-    for (i=1;i<m_psmDataIndex;i++) {
-        m_psmData[i-1] = m_psmData[i];
+    uint32_t frameCount = m_psmParser.m_frameCount;
+    uint32_t checksumFailCount = m_psmParser.m_checksumFailCount;
+    uint32_t discardedByteCount = m_psmParser.m_discardedByteCount;
+
+    while (psm_parser_parse(&m_psmParser, &m_psmRing, &m_psmParsedData)) {
+        if (m_publishFrames) {
+            m_psmParsedData.timestamp_us = readUs;
+            psm_setParticles();
+        }
     }
-    m_psmDataIndex--;
+    metrics_add(MetricPsmFrames, m_psmParser.m_frameCount - frameCount);
+    metrics_add(MetricPsmChecksumFails, m_psmParser.m_checksumFailCount - checksumFailCount);
+    metrics_add(MetricPsmDiscardedBytes, m_psmParser.m_discardedByteCount - discardedByteCount);
 }
 
-static void psm_removeBytesFromBegin(uint32_t count)
+static void psm_readData(size_t length)
 {
-    uint32_t i;
-    for (i=1;i<count;i++) {
-        psm_removeByteFromBegin();
+    uint8_t *data;
+    size_t size;
+    int rxBytes;
+
+    while (length > 0) {
+        size = psm_ring_getWritable(&m_psmRing, &data);
+        if (size > length) {
+            size = length;
+        }
+        rxBytes = hal_uart_read(data, size);
+        if (rxBytes <= 0) {
+            break;
+        }
+        psm_ring_commit(&m_psmRing, rxBytes);
+        psm_parseData(esp_timer_get_time());
+        length -= rxBytes;
     }
 }
 
-
-static void psm_parseData()
+/*!
+ * \brief psm_reader_feed
+ * parses data that is not read from UART, e.g. replayed bus capture
+ */
+void psm_reader_feed(const uint8_t *data, size_t size)
 {
-    if (m_psmData[0] == FIXED_CHAR0 && m_psmData[1] == FIXED_CHAR1) {
-        if (psm_setParticles(m_psmData+2, m_psmDataIndex-2)) {
-            psm_removeBytesFromBegin(32);
+    uint8_t *ringData;
+    size_t part;
+
+    while (size > 0) {
+        part = psm_ring_getWritable(&m_psmRing, &ringData);
+        if (part > size) {
+            part = size;
         }
-    } else {
-        psm_removeByteFromBegin();
+        memcpy(ringData, data, part);
+        psm_ring_commit(&m_psmRing, part);
+        psm_parseData(esp_timer_get_time());
+        data += part;
+        size -= part;
+    }
+}
+
+static void psm_sendCommand(uint8_t command, uint8_t data)
+{
+    uint8_t frame[PSM_COMMAND_SIZE] = { FIXED_CHAR0, FIXED_CHAR1, command, 0x00, data, 0, 0 };
+    uint16_t checksum = 0;
+    size_t i;
+
+    for (i=0;i<PSM_COMMAND_SIZE-2;i++) {
+        checksum += frame[i];
     }
+    frame[PSM_COMMAND_SIZE-2] = (uint8_t)(checksum >> 8);
+    frame[PSM_COMMAND_SIZE-1] = (uint8_t)(checksum);
+    hal_uart_write(frame, sizeof(frame));
 }
 
-void psm_reader(void)
+static void psm_handleUart(uint32_t timeoutMs)
 {
-    uint8_t* data = (uint8_t*) malloc(RX_BUF_SIZE+1);
-    int i;
     size_t length = 0;
-    while (1) {
-        if (uart_get_buffered_data_len(UART, &length) == ESP_OK && length >= 32) {
-            if (length > RX_BUF_SIZE) {
-                length = RX_BUF_SIZE;
-            }
-            const int rxBytes = uart_read_bytes(UART, data, length, 100);
-            if (rxBytes > 0) {
-                data[rxBytes] = 0;
-                for (i=0;i<rxBytes;i++) {
-                    m_psmData[m_psmDataIndex++] = data[i];
-                 }
-                 while (1) {
-                     if (m_psmDataIndex > 32) {
-                        psm_parseData();
-                     } else {
-                        break;
-                     }
-                 }
-            }
+    switch (hal_uart_wait(timeoutMs, &length)) {
+        case HalUartEventData:
+            psm_readData(length);
+            break;
+        case HalUartEventOverflow:
+            metrics_add(MetricUartOverflows, 1);
+            psm_ring_init(&m_psmRing);
+            psm_parser_resync(&m_psmParser);
+            break;
+        case HalUartEventNone:
+        default:
+            break;
+    }
+    metrics_add(MetricPsmWakeups, 1);
+}
+
+#if PSM_USE_SCHEDULE
+/*!
+ * \brief psm_scheduleRun
+ * sensor hub job: wakes sensor, lets fan settle, reads
+ * PSM_SAMPLE_FRAME_COUNT frames in passive mode and puts sensor to sleep
+ * for rest of the period. Job returns to hub while it waits for frames.
+ *
+ * \return ms to next run
+ */
+static uint32_t psm_scheduleRun(void *context)
+{
+    (void)context;
+    if (m_phase == PsmPhaseWake) {
+        psm_sendCommand(PSM_COMMAND_SLEEP, PSM_WAKEUP);
+        m_publishFrames = false;
+        m_phase = PsmPhaseRead;
+        m_readCount = 0;
+        m_periodMs = PSM_SETTLE_TIME_MS;
+        return PSM_SETTLE_TIME_MS;
+    }
+    if (m_readCount == 0) {
+        m_publishFrames = true;
+        // sensor starts in active mode after power on, mode is set every time
+        psm_sendCommand(PSM_COMMAND_MODE, PSM_MODE_PASSIVE);
+    } else if (m_psmParser.m_frameCount == m_readFrameCount) {
+        if (m_readWaitMs < PSM_FRAME_TIMEOUT_MS) {
+            m_readWaitMs += PSM_READ_POLL_MS;
+            m_periodMs += PSM_READ_POLL_MS;
+            return PSM_READ_POLL_MS;
         }
-        vTaskDelay(1);
+        printf("psm no reply to read command\n");
     }
-    free(data);
-}
\ No newline at end of file
+    if (m_readCount < PSM_SAMPLE_FRAME_COUNT) {
+        psm_sendCommand(PSM_COMMAND_READ, 0x00);
+        m_readFrameCount = m_psmParser.m_frameCount;
+        m_readCount++;
+        m_readWaitMs = PSM_READ_POLL_MS;
+        m_periodMs += PSM_READ_POLL_MS;
+        return PSM_READ_POLL_MS;
+    }
+    psm_sendCommand(PSM_COMMAND_SLEEP, PSM_SLEEP);
+    m_phase = PsmPhaseWake;
+    return m_periodMs < PSM_SCHEDULE_PERIOD_MS ? PSM_SCHEDULE_PERIOD_MS - m_periodMs : 0;
+}
+
+/*!
+ * \brief psm_reader_start
+ * adds schedule of sensor to sensor hub, frames are handled while hub waits
+ */
+void psm_reader_start(void)
+{
+    m_phase = PsmPhaseWake;
+    sensor_hub_addJob("psm", psm_scheduleRun, NULL, 0);
+    sensor_hub_setEventSource(psm_handleUart, hal_uart_wake);
+}
+#else
+/*!
+ * \brief psm_reader_start
+ * sensor streams frames, they are handled while sensor hub waits
+ */
+void psm_reader_start(void)
+{
+    psm_sendCommand(PSM_COMMAND_MODE, PSM_MODE_ACTIVE);
+    sensor_hub_setEventSource(psm_handleUart, hal_uart_wake);
+}
+#endif
@@ -16,7 +16,18 @@
 #define FIXED_CHAR0 0x42
 #define FIXED_CHAR1 0x4d
 
+// commands: FIXED_CHAR0, FIXED_CHAR1, command, data high, data low, checksum
+#define PSM_COMMAND_SIZE        7
+#define PSM_COMMAND_READ        0xE2    // read one frame in passive mode
+#define PSM_COMMAND_MODE        0xE1
+#define PSM_COMMAND_SLEEP       0xE4
+#define PSM_MODE_PASSIVE        0x00
+#define PSM_MODE_ACTIVE         0x01
+#define PSM_SLEEP               0x00
+#define PSM_WAKEUP              0x01
+
 #include <inttypes.h>
+#include <stddef.h>
 
 struct PMSData {
   uint16_t framelen;       ///< How long this data chunk is
@@ -34,9 +45,12 @@ struct PMSData {
       particles_100um;     ///< 10.0um Particle Count
   uint16_t unused;         ///< Unused
   uint16_t checksum;       ///< Packet checksum
+  int64_t timestamp_us;    ///< esp_timer time when end of frame was read, not part of frame
 };
 
 void psm_init();
-void psm_reader();
+void psm_init_parser();
+void psm_reader_start(void);
+void psm_reader_feed(const uint8_t *data, size_t size);
 
 #endif // PSM_READER_H
\ No newline at end of file
@@ -0,0 +1,429 @@
+/*!
+ * \file
+ * \brief file sample_log.c
+ *
+ * store-and-forward log of sensor values on flash partition
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "sample_log.h"
+#include <string.h>
+#include <stddef.h>
+
+typedef struct
+{
+    uint32_t m_magic;
+    uint32_t m_sequence;
+    uint32_t m_boot;
+    uint32_t m_baseTime;
+    uint32_t m_replayed;
+    uint32_t m_reserved;
+} SampleLogHeader;
+
+_Static_assert(sizeof(SampleLogHeader) == SAMPLE_LOG_HEADER_SIZE, "sector header size");
+
+typedef struct
+{
+    uint8_t m_sensor;
+    uint8_t m_crc;
+    uint16_t m_timeDelta;
+    int32_t m_valueDelta;
+} SampleLogEntry;
+
+typedef enum
+{
+    SampleLogDecodeRecord = 0,
+    SampleLogDecodeSkip,
+    SampleLogDecodeEnd,
+} SampleLogDecode;
+
+static uint32_t sample_log_address(uint32_t sector, uint32_t offset)
+{
+    return sector * SAMPLE_LOG_SECTOR_SIZE + offset;
+}
+
+static uint8_t sample_log_crc8(const SampleLogEntry *entry)
+{
+    uint8_t data[SAMPLE_LOG_RECORD_SIZE];
+    uint8_t crc = 0;
+    size_t i;
+    int bit;
+
+    memcpy(data, entry, sizeof(data));
+    data[offsetof(SampleLogEntry, m_crc)] = 0;
+    for (i=0;i<sizeof(data);i++) {
+        crc ^= data[i];
+        for (bit=0;bit<8;bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static bool sample_log_isErased(const SampleLogEntry *entry)
+{
+    const uint8_t *data = (const uint8_t *)entry;
+    size_t i;
+    for (i=0;i<sizeof(SampleLogEntry);i++) {
+        if (data[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool sample_log_readHeader(SampleLog *log, uint32_t sector, SampleLogHeader *header)
+{
+    if (!log->m_flash.read(log->m_flash.context, sample_log_address(sector, 0), header, sizeof(SampleLogHeader))) {
+        return false;
+    }
+    return header->m_magic == SAMPLE_LOG_MAGIC;
+}
+
+static void sample_log_startCursor(SampleLogCursor *cursor, uint32_t sector, const SampleLogHeader *header)
+{
+    memset(cursor, 0, sizeof(SampleLogCursor));
+    cursor->m_sector = sector;
+    cursor->m_offset = SAMPLE_LOG_HEADER_SIZE;
+    cursor->m_time = header->m_baseTime;
+    cursor->m_boot = header->m_boot;
+}
+
+static uint32_t sample_log_endOffset(SampleLog *log, uint32_t sector)
+{
+    return sector == log->m_write.m_sector ? log->m_write.m_offset : SAMPLE_LOG_SECTOR_SIZE;
+}
+
+static bool sample_log_sectorDone(SampleLog *log, const SampleLogCursor *cursor)
+{
+    return cursor->m_sector != log->m_write.m_sector
+        && (cursor->m_end || cursor->m_offset + SAMPLE_LOG_RECORD_SIZE > SAMPLE_LOG_SECTOR_SIZE);
+}
+
+/*!
+ * \brief sample_log_decodeNext
+ * decodes next record from cursor position, torn records (crc mismatch)
+ * from power loss are skipped
+ */
+static SampleLogDecode sample_log_decodeNext(SampleLog *log, SampleLogCursor *cursor,
+                                             uint32_t endOffset, SampleLogRecord *record)
+{
+    SampleLogEntry entry;
+
+    if (cursor->m_end || cursor->m_offset + SAMPLE_LOG_RECORD_SIZE > endOffset) {
+        return SampleLogDecodeEnd;
+    }
+    if (!log->m_flash.read(log->m_flash.context, sample_log_address(cursor->m_sector, cursor->m_offset),
+                           &entry, sizeof(entry))) {
+        return SampleLogDecodeEnd;
+    }
+    if (sample_log_isErased(&entry)) {
+        cursor->m_end = true;
+        return SampleLogDecodeEnd;
+    }
+    cursor->m_offset += SAMPLE_LOG_RECORD_SIZE;
+    if (entry.m_crc != sample_log_crc8(&entry)) {
+        return SampleLogDecodeSkip;
+    }
+    if (entry.m_sensor == SAMPLE_LOG_TIME_RECORD) {
+        cursor->m_time = (uint32_t)entry.m_valueDelta;
+        return SampleLogDecodeSkip;
+    }
+    if (entry.m_sensor == SAMPLE_LOG_BOOT_RECORD) {
+        cursor->m_boot = (uint32_t)entry.m_valueDelta;
+        return SampleLogDecodeSkip;
+    }
+    if (entry.m_sensor >= SAMPLE_LOG_MAX_SENSORS) {
+        return SampleLogDecodeSkip;
+    }
+    cursor->m_time += entry.m_timeDelta;
+    cursor->m_value[entry.m_sensor] = (int32_t)((uint32_t)cursor->m_value[entry.m_sensor]
+                                                + (uint32_t)entry.m_valueDelta);
+    record->m_sensor = entry.m_sensor;
+    record->m_boot = cursor->m_boot;
+    record->m_timestamp = cursor->m_time;
+    record->m_value = cursor->m_value[entry.m_sensor];
+    return SampleLogDecodeRecord;
+}
+
+static bool sample_log_startSector(SampleLog *log, uint32_t sector, uint32_t sequence, uint32_t baseTime)
+{
+    SampleLogHeader header;
+    header.m_magic = SAMPLE_LOG_MAGIC;
+    header.m_sequence = sequence;
+    header.m_boot = log->m_boot;
+    header.m_baseTime = baseTime;
+    header.m_replayed = 0xFFFFFFFF;
+    header.m_reserved = 0xFFFFFFFF;
+
+    sample_log_startCursor(&log->m_write, sector, &header);
+    log->m_sequence = sequence;
+    if (!log->m_flash.erase(log->m_flash.context, sample_log_address(sector, 0), SAMPLE_LOG_SECTOR_SIZE)) {
+        return false;
+    }
+    // magic is written last, header torn by power loss is not valid
+    if (!log->m_flash.write(log->m_flash.context, sample_log_address(sector, sizeof(header.m_magic)),
+                            &header.m_sequence, sizeof(header) - sizeof(header.m_magic))) {
+        return false;
+    }
+    return log->m_flash.write(log->m_flash.context, sample_log_address(sector, 0),
+                              &header.m_magic, sizeof(header.m_magic));
+}
+
+static void sample_log_startReadSector(SampleLog *log, uint32_t sector)
+{
+    SampleLogHeader header;
+    if (!sample_log_readHeader(log, sector, &header)) {
+        header.m_baseTime = 0;
+        header.m_boot = 0;
+    }
+    sample_log_startCursor(&log->m_read, sector, &header);
+    log->m_readPending = log->m_read;
+}
+
+static bool sample_log_nextWriteSector(SampleLog *log, uint32_t baseTime)
+{
+    uint32_t next = (log->m_write.m_sector + 1) % log->m_sectorCount;
+    bool ret = sample_log_startSector(log, next, log->m_sequence + 1, baseTime);
+
+    if (next == log->m_read.m_sector) {
+        // log is full, oldest sector which was not replayed is lost
+        log->m_droppedSectorCount++;
+        sample_log_startReadSector(log, (next + 1) % log->m_sectorCount);
+    }
+    return ret;
+}
+
+/*!
+ * \brief sample_log_writeEntry
+ * sensor byte is written last, so entry torn by power loss has erased
+ * sensor and is skipped even when its crc happens to match
+ */
+static bool sample_log_writeEntry(SampleLog *log, SampleLogEntry *entry)
+{
+    uint32_t address = sample_log_address(log->m_write.m_sector, log->m_write.m_offset);
+    entry->m_crc = sample_log_crc8(entry);
+    log->m_write.m_offset += SAMPLE_LOG_RECORD_SIZE;
+    if (!log->m_flash.write(log->m_flash.context, address + offsetof(SampleLogEntry, m_crc), &entry->m_crc,
+                            sizeof(SampleLogEntry) - offsetof(SampleLogEntry, m_crc))) {
+        return false;
+    }
+    return log->m_flash.write(log->m_flash.context, address, &entry->m_sensor, sizeof(entry->m_sensor));
+}
+
+/*!
+ * \brief sample_log_init
+ * finds newest sector for writing and oldest not replayed sector for
+ * reading. Replay position inside sector is not stored, so after reboot
+ * at most one sector can be replayed again. Boot of log is one more than
+ * newest boot in log.
+ */
+bool sample_log_init(SampleLog *log, const SampleLogFlash *flash)
+{
+    SampleLogHeader header, headHeader;
+    SampleLogRecord record;
+    uint32_t i, headSector = 0, headSequence = 0;
+    uint32_t tailSector = 0, tailSequence = 0;
+    bool headFound = false, tailFound = false;
+
+    memset(log, 0, sizeof(SampleLog));
+    log->m_flash = *flash;
+    log->m_sectorCount = flash->size / SAMPLE_LOG_SECTOR_SIZE;
+    if (log->m_sectorCount < 2) {
+        return false;
+    }
+
+    for (i=0;i<log->m_sectorCount;i++) {
+        if (!sample_log_readHeader(log, i, &header)) {
+            continue;
+        }
+        if (!headFound || header.m_sequence > headSequence) {
+            headFound = true;
+            headSector = i;
+            headSequence = header.m_sequence;
+            headHeader = header;
+        }
+        if (header.m_replayed != 0 && (!tailFound || header.m_sequence < tailSequence)) {
+            tailFound = true;
+            tailSector = i;
+            tailSequence = header.m_sequence;
+        }
+    }
+
+    if (!headFound) {
+        log->m_boot = 1;
+        if (!sample_log_startSector(log, 0, 1, 0)) {
+            return false;
+        }
+        sample_log_startReadSector(log, 0);
+        return true;
+    }
+
+    // continue writing after last record, decoding restores delta state
+    log->m_sequence = headSequence;
+    sample_log_startCursor(&log->m_write, headSector, &headHeader);
+    while (sample_log_decodeNext(log, &log->m_write, SAMPLE_LOG_SECTOR_SIZE, &record) != SampleLogDecodeEnd) {
+    }
+    log->m_write.m_end = false;
+    log->m_boot = log->m_write.m_boot + 1;
+
+    sample_log_startReadSector(log, tailFound ? tailSector : headSector);
+    return true;
+}
+
+bool sample_log_append(SampleLog *log, uint8_t sensor, uint32_t timestamp, int32_t value)
+{
+    SampleLogEntry entry;
+    uint32_t timeDelta = timestamp - log->m_write.m_time;
+
+    if (sensor >= SAMPLE_LOG_MAX_SENSORS) {
+        return false;
+    }
+    // room for possible boot, time and value records
+    if (log->m_write.m_offset + 3 * SAMPLE_LOG_RECORD_SIZE > SAMPLE_LOG_SECTOR_SIZE) {
+        if (!sample_log_nextWriteSector(log, timestamp)) {
+            return false;
+        }
+        timeDelta = 0;
+    }
+    // first value after reboot in sector of previous boot
+    if (log->m_write.m_boot != log->m_boot) {
+        entry.m_sensor = SAMPLE_LOG_BOOT_RECORD;
+        entry.m_timeDelta = 0;
+        entry.m_valueDelta = (int32_t)(log->m_boot);
+        if (!sample_log_writeEntry(log, &entry)) {
+            return false;
+        }
+        log->m_write.m_boot = log->m_boot;
+    }
+    // long gap, or time going backwards after reboot
+    if (timeDelta > 0xFFFF) {
+        entry.m_sensor = SAMPLE_LOG_TIME_RECORD;
+        entry.m_timeDelta = 0;
+        entry.m_valueDelta = (int32_t)timestamp;
+        if (!sample_log_writeEntry(log, &entry)) {
+            return false;
+        }
+        log->m_write.m_time = timestamp;
+        timeDelta = 0;
+    }
+
+    entry.m_sensor = sensor;
+    entry.m_timeDelta = (uint16_t)timeDelta;
+    entry.m_valueDelta = (int32_t)((uint32_t)value - (uint32_t)log->m_write.m_value[sensor]);
+    if (!sample_log_writeEntry(log, &entry)) {
+        return false;
+    }
+    log->m_write.m_time = timestamp;
+    log->m_write.m_value[sensor] = value;
+    return true;
+}
+
+/*!
+ * \brief sample_log_boot
+ * \return boot of values appended now
+ */
+uint32_t sample_log_boot(const SampleLog *log)
+{
+    return log->m_boot;
+}
+
+bool sample_log_isEmpty(SampleLog *log)
+{
+    return log->m_read.m_sector == log->m_write.m_sector
+        && log->m_read.m_offset >= log->m_write.m_offset;
+}
+
+/*!
+ * \brief sample_log_read
+ * reads next records without removing them from log, records are removed
+ * with sample_log_consume() after they are sent. Records read at once are
+ * from same boot.
+ *
+ * \return count of records, 0 when log is empty
+ */
+size_t sample_log_read(SampleLog *log, SampleLogRecord *records, size_t count)
+{
+    SampleLogCursor before;
+    SampleLogDecode decode;
+    size_t ret;
+
+    while (1) {
+        log->m_readPending = log->m_read;
+        ret = 0;
+        while (ret < count) {
+            before = log->m_readPending;
+            decode = sample_log_decodeNext(log, &log->m_readPending,
+                                           sample_log_endOffset(log, log->m_readPending.m_sector),
+                                           &records[ret]);
+            if (decode == SampleLogDecodeEnd) {
+                break;
+            }
+            if (decode == SampleLogDecodeRecord) {
+                if (ret > 0 && records[ret].m_boot != records[0].m_boot) {
+                    // record of next boot is left to next read
+                    log->m_readPending = before;
+                    break;
+                }
+                ret++;
+            }
+        }
+        if (ret > 0 || !sample_log_sectorDone(log, &log->m_readPending)) {
+            return ret;
+        }
+        // sector had no more values
+        sample_log_consume(log);
+    }
+}
+
+void sample_log_consume(SampleLog *log)
+{
+    uint32_t replayed = 0;
+
+    log->m_read = log->m_readPending;
+    if (!sample_log_sectorDone(log, &log->m_read)) {
+        return;
+    }
+    log->m_flash.write(log->m_flash.context,
+                       sample_log_address(log->m_read.m_sector, offsetof(SampleLogHeader, m_replayed)),
+                       &replayed, sizeof(replayed));
+    sample_log_startReadSector(log, (log->m_read.m_sector + 1) % log->m_sectorCount);
+}
+
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"
+
+static bool sample_log_partitionRead(void *context, uint32_t address, void *data, size_t size)
+{
+    return esp_partition_read((const esp_partition_t *)context, address, data, size) == ESP_OK;
+}
+
+static bool sample_log_partitionWrite(void *context, uint32_t address, const void *data, size_t size)
+{
+    return esp_partition_write((const esp_partition_t *)context, address, data, size) == ESP_OK;
+}
+
+static bool sample_log_partitionErase(void *context, uint32_t address, size_t size)
+{
+    return esp_partition_erase_range((const esp_partition_t *)context, address, size) == ESP_OK;
+}
+
+bool sample_log_initPartition(SampleLog *log, const char *label)
+{
+    SampleLogFlash flash;
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                ESP_PARTITION_SUBTYPE_ANY, label);
+    if (partition == NULL) {
+        return false;
+    }
+    flash.read = sample_log_partitionRead;
+    flash.write = sample_log_partitionWrite;
+    flash.erase = sample_log_partitionErase;
+    flash.context = (void *)partition;
+    flash.size = partition->size;
+    return sample_log_init(log, &flash);
+}
+#endif
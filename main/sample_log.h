@@ -0,0 +1,101 @@
+/*!
+ * \file
+ * \brief file sample_log.h
+ *
+ * store-and-forward log of sensor values on flash partition
+ *
+ * Partition is ring of 4kB sectors, newest sector is erased again when
+ * log wraps so every sector is erased equally often.
+ *
+ * sector header (24 bytes): u32 magic, u32 sector sequence, u32 boot,
+ *                           u32 base timestamp, u32 replayed (0 = yes),
+ *                           u32 reserved
+ * record (8 bytes):         u8 sensor, u8 crc8, u16 time delta (ms),
+ *                           i32 value delta to previous value of same
+ *                           sensor in same sector
+ * sensor SAMPLE_LOG_TIME_RECORD record has absolute timestamp as value,
+ * SAMPLE_LOG_BOOT_RECORD record has boot of following records as value,
+ * 0xFF sensor is erased (end of sector)
+ *
+ * Timestamps are ms since boot, so every record belongs to boot. Boot
+ * count is kept in log itself: it is one more than newest boot in log, so
+ * it increases on every boot that logs values.
+ *
+ * Not thread safe, log is used only from tcpip sender task.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef SAMPLE_LOG_H
+#define SAMPLE_LOG_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SAMPLE_LOG_PARTITION_LABEL  "samplelog"
+#define SAMPLE_LOG_SECTOR_SIZE      4096
+#define SAMPLE_LOG_HEADER_SIZE      24
+#define SAMPLE_LOG_RECORD_SIZE      8
+#define SAMPLE_LOG_MAGIC            0x534C4F48
+#define SAMPLE_LOG_MAX_SENSORS      32
+#define SAMPLE_LOG_BOOT_RECORD      0xFD
+#define SAMPLE_LOG_TIME_RECORD      0xFE
+#define SAMPLE_LOG_ERASED           0xFF
+
+/*
+* Flash access, partition on device, file on host
+*/
+typedef struct
+{
+    bool (*read)(void *context, uint32_t address, void *data, size_t size);
+    bool (*write)(void *context, uint32_t address, const void *data, size_t size);
+    bool (*erase)(void *context, uint32_t address, size_t size);
+    void *context;
+    uint32_t size;
+} SampleLogFlash;
+
+/*
+* Position in log and delta decoding state of that sector
+*/
+typedef struct
+{
+    uint32_t m_sector;
+    uint32_t m_offset;
+    uint32_t m_time;
+    uint32_t m_boot;
+    int32_t m_value[SAMPLE_LOG_MAX_SENSORS];
+    bool m_end;             // rest of sector is erased
+} SampleLogCursor;
+
+typedef struct
+{
+    SampleLogFlash m_flash;
+    uint32_t m_sectorCount;
+    uint32_t m_sequence;    // sequence of sector where m_write is
+    uint32_t m_boot;        // boot of records appended now
+    SampleLogCursor m_write;
+    SampleLogCursor m_read;
+    SampleLogCursor m_readPending;
+    uint32_t m_droppedSectorCount;
+} SampleLog;
+
+typedef struct
+{
+    uint8_t m_sensor;
+    uint32_t m_boot;
+    uint32_t m_timestamp;
+    int32_t m_value;
+} SampleLogRecord;
+
+bool sample_log_init(SampleLog *log, const SampleLogFlash *flash);
+bool sample_log_initPartition(SampleLog *log, const char *label);
+bool sample_log_append(SampleLog *log, uint8_t sensor, uint32_t timestamp, int32_t value);
+bool sample_log_isEmpty(SampleLog *log);
+uint32_t sample_log_boot(const SampleLog *log);
+size_t sample_log_read(SampleLog *log, SampleLogRecord *records, size_t count);
+void sample_log_consume(SampleLog *log);
+
+#endif // SAMPLE_LOG_H
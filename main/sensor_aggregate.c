@@ -0,0 +1,132 @@
+/*!
+ * \file
+ * \brief file sensor_aggregate.c
+ *
+ * windowed min/max/mean/stddev and EWMA of sensor values
+ * Values are aggregated in constant time and memory, summary is given to
+ * sender when window ends.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "sensor_aggregate.h"
+#include <math.h>
+#include <stdbool.h>
+
+/*
+* Running values of one window. Sums are integer offsets from first value of
+* window, so they stay exact at any magnitude of values; sum of squares
+* holds while offsets stay below 2^32 / sqrt(count).
+*/
+typedef struct
+{
+    uint32_t m_start;
+    uint32_t m_count;
+    int32_t m_first;
+    int32_t m_min;
+    int32_t m_max;
+    int64_t m_sum;
+    uint64_t m_sumSquares;
+} AggregateWindow;
+
+/*
+* State of one sensor type, written only from task that sets its values
+*/
+typedef struct
+{
+    AggregateWindow m_window[AGGREGATE_WINDOW_COUNT];
+    int64_t m_ewma;         // fixed point, AGGREGATE_EWMA_ONE is 1
+    bool m_ewmaSet;
+} AggregateSensor;
+
+#define AGGREGATE_EWMA_ONE  (INT64_C(1) << 16)
+
+static const uint32_t m_windowMs[AGGREGATE_WINDOW_COUNT] = AGGREGATE_WINDOWS_MS;
+// indexed by slot of sensor registry
+static AggregateSensor m_sensor[SENSOR_REGISTRY_MAX];
+
+static int32_t sensor_aggregate_divRound(int64_t value, int64_t divisor)
+{
+    return (int32_t)(value >= 0 ? (value + divisor / 2) / divisor : (value - divisor / 2) / divisor);
+}
+
+/*!
+ * \brief sensor_aggregate_stddev
+ * population standard deviation of window, double math is done once per
+ * window
+ */
+static int32_t sensor_aggregate_stddev(const AggregateWindow *window)
+{
+    double mean = (double)(window->m_sum) / window->m_count;
+    double variance = (double)(window->m_sumSquares) / window->m_count - mean * mean;
+
+    return variance > 0.0 ? (int32_t)(sqrt(variance) + 0.5) : 0;
+}
+
+static void sensor_aggregate_sendSummary(SensorType type, size_t index, const AggregateWindow *window, int64_t ewma)
+{
+    SensorSummary summary;
+
+    summary.m_type = type;
+    summary.m_windowMs = m_windowMs[index];
+    summary.m_timestamp = window->m_start + m_windowMs[index];
+    summary.m_count = window->m_count > UINT16_MAX ? UINT16_MAX : (uint16_t)window->m_count;
+    summary.m_min = window->m_min;
+    summary.m_max = window->m_max;
+    summary.m_mean = window->m_first + sensor_aggregate_divRound(window->m_sum, window->m_count);
+    summary.m_stddev = sensor_aggregate_stddev(window);
+    summary.m_ewma = sensor_aggregate_divRound(ewma, AGGREGATE_EWMA_ONE);
+    tcpip_setNewSummary(&summary, index);
+}
+
+void sensor_aggregate_addValue(SensorType type, int32_t value, uint32_t timestamp)
+{
+    AggregateSensor *sensor;
+    AggregateWindow *window;
+    size_t slot = sensor_registry_slot(type);
+    int64_t offset;
+    size_t i;
+
+    if (slot == SENSOR_SLOT_NONE) {
+        return;
+    }
+    sensor = &m_sensor[slot];
+    for (i=0;i<AGGREGATE_WINDOW_COUNT;i++) {
+        window = &sensor->m_window[i];
+        if (window->m_count > 0 && timestamp - window->m_start >= m_windowMs[i]) {
+            sensor_aggregate_sendSummary(type, i, window, sensor->m_ewma);
+            window->m_count = 0;
+        }
+    }
+
+    if (sensor->m_ewmaSet) {
+        sensor->m_ewma += ((int64_t)(value) * AGGREGATE_EWMA_ONE - sensor->m_ewma) * AGGREGATE_EWMA_ALPHA / 1000;
+    } else {
+        sensor->m_ewma = (int64_t)(value) * AGGREGATE_EWMA_ONE;
+        sensor->m_ewmaSet = true;
+    }
+
+    for (i=0;i<AGGREGATE_WINDOW_COUNT;i++) {
+        window = &sensor->m_window[i];
+        if (window->m_count == 0) {
+            window->m_start = timestamp;
+            window->m_first = value;
+            window->m_min = value;
+            window->m_max = value;
+            window->m_sum = 0;
+            window->m_sumSquares = 0;
+        }
+        window->m_count++;
+        offset = (int64_t)(value) - window->m_first;
+        window->m_sum += offset;
+        window->m_sumSquares += (uint64_t)(offset) * (uint64_t)(offset);
+        if (value < window->m_min) {
+            window->m_min = value;
+        }
+        if (value > window->m_max) {
+            window->m_max = value;
+        }
+    }
+}
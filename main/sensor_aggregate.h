@@ -0,0 +1,29 @@
+/*!
+ * \file
+ * \brief file sensor_aggregate.h
+ *
+ * windowed min/max/mean/stddev and EWMA of sensor values
+ * Values are aggregated in constant time and memory, summary is given to
+ * sender when window ends.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef SENSOR_AGGREGATE_H
+#define SENSOR_AGGREGATE_H
+
+#include <inttypes.h>
+#include "tcpip_sender.h"
+
+// options are set in Kconfig, menu "Weather sensors" / "Network"
+#define AGGREGATE_WINDOW_COUNT      2
+#define AGGREGATE_WINDOWS_MS        { CONFIG_WEATHER_AGGREGATE_SHORT_WINDOW_MS, CONFIG_WEATHER_AGGREGATE_LONG_WINDOW_MS }
+// weight of new value in EWMA, 1/1000
+#define AGGREGATE_EWMA_ALPHA        CONFIG_WEATHER_AGGREGATE_EWMA_ALPHA
+
+// value is fixed point with binary protocol scale of the sensor type
+void sensor_aggregate_addValue(SensorType type, int32_t value, uint32_t timestamp);
+
+#endif // SENSOR_AGGREGATE_H
@@ -0,0 +1,161 @@
+/*!
+ * \file
+ * \brief file sensor_hub.c
+ *
+ * one task runs acquisition of all sensors
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "sensor_hub.h"
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "metrics.h"
+
+/*
+* Scheduled job, few jobs are scanned linearly for earliest deadline
+*/
+typedef struct
+{
+    const char *m_name;
+    SensorHubRun m_run;
+    void *m_context;
+    int64_t m_dueUs;        // esp_timer time of next run
+} SensorHubJob;
+
+static SensorHubJob m_jobs[SENSOR_HUB_MAX_JOBS];
+static size_t m_jobCount = 0;
+static TaskHandle_t m_hubTask = NULL;
+static SensorHubWait m_wait = NULL;
+static SensorHubWake m_wake = NULL;
+
+/*!
+ * \brief sensor_hub_addJob
+ * \param firstDelayMs delay from now to first run
+ */
+bool sensor_hub_addJob(const char *name, SensorHubRun run, void *context, uint32_t firstDelayMs)
+{
+    if (m_jobCount >= SENSOR_HUB_MAX_JOBS) {
+        printf("sensor hub is full, %s not added\n", name);
+        return false;
+    }
+    m_jobs[m_jobCount].m_name = name;
+    m_jobs[m_jobCount].m_run = run;
+    m_jobs[m_jobCount].m_context = context;
+    m_jobs[m_jobCount].m_dueUs = esp_timer_get_time() + (int64_t)(firstDelayMs) * 1000;
+    m_jobCount++;
+    return true;
+}
+
+/*!
+ * \brief sensor_hub_setEventSource
+ * hub waits for deadlines with wait, so events are handled while no job is
+ * due. There is one source, later call replaces it.
+ */
+void sensor_hub_setEventSource(SensorHubWait wait, SensorHubWake wake)
+{
+    m_wait = wait;
+    m_wake = wake;
+}
+
+static void sensor_hub_timerCallback(void *arg)
+{
+    (void)arg;
+    if (m_wake != NULL) {
+        m_wake();
+    } else if (m_hubTask != NULL) {
+        xTaskNotifyGive(m_hubTask);
+    }
+}
+
+/*!
+ * \brief sensor_hub_runDue
+ * runs jobs whose deadline has passed
+ *
+ * \return earliest deadline after the runs
+ */
+static int64_t sensor_hub_runDue(void)
+{
+    SensorHubJob *job;
+    int64_t now, next = INT64_MAX;
+    uint32_t delayMs;
+    size_t i;
+
+    for (i=0;i<m_jobCount;i++) {
+        job = &m_jobs[i];
+        now = esp_timer_get_time();
+        if (job->m_dueUs <= now) {
+            metrics_addLatency(MetricLatencyHubLateness, (uint32_t)(now - job->m_dueUs));
+            delayMs = job->m_run(job->m_context);
+            job->m_dueUs += (int64_t)(delayMs) * 1000;
+            now = esp_timer_get_time();
+            if (job->m_dueUs <= now) {
+                // run took longer than delay, missed deadline is not caught up
+                metrics_add(MetricHubOverruns, 1);
+                job->m_dueUs = now;
+            }
+        }
+        if (job->m_dueUs < next) {
+            next = job->m_dueUs;
+        }
+    }
+    return next;
+}
+
+/*!
+ * \brief sensor_hub_waitUntil
+ * sleeps until deadline, or shorter when event source has event. Timeout
+ * of wait is only fallback, it is rounded up to ticks and timer wakes the
+ * task at deadline.
+ */
+static void sensor_hub_waitUntil(esp_timer_handle_t timer, int64_t deadline)
+{
+    int64_t remaining = deadline - esp_timer_get_time();
+    uint32_t timeoutMs;
+
+    if (remaining <= 0) {
+        return;
+    }
+    if (deadline == INT64_MAX) {
+        timeoutMs = SENSOR_HUB_WAIT_FOREVER;
+    } else {
+        esp_timer_start_once(timer, (uint64_t)(remaining));
+        timeoutMs = (uint32_t)(remaining / 1000) + portTICK_PERIOD_MS;
+    }
+    if (m_wait != NULL) {
+        m_wait(timeoutMs);
+    } else {
+        ulTaskNotifyTake(pdTRUE, timeoutMs == SENSOR_HUB_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs));
+    }
+    esp_timer_stop(timer);
+}
+
+/*!
+ * \brief sensor_hub_run
+ * runs jobs at their deadlines and handles events between them
+ */
+void sensor_hub_run(void)
+{
+    const esp_timer_create_args_t args = {
+        .callback = sensor_hub_timerCallback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "sensor_hub",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_handle_t timer;
+
+    m_hubTask = xTaskGetCurrentTaskHandle();
+    metrics_registerTask();
+    if (esp_timer_create(&args, &timer) != ESP_OK) {
+        printf("sensor hub timer failed\n");
+        return;
+    }
+    while (1) {
+        sensor_hub_waitUntil(timer, sensor_hub_runDue());
+    }
+}
@@ -0,0 +1,61 @@
+/*!
+ * \file
+ * \brief file sensor_hub.h
+ *
+ * one task runs acquisition of all sensors. Every job has its own schedule:
+ * job returns delay from its deadline to next one, so periods don't drift
+ * and phases of a measurement (start, read) can be runs of one job. Task
+ * sleeps until earliest deadline with one-shot esp_timer, or until event
+ * source (UART of PMS5003) has data.
+ * Lateness of job runs from deadline goes to MetricLatencyHubLateness, and
+ * runs that start after next deadline already passed to MetricHubOverruns.
+ *
+ * Jobs and event source are added before sensor_hub_run(), which is called
+ * from hub task and never returns.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef SENSOR_HUB_H
+#define SENSOR_HUB_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+#define SENSOR_HUB_MAX_JOBS     4
+// stack of hub task in bytes, replaces bme280 and psm tasks of 2048 bytes each
+#define SENSOR_HUB_STACK_SIZE   CONFIG_WEATHER_SENSOR_HUB_STACK_SIZE
+#define SENSOR_HUB_PRIORITY     10
+// PMS5003 UART is handled on core 1 like before
+#define SENSOR_HUB_CORE         1
+// timeout of SensorHubWait when no job is scheduled
+#define SENSOR_HUB_WAIT_FOREVER UINT32_MAX
+
+/*!
+ * \brief SensorHubRun
+ * runs job once
+ *
+ * \return ms from this deadline to next run of the job
+ */
+typedef uint32_t (*SensorHubRun)(void *context);
+
+/*!
+ * \brief SensorHubWait
+ * blocks until event or timeout and handles event
+ */
+typedef void (*SensorHubWait)(uint32_t timeoutMs);
+
+/*!
+ * \brief SensorHubWake
+ * makes SensorHubWait return early, called from esp_timer task
+ */
+typedef void (*SensorHubWake)(void);
+
+bool sensor_hub_addJob(const char *name, SensorHubRun run, void *context, uint32_t firstDelayMs);
+void sensor_hub_setEventSource(SensorHubWait wait, SensorHubWake wake);
+void sensor_hub_run(void);
+
+#endif // SENSOR_HUB_H
@@ -0,0 +1,180 @@
+/*!
+ * \file
+ * \brief file sensor_registry.c
+ *
+ * descriptors of sensor channels
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "sensor_registry.h"
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+
+_Static_assert(SENSOR_REGISTRY_MAX > 0, "enable a sensor or reserve registered channels");
+_Static_assert(SENSOR_REGISTRY_MAX <= SENSOR_REGISTRY_LIMIT, "too many sensor channels for dirty masks");
+_Static_assert(SensorTypeBuiltinCount + CONFIG_WEATHER_SENSOR_REGISTERED_CHANNELS < SENSOR_TYPE_INVALID,
+               "too many sensor ids");
+
+#define BME_PERIOD  CONFIG_WEATHER_BME280_SAMPLE_PERIOD_MS
+#define PSM_PERIOD  CONFIG_WEATHER_PMS5003_PERIOD_MS
+#define SEND_PERIOD CONFIG_WEATHER_SEND_PERIOD_MS
+
+// slot of each built-in id, channels of enabled sensors get dense slots
+#if CONFIG_WEATHER_SENSOR_BME280
+#define SLOT_TEMPERATURE    0
+#define SLOT_HUMID          1
+#define SLOT_PRESURE        2
+#else
+#define SLOT_TEMPERATURE    SENSOR_SLOT_NONE
+#define SLOT_HUMID          SENSOR_SLOT_NONE
+#define SLOT_PRESURE        SENSOR_SLOT_NONE
+#endif
+#if CONFIG_WEATHER_SENSOR_PMS5003
+#define SLOT_PM10           (SENSOR_SLOTS_BME280 + 0)
+#define SLOT_PM25           (SENSOR_SLOTS_BME280 + 1)
+#define SLOT_PM100          (SENSOR_SLOTS_BME280 + 2)
+#else
+#define SLOT_PM10           SENSOR_SLOT_NONE
+#define SLOT_PM25           SENSOR_SLOT_NONE
+#define SLOT_PM100          SENSOR_SLOT_NONE
+#endif
+#if CONFIG_WEATHER_BME280_SECOND
+#define SLOT_TEMPERATURE2   (SENSOR_SLOTS_BME280 + SENSOR_SLOTS_PMS5003 + 0)
+#define SLOT_HUMID2         (SENSOR_SLOTS_BME280 + SENSOR_SLOTS_PMS5003 + 1)
+#define SLOT_PRESURE2       (SENSOR_SLOTS_BME280 + SENSOR_SLOTS_PMS5003 + 2)
+#else
+#define SLOT_TEMPERATURE2   SENSOR_SLOT_NONE
+#define SLOT_HUMID2         SENSOR_SLOT_NONE
+#define SLOT_PRESURE2       SENSOR_SLOT_NONE
+#endif
+
+#define SLOT_USED(slot)     ((slot) != SENSOR_SLOT_NONE)
+_Static_assert(SLOT_USED(SLOT_TEMPERATURE) + SLOT_USED(SLOT_HUMID) + SLOT_USED(SLOT_PRESURE)
+               + SLOT_USED(SLOT_PM10) + SLOT_USED(SLOT_PM25) + SLOT_USED(SLOT_PM100)
+               + SLOT_USED(SLOT_TEMPERATURE2) + SLOT_USED(SLOT_HUMID2) + SLOT_USED(SLOT_PRESURE2)
+               == SENSOR_BUILTIN_SLOTS, "slot for every channel of enabled sensors");
+#if !CONFIG_WEATHER_SENSOR_BME280
+_Static_assert(!SLOT_USED(SLOT_TEMPERATURE) && !SLOT_USED(SLOT_HUMID) && !SLOT_USED(SLOT_PRESURE),
+               "disabled BME280 has no slots");
+#endif
+#if !CONFIG_WEATHER_SENSOR_PMS5003
+_Static_assert(!SLOT_USED(SLOT_PM10) && !SLOT_USED(SLOT_PM25) && !SLOT_USED(SLOT_PM100),
+               "disabled PMS5003 has no slots");
+#endif
+#if !CONFIG_WEATHER_BME280_SECOND
+_Static_assert(!SLOT_USED(SLOT_TEMPERATURE2) && !SLOT_USED(SLOT_HUMID2) && !SLOT_USED(SLOT_PRESURE2),
+               "disabled second BME280 has no slots");
+#endif
+
+static const uint8_t m_slot[SensorTypeBuiltinCount] = {
+    [SensorTypeTemperature]  = SLOT_TEMPERATURE,
+    [SensorTypeHumid]        = SLOT_HUMID,
+    [SensorTypePresure]      = SLOT_PRESURE,
+    [SensorTypePM10]         = SLOT_PM10,
+    [SensorTypePM25]         = SLOT_PM25,
+    [SensorTypePM100]        = SLOT_PM100,
+    [SensorTypeTemperature2] = SLOT_TEMPERATURE2,
+    [SensorTypeHumid2]       = SLOT_HUMID2,
+    [SensorTypePresure2]     = SLOT_PRESURE2,
+};
+
+// indexed by slot, registered channels follow built-in ones
+static SensorDescriptor m_sensors[SENSOR_REGISTRY_MAX] = {
+    //                    id                      code unit    scale divisor sample      send         deadband ppm heartbeat
+#if CONFIG_WEATHER_SENSOR_BME280
+    [SLOT_TEMPERATURE]  = { SensorTypeTemperature,  't', "C",     2, 100,  BME_PERIOD, SEND_PERIOD, 0,   0, 60000 },  // 0.01 C
+    [SLOT_HUMID]        = { SensorTypeHumid,        'h', "%RH",   3, 1024, BME_PERIOD, SEND_PERIOD, 51,  0, 60000 },  // Q22.10 %RH, 0.05 %RH
+    [SLOT_PRESURE]      = { SensorTypePresure,      'p', "Pa",    3, 256,  BME_PERIOD, SEND_PERIOD, 256, 0, 60000 },  // Q24.8 Pa, 0.01 hPa
+#endif
+#if CONFIG_WEATHER_SENSOR_PMS5003
+    [SLOT_PM10]         = { SensorTypePM10,         'a', "ug/m3", 0, 1,    PSM_PERIOD, SEND_PERIOD, 0,   0, 60000 },
+    [SLOT_PM25]         = { SensorTypePM25,         'b', "ug/m3", 0, 1,    PSM_PERIOD, SEND_PERIOD, 0,   0, 60000 },
+    [SLOT_PM100]        = { SensorTypePM100,        'c', "ug/m3", 0, 1,    PSM_PERIOD, SEND_PERIOD, 0,   0, 60000 },
+#endif
+#if CONFIG_WEATHER_BME280_SECOND
+    [SLOT_TEMPERATURE2] = { SensorTypeTemperature2, 'T', "C",     2, 100,  BME_PERIOD, SEND_PERIOD, 0,   0, 60000 },  // 0.01 C
+    [SLOT_HUMID2]       = { SensorTypeHumid2,       'H', "%RH",   3, 1024, BME_PERIOD, SEND_PERIOD, 51,  0, 60000 },  // Q22.10 %RH, 0.05 %RH
+    [SLOT_PRESURE2]     = { SensorTypePresure2,     'P', "Pa",    3, 256,  BME_PERIOD, SEND_PERIOD, 256, 0, 60000 },  // Q24.8 Pa, 0.01 hPa
+#endif
+};
+// slots in use
+static atomic_uint m_count = SENSOR_BUILTIN_SLOTS;
+static portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/*!
+ * \brief sensor_registry_slot
+ * \return slot of sensor id, SENSOR_SLOT_NONE if id is not registered or
+ * its sensor is disabled
+ */
+size_t sensor_registry_slot(SensorType type)
+{
+    size_t slot;
+
+    if (type < SensorTypeBuiltinCount) {
+        return m_slot[type];
+    }
+    slot = (size_t)(type - SensorTypeBuiltinCount) + SENSOR_BUILTIN_SLOTS;
+    return slot < atomic_load_explicit(&m_count, memory_order_acquire) ? slot : SENSOR_SLOT_NONE;
+}
+
+/*!
+ * \brief sensor_registry_get
+ * \return descriptor of sensor, NULL if id is not registered or its sensor
+ * is disabled
+ */
+const SensorDescriptor *sensor_registry_get(SensorType type)
+{
+    size_t slot = sensor_registry_slot(type);
+
+    return slot != SENSOR_SLOT_NONE ? &m_sensors[slot] : NULL;
+}
+
+/*!
+ * \brief sensor_registry_getSlot
+ * \return descriptor in slot, NULL if slot is not used
+ */
+const SensorDescriptor *sensor_registry_getSlot(size_t slot)
+{
+    if (slot >= atomic_load_explicit(&m_count, memory_order_acquire)) {
+        return NULL;
+    }
+    return &m_sensors[slot];
+}
+
+/*!
+ * \brief sensor_registry_count
+ * \return slots in use, enabled built-in and registered channels
+ */
+size_t sensor_registry_count(void)
+{
+    return atomic_load_explicit(&m_count, memory_order_acquire);
+}
+
+/*!
+ * \brief sensor_registry_register
+ * adds channel at startup, before its values are set. m_id of descriptor
+ * is ignored, id is given by registry.
+ *
+ * \return id of channel, SENSOR_TYPE_INVALID if registry is full
+ */
+SensorType sensor_registry_register(const SensorDescriptor *descriptor)
+{
+    SensorType id = SENSOR_TYPE_INVALID;
+    unsigned int index;
+
+    taskENTER_CRITICAL(&m_lock);
+    index = atomic_load_explicit(&m_count, memory_order_relaxed);
+    if (index < SENSOR_REGISTRY_MAX) {
+        // registered ids follow built-in ids, slots follow enabled ones
+        id = (SensorType)(index - SENSOR_BUILTIN_SLOTS + SensorTypeBuiltinCount);
+        m_sensors[index] = *descriptor;
+        m_sensors[index].m_id = id;
+        // entry is complete before readers see it
+        atomic_store_explicit(&m_count, index + 1, memory_order_release);
+    }
+    taskEXIT_CRITICAL(&m_lock);
+    return id;
+}
@@ -0,0 +1,99 @@
+/*!
+ * \file
+ * \brief file sensor_registry.h
+ *
+ * descriptors of sensor channels
+ * Built-in channels of sensors enabled in Kconfig are in compile-time
+ * table, readers can register CONFIG_WEATHER_SENSOR_REGISTERED_CHANNELS
+ * more at startup. Built-in channels have fixed ids, binary protocol
+ * sensor ids, so ids don't change with Kconfig. Only enabled channels have
+ * slot, slots are dense and index per-channel state of sender and
+ * aggregation and bits of dirty masks in sender, so registry has at most
+ * SENSOR_REGISTRY_LIMIT slots.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef SENSOR_REGISTRY_H
+#define SENSOR_REGISTRY_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+
+#define SENSOR_REGISTRY_LIMIT       32
+#define SENSOR_TYPE_INVALID         0xFF
+#define SENSOR_SLOT_NONE            0xFF
+
+typedef uint8_t SensorType;
+
+// ids of built-in channels, binary protocol sensor ids, registered
+// channels get ids after these
+enum
+{
+    SensorTypeTemperature = 0,
+    SensorTypeHumid = 1,
+    SensorTypePresure = 2,
+    SensorTypePM10 = 3,
+    SensorTypePM25 = 4,
+    SensorTypePM100 = 5,
+    // second BME280, e.g. outdoor sensor at 0x77
+    SensorTypeTemperature2 = 6,
+    SensorTypeHumid2 = 7,
+    SensorTypePresure2 = 8,
+    SensorTypeBuiltinCount = 9,
+};
+
+// slots of built-in channels of each sensor, 0 when sensor is disabled
+#if CONFIG_WEATHER_SENSOR_BME280
+#define SENSOR_SLOTS_BME280         3
+#else
+#define SENSOR_SLOTS_BME280         0
+#endif
+#if CONFIG_WEATHER_SENSOR_PMS5003
+#define SENSOR_SLOTS_PMS5003        3
+#else
+#define SENSOR_SLOTS_PMS5003        0
+#endif
+#if CONFIG_WEATHER_BME280_SECOND
+#define SENSOR_SLOTS_BME280_SECOND  3
+#else
+#define SENSOR_SLOTS_BME280_SECOND  0
+#endif
+#define SENSOR_BUILTIN_SLOTS        (SENSOR_SLOTS_BME280 + SENSOR_SLOTS_PMS5003 + SENSOR_SLOTS_BME280_SECOND)
+
+// enabled built-in channels and room for registered ones, per-channel
+// arrays of sender and aggregation have this many slots
+#define SENSOR_REGISTRY_MAX         (SENSOR_BUILTIN_SLOTS + CONFIG_WEATHER_SENSOR_REGISTERED_CHANNELS)
+
+/*
+* One sensor channel. Values are fixed point in native format of the
+* sensor, value / m_divisor is value in m_unit.
+*/
+typedef struct
+{
+    SensorType m_id;
+    char m_code;                // sensor character of text protocol
+    const char *m_unit;
+    uint8_t m_scale;            // decimal places of binary protocol value
+    int32_t m_divisor;
+    uint32_t m_samplePeriodMs;  // how often sensor is read
+    uint32_t m_sendPeriodMs;    // least time between sends, 0 = every new value
+    // new value is sent only when it differs from last sent value more
+    // than either deadband, 0 = deadband not used, any change when both
+    // are 0. Unchanged value is sent again after m_heartbeatMs, 0 = never.
+    int32_t m_deadband;         // native fixed point units
+    uint32_t m_deadbandPpm;     // parts per million of last sent value
+    uint32_t m_heartbeatMs;
+} SensorDescriptor;
+
+const SensorDescriptor *sensor_registry_get(SensorType type);
+size_t sensor_registry_slot(SensorType type);
+const SensorDescriptor *sensor_registry_getSlot(size_t slot);
+size_t sensor_registry_count(void);
+SensorType sensor_registry_register(const SensorDescriptor *descriptor);
+
+#endif // SENSOR_REGISTRY_H
@@ -0,0 +1,114 @@
+/*!
+ * \file
+ * \brief file tcpip_clock.c
+ *
+ * clock sync with server
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "tcpip_clock.h"
+#include <string.h>
+#include "lwip/sockets.h"
+#include "esp_timer.h"
+#include "metrics.h"
+
+void tcpip_clock_reset(TcpipClock *clock)
+{
+    memset(clock, 0, sizeof(TcpipClock));
+}
+
+/*!
+ * \brief tcpip_clock_request
+ * writes sync request when TCPIP_CLOCK_SYNC_PERIOD_MS has passed since
+ * previous one
+ *
+ * \param buffer output buffer, at least TCPIP_CLOCK_REQUEST_SIZE
+ * \return size of request, 0 if sync is not due
+ */
+size_t tcpip_clock_request(TcpipClock *clock, uint8_t *buffer)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (clock->m_requestUs != 0 && now - clock->m_requestUs < (int64_t)(TCPIP_CLOCK_SYNC_PERIOD_MS) * 1000) {
+        return 0;
+    }
+    clock->m_requestUs = now;
+    return tcpip_protocol_writeClockRequest(buffer, (uint64_t)(now), clock->m_synced ? clock->m_offsetUs : 0,
+                                            clock->m_synced ? clock->m_roundTripUs : 0);
+}
+
+/*!
+ * \brief tcpip_clock_read
+ * reads until reply is complete, never longer than to deadline
+ *
+ * \return true when whole reply is in buffer
+ */
+static bool tcpip_clock_read(TcpipClock *clock, int sock, int64_t deadline)
+{
+    struct timeval timeout;
+    fd_set readSet;
+    int64_t remaining;
+    int rc;
+
+    while (clock->m_replySize < TCPIP_CLOCK_REPLY_SIZE) {
+        remaining = deadline - esp_timer_get_time();
+        if (remaining <= 0) {
+            return false;
+        }
+        FD_ZERO(&readSet);
+        FD_SET(sock, &readSet);
+        timeout.tv_sec = (long)(remaining / 1000000);
+        timeout.tv_usec = (long)(remaining % 1000000);
+        if (select(sock + 1, &readSet, NULL, NULL, &timeout) <= 0) {
+            return false;
+        }
+        rc = recv(sock, clock->m_reply + clock->m_replySize, TCPIP_CLOCK_REPLY_SIZE - clock->m_replySize,
+                  MSG_DONTWAIT);
+        if (rc <= 0) {
+            // closed connection is detected by sender
+            return false;
+        }
+        clock->m_replySize += (size_t)(rc);
+    }
+    return true;
+}
+
+/*!
+ * \brief tcpip_clock_receive
+ * waits reply to latest request and computes offset of the clocks. Replies
+ * to earlier requests are dropped. After first sync next request is sent
+ * at once, so server gets offset without waiting whole period.
+ *
+ * \return false if there was no reply in TCPIP_CLOCK_SYNC_TIMEOUT_MS
+ */
+bool tcpip_clock_receive(TcpipClock *clock, int sock)
+{
+    int64_t deadline = clock->m_requestUs + (int64_t)(TCPIP_CLOCK_SYNC_TIMEOUT_MS) * 1000;
+    uint64_t sentUs, receivedUs, repliedUs;
+    int64_t now;
+
+    while (tcpip_clock_read(clock, sock, deadline)) {
+        now = esp_timer_get_time();
+        clock->m_replySize = 0;
+        if (!tcpip_protocol_readClockReply(clock->m_reply, TCPIP_CLOCK_REPLY_SIZE, &sentUs, &receivedUs,
+                                           &repliedUs)) {
+            // stream is out of sync, server sends nothing else than replies
+            return false;
+        }
+        if (sentUs != (uint64_t)(clock->m_requestUs)) {
+            continue;
+        }
+        if (!clock->m_synced) {
+            clock->m_requestUs = 0;
+        }
+        clock->m_offsetUs = ((int64_t)(receivedUs - sentUs) + (int64_t)(repliedUs - (uint64_t)(now))) / 2;
+        clock->m_roundTripUs = (uint32_t)((now - (int64_t)(sentUs)) - (int64_t)(repliedUs - receivedUs));
+        clock->m_synced = true;
+        metrics_addLatency(MetricLatencyClockSync, clock->m_roundTripUs);
+        return true;
+    }
+    return false;
+}
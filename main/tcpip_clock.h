@@ -0,0 +1,53 @@
+/*!
+ * \file
+ * \brief file tcpip_clock.h
+ *
+ * clock sync with server, so server can tell how old values are when they
+ * are received. Sender asks time of server every TCPIP_CLOCK_SYNC_PERIOD_MS
+ * and offset of the clocks is computed NTP style from four timestamps.
+ * Offset and round trip are sent to server in next request, format in
+ * tcpip_protocol.h. Round trips go to MetricLatencyClockSync histogram.
+ *
+ * Sender sends request with its other messages and waits reply with
+ * tcpip_clock_receive(). Needs binary protocol over TCP, server must reply
+ * to requests.
+ * Used only from tcpip sender task.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef TCPIP_CLOCK_H
+#define TCPIP_CLOCK_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "tcpip_protocol.h"
+
+#if CONFIG_WEATHER_CLOCK_SYNC
+#define TCPIP_CLOCK_SYNC                1
+#else
+#define TCPIP_CLOCK_SYNC                0
+#endif
+#define TCPIP_CLOCK_SYNC_PERIOD_MS      60000
+// sender waits reply this long, late reply is dropped on next sync
+#define TCPIP_CLOCK_SYNC_TIMEOUT_MS     500
+
+typedef struct
+{
+    bool m_synced;
+    int64_t m_offsetUs;         // server clock - device clock
+    uint32_t m_roundTripUs;
+    int64_t m_requestUs;        // device us of latest request, 0 = sync at once
+    // reply can arrive in parts, partial reply is kept to next try
+    uint8_t m_reply[TCPIP_CLOCK_REPLY_SIZE];
+    size_t m_replySize;
+} TcpipClock;
+
+void tcpip_clock_reset(TcpipClock *clock);
+size_t tcpip_clock_request(TcpipClock *clock, uint8_t *buffer);
+bool tcpip_clock_receive(TcpipClock *clock, int sock);
+
+#endif // TCPIP_CLOCK_H
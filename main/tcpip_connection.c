@@ -0,0 +1,162 @@
+/*!
+ * \file
+ * \brief file tcpip_connection.c
+ *
+ * TCP connection to server
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "tcpip_connection.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include "lwip/sockets.h"
+#include "esp_random.h"
+
+/*!
+ * \brief tcpip_connection_connect
+ * non-blocking connect, waits with select() until connection is made or
+ * timeout
+ */
+static bool tcpip_connection_connect(int sock, const char *address, uint16_t port, uint32_t timeoutMs)
+{
+    struct sockaddr_in servaddr;
+    struct timeval timeout;
+    fd_set writable;
+    int flags = fcntl(sock, F_GETFL, 0);
+    int err = 0;
+    socklen_t length = sizeof(err);
+
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return false;
+    }
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_port = htons(port);
+    servaddr.sin_addr.s_addr = inet_addr(address);
+
+    if (connect(sock, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+        if (errno != EINPROGRESS) {
+            return false;
+        }
+        FD_ZERO(&writable);
+        FD_SET(sock, &writable);
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+        if (select(sock + 1, NULL, &writable, NULL, &timeout) <= 0) {
+            return false;
+        }
+        if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &length) < 0 || err != 0) {
+            return false;
+        }
+    }
+    // sends block, bounded by SO_SNDTIMEO
+    return fcntl(sock, F_SETFL, flags) >= 0;
+}
+
+static bool tcpip_connection_configure(int sock)
+{
+    const int enable = 1;
+    const int idle = TCPIP_KEEPALIVE_IDLE_S;
+    const int interval = TCPIP_KEEPALIVE_INTERVAL_S;
+    const int count = TCPIP_KEEPALIVE_COUNT;
+    // connection is closed only when it is lost, so close resets it at once
+    // instead of keeping lwIP PCB in TIME_WAIT
+    const struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+    struct timeval timeout;
+
+    timeout.tv_sec = TCPIP_SEND_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (TCPIP_SEND_TIMEOUT_MS % 1000) * 1000;
+    return setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0
+        && setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable)) == 0
+        && setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) == 0
+        && setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) == 0
+        && setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) == 0
+        // values are already coalesced to one send, so Nagle would only delay them
+        && setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) == 0
+        && setsockopt(sock, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger)) == 0;
+}
+
+/*!
+ * \brief tcpip_connection_open
+ * \return connected socket, -1 if connecting failed. Socket is closed on
+ * every failure.
+ */
+int tcpip_connection_open(const char *address, uint16_t port, uint32_t timeoutMs)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (sock < 0) {
+        return -1;
+    }
+    if (!tcpip_connection_connect(sock, address, port, timeoutMs) || !tcpip_connection_configure(sock)) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/*!
+ * \brief tcpip_connection_alive
+ * checks pending socket error and whether peer has closed or reset the
+ * connection, never blocks. Data waiting to be read, like clock sync reply,
+ * is left there.
+ */
+bool tcpip_connection_alive(int sock)
+{
+    int err = 0;
+    socklen_t length = sizeof(err);
+    uint8_t byte;
+    int rc;
+
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &length) < 0 || err != 0) {
+        return false;
+    }
+    rc = recv(sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (rc == 0) {
+        return false;
+    }
+    return rc > 0 || errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+/*!
+ * \brief tcpip_connection_sendErrorIsFatal
+ * \return true if send() error means connection is lost, timeouts are not
+ */
+bool tcpip_connection_sendErrorIsFatal(int err)
+{
+    return err != EAGAIN && err != EWOULDBLOCK && err != EINTR;
+}
+
+void tcpip_connection_close(int sock)
+{
+    if (sock >= 0) {
+        close(sock);
+    }
+}
+
+void tcpip_connection_backoffReset(TcpipBackoff *backoff)
+{
+    backoff->m_delayMs = TCPIP_BACKOFF_MIN_MS;
+}
+
+/*!
+ * \brief tcpip_connection_backoffNext
+ * \return delay before next reconnect, half of delay is random so devices
+ * don't reconnect in step after server restart
+ */
+uint32_t tcpip_connection_backoffNext(TcpipBackoff *backoff)
+{
+    uint32_t delay;
+
+    if (backoff->m_delayMs < TCPIP_BACKOFF_MIN_MS) {
+        backoff->m_delayMs = TCPIP_BACKOFF_MIN_MS;
+    }
+    delay = backoff->m_delayMs / 2 + esp_random() % (backoff->m_delayMs / 2 + 1);
+    backoff->m_delayMs = backoff->m_delayMs >= TCPIP_BACKOFF_MAX_MS / 2 ? TCPIP_BACKOFF_MAX_MS
+                                                                        : backoff->m_delayMs * 2;
+    return delay;
+}
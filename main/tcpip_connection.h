@@ -0,0 +1,42 @@
+/*!
+ * \file
+ * \brief file tcpip_connection.h
+ *
+ * TCP connection to server: connect with timeout, keepalive and detection
+ * of lost peer, and reconnect delays with exponential backoff
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef TCPIP_CONNECTION_H
+#define TCPIP_CONNECTION_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define TCPIP_CONNECT_TIMEOUT_MS    3000
+// send() gives up after this, failed sends are counted by sender
+#define TCPIP_SEND_TIMEOUT_MS       2000
+// dead peer is detected after idle + interval * count seconds without ACK
+#define TCPIP_KEEPALIVE_IDLE_S      5
+#define TCPIP_KEEPALIVE_INTERVAL_S  2
+#define TCPIP_KEEPALIVE_COUNT       3
+// reconnect delay doubles from min to max, random half of it is jitter
+#define TCPIP_BACKOFF_MIN_MS        500
+#define TCPIP_BACKOFF_MAX_MS        60000
+
+typedef struct
+{
+    uint32_t m_delayMs;     // delay before jitter of next reconnect
+} TcpipBackoff;
+
+int tcpip_connection_open(const char *address, uint16_t port, uint32_t timeoutMs);
+bool tcpip_connection_alive(int sock);
+bool tcpip_connection_sendErrorIsFatal(int err);
+void tcpip_connection_close(int sock);
+void tcpip_connection_backoffReset(TcpipBackoff *backoff);
+uint32_t tcpip_connection_backoffNext(TcpipBackoff *backoff);
+
+#endif // TCPIP_CONNECTION_H
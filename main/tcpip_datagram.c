@@ -0,0 +1,222 @@
+/*!
+ * \file
+ * \brief file tcpip_datagram.c
+ *
+ * UDP transport of sender
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "tcpip_datagram.h"
+#include <string.h>
+#include "lwip/sockets.h"
+#include "metrics.h"
+
+/*!
+ * \brief tcpip_datagram_open
+ * \return UDP socket connected to server, so only datagrams of server are
+ * received, -1 on failure
+ */
+int tcpip_datagram_open(const char *address, uint16_t port)
+{
+    struct sockaddr_in servaddr;
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (sock < 0) {
+        return -1;
+    }
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_port = htons(port);
+    servaddr.sin_addr.s_addr = inet_addr(address);
+    if (connect(sock, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+#if TCPIP_DATAGRAM_WINDOW > 0
+static void tcpip_datagram_giveUp(TcpipDatagram *datagram, TcpipDatagramEntry *entry)
+{
+    uint32_t age = datagram->m_sequence - 1 - entry->m_sequence;
+
+    if (age < 32) {
+        datagram->m_lostMask |= 1u << age;
+    }
+    entry->m_used = false;
+    metrics_add(MetricDatagramLost, 1);
+}
+
+/*!
+ * \brief tcpip_datagram_entry
+ * \return free window entry, or oldest entry which is given up
+ */
+static TcpipDatagramEntry *tcpip_datagram_entry(TcpipDatagram *datagram)
+{
+    TcpipDatagramEntry *oldest = &datagram->m_window[0];
+    size_t i;
+
+    for (i=0;i<TCPIP_DATAGRAM_WINDOW;i++) {
+        if (!datagram->m_window[i].m_used) {
+            return &datagram->m_window[i];
+        }
+        if ((int32_t)(datagram->m_window[i].m_sequence - oldest->m_sequence) < 0) {
+            oldest = &datagram->m_window[i];
+        }
+    }
+    tcpip_datagram_giveUp(datagram, oldest);
+    return oldest;
+}
+
+static void tcpip_datagram_ack(TcpipDatagram *datagram, uint32_t sequence, uint32_t mask)
+{
+    TcpipDatagramEntry *entry;
+    uint32_t distance;
+    size_t i;
+
+    for (i=0;i<TCPIP_DATAGRAM_WINDOW;i++) {
+        entry = &datagram->m_window[i];
+        distance = sequence - entry->m_sequence;
+        if (entry->m_used && (distance == 0 || (distance <= 32 && (mask & (1u << (distance - 1)))))) {
+            entry->m_used = false;
+        }
+    }
+}
+#endif
+
+/*!
+ * \brief tcpip_datagram_send
+ * sends payload as one datagram. Datagram that failed to send is not kept
+ * for retransmit, caller sends payload again.
+ */
+bool tcpip_datagram_send(TcpipDatagram *datagram, int sock, const void *payload, size_t size, uint32_t now)
+{
+#if TCPIP_DATAGRAM_WINDOW > 0
+    TcpipDatagramEntry *entry;
+#else
+    static uint8_t buffer[TCPIP_DATAGRAM_HEADER_SIZE + TCPIP_DATAGRAM_MAX_PAYLOAD];
+    size_t length;
+#endif
+    uint32_t sequence;
+
+    if (size > TCPIP_DATAGRAM_MAX_PAYLOAD) {
+        return false;
+    }
+    sequence = datagram->m_sequence++;
+#if TCPIP_DATAGRAM_WINDOW > 0
+    datagram->m_lostMask <<= 1;
+    entry = tcpip_datagram_entry(datagram);
+    entry->m_size = tcpip_protocol_writeDatagramHeader(entry->m_data, TCPIP_DATAGRAM_FLAG_ACK, (uint16_t)size,
+                                                       sequence, now);
+    memcpy(entry->m_data + entry->m_size, payload, size);
+    entry->m_size += size;
+    entry->m_sequence = sequence;
+    entry->m_sentMs = now;
+    entry->m_retries = 0;
+    entry->m_used = send(sock, entry->m_data, entry->m_size, 0) == (int)(entry->m_size);
+    if (!entry->m_used) {
+        // caller sends payload again, so this sequence is not waited for
+        datagram->m_lostMask |= 1;
+    }
+    return entry->m_used;
+#else
+    length = tcpip_protocol_writeDatagramHeader(buffer, 0, (uint16_t)size, sequence, now);
+    memcpy(buffer + length, payload, size);
+    length += size;
+    return send(sock, buffer, length, 0) == (int)(length);
+#endif
+}
+
+/*!
+ * \brief tcpip_datagram_poll
+ * handles received acks and sends again datagrams that are not acked in
+ * TCPIP_DATAGRAM_RETRANSMIT_MS, never blocks
+ */
+void tcpip_datagram_poll(TcpipDatagram *datagram, int sock, uint32_t now)
+{
+#if TCPIP_DATAGRAM_WINDOW > 0
+    uint8_t buffer[TCPIP_DATAGRAM_ACK_SIZE];
+    TcpipDatagramEntry *entry;
+    uint32_t sequence, mask;
+    int rc;
+    size_t i;
+
+    while ((rc = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        if (tcpip_protocol_readDatagramAck(buffer, (size_t)(rc), &sequence, &mask)) {
+            tcpip_datagram_ack(datagram, sequence, mask);
+        }
+    }
+    for (i=0;i<TCPIP_DATAGRAM_WINDOW;i++) {
+        entry = &datagram->m_window[i];
+        if (!entry->m_used || now - entry->m_sentMs < TCPIP_DATAGRAM_RETRANSMIT_MS) {
+            continue;
+        }
+        if (entry->m_retries >= TCPIP_DATAGRAM_MAX_RETRIES) {
+            tcpip_datagram_giveUp(datagram, entry);
+            continue;
+        }
+        entry->m_data[1] |= TCPIP_DATAGRAM_FLAG_RETRANSMIT;
+        entry->m_retries++;
+        entry->m_sentMs = now;
+        send(sock, entry->m_data, entry->m_size, 0);
+        metrics_add(MetricDatagramRetransmits, 1);
+    }
+#else
+    (void)datagram;
+    (void)sock;
+    (void)now;
+#endif
+}
+
+bool tcpip_datagram_waitingAck(const TcpipDatagram *datagram)
+{
+#if TCPIP_DATAGRAM_WINDOW > 0
+    size_t i;
+    for (i=0;i<TCPIP_DATAGRAM_WINDOW;i++) {
+        if (datagram->m_window[i].m_used) {
+            return true;
+        }
+    }
+#else
+    (void)datagram;
+#endif
+    return false;
+}
+
+/*!
+ * \brief tcpip_datagram_lastSequence
+ * \return sequence of latest tcpip_datagram_send()
+ */
+uint32_t tcpip_datagram_lastSequence(const TcpipDatagram *datagram)
+{
+    return datagram->m_sequence - 1;
+}
+
+/*!
+ * \brief tcpip_datagram_status
+ * tells whether receiver has got datagram, acks are handled by
+ * tcpip_datagram_poll(). Status of 32 latest datagrams is known.
+ */
+TcpipDatagramStatus tcpip_datagram_status(const TcpipDatagram *datagram, uint32_t sequence)
+{
+#if TCPIP_DATAGRAM_WINDOW > 0
+    uint32_t age = datagram->m_sequence - 1 - sequence;
+    size_t i;
+
+    for (i=0;i<TCPIP_DATAGRAM_WINDOW;i++) {
+        if (datagram->m_window[i].m_used && datagram->m_window[i].m_sequence == sequence) {
+            return TcpipDatagramWaiting;
+        }
+    }
+    if (age >= 32 || (datagram->m_lostMask & (1u << age))) {
+        return TcpipDatagramLost;
+    }
+#else
+    (void)datagram;
+    (void)sequence;
+#endif
+    return TcpipDatagramAcked;
+}
@@ -0,0 +1,73 @@
+/*!
+ * \file
+ * \brief file tcpip_datagram.h
+ *
+ * UDP transport of sender: every send is one sequence numbered datagram,
+ * format in tcpip_protocol.h. With TCPIP_DATAGRAM_WINDOW > 0 receiver acks
+ * datagrams and unacked ones are sent again from window of copies.
+ * Window never blocks sending, oldest unacked datagram is given up when
+ * window is full.
+ *
+ * Used only from tcpip sender task.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef TCPIP_DATAGRAM_H
+#define TCPIP_DATAGRAM_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "tcpip_protocol.h"
+
+// datagrams kept for retransmit, 0 = no acks
+#ifdef CONFIG_WEATHER_DATAGRAM_WINDOW
+#define TCPIP_DATAGRAM_WINDOW           CONFIG_WEATHER_DATAGRAM_WINDOW
+#else
+#define TCPIP_DATAGRAM_WINDOW           0
+#endif
+#define TCPIP_DATAGRAM_MAX_PAYLOAD      1460
+#define TCPIP_DATAGRAM_RETRANSMIT_MS    300
+#define TCPIP_DATAGRAM_MAX_RETRIES      3
+
+typedef enum
+{
+    TcpipDatagramAcked = 0,     // acked, or sent without ack request
+    TcpipDatagramWaiting,       // in window, waiting for ack
+    TcpipDatagramLost,          // given up, or too old to know
+} TcpipDatagramStatus;
+
+/*
+* Sent datagram waiting for ack
+*/
+typedef struct
+{
+    bool m_used;
+    uint8_t m_retries;
+    uint32_t m_sequence;
+    uint32_t m_sentMs;      // time of latest send
+    size_t m_size;          // header and payload
+    uint8_t m_data[TCPIP_DATAGRAM_HEADER_SIZE + TCPIP_DATAGRAM_MAX_PAYLOAD];
+} TcpipDatagramEntry;
+
+typedef struct
+{
+    uint32_t m_sequence;    // sequence of next datagram
+#if TCPIP_DATAGRAM_WINDOW > 0
+    TcpipDatagramEntry m_window[TCPIP_DATAGRAM_WINDOW];
+    // bit i is set when datagram m_sequence - 1 - i was given up
+    uint32_t m_lostMask;
+#endif
+} TcpipDatagram;
+
+int tcpip_datagram_open(const char *address, uint16_t port);
+bool tcpip_datagram_send(TcpipDatagram *datagram, int sock, const void *payload, size_t size, uint32_t now);
+void tcpip_datagram_poll(TcpipDatagram *datagram, int sock, uint32_t now);
+bool tcpip_datagram_waitingAck(const TcpipDatagram *datagram);
+uint32_t tcpip_datagram_lastSequence(const TcpipDatagram *datagram);
+TcpipDatagramStatus tcpip_datagram_status(const TcpipDatagram *datagram, uint32_t sequence);
+
+#endif // TCPIP_DATAGRAM_H
@@ -0,0 +1,478 @@
+/*!
+ * \file
+ * \brief file tcpip_protocol.c
+ *
+ * message formats sent to server
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "tcpip_protocol.h"
+#include <stdio.h>
+#include <string.h>
+
+// text values are printed like single precision floats were
+#define TCPIP_FLOAT_MANTISSA_BITS   24
+
+char tcpip_protocol_getSensorTypeChar(SensorType type)
+{
+    const SensorDescriptor *descriptor = sensor_registry_get(type);
+    return descriptor != NULL ? descriptor->m_code : ' ';
+}
+
+uint8_t tcpip_protocol_getBinaryScale(SensorType type)
+{
+    const SensorDescriptor *descriptor = sensor_registry_get(type);
+    return descriptor != NULL ? descriptor->m_scale : 0;
+}
+
+int32_t tcpip_protocol_getValueDivisor(SensorType type)
+{
+    const SensorDescriptor *descriptor = sensor_registry_get(type);
+    return descriptor != NULL ? descriptor->m_divisor : 1;
+}
+
+/*!
+ * \brief tcpip_protocol_toBinaryValue
+ * converts value from native format of the sensor to binary protocol scale
+ * with integer math, rounded to nearest
+ */
+int32_t tcpip_protocol_toBinaryValue(SensorType type, int32_t value)
+{
+    int32_t divisor = tcpip_protocol_getValueDivisor(type);
+    int64_t multiplier = 1;
+    int64_t scaled;
+    uint8_t scale = tcpip_protocol_getBinaryScale(type);
+    uint8_t i;
+
+    for (i=0;i<scale;i++) {
+        multiplier *= 10;
+    }
+    if (multiplier == divisor) {
+        return value;
+    }
+    scaled = (int64_t)(value) * multiplier;
+    scaled += scaled >= 0 ? divisor / 2 : -(divisor / 2);
+    return (int32_t)(scaled / divisor);
+}
+
+/*!
+ * \brief tcpip_protocol_roundToFloat
+ * rounds numerator / denominator to 24 bit mantissa of single precision
+ * float, ties to even like FPU does
+ *
+ * \param exponent value is mantissa * 2^exponent
+ * \return mantissa
+ */
+static uint32_t tcpip_protocol_roundToFloat(uint64_t numerator, uint64_t denominator, int *exponent)
+{
+    uint64_t quotient, remainder;
+    int shift = 0;
+
+    *exponent = 0;
+    if (numerator == 0) {
+        return 0;
+    }
+    while (numerator >= (denominator << TCPIP_FLOAT_MANTISSA_BITS)) {
+        denominator <<= 1;
+        shift--;
+    }
+    while (numerator < (denominator << (TCPIP_FLOAT_MANTISSA_BITS - 1))) {
+        numerator <<= 1;
+        shift++;
+    }
+    quotient = numerator / denominator;
+    remainder = numerator % denominator;
+    if (remainder * 2 > denominator || (remainder * 2 == denominator && (quotient & 1))) {
+        quotient++;
+    }
+    if (quotient == (1u << TCPIP_FLOAT_MANTISSA_BITS)) {
+        quotient >>= 1;
+        shift--;
+    }
+    *exponent = -shift;
+    return (uint32_t)(quotient);
+}
+
+/*!
+ * \brief tcpip_protocol_toFloatInteger
+ * integer as it is after conversion to float
+ */
+static uint64_t tcpip_protocol_toFloatInteger(uint64_t value)
+{
+    uint32_t mantissa;
+    int exponent;
+
+    if (value < (1u << TCPIP_FLOAT_MANTISSA_BITS)) {
+        return value;
+    }
+    mantissa = tcpip_protocol_roundToFloat(value, 1, &exponent);
+    return (uint64_t)(mantissa) << exponent;
+}
+
+/*!
+ * \brief tcpip_protocol_toMicros
+ * value / divisor in millionths, value and divisor are converted to float,
+ * divided and printed with 6 decimals like "%f" of single precision value
+ * does, with integer math only
+ */
+static uint64_t tcpip_protocol_toMicros(uint32_t magnitude, int32_t divisor)
+{
+    uint64_t scaled, rest, half, micros;
+    uint32_t mantissa;
+    int exponent;
+
+    mantissa = tcpip_protocol_roundToFloat(tcpip_protocol_toFloatInteger(magnitude),
+                                           tcpip_protocol_toFloatInteger(divisor > 0 ? (uint64_t)(divisor) : 1),
+                                           &exponent);
+    scaled = (uint64_t)(mantissa) * 1000000u;
+    if (exponent >= 0) {
+        return scaled << exponent;
+    }
+    if (exponent <= -64) {
+        return 0;
+    }
+    // exact value is printed rounded to nearest, ties to even
+    micros = scaled >> -exponent;
+    rest = scaled & ((1ull << -exponent) - 1);
+    half = 1ull << (-exponent - 1);
+    if (rest > half || (rest == half && (micros & 1))) {
+        micros++;
+    }
+    return micros;
+}
+
+static char *tcpip_protocol_writeDecimal(char *buffer, uint64_t value)
+{
+    char digits[20];
+    size_t count = 0;
+
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) {
+        *buffer++ = digits[--count];
+    }
+    return buffer;
+}
+
+/*!
+ * \brief tcpip_protocol_formatText
+ * formats value as text line "I<c><value>\n". Value has the same digits as
+ * single precision value / divisor printed with "%f" and trailing zeros of
+ * decimals trimmed to one, but float and stdio are not used.
+ *
+ * \param buffer output buffer, at least TCPIP_TEXT_LINE_SIZE
+ * \return length of line, line is null terminated
+ */
+size_t tcpip_protocol_formatText(char *buffer, size_t size, const ClientSideValue *value)
+{
+    uint32_t magnitude = value->m_value < 0 ? 0u - (uint32_t)(value->m_value) : (uint32_t)(value->m_value);
+    uint64_t micros = tcpip_protocol_toMicros(magnitude, tcpip_protocol_getValueDivisor(value->m_type));
+    uint32_t fraction = (uint32_t)(micros % 1000000u);
+    char *pos = buffer;
+    int digits = 6;
+    int i;
+
+    if (size < TCPIP_TEXT_LINE_SIZE) {
+        return 0;
+    }
+    *pos++ = 'I';
+    *pos++ = tcpip_protocol_getSensorTypeChar(value->m_type);
+    if (value->m_value < 0) {
+        *pos++ = '-';
+    }
+    pos = tcpip_protocol_writeDecimal(pos, micros / 1000000u);
+    *pos++ = '.';
+    while (digits > 1 && fraction % 10 == 0) {
+        fraction /= 10;
+        digits--;
+    }
+    pos += digits;
+    for (i=1;i<=digits;i++) {
+        pos[-i] = (char)('0' + fraction % 10);
+        fraction /= 10;
+    }
+    *pos++ = '\n';
+    *pos = '\0';
+    return (size_t)(pos - buffer);
+}
+
+static uint8_t *tcpip_protocol_writeU16(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)(value >> 8);
+    buffer[1] = (uint8_t)(value);
+    return buffer + 2;
+}
+
+static uint8_t *tcpip_protocol_writeU32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)(value >> 24);
+    buffer[1] = (uint8_t)(value >> 16);
+    buffer[2] = (uint8_t)(value >> 8);
+    buffer[3] = (uint8_t)(value);
+    return buffer + 4;
+}
+
+static uint8_t *tcpip_protocol_writeU64(uint8_t *buffer, uint64_t value)
+{
+    buffer = tcpip_protocol_writeU32(buffer, (uint32_t)(value >> 32));
+    return tcpip_protocol_writeU32(buffer, (uint32_t)(value));
+}
+
+size_t tcpip_protocol_writeBinaryHeader(uint8_t *buffer, uint16_t count)
+{
+    buffer[0] = TCPIP_BINARY_MAGIC;
+    buffer[1] = TCPIP_BINARY_VERSION;
+    tcpip_protocol_writeU16(buffer + 2, count);
+    return TCPIP_BINARY_HEADER_SIZE;
+}
+
+size_t tcpip_protocol_writeBinaryReplayHeader(uint8_t *buffer, uint16_t count, uint32_t boot, uint32_t currentBoot)
+{
+    buffer[0] = TCPIP_BINARY_REPLAY_MAGIC;
+    buffer[1] = TCPIP_BINARY_VERSION;
+    tcpip_protocol_writeU16(buffer + 2, count);
+    tcpip_protocol_writeU32(buffer + 4, boot);
+    tcpip_protocol_writeU32(buffer + 8, currentBoot);
+    return TCPIP_BINARY_REPLAY_HEADER_SIZE;
+}
+
+/*!
+ * \brief tcpip_protocol_getBinaryValue
+ * value as fixed point integer with scale of the sensor type
+ */
+int32_t tcpip_protocol_getBinaryValue(const ClientSideValue *value)
+{
+    return tcpip_protocol_toBinaryValue(value->m_type, value->m_value);
+}
+
+size_t tcpip_protocol_writeBinaryFields(uint8_t *buffer, uint8_t sensor, uint16_t sequence,
+                                        uint32_t timestamp, int32_t value)
+{
+    uint8_t *pos = buffer;
+    *pos++ = sensor;
+    *pos++ = tcpip_protocol_getBinaryScale((SensorType)sensor);
+    pos = tcpip_protocol_writeU16(pos, sequence);
+    pos = tcpip_protocol_writeU32(pos, timestamp);
+    tcpip_protocol_writeU32(pos, (uint32_t)value);
+    return TCPIP_BINARY_RECORD_SIZE;
+}
+
+size_t tcpip_protocol_writeBinaryRecord(uint8_t *buffer, const ClientSideValue *value)
+{
+    return tcpip_protocol_writeBinaryFields(buffer, (uint8_t)value->m_type, value->m_sequence,
+                                            value->m_timestamp, tcpip_protocol_getBinaryValue(value));
+}
+
+static int tcpip_protocol_formatFixed(char *buffer, size_t size, int32_t value, uint8_t scale)
+{
+    uint32_t divider = 1;
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    uint8_t i;
+
+    for (i=0;i<scale;i++) {
+        divider *= 10;
+    }
+    if (scale == 0) {
+        return snprintf(buffer, size, "%s%" PRIu32, value < 0 ? "-" : "", magnitude);
+    }
+    return snprintf(buffer, size, "%s%" PRIu32 ".%0*" PRIu32, value < 0 ? "-" : "",
+                    magnitude / divider, (int)scale, magnitude % divider);
+}
+
+/*!
+ * \brief tcpip_protocol_formatSummaryText
+ * formats summary as text line
+ * "A<c><window s>,<count>,<min>,<max>,<mean>,<stddev>,<ewma>\n"
+ *
+ * \param buffer output buffer, at least TCPIP_TEXT_SUMMARY_LINE_SIZE
+ * \return length of line
+ */
+size_t tcpip_protocol_formatSummaryText(char *buffer, size_t size, const SensorSummary *summary)
+{
+    const int32_t values[] = { summary->m_min, summary->m_max, summary->m_mean, summary->m_stddev, summary->m_ewma };
+    uint8_t scale = tcpip_protocol_getBinaryScale(summary->m_type);
+    size_t c, i;
+
+    c = (size_t)snprintf(buffer, size, "A%c%" PRIu32 ",%u", tcpip_protocol_getSensorTypeChar(summary->m_type),
+                         summary->m_windowMs / 1000, (unsigned int)summary->m_count);
+    for (i=0;i<sizeof(values)/sizeof(values[0]) && c + 2 < size;i++) {
+        buffer[c++] = ',';
+        c += (size_t)tcpip_protocol_formatFixed(buffer + c, size - c - 1, values[i], scale);
+    }
+    if (c + 2 > size) {
+        c = size - 2;
+    }
+    buffer[c++] = '\n';
+    buffer[c] = '\0';
+    return c;
+}
+
+size_t tcpip_protocol_writeBinarySummaryHeader(uint8_t *buffer, uint16_t count)
+{
+    buffer[0] = TCPIP_BINARY_SUMMARY_MAGIC;
+    buffer[1] = TCPIP_BINARY_VERSION;
+    tcpip_protocol_writeU16(buffer + 2, count);
+    return TCPIP_BINARY_HEADER_SIZE;
+}
+
+size_t tcpip_protocol_writeBinarySummary(uint8_t *buffer, const SensorSummary *summary)
+{
+    uint8_t *pos = buffer;
+    *pos++ = (uint8_t)summary->m_type;
+    *pos++ = tcpip_protocol_getBinaryScale(summary->m_type);
+    pos = tcpip_protocol_writeU16(pos, (uint16_t)(summary->m_windowMs / 1000));
+    pos = tcpip_protocol_writeU32(pos, summary->m_timestamp);
+    pos = tcpip_protocol_writeU16(pos, summary->m_count);
+    pos = tcpip_protocol_writeU32(pos, (uint32_t)summary->m_min);
+    pos = tcpip_protocol_writeU32(pos, (uint32_t)summary->m_max);
+    pos = tcpip_protocol_writeU32(pos, (uint32_t)summary->m_mean);
+    pos = tcpip_protocol_writeU32(pos, (uint32_t)summary->m_stddev);
+    tcpip_protocol_writeU32(pos, (uint32_t)summary->m_ewma);
+    return TCPIP_BINARY_SUMMARY_SIZE;
+}
+
+static size_t tcpip_protocol_appendU32List(char *buffer, size_t size, size_t c, const uint32_t *values, size_t count)
+{
+    size_t i;
+    for (i=0;i<count && c < size;i++) {
+        c += (size_t)snprintf(buffer + c, size - c, "%s%" PRIu32, i == 0 ? "" : ",", values[i]);
+    }
+    if (c + 2 > size) {
+        c = size - 2;
+    }
+    buffer[c++] = '\n';
+    buffer[c] = '\0';
+    return c;
+}
+
+/*!
+ * \brief tcpip_protocol_formatStatsText
+ * formats metrics as text lines, see tcpip_protocol.h
+ *
+ * \param buffer output buffer, at least TCPIP_TEXT_STATS_SIZE
+ * \return length of text
+ */
+size_t tcpip_protocol_formatStatsText(char *buffer, size_t size, const MetricsSnapshot *stats)
+{
+    size_t c = 0;
+    size_t i;
+
+    c += (size_t)snprintf(buffer + c, size - c, "Sc");
+    c = tcpip_protocol_appendU32List(buffer, size, c, stats->m_counter, MetricCounterCount);
+    for (i=0;i<MetricLatencyCount && c < size;i++) {
+        c += (size_t)snprintf(buffer + c, size - c, "Sl%u,", (unsigned int)(i));
+        c = tcpip_protocol_appendU32List(buffer, size, c, stats->m_latency[i], METRICS_LATENCY_BUCKETS);
+    }
+    for (i=0;i<stats->m_taskCount && c < size;i++) {
+        c += (size_t)snprintf(buffer + c, size - c, "Ss%s,%" PRIu32 ",%u\n", stats->m_taskName[i],
+                              stats->m_stackFree[i], (unsigned int)(stats->m_duty[i]));
+    }
+    if (c < size) {
+        c += (size_t)snprintf(buffer + c, size - c, "Sh%" PRIu32 ",%" PRIu32 "\n", stats->m_heapFree,
+                              stats->m_heapMinFree);
+    }
+    return c < size ? c : size - 1;
+}
+
+size_t tcpip_protocol_writeBinaryStats(uint8_t *buffer, const MetricsSnapshot *stats)
+{
+    uint8_t *pos = buffer + TCPIP_BINARY_HEADER_SIZE;
+    size_t i, j, length;
+
+    *pos++ = MetricCounterCount;
+    for (i=0;i<MetricCounterCount;i++) {
+        pos = tcpip_protocol_writeU32(pos, stats->m_counter[i]);
+    }
+    *pos++ = MetricLatencyCount;
+    *pos++ = METRICS_LATENCY_BUCKETS;
+    for (i=0;i<MetricLatencyCount;i++) {
+        for (j=0;j<METRICS_LATENCY_BUCKETS;j++) {
+            pos = tcpip_protocol_writeU32(pos, stats->m_latency[i][j]);
+        }
+    }
+    *pos++ = stats->m_taskCount;
+    for (i=0;i<stats->m_taskCount;i++) {
+        length = strnlen(stats->m_taskName[i], METRICS_TASK_NAME_SIZE);
+        *pos++ = (uint8_t)(length);
+        memcpy(pos, stats->m_taskName[i], length);
+        pos += length;
+        pos = tcpip_protocol_writeU32(pos, stats->m_stackFree[i]);
+        pos = tcpip_protocol_writeU16(pos, stats->m_duty[i]);
+    }
+    pos = tcpip_protocol_writeU32(pos, stats->m_heapFree);
+    pos = tcpip_protocol_writeU32(pos, stats->m_heapMinFree);
+    buffer[0] = TCPIP_BINARY_STATS_MAGIC;
+    buffer[1] = TCPIP_BINARY_VERSION;
+    tcpip_protocol_writeU16(buffer + 2, (uint16_t)(pos - buffer - TCPIP_BINARY_HEADER_SIZE));
+    return (size_t)(pos - buffer);
+}
+
+size_t tcpip_protocol_writeDatagramHeader(uint8_t *buffer, uint8_t flags, uint16_t size, uint32_t sequence,
+                                          uint32_t timestamp)
+{
+    uint8_t *pos = buffer;
+    *pos++ = TCPIP_DATAGRAM_MAGIC;
+    *pos++ = flags;
+    pos = tcpip_protocol_writeU16(pos, size);
+    pos = tcpip_protocol_writeU32(pos, sequence);
+    tcpip_protocol_writeU32(pos, timestamp);
+    return TCPIP_DATAGRAM_HEADER_SIZE;
+}
+
+static uint32_t tcpip_protocol_readU32(const uint8_t *buffer)
+{
+    return ((uint32_t)(buffer[0]) << 24) | ((uint32_t)(buffer[1]) << 16) | ((uint32_t)(buffer[2]) << 8)
+        | (uint32_t)(buffer[3]);
+}
+
+/*!
+ * \brief tcpip_protocol_readDatagramAck
+ * \return false if buffer is not ack datagram
+ */
+bool tcpip_protocol_readDatagramAck(const uint8_t *buffer, size_t size, uint32_t *sequence, uint32_t *mask)
+{
+    if (size < TCPIP_DATAGRAM_ACK_SIZE || buffer[0] != TCPIP_DATAGRAM_ACK_MAGIC) {
+        return false;
+    }
+    *sequence = tcpip_protocol_readU32(buffer + 4);
+    *mask = tcpip_protocol_readU32(buffer + 8);
+    return true;
+}
+
+static uint64_t tcpip_protocol_readU64(const uint8_t *buffer)
+{
+    return ((uint64_t)(tcpip_protocol_readU32(buffer)) << 32) | tcpip_protocol_readU32(buffer + 4);
+}
+
+size_t tcpip_protocol_writeClockRequest(uint8_t *buffer, uint64_t sentUs, int64_t offsetUs, uint32_t roundTripUs)
+{
+    uint8_t *pos = buffer;
+    *pos++ = TCPIP_CLOCK_REQUEST_MAGIC;
+    *pos++ = TCPIP_BINARY_VERSION;
+    pos = tcpip_protocol_writeU16(pos, 0);
+    pos = tcpip_protocol_writeU64(pos, sentUs);
+    pos = tcpip_protocol_writeU64(pos, (uint64_t)(offsetUs));
+    tcpip_protocol_writeU32(pos, roundTripUs);
+    return TCPIP_CLOCK_REQUEST_SIZE;
+}
+
+/*!
+ * \brief tcpip_protocol_readClockReply
+ * \return false if buffer is not clock sync reply
+ */
+bool tcpip_protocol_readClockReply(const uint8_t *buffer, size_t size, uint64_t *sentUs, uint64_t *receivedUs,
+                                   uint64_t *repliedUs)
+{
+    if (size < TCPIP_CLOCK_REPLY_SIZE || buffer[0] != TCPIP_CLOCK_REPLY_MAGIC) {
+        return false;
+    }
+    *sentUs = tcpip_protocol_readU64(buffer + 4);
+    *receivedUs = tcpip_protocol_readU64(buffer + 12);
+    *repliedUs = tcpip_protocol_readU64(buffer + 20);
+    return true;
+}
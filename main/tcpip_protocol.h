@@ -0,0 +1,136 @@
+/*!
+ * \file
+ * \brief file tcpip_protocol.h
+ *
+ * message formats sent to server
+ *
+ * Text protocol, one line per value:
+ *   I<c><value>\n
+ *
+ * Binary protocol (version 1), all fields big endian:
+ *   header  u8 magic (0xA5), u8 version, u16 record count
+ *   record  u8 sensor id, u8 decimal scale, u16 sequence number,
+ *           u32 timestamp (ms since boot when sample was taken), i32 value
+ *   value of record is value * 10^-scale
+ *
+ * Values replayed from sample log (binary protocol), records as above with
+ * sequence 0:
+ *   header  u8 magic (0xAA), u8 version, u16 record count, u32 boot of
+ *           records, u32 current boot
+ *   timestamps are ms since boot of records, boots are counted by sample
+ *   log (see sample_log.h). Records of older boot than current one are
+ *   from before reboot of device.
+ *
+ * Window summaries (when TCPIP_SEND_SUMMARIES is set):
+ *   text    A<c><window s>,<count>,<min>,<max>,<mean>,<stddev>,<ewma>\n
+ *   binary  header with magic 0xA6, records u8 sensor id, u8 decimal scale,
+ *           u16 window (s), u32 timestamp of window end (ms since boot),
+ *           u16 count, i32 min, i32 max, i32 mean, i32 stddev, i32 ewma
+ *
+ * Runtime metrics, every TCPIP_STATS_PERIOD_MS (see metrics.h):
+ *   text    Sc<counter 0>,<counter 1>,...\n
+ *           Sl<latency id>,<bucket 0>,<bucket 1>,...\n for every histogram
+ *           Ss<task name>,<least free stack bytes>,<duty 1/1000>\n for every task
+ *           Sh<free heap bytes>,<least free heap bytes>\n
+ *   binary  header with magic 0xA7 and payload size in bytes as count,
+ *           u8 counter count, u32 counters,
+ *           u8 histogram count, u8 bucket count, u32 buckets of every histogram,
+ *           u8 task count, for every task u8 name length, name, u32 free stack,
+ *           u16 duty cycle since previous message (1/1000),
+ *           u32 free heap, u32 least free heap
+ *
+ * Clock sync (TCPIP_CLOCK_SYNC, binary protocol over TCP, see tcpip_clock.h):
+ *   request header with magic 0xA8 and count 0, u64 t1 (device us since boot
+ *           when request was sent), i64 offset (server - device us) and
+ *           u32 round trip (us) of previous sync, 0 before first one
+ *   reply   u8 magic (0xA9), u8 version, u16 0, u64 t1 of request,
+ *           u64 t2 (server us when request was received),
+ *           u64 t3 (server us when reply was sent)
+ *   server time of sample is timestamp * 1000 + offset
+ *
+ * UDP transport (TCPIP_TRANSPORT_UDP), every send is one datagram:
+ *   datagram  u8 magic (0xB5), u8 flags, u16 payload size, u32 sequence,
+ *             u32 timestamp of first send (ms since boot), payload of
+ *             messages above
+ *   ack       u8 magic (0xB6), u8 0, u16 0, u32 sequence, u32 mask where
+ *             bit i acks sequence - 1 - i
+ *   flags bit 0 asks receiver to ack, bit 1 is set on retransmit
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef TCPIP_PROTOCOL_H
+#define TCPIP_PROTOCOL_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "tcpip_sender.h"
+#include "metrics.h"
+
+#define TCPIP_PROTOCOL_TEXT             0
+#define TCPIP_PROTOCOL_BINARY           1
+#if CONFIG_WEATHER_PROTOCOL_BINARY
+#define TCPIP_PROTOCOL                  TCPIP_PROTOCOL_BINARY
+#else
+#define TCPIP_PROTOCOL                  TCPIP_PROTOCOL_TEXT
+#endif
+
+// longest line is I<c>-2147483648.000000\n
+#define TCPIP_TEXT_LINE_SIZE            24
+#define TCPIP_TEXT_SUMMARY_LINE_SIZE    128
+
+#define TCPIP_BINARY_MAGIC              0xA5
+#define TCPIP_BINARY_VERSION            1
+#define TCPIP_BINARY_HEADER_SIZE        4
+#define TCPIP_BINARY_RECORD_SIZE        12
+#define TCPIP_BINARY_REPLAY_MAGIC       0xAA
+#define TCPIP_BINARY_REPLAY_HEADER_SIZE 12
+#define TCPIP_BINARY_SUMMARY_MAGIC      0xA6
+#define TCPIP_BINARY_SUMMARY_SIZE       30
+#define TCPIP_BINARY_STATS_MAGIC        0xA7
+#define TCPIP_CLOCK_REQUEST_MAGIC       0xA8
+#define TCPIP_CLOCK_REQUEST_SIZE        24
+#define TCPIP_CLOCK_REPLY_MAGIC         0xA9
+#define TCPIP_CLOCK_REPLY_SIZE          28
+
+#define TCPIP_DATAGRAM_MAGIC            0xB5
+#define TCPIP_DATAGRAM_ACK_MAGIC        0xB6
+#define TCPIP_DATAGRAM_HEADER_SIZE      12
+#define TCPIP_DATAGRAM_ACK_SIZE         12
+#define TCPIP_DATAGRAM_FLAG_ACK         0x01
+#define TCPIP_DATAGRAM_FLAG_RETRANSMIT  0x02
+
+#define TCPIP_TEXT_STATS_SIZE           (12 * (MetricCounterCount + 1) + \
+                                         12 * (METRICS_LATENCY_BUCKETS + 1) * MetricLatencyCount + \
+                                         (METRICS_TASK_NAME_SIZE + 20) * METRICS_MAX_TASKS + 24)
+#define TCPIP_BINARY_STATS_SIZE         (TCPIP_BINARY_HEADER_SIZE + 1 + 4 * MetricCounterCount + \
+                                         2 + 4 * METRICS_LATENCY_BUCKETS * MetricLatencyCount + \
+                                         1 + (1 + METRICS_TASK_NAME_SIZE + 6) * METRICS_MAX_TASKS + 8)
+
+char tcpip_protocol_getSensorTypeChar(SensorType type);
+uint8_t tcpip_protocol_getBinaryScale(SensorType type);
+int32_t tcpip_protocol_getValueDivisor(SensorType type);
+int32_t tcpip_protocol_toBinaryValue(SensorType type, int32_t value);
+size_t tcpip_protocol_formatText(char *buffer, size_t size, const ClientSideValue *value);
+size_t tcpip_protocol_writeBinaryHeader(uint8_t *buffer, uint16_t count);
+size_t tcpip_protocol_writeBinaryReplayHeader(uint8_t *buffer, uint16_t count, uint32_t boot, uint32_t currentBoot);
+int32_t tcpip_protocol_getBinaryValue(const ClientSideValue *value);
+size_t tcpip_protocol_writeBinaryFields(uint8_t *buffer, uint8_t sensor, uint16_t sequence,
+                                        uint32_t timestamp, int32_t value);
+size_t tcpip_protocol_writeBinaryRecord(uint8_t *buffer, const ClientSideValue *value);
+size_t tcpip_protocol_formatSummaryText(char *buffer, size_t size, const SensorSummary *summary);
+size_t tcpip_protocol_writeBinarySummaryHeader(uint8_t *buffer, uint16_t count);
+size_t tcpip_protocol_writeBinarySummary(uint8_t *buffer, const SensorSummary *summary);
+size_t tcpip_protocol_formatStatsText(char *buffer, size_t size, const MetricsSnapshot *stats);
+size_t tcpip_protocol_writeBinaryStats(uint8_t *buffer, const MetricsSnapshot *stats);
+size_t tcpip_protocol_writeDatagramHeader(uint8_t *buffer, uint8_t flags, uint16_t size, uint32_t sequence,
+                                          uint32_t timestamp);
+bool tcpip_protocol_readDatagramAck(const uint8_t *buffer, size_t size, uint32_t *sequence, uint32_t *mask);
+size_t tcpip_protocol_writeClockRequest(uint8_t *buffer, uint64_t sentUs, int64_t offsetUs, uint32_t roundTripUs);
+bool tcpip_protocol_readClockReply(const uint8_t *buffer, size_t size, uint64_t *sentUs, uint64_t *receivedUs,
+                                   uint64_t *repliedUs);
+
+#endif // TCPIP_PROTOCOL_H
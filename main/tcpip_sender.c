@@ -10,180 +10,834 @@
  */
 
 #include "tcpip_sender.h"
+#include <errno.h>
+#include <string.h>
 #include <sys/socket.h>
-#include <pthread.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "tcpip_protocol.h"
+#include "tcpip_connection.h"
+#include "tcpip_datagram.h"
+#include "tcpip_clock.h"
+#include "sample_log.h"
+#include "sensor_aggregate.h"
+#include "metrics.h"
+#include "power_manager.h"
 #include "wifi_connect.h"
+#if CONFIG_WEATHER_USE_DEFAULT_VALUES
 #include "default_values.h"
+#else
+#define TCP_IP_ADDR                 CONFIG_WEATHER_SERVER_ADDRESS
+#define TCP_IP_PORT                 CONFIG_WEATHER_SERVER_PORT
+#endif
 
-static ClientSideValue m_clientSide[SensorTypeNA];
-static pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
-static size_t m_nextItemToSend;
+#define TCPIP_SLOT_READ_RETRY_COUNT 10
+// connection is closed after this many sends in row time out
+#define TCPIP_MAX_SEND_FAILS        3
 
-void tcpip_setNewValue(SensorType type, double value)
+// store-and-forward log needs timestamps, so it is used only with binary protocol
+#define TCPIP_USE_SAMPLE_LOG        (TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY)
+#define TCPIP_REPLAY_BATCH_SIZE     64
+// acks of replayed datagrams are checked this often
+#define TCPIP_REPLAY_ACK_POLL_MS    10
+// server replies to clock sync only on TCP stream of binary protocol
+#define TCPIP_USE_CLOCK_SYNC        (TCPIP_CLOCK_SYNC && TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY && \
+                                     TCPIP_TRANSPORT == TCPIP_TRANSPORT_TCP)
+
+// one TCP segment, values that don't fit are sent with next send()
+#define TCPIP_SEND_BUFFER_SIZE      1460
+#if TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY
+#define TCPIP_VALUE_SIZE            TCPIP_BINARY_RECORD_SIZE
+#define TCPIP_SUMMARY_SIZE          TCPIP_BINARY_SUMMARY_SIZE
+#else
+#define TCPIP_VALUE_SIZE            TCPIP_TEXT_LINE_SIZE
+#define TCPIP_SUMMARY_SIZE          TCPIP_TEXT_SUMMARY_LINE_SIZE
+#endif
+
+/*
+* Latest value of one sensor type, protected with sequence lock.
+* Lock is odd while value is written, so reader can detect torn read and
+* retry. Each type must be written from one task only.
+*/
+typedef struct
+{
+    atomic_uint m_lock;
+    ClientSideValue m_value;
+    // last value marked to be sent, used only by writer of the slot
+    int32_t m_reported;
+    uint32_t m_reportedMs;
+    bool m_reportedSet;
+} ClientSideSlot;
+
+/*
+* Latest summary of one aggregation window, protected like ClientSideSlot
+*/
+typedef struct
+{
+    atomic_uint m_lock;
+    SensorSummary m_summary;
+} SummarySlot;
+
+// per-channel state is indexed by slot of sensor registry, disabled
+// sensors have none
+static ClientSideSlot m_clientSide[SENSOR_REGISTRY_MAX];
+// bit per slot, set when slot gets new value and cleared by sender, so
+// sender visits only changed slots
+static atomic_uint m_dirty;
+// dirty slots that sender left to next send, used only by sender task
+static uint32_t m_pending = 0;
+static uint32_t m_lastSent[SENSOR_REGISTRY_MAX];
+// sample time of value collected to send, used only by sender task
+static uint32_t m_sentSampleMs[SENSOR_REGISTRY_MAX];
+#if TCPIP_SEND_SUMMARIES
+static SummarySlot m_summarySlot[SENSOR_REGISTRY_MAX][AGGREGATE_WINDOW_COUNT];
+static atomic_uint m_summaryDirty[AGGREGATE_WINDOW_COUNT];
+static uint32_t m_summaryPending[AGGREGATE_WINDOW_COUNT];
+#endif
+static TaskHandle_t m_senderTask = NULL;
+// send() failed so that connection can't be used anymore
+static bool m_connectionLost = false;
+#if TCPIP_TRANSPORT == TCPIP_TRANSPORT_UDP
+static TcpipDatagram m_datagram;
+#endif
+#if TCPIP_USE_CLOCK_SYNC
+static TcpipClock m_clock;
+#endif
+#if TCPIP_USE_SAMPLE_LOG
+static SampleLog m_sampleLog;
+static bool m_sampleLogReady = false;
+#if TCPIP_TRANSPORT == TCPIP_TRANSPORT_UDP
+// replayed records are consumed from log when their datagram is acked
+static uint32_t m_replaySequence;
+static bool m_replayWaiting = false;
+#endif
+#endif
+
+static void tcpip_writeBegin(atomic_uint *lock)
 {
-    pthread_mutex_lock(&m_mutex);
-    m_clientSide[type].m_sent = false;
-    m_clientSide[type].m_value = value;
-    pthread_mutex_unlock(&m_mutex);
+    unsigned int value = atomic_load_explicit(lock, memory_order_relaxed);
+    atomic_store_explicit(lock, value + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
 }
 
-static char tcpip_getSensorTypeChar(SensorType type)
+static void tcpip_writeEnd(atomic_uint *lock)
 {
-    switch (type) {
-        case SensorTypeHumid: return 'h';
-        case SensorTypeTemperature: return 't';
-        case SensorTypePresure: return 'p';
-        case SensorTypePM10: return 'a';
-        case SensorTypePM25: return 'b';
-        case SensorTypePM100: return 'c';
-        case SensorTypeNA:
-        default:
-            break;
+    unsigned int value = atomic_load_explicit(lock, memory_order_relaxed);
+    atomic_store_explicit(lock, value + 1, memory_order_release);
+}
+
+/*!
+ * \brief tcpip_readLocked
+ * reads consistent snapshot of data protected with sequence lock
+ *
+ * \return false if writer was active on every try, then slot is left to
+ * next round
+ */
+static bool tcpip_readLocked(atomic_uint *lock, void *dataOut, const void *data, size_t size)
+{
+    unsigned int before, after;
+    int i;
+
+    for (i=0;i<TCPIP_SLOT_READ_RETRY_COUNT;i++) {
+        before = atomic_load_explicit(lock, memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(dataOut, data, size);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(lock, memory_order_relaxed);
+        if (before == after) {
+            metrics_add(MetricSlotRetries, (uint32_t)(i));
+            return true;
+        }
+    }
+    metrics_add(MetricSlotRetries, TCPIP_SLOT_READ_RETRY_COUNT);
+    metrics_add(MetricSlotSkips, 1);
+    return false;
+}
+
+static void tcpip_notifySender()
+{
+    if (m_senderTask != NULL) {
+        xTaskNotifyGive(m_senderTask);
+    }
+}
+
+/*!
+ * \brief tcpip_takeDirty
+ * \return sensors or windows marked since previous call
+ */
+static uint32_t tcpip_takeDirty(atomic_uint *dirty)
+{
+    return atomic_exchange_explicit(dirty, 0, memory_order_acquire);
+}
+
+static void tcpip_markDirty(atomic_uint *dirty, size_t index)
+{
+    atomic_fetch_or_explicit(dirty, 1u << index, memory_order_release);
+}
+
+/*!
+ * \brief tcpip_valueChanged
+ * \return true if value differs from last sent value more than either
+ * deadband that is set, or any change when neither is set, or if heartbeat
+ * interval has passed
+ */
+static bool tcpip_valueChanged(const ClientSideSlot *slot, const SensorDescriptor *descriptor, int32_t value,
+                               uint32_t timestamp)
+{
+    int64_t difference, reference;
+
+    if (!slot->m_reportedSet
+        || (descriptor->m_heartbeatMs > 0 && timestamp - slot->m_reportedMs >= descriptor->m_heartbeatMs)) {
+        return true;
+    }
+    difference = (int64_t)(value) - slot->m_reported;
+    difference = difference < 0 ? -difference : difference;
+    reference = slot->m_reported < 0 ? -(int64_t)(slot->m_reported) : slot->m_reported;
+    if (difference == 0) {
+        return false;
+    }
+    if (descriptor->m_deadband <= 0 && descriptor->m_deadbandPpm == 0) {
+        return true;
+    }
+    return (descriptor->m_deadband > 0 && difference > descriptor->m_deadband)
+        || (descriptor->m_deadbandPpm > 0 && difference * 1000000 > reference * descriptor->m_deadbandPpm);
+}
+
+/*!
+ * \brief tcpip_setNewValueAt
+ * stores new value of sensor, never blocks. Value that is within deadband
+ * of last sent value is not stored, so it is not sent.
+ *
+ * \param sampleUs esp_timer time when sample was taken from sensor
+ */
+void tcpip_setNewValueAt(SensorType type, int32_t value, int64_t sampleUs)
+{
+    uint32_t timestamp = (uint32_t)(sampleUs / 1000);
+    size_t index = sensor_registry_slot(type);
+
+    if (index == SENSOR_SLOT_NONE) {
+        return;
+    }
+#if TCPIP_SEND_SUMMARIES
+    sensor_aggregate_addValue(type, tcpip_protocol_toBinaryValue(type, value), timestamp);
+#endif
+#if TCPIP_SEND_VALUES
+    ClientSideSlot *slot = &m_clientSide[index];
+    const SensorDescriptor *descriptor = sensor_registry_getSlot(index);
+
+    if (!tcpip_valueChanged(slot, descriptor, value, timestamp)) {
+        metrics_add(MetricValuesSuppressed, 1);
+        return;
     }
+    slot->m_reported = value;
+    slot->m_reportedMs = timestamp;
+    slot->m_reportedSet = true;
+
+    tcpip_writeBegin(&slot->m_lock);
+    slot->m_value.m_value = value;
+    slot->m_value.m_timestamp = timestamp;
+    slot->m_value.m_sequence++;
+    if (slot->m_value.m_sequence == 0) {
+        // 0 is reserved for values replayed from sample log
+        slot->m_value.m_sequence = 1;
+    }
+    tcpip_writeEnd(&slot->m_lock);
+    tcpip_markDirty(&m_dirty, index);
+    tcpip_notifySender();
+#endif
+}
+
+/*!
+ * \brief tcpip_setNewValue
+ * stores new value of sensor sampled just now
+ */
+void tcpip_setNewValue(SensorType type, int32_t value)
+{
+    tcpip_setNewValueAt(type, value, esp_timer_get_time());
+}
+
+/*!
+ * \brief tcpip_setNewSummary
+ * stores summary of ended aggregation window, never blocks
+ */
+void tcpip_setNewSummary(const SensorSummary *summary, size_t window)
+{
+#if TCPIP_SEND_SUMMARIES
+    size_t index = sensor_registry_slot(summary->m_type);
+    SummarySlot *slot;
 
-    return ' ';
+    if (index == SENSOR_SLOT_NONE) {
+        return;
+    }
+    slot = &m_summarySlot[index][window];
+    tcpip_writeBegin(&slot->m_lock);
+    slot->m_summary = *summary;
+    tcpip_writeEnd(&slot->m_lock);
+    tcpip_markDirty(&m_summaryDirty[window], index);
+    tcpip_notifySender();
+#else
+    (void)summary;
+    (void)window;
+#endif
 }
 
-static void tcpip_printLogValue(const char *buffer, bool sentOk)
+static bool tcpip_readSlot(size_t index, SensorType type, ClientSideValue *valueOut)
 {
-    printf("OK? %d : %s", (int)(sentOk), buffer);
+    ClientSideSlot *slot = &m_clientSide[index];
+    if (!tcpip_readLocked(&slot->m_lock, valueOut, &slot->m_value, sizeof(ClientSideValue))) {
+        return false;
+    }
+    valueOut->m_type = type;
+    return true;
 }
 
+static void tcpip_printLogValues(const void *buffer, size_t count, bool sentOk)
+{
+#if !TCPIP_PRINT_VALUES
+    (void)buffer;
+    (void)count;
+    (void)sentOk;
+#elif TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY
+    (void)buffer;
+    printf("OK? %d : %d values\n", (int)(sentOk), (int)(count));
+#else
+    (void)count;
+    printf("OK? %d : %s", (int)(sentOk), (const char *)buffer);
+#endif
+}
 
-static bool tcpip_sendValue(int sockClient, ClientSideValue *value)
+/*!
+ * \brief tcpip_send
+ * sends whole buffer, latency and failures are counted to metrics.
+ * Connection is marked lost on errors other than timeout, and when only
+ * part of buffer was sent, because receiver would lose framing.
+ */
+static bool tcpip_send(int sockClient, const void *buffer, size_t size)
 {
-    size_t i, c;
-    char buffer[124];
-    memset(buffer, '\0', 124*sizeof(char));
-    snprintf(buffer, 120, "I%c%f", tcpip_getSensorTypeChar(value->m_type), value->m_value);
+    int64_t start = esp_timer_get_time();
+#if TCPIP_TRANSPORT == TCPIP_TRANSPORT_UDP
+    bool sentOk = tcpip_datagram_send(&m_datagram, sockClient, buffer, size, (uint32_t)(start / 1000));
+#else
+    int rc = send(sockClient, buffer, size, 0);
+    bool sentOk = rc == (int)(size);
+#endif
 
-    c = strlen(buffer);
-    for (i=0;i<c;i++) {
-        if (buffer[i] == ',') {
-            buffer[i] = '.';
+    metrics_addLatency(MetricLatencySend, (uint32_t)(esp_timer_get_time() - start));
+    if (!sentOk) {
+        metrics_add(MetricSendFails, 1);
+#if TCPIP_TRANSPORT == TCPIP_TRANSPORT_TCP
+        if (rc > 0 || tcpip_connection_sendErrorIsFatal(errno)) {
+            m_connectionLost = true;
         }
+#endif
     }
-    while (1) {
-        c = strlen(buffer);
-        if (c <= 5) {
-            break;
+    return sentOk;
+}
+
+/*!
+ * \brief tcpip_collectValues
+ * writes unsent values to buffer, only slots marked dirty are visited
+ *
+ * \param sent bits of written slots, they are marked pending again if
+ * send fails
+ * \return bytes written to buffer
+ */
+static size_t tcpip_collectValues(uint8_t *buffer, size_t bufferSize, uint32_t now, uint32_t *sent, size_t *count)
+{
+#if TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY
+    size_t size = TCPIP_BINARY_HEADER_SIZE;
+#else
+    size_t size = 0;
+#endif
+    uint32_t dirty = m_pending | tcpip_takeDirty(&m_dirty);
+    const SensorDescriptor *descriptor;
+    ClientSideValue value;
+    size_t valueCount = 0;
+    uint32_t bit;
+    size_t i;
+
+    m_pending = 0;
+    while (dirty != 0) {
+        i = (size_t)(__builtin_ctz(dirty));
+        bit = 1u << i;
+        dirty &= ~bit;
+        descriptor = sensor_registry_getSlot(i);
+        if (descriptor == NULL) {
+            continue;
         }
-        if (buffer[c-1] == '0' && buffer[c-2] != '.') {
-            buffer[c-1] = '\0';
+        if (size + TCPIP_VALUE_SIZE > bufferSize
+            || (descriptor->m_sendPeriodMs > 0 && now - m_lastSent[i] < descriptor->m_sendPeriodMs)
+            || !tcpip_readSlot(i, descriptor->m_id, &value)) {
+            m_pending |= bit;
             continue;
         }
-        break;
+#if TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY
+        size += tcpip_protocol_writeBinaryRecord(buffer + size, &value);
+#else
+        size += tcpip_protocol_formatText((char *)buffer + size, TCPIP_TEXT_LINE_SIZE, &value);
+#endif
+        m_sentSampleMs[i] = value.m_timestamp;
+        *sent |= bit;
+        valueCount++;
+    }
+    if (valueCount == 0) {
+        return 0;
     }
-    strcat(buffer, "\n");
-    c = strlen(buffer);
+#if TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY
+    tcpip_protocol_writeBinaryHeader(buffer, (uint16_t)valueCount);
+#endif
+    *count += valueCount;
+    return size;
+}
 
-    if (send(sockClient, buffer, c, 0) == (int)(c)) {
-        value->m_sent = true;
-        tcpip_printLogValue(buffer, true);
-        return true;
+#if TCPIP_SEND_SUMMARIES
+/*!
+ * \brief tcpip_collectSummaries
+ * writes unsent window summaries to buffer, only slots marked dirty are
+ * visited
+ *
+ * \param sent bits of written slots per window
+ * \return bytes written to buffer
+ */
+static size_t tcpip_collectSummaries(uint8_t *buffer, size_t bufferSize, uint32_t *sent, size_t *count)
+{
+#if TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY
+    size_t size = TCPIP_BINARY_HEADER_SIZE;
+#else
+    size_t size = 0;
+#endif
+    SensorSummary summary;
+    SummarySlot *slot;
+    size_t summaryCount = 0;
+    uint32_t dirty, bit;
+    size_t i, w;
+
+    if (bufferSize < size) {
+        return 0;
+    }
+    for (w=0;w<AGGREGATE_WINDOW_COUNT;w++) {
+        dirty = m_summaryPending[w] | tcpip_takeDirty(&m_summaryDirty[w]);
+        m_summaryPending[w] = 0;
+        while (dirty != 0) {
+            i = (size_t)(__builtin_ctz(dirty));
+            bit = 1u << i;
+            dirty &= ~bit;
+            slot = &m_summarySlot[i][w];
+            if (size + TCPIP_SUMMARY_SIZE > bufferSize
+                || !tcpip_readLocked(&slot->m_lock, &summary, &slot->m_summary, sizeof(summary))) {
+                m_summaryPending[w] |= bit;
+                continue;
+            }
+#if TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY
+            size += tcpip_protocol_writeBinarySummary(buffer + size, &summary);
+#else
+            size += tcpip_protocol_formatSummaryText((char *)buffer + size, TCPIP_TEXT_SUMMARY_LINE_SIZE, &summary);
+#endif
+            sent[w] |= bit;
+            summaryCount++;
+        }
     }
+    if (summaryCount == 0) {
+        return 0;
+    }
+#if TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY
+    tcpip_protocol_writeBinarySummaryHeader(buffer, (uint16_t)summaryCount);
+#endif
+    *count += summaryCount;
+    return size;
+}
+#endif
 
-    tcpip_printLogValue(buffer, false);
-    return false;
+/*!
+ * \brief tcpip_sendPending
+ * \return true if some collected slots didn't fit to previous send
+ */
+static bool tcpip_sendPending()
+{
+#if TCPIP_SEND_SUMMARIES
+    size_t w;
+    for (w=0;w<AGGREGATE_WINDOW_COUNT;w++) {
+        if (m_summaryPending[w] != 0) {
+            return true;
+        }
+    }
+#endif
+    return m_pending != 0;
 }
 
-static bool tcpip_setUp()
+/*!
+ * \brief tcpip_markSent
+ * counts age of sent values from sample to end of send()
+ */
+static void tcpip_markSent(uint32_t sent, uint32_t now)
 {
-    int tcp_fail_count = 0;
-    bool sent = false;
+    uint32_t doneMs = (uint32_t)(esp_timer_get_time() / 1000);
+    uint64_t ageUs;
+    uint32_t bit;
     size_t i;
-    int sock_cli;
 
-    sock_cli = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    struct sockaddr_in servaddr;
-    memset(&servaddr, 0, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_port = htons(TCP_IP_PORT);
-    servaddr.sin_addr.s_addr = inet_addr(TCP_IP_ADDR);
+    while (sent != 0) {
+        i = (size_t)(__builtin_ctz(sent));
+        bit = 1u << i;
+        sent &= ~bit;
+        m_lastSent[i] = now;
+        // value that waited over 71 min for connection would wrap in us,
+        // it goes to last bucket instead
+        ageUs = (uint64_t)(doneMs - m_sentSampleMs[i]) * 1000;
+        metrics_addLatency(MetricLatencySampleToSend, ageUs < UINT32_MAX ? (uint32_t)(ageUs) : UINT32_MAX);
+    }
+}
 
-    if (connect(sock_cli, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0)
-    {
-        printf("Connecting to server failed\n");
-        return false;
+/*!
+ * \brief tcpip_sendValues
+ * sends unsent values and summaries, one send() per TCPIP_SEND_BUFFER_SIZE
+ */
+static void tcpip_sendValues(int sockClient, int *failCount)
+{
+    static uint8_t buffer[TCPIP_SEND_BUFFER_SIZE];
+    uint32_t now = (uint32_t)(esp_timer_get_time() / 1000);
+    uint32_t sent;
+#if TCPIP_SEND_SUMMARIES
+    uint32_t summarySent[AGGREGATE_WINDOW_COUNT];
+    size_t w;
+#endif
+    size_t count;
+    size_t size;
+    bool sentOk;
+
+    do {
+        sent = 0;
+        count = 0;
+        size = tcpip_collectValues(buffer, sizeof(buffer), now, &sent, &count);
+#if TCPIP_SEND_SUMMARIES
+        memset(summarySent, 0, sizeof(summarySent));
+        size += tcpip_collectSummaries(buffer + size, sizeof(buffer) - size, summarySent, &count);
+#endif
+        if (count == 0) {
+            return;
+        }
+
+        sentOk = tcpip_send(sockClient, buffer, size);
+        if (sentOk) {
+            tcpip_markSent(sent, now);
+            *failCount = 0;
+        } else {
+            m_pending |= sent;
+#if TCPIP_SEND_SUMMARIES
+            for (w=0;w<AGGREGATE_WINDOW_COUNT;w++) {
+                m_summaryPending[w] |= summarySent[w];
+            }
+#endif
+            (*failCount)++;
+        }
+        tcpip_printLogValues(buffer, count, sentOk);
+    } while (sentOk && tcpip_sendPending());
+}
+
+/*!
+ * \brief tcpip_sendStats
+ * sends runtime metrics every TCPIP_STATS_PERIOD_MS
+ */
+static void tcpip_sendStats(int sockClient, int *failCount)
+{
+#if TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY
+    static uint8_t buffer[TCPIP_BINARY_STATS_SIZE];
+#else
+    static char buffer[TCPIP_TEXT_STATS_SIZE];
+#endif
+    static int64_t lastSent = 0;
+    int64_t now = esp_timer_get_time();
+    MetricsSnapshot stats;
+    size_t size;
+
+    if (TCPIP_STATS_PERIOD_MS == 0 || now - lastSent < (int64_t)(TCPIP_STATS_PERIOD_MS) * 1000) {
+        return;
+    }
+    lastSent = now;
+    metrics_snapshot(&stats);
+#if TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY
+    size = tcpip_protocol_writeBinaryStats(buffer, &stats);
+#else
+    size = tcpip_protocol_formatStatsText(buffer, sizeof(buffer), &stats);
+#endif
+    if (tcpip_send(sockClient, buffer, size)) {
+        *failCount = 0;
+    } else {
+        (*failCount)++;
     }
+}
 
-    struct timeval tm;
-    tm.tv_sec = 1;
-    tm.tv_usec = 0;
+/*!
+ * \brief tcpip_syncClock
+ * exchanges clock sync with server every TCPIP_CLOCK_SYNC_PERIOD_MS
+ */
+static void tcpip_syncClock(int sockClient, int *failCount)
+{
+#if TCPIP_USE_CLOCK_SYNC
+    uint8_t buffer[TCPIP_CLOCK_REQUEST_SIZE];
+    size_t size = tcpip_clock_request(&m_clock, buffer);
 
-    int err = setsockopt(sock_cli, SOL_SOCKET, SO_RCVTIMEO, &tm, sizeof(tm));
-    if (err < 0) {
-        close(sock_cli);
-        return false;
+    if (size == 0) {
+        return;
     }
+    if (!tcpip_send(sockClient, buffer, size)) {
+        (*failCount)++;
+        return;
+    }
+    *failCount = 0;
+    tcpip_clock_receive(&m_clock, sockClient);
+#else
+    (void)sockClient;
+    (void)failCount;
+#endif
+}
 
-    printf("Connected to server\n" );
-    vTaskDelay(500/portTICK_PERIOD_MS);
-
-    while(1){
-        vTaskDelay(500/portTICK_PERIOD_MS);
-        sent = false;
-        pthread_mutex_lock(&m_mutex);
-        for (i=m_nextItemToSend;i<(size_t)(SensorTypeNA);i++) {
-            if (m_clientSide[i].m_sent == false) {
-                if (tcpip_sendValue(sock_cli, &m_clientSide[i])) {
-                    tcp_fail_count = 0;
-                } else {
-                    tcp_fail_count++;
-                }
-                sent = true;
-                m_nextItemToSend++;
-                break;
-            }
+#if TCPIP_USE_SAMPLE_LOG
+/*!
+ * \brief tcpip_replayAcked
+ * \return true when previous replayed batch is handled and next one can be
+ * sent. Batch whose datagram was lost is read from log again.
+ */
+static bool tcpip_replayAcked(int sockClient)
+{
+#if TCPIP_TRANSPORT == TCPIP_TRANSPORT_UDP
+    if (!m_replayWaiting) {
+        return true;
+    }
+    tcpip_datagram_poll(&m_datagram, sockClient, (uint32_t)(esp_timer_get_time() / 1000));
+    switch (tcpip_datagram_status(&m_datagram, m_replaySequence)) {
+        case TcpipDatagramWaiting:
+            return false;
+        case TcpipDatagramAcked:
+            sample_log_consume(&m_sampleLog);
+            break;
+        case TcpipDatagramLost:
+        default:
+            break;
+    }
+    m_replayWaiting = false;
+#else
+    (void)sockClient;
+#endif
+    return true;
+}
+
+/*!
+ * \brief tcpip_replaySampleLog
+ * sends values stored while offline, in batches of TCPIP_REPLAY_BATCH_SIZE.
+ * Over TCP batch is consumed from log when send() has taken it, over UDP
+ * when its datagram is acked, one batch at a time while new values go on.
+ *
+ * \return false if sending failed
+ */
+static bool tcpip_replaySampleLog(int sockClient, int *failCount)
+{
+    static SampleLogRecord records[TCPIP_REPLAY_BATCH_SIZE];
+    static uint8_t buffer[TCPIP_BINARY_REPLAY_HEADER_SIZE + TCPIP_BINARY_RECORD_SIZE * TCPIP_REPLAY_BATCH_SIZE];
+    size_t count, size, i;
+
+    while (m_sampleLogReady && tcpip_replayAcked(sockClient)
+           && (count = sample_log_read(&m_sampleLog, records, TCPIP_REPLAY_BATCH_SIZE)) > 0) {
+        // records of one read are from same boot
+        size = tcpip_protocol_writeBinaryReplayHeader(buffer, (uint16_t)count, records[0].m_boot,
+                                                      sample_log_boot(&m_sampleLog));
+        for (i=0;i<count;i++) {
+            // sequence 0 tells that value is replayed from log
+            size += tcpip_protocol_writeBinaryFields(buffer + size, records[i].m_sensor, 0,
+                                                     records[i].m_timestamp, records[i].m_value);
         }
-        if (!sent) {
-            for (i=0;i<(size_t)(m_nextItemToSend);i++) {
-                if (m_clientSide[i].m_sent == false) {
-                    if (tcpip_sendValue(sock_cli, &m_clientSide[i])) {
-                        tcp_fail_count = 0;
-                    } else {
-                        tcp_fail_count++;
-                    }
-                    sent = true;
-                    m_nextItemToSend++;
-                    break;
-                }
-            }
+        if (!tcpip_send(sockClient, buffer, size)) {
+            (*failCount)++;
+            tcpip_printLogValues(buffer, count, false);
+            return false;
+        }
+        *failCount = 0;
+        tcpip_printLogValues(buffer, count, true);
+#if TCPIP_TRANSPORT == TCPIP_TRANSPORT_UDP
+        m_replaySequence = tcpip_datagram_lastSequence(&m_datagram);
+        m_replayWaiting = true;
+#else
+        sample_log_consume(&m_sampleLog);
+#endif
+    }
+    return true;
+}
+
+/*!
+ * \brief tcpip_logValues
+ * moves unsent values to sample log
+ */
+static void tcpip_logValues()
+{
+    const SensorDescriptor *descriptor;
+    ClientSideValue value;
+    uint32_t dirty, bit;
+    size_t i;
+
+    if (!m_sampleLogReady) {
+        return;
+    }
+    dirty = m_pending | tcpip_takeDirty(&m_dirty);
+    m_pending = 0;
+    while (dirty != 0) {
+        i = (size_t)(__builtin_ctz(dirty));
+        bit = 1u << i;
+        dirty &= ~bit;
+        descriptor = sensor_registry_getSlot(i);
+        if (descriptor == NULL) {
+            continue;
         }
-        if (m_nextItemToSend == (size_t)(SensorTypeNA)) {
-            m_nextItemToSend = 0;
+        if (!tcpip_readSlot(i, descriptor->m_id, &value)) {
+            m_pending |= bit;
+            continue;
         }
+        sample_log_append(&m_sampleLog, descriptor->m_id, value.m_timestamp, tcpip_protocol_getBinaryValue(&value));
+    }
+}
+#endif
 
-        pthread_mutex_unlock(&m_mutex);
-        if (tcp_fail_count > 10 || wifi_connect_get_connected() == 0) {
-            break;
+/*!
+ * \brief tcpip_waitOffline
+ * waits while there is no connection to server, new values are stored to
+ * sample log meanwhile
+ */
+static void tcpip_waitOffline(TickType_t timeout)
+{
+#if TCPIP_USE_SAMPLE_LOG
+    TickType_t start = xTaskGetTickCount();
+    TickType_t elapsed = 0;
+    while (elapsed < timeout) {
+        ulTaskNotifyTake(pdTRUE, timeout - elapsed);
+        tcpip_logValues();
+        elapsed = xTaskGetTickCount() - start;
+    }
+#else
+    vTaskDelay(timeout);
+#endif
+}
+
+static bool tcpip_connectionUsable(int sockClient, int failCount)
+{
+#if TCPIP_TRANSPORT == TCPIP_TRANSPORT_UDP
+    // no connection state, socket is opened again after failed sends
+    (void)sockClient;
+    return failCount < TCPIP_MAX_SEND_FAILS && wifi_connect_get_connected() != 0;
+#else
+    return !m_connectionLost && failCount < TCPIP_MAX_SEND_FAILS && wifi_connect_get_connected() != 0
+        && tcpip_connection_alive(sockClient);
+#endif
+}
+
+/*!
+ * \brief tcpip_waitTimeout
+ * sender wakes up for retransmits while datagrams wait for ack
+ */
+static TickType_t tcpip_waitTimeout(int sockClient)
+{
+#if TCPIP_TRANSPORT == TCPIP_TRANSPORT_UDP
+    tcpip_datagram_poll(&m_datagram, sockClient, (uint32_t)(esp_timer_get_time() / 1000));
+#if TCPIP_USE_SAMPLE_LOG
+    if (m_replayWaiting) {
+        return pdMS_TO_TICKS(TCPIP_REPLAY_ACK_POLL_MS);
+    }
+#endif
+    if (tcpip_datagram_waitingAck(&m_datagram)) {
+        return pdMS_TO_TICKS(TCPIP_DATAGRAM_RETRANSMIT_MS);
+    }
+#else
+    (void)sockClient;
+#endif
+    return TCPIP_SEND_IDLE_TIMEOUT_MS/portTICK_PERIOD_MS;
+}
+
+/*!
+ * \brief tcpip_setUp
+ * connects to server and sends values until connection is lost
+ *
+ * \return false if connecting failed
+ */
+static bool tcpip_setUp()
+{
+    int tcp_fail_count = 0;
+#if TCPIP_TRANSPORT == TCPIP_TRANSPORT_UDP
+    int sock_cli = tcpip_datagram_open(TCP_IP_ADDR, TCP_IP_PORT);
+#else
+    int sock_cli = tcpip_connection_open(TCP_IP_ADDR, TCP_IP_PORT, TCPIP_CONNECT_TIMEOUT_MS);
+#endif
+
+    if (sock_cli < 0) {
+        printf("Connecting to server failed\n");
+        return false;
+    }
+    m_connectionLost = false;
+#if TCPIP_USE_CLOCK_SYNC
+    // server may have restarted, so clock is synced again
+    tcpip_clock_reset(&m_clock);
+#endif
+    metrics_add(MetricReconnects, 1);
+    printf("Connected to server\n" );
+
+    while (tcpip_connectionUsable(sock_cli, tcp_fail_count)) {
+#if TCPIP_USE_SAMPLE_LOG
+        // values logged while offline are sent before new values
+        if (!tcpip_replaySampleLog(sock_cli, &tcp_fail_count)) {
+            continue;
+        }
+#endif
+        // woken by tcpip_setNewValue(), or after timeout to check connection
+        if (ulTaskNotifyTake(pdTRUE, tcpip_waitTimeout(sock_cli)) > 0) {
+#if POWER_SAVE
+            // values of whole wake window go to same send, radio sleeps between
+            vTaskDelay(power_ticksToWakeWindow(POWER_SEND_OFFSET_MS));
+            ulTaskNotifyTake(pdTRUE, 0);
+#else
+            if (TCPIP_SEND_COALESCE_MS > 0) {
+                // collect values set close to each other to same send
+                vTaskDelay(TCPIP_SEND_COALESCE_MS/portTICK_PERIOD_MS);
+                ulTaskNotifyTake(pdTRUE, 0);
+            }
+#endif
         }
+        tcpip_sendValues(sock_cli, &tcp_fail_count);
+        tcpip_sendStats(sock_cli, &tcp_fail_count);
+        tcpip_syncClock(sock_cli, &tcp_fail_count);
     }
 
-    close(sock_cli);
+    printf("Connection to server lost\n");
+    tcpip_connection_close(sock_cli);
     return true;
 }
 
 void tcpip_sender_init()
 {
+    TcpipBackoff backoff;
+
     printf("tcp sender init().\n");
-    m_nextItemToSend = 0;
-    size_t i;
-    for (i=0;i<(size_t)(SensorTypeNA);i++) {
-        m_clientSide[i].m_type = (SensorType)(i);
-        m_clientSide[i].m_sent = true;
-        m_clientSide[i].m_value = 0;
+    m_senderTask = xTaskGetCurrentTaskHandle();
+    metrics_registerTask();
+#if TCPIP_USE_SAMPLE_LOG
+    m_sampleLogReady = sample_log_initPartition(&m_sampleLog, SAMPLE_LOG_PARTITION_LABEL);
+    if (!m_sampleLogReady) {
+        printf("sample log partition not found\n");
     }
+#endif
     printf("tcp sender init() setup");
+    tcpip_connection_backoffReset(&backoff);
     while (1) {
-        vTaskDelay(1);
         if (wifi_connect_get_connected() == 0) {
             printf("wifi not connected\n");
-            vTaskDelay(500);
+            tcpip_waitOffline(500);
             continue;
         }
         printf("tcp sender init()x setup");
-        tcpip_setUp();
-        vTaskDelay(500/ portTICK_PERIOD_MS);
+        if (tcpip_setUp()) {
+            // connection was up, so server is reachable again
+            tcpip_connection_backoffReset(&backoff);
+        }
+        tcpip_waitOffline(pdMS_TO_TICKS(tcpip_connection_backoffNext(&backoff)));
     }
 }
\ No newline at end of file
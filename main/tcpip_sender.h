@@ -12,30 +12,79 @@
 #ifndef TCPIP_SENDER_H
 #define TCPIP_SENDER_H
 
-#define BUFFER_SIZE 1024
+#include "sdkconfig.h"
+
+// options are set in Kconfig, menu "Weather sensors" / "Network"
+
+// sender waits this long after first new value before sending, so values
+// set close to each other go to same send()
+#define TCPIP_SEND_COALESCE_MS      CONFIG_WEATHER_SEND_COALESCE_MS
+// sender wakes up at least this often to check connection
+#define TCPIP_SEND_IDLE_TIMEOUT_MS  500
+// every new value is sent, can be disabled when window summaries are enough
+#if CONFIG_WEATHER_SEND_VALUES
+#define TCPIP_SEND_VALUES           1
+#else
+#define TCPIP_SEND_VALUES           0
+#endif
+// min/max/mean/stddev/ewma summary of every aggregation window is sent
+#if CONFIG_WEATHER_SEND_SUMMARIES
+#define TCPIP_SEND_SUMMARIES        1
+#else
+#define TCPIP_SEND_SUMMARIES        0
+#endif
+
+// TCP stream, or UDP datagrams with acks (tcpip_datagram.h), to same port
+#define TCPIP_TRANSPORT_TCP         0
+#define TCPIP_TRANSPORT_UDP         1
+#if CONFIG_WEATHER_TRANSPORT_UDP
+#define TCPIP_TRANSPORT             TCPIP_TRANSPORT_UDP
+#else
+#define TCPIP_TRANSPORT             TCPIP_TRANSPORT_TCP
+#endif
+
+// runtime metrics are sent this often, 0 = never
+#define TCPIP_STATS_PERIOD_MS       CONFIG_WEATHER_STATS_PERIOD_MS
+// every sent message is printed to console
+#define TCPIP_PRINT_VALUES          0
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "sensor_registry.h"
 
-typedef enum
+/*
+* Value is fixed point in native format of the sensor, see m_divisor of
+* SensorDescriptor: 0.01 C, Q22.10 %RH, Q24.8 Pa, ug/m3
+*/
+typedef struct
 {
-    SensorTypeTemperature = 0,
-    SensorTypeHumid,
-    SensorTypePresure,
-    SensorTypePM10,
-    SensorTypePM25,
-    SensorTypePM100,
-    SensorTypeNA,
-} SensorType;
+    int32_t m_value;
+    SensorType m_type;
+    uint32_t m_timestamp;   // ms since boot when sample was taken
+    uint16_t m_sequence;    // increased on every new value of this type
+} ClientSideValue;
 
+/*
+* Summary of one aggregation window, values are fixed point with binary
+* protocol scale of the sensor type
+*/
 typedef struct
 {
-    double m_value;
     SensorType m_type;
-    bool m_sent;
-} ClientSideValue;
+    uint32_t m_windowMs;
+    uint32_t m_timestamp;   // ms since boot when window ended
+    uint16_t m_count;       // values in window
+    int32_t m_min;
+    int32_t m_max;
+    int32_t m_mean;
+    int32_t m_stddev;
+    int32_t m_ewma;
+} SensorSummary;
 
 void tcpip_sender_init();
-void tcpip_setNewValue(SensorType type, double value);
+void tcpip_setNewValue(SensorType type, int32_t value);
+void tcpip_setNewValueAt(SensorType type, int32_t value, int64_t sampleUs);
+void tcpip_setNewSummary(const SensorSummary *summary, size_t window);
 
 #endif // TCPIP_SENDER_H
\ No newline at end of file
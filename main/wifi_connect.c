@@ -16,7 +16,14 @@
 #include "esp_event.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
+#include "sdkconfig.h"
+#include "power_manager.h"
+#if CONFIG_WEATHER_USE_DEFAULT_VALUES
 #include "default_values.h"
+#else
+#define WIFI_SSID               CONFIG_WEATHER_WIFI_SSID
+#define WIFI_PASS               CONFIG_WEATHER_WIFI_PASSWORD
+#endif
 
 #define WIFI_MAXIMUM_RETRY      10
 #define WIFI_CONNECTED_BIT      BIT0
@@ -92,7 +99,12 @@ void wifi_init_sta(void)
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
     ESP_ERROR_CHECK(esp_wifi_start() );
+#if POWER_SAVE
+    // radio sleeps between DTIM beacons, sends are grouped to wake windows
+    esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+#else
     esp_wifi_set_ps(WIFI_PS_NONE);
+#endif
     ESP_LOGI(TAG, "wifi_init_sta finished.");
 
     EventBits_t bits = xEventGroupWaitBits(m_wifi_event_group,
@@ -0,0 +1,104 @@
+/*!
+ * \file
+ * \brief file aggregate_test.c
+ *
+ * accuracy test of window summaries
+ * Pressure at binary scale, about 1e8, with 1 Pa noise and 3 Pa drift is
+ * aggregated every 10 ms in windows of 600 and 6000 values. Summaries that
+ * sensor_aggregate.c gives to sender are compared with exact values of the
+ * same samples: min, max and mean must be exact, stddev and EWMA within
+ * rounding.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "sensor_aggregate.h"
+
+#define TEST_PERIOD_MS      10
+#define TEST_VALUES         (CONFIG_WEATHER_AGGREGATE_LONG_WINDOW_MS / TEST_PERIOD_MS)
+// 1013.25 hPa at scale 3 of binary protocol
+#define TEST_BASE           101325000
+#define TEST_NOISE          1000    // 1 Pa
+#define TEST_DRIFT          3000    // 3 Pa over long window
+
+static int32_t m_value[TEST_VALUES + 1];
+static double m_ewma[TEST_VALUES + 1];     // after value of same index
+static int m_summaries[AGGREGATE_WINDOW_COUNT];
+static bool m_ok = true;
+static uint32_t m_seed = 1;
+
+static uint32_t test_random(void)
+{
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+static bool test_near(const char *name, size_t window, int64_t value, int64_t expected, int64_t tolerance)
+{
+    if (llabs(value - expected) <= tolerance) {
+        return true;
+    }
+    printf("window %d: %s %" PRId64 ", expected %" PRId64 "\n", (int)(window), name, value, expected);
+    return false;
+}
+
+/*!
+ * \brief tcpip_setNewSummary
+ * sender of the test, checks summary against samples of its window
+ */
+void tcpip_setNewSummary(const SensorSummary *summary, size_t window)
+{
+    size_t first = (summary->m_timestamp - summary->m_windowMs) / TEST_PERIOD_MS;
+    size_t count = summary->m_windowMs / TEST_PERIOD_MS;
+    int32_t min = m_value[first], max = m_value[first];
+    int64_t sum = 0;
+    double mean, squares = 0.0;
+    size_t i;
+
+    for (i=first;i<first+count;i++) {
+        sum += m_value[i];
+        min = m_value[i] < min ? m_value[i] : min;
+        max = m_value[i] > max ? m_value[i] : max;
+    }
+    mean = (double)(sum) / count;
+    for (i=first;i<first+count;i++) {
+        squares += (m_value[i] - mean) * (m_value[i] - mean);
+    }
+    m_ok &= test_near("count", window, summary->m_count, (int64_t)(count), 0);
+    m_ok &= test_near("min", window, summary->m_min, min, 0);
+    m_ok &= test_near("max", window, summary->m_max, max, 0);
+    m_ok &= test_near("mean", window, summary->m_mean, llround(mean), 0);
+    m_ok &= test_near("stddev", window, summary->m_stddev, llround(sqrt(squares / count)), 1);
+    // EWMA of values before the one that ended window
+    m_ok &= test_near("ewma", window, summary->m_ewma, llround(m_ewma[first + count - 1]), 1);
+    m_summaries[window]++;
+}
+
+int main(void)
+{
+    const double alpha = AGGREGATE_EWMA_ALPHA / 1000.0;
+    int32_t noise;
+    size_t i;
+
+    for (i=0;i<=TEST_VALUES;i++) {
+        noise = (int32_t)(test_random() % (2 * TEST_NOISE + 1)) - TEST_NOISE;
+        m_value[i] = TEST_BASE + (int32_t)((int64_t)(TEST_DRIFT) * (int64_t)(i) / TEST_VALUES) + noise;
+        m_ewma[i] = i == 0 ? m_value[i] : m_ewma[i - 1] + alpha * (m_value[i] - m_ewma[i - 1]);
+    }
+    // last value ends long window
+    for (i=0;i<=TEST_VALUES;i++) {
+        sensor_aggregate_addValue(SensorTypePresure, m_value[i], (uint32_t)(i * TEST_PERIOD_MS));
+    }
+    m_ok &= m_summaries[0] == CONFIG_WEATHER_AGGREGATE_LONG_WINDOW_MS / CONFIG_WEATHER_AGGREGATE_SHORT_WINDOW_MS;
+    m_ok &= m_summaries[1] == 1;
+    printf("%d short and %d long windows\n", m_summaries[0], m_summaries[1]);
+    printf("aggregate_test %s\n", m_ok ? "passed" : "FAILED");
+    return m_ok ? 0 : 1;
+}
@@ -0,0 +1,349 @@
+/*!
+ * \file
+ * \brief file capture_replay_test.c
+ *
+ * regression test of bus capture replay
+ * Capture of two BME280 sensors on two I2C ports and of PMS5003 UART data
+ * with noise, corrupted and truncated frames is written to RAM flash and
+ * replayed through bme280_reader_feed() and psm_reader_feed() like
+ * HAL_CAPTURE_REPLAY does. Values given to sender must equal compensated
+ * values of every burst and values of every intact frame, in order.
+ * Replay speed is reported against capture time.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bus_capture.h"
+#include "bme280_reader.h"
+#include "psm_parser.h"
+#include "psm_reader.h"
+#include "tcpip_sender.h"
+
+#define TEST_FLASH_SIZE     (64 * BUS_CAPTURE_SECTOR_SIZE)
+#define TEST_DEVICES        2
+#define TEST_READINGS       2000
+#define TEST_PERIOD_MS      1000
+#define TEST_MAX_VALUES     (TEST_READINGS * 3 * (TEST_DEVICES + 1))
+#define TEST_STREAM_SIZE    (TEST_READINGS * 3 * PSM_FRAME_SIZE)
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        return false; \
+    } \
+} while (0)
+
+/*
+* Values of one sensor in order they were given to sender
+*/
+typedef struct
+{
+    int32_t m_values[TEST_READINGS];
+    size_t m_count;
+} TestSeries;
+
+static const bme280_device_config m_devices[TEST_DEVICES] = {
+    { 0, BME280_ADDRESS, SensorTypeTemperature, SensorTypeHumid, SensorTypePresure },
+    { 1, BME280_ADDRESS_SECONDARY, SensorTypeTemperature2, SensorTypeHumid2, SensorTypePresure2 },
+};
+// datasheet example, second sensor has other trimming
+static const bme280_calib_data m_calib[TEST_DEVICES] = {
+    { .dig_T1 = 27504, .dig_T2 = 26435, .dig_T3 = -1000,
+      .dig_P1 = 36477, .dig_P2 = -10685, .dig_P3 = 3024, .dig_P4 = 2855, .dig_P5 = 140,
+      .dig_P6 = -7, .dig_P7 = 15500, .dig_P8 = -14600, .dig_P9 = 6000,
+      .dig_H1 = 75, .dig_H2 = 362, .dig_H3 = 0, .dig_H4 = 324, .dig_H5 = 50, .dig_H6 = 30 },
+    { .dig_T1 = 28485, .dig_T2 = 26319, .dig_T3 = 50,
+      .dig_P1 = 37712, .dig_P2 = -10538, .dig_P3 = 3024, .dig_P4 = 7893, .dig_P5 = -103,
+      .dig_P6 = -7, .dig_P7 = 9900, .dig_P8 = -10230, .dig_P9 = 4285,
+      .dig_H1 = 75, .dig_H2 = 353, .dig_H3 = 0, .dig_H4 = 340, .dig_H5 = 0, .dig_H6 = 30 },
+};
+
+static uint8_t m_flash[TEST_FLASH_SIZE];
+static uint8_t m_stream[TEST_STREAM_SIZE];
+static TestSeries m_expected[SensorTypeBuiltinCount];
+static TestSeries m_replayed[SensorTypeBuiltinCount];
+static uint32_t m_seed = 1;
+
+static uint32_t test_random(void)
+{
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+/*!
+ * \brief tcpip_setNewValueAt
+ * sender of firmware is replaced by recorder of values
+ */
+void tcpip_setNewValueAt(SensorType type, int32_t value, int64_t sampleUs)
+{
+    TestSeries *series = &m_replayed[type];
+    if (type < SensorTypeBuiltinCount && series->m_count < TEST_READINGS) {
+        series->m_values[series->m_count++] = value;
+    }
+}
+
+static void test_expect(SensorType type, int32_t value)
+{
+    TestSeries *series = &m_expected[type];
+    if (series->m_count < TEST_READINGS) {
+        series->m_values[series->m_count++] = value;
+    }
+}
+
+static bool test_flashRead(void *context, uint32_t address, void *data, size_t size)
+{
+    memcpy(data, m_flash + address, size);
+    return true;
+}
+
+static bool test_flashWrite(void *context, uint32_t address, const void *data, size_t size)
+{
+    size_t i;
+    for (i=0;i<size;i++) {
+        m_flash[address + i] &= ((const uint8_t *)data)[i];
+    }
+    return true;
+}
+
+static bool test_flashErase(void *context, uint32_t address, size_t size)
+{
+    memset(m_flash + address, 0xFF, size);
+    return true;
+}
+
+static const BusCaptureFlash m_flashOps = {
+    .read = test_flashRead,
+    .write = test_flashWrite,
+    .erase = test_flashErase,
+    .context = NULL,
+    .size = TEST_FLASH_SIZE,
+};
+
+static void test_put16(uint8_t *reg, uint16_t value)
+{
+    reg[0] = (uint8_t)(value);
+    reg[1] = (uint8_t)(value >> 8);
+}
+
+/*!
+ * \brief test_captureCalibration
+ * calibration bursts as bme280_reader reads them, 0x88..0xA1 and 0xE1..0xE7
+ */
+static bool test_captureCalibration(BusCapture *capture, size_t device, uint32_t timestamp)
+{
+    const bme280_calib_data *cal = &m_calib[device];
+    uint8_t tp[BME280_REGISTER_DIG_H1 - BME280_REGISTER_DIG_T1 + 1];
+    uint8_t h[BME280_REGISTER_DIG_H6 - BME280_REGISTER_DIG_H2 + 1];
+    uint8_t address = BUS_CAPTURE_I2C_ADDRESS(m_devices[device].port, m_devices[device].address);
+    const int16_t p[8] = { cal->dig_P2, cal->dig_P3, cal->dig_P4, cal->dig_P5,
+                           cal->dig_P6, cal->dig_P7, cal->dig_P8, cal->dig_P9 };
+    size_t i;
+
+    memset(tp, 0, sizeof(tp));
+    test_put16(tp, cal->dig_T1);
+    test_put16(tp + 2, (uint16_t)(cal->dig_T2));
+    test_put16(tp + 4, (uint16_t)(cal->dig_T3));
+    test_put16(tp + 6, cal->dig_P1);
+    for (i=0;i<8;i++) {
+        test_put16(tp + 8 + 2 * i, (uint16_t)(p[i]));
+    }
+    tp[BME280_REGISTER_DIG_H1 - BME280_REGISTER_DIG_T1] = cal->dig_H1;
+    test_put16(h, (uint16_t)(cal->dig_H2));
+    h[2] = cal->dig_H3;
+    h[3] = (uint8_t)(cal->dig_H4 >> 4);
+    h[4] = (uint8_t)((cal->dig_H4 & 0xF) | ((cal->dig_H5 & 0xF) << 4));
+    h[5] = (uint8_t)(cal->dig_H5 >> 4);
+    h[6] = (uint8_t)(cal->dig_H6);
+    return bus_capture_i2cRead(capture, address, BME280_REGISTER_DIG_T1, tp, sizeof(tp), timestamp)
+        && bus_capture_i2cRead(capture, address, BME280_REGISTER_DIG_H2, h, sizeof(h), timestamp);
+}
+
+/*!
+ * \brief test_captureReading
+ * data burst 0xF7..0xFE of random raw values, 0..50 C, 900..1100 hPa
+ */
+static bool test_captureReading(BusCapture *capture, size_t device, uint32_t timestamp)
+{
+    const bme280_device_config *config = &m_devices[device];
+    bme280_raw_data raw;
+    bme280_values values;
+    uint8_t data[BME280_RAW_DATA_SIZE];
+
+    raw.temperature = 440000 + test_random() % 160000;
+    raw.pressure = 330000 + test_random() % 160000;
+    raw.humidity = 20000 + test_random() % 30000;
+    data[0] = (uint8_t)(raw.pressure >> 12);
+    data[1] = (uint8_t)(raw.pressure >> 4);
+    data[2] = (uint8_t)(raw.pressure << 4);
+    data[3] = (uint8_t)(raw.temperature >> 12);
+    data[4] = (uint8_t)(raw.temperature >> 4);
+    data[5] = (uint8_t)(raw.temperature << 4);
+    data[6] = (uint8_t)(raw.humidity >> 8);
+    data[7] = (uint8_t)(raw.humidity);
+    bme280_reader_compensate(&m_calib[device], &raw, &values);
+    test_expect(config->temperature, values.temperature);
+    test_expect(config->humid, values.humidity);
+    test_expect(config->pressure, values.pressure);
+    return bus_capture_i2cRead(capture, BUS_CAPTURE_I2C_ADDRESS(config->port, config->address),
+                               BME280_REGISTER_PRESSUREDATA, data, sizeof(data), timestamp);
+}
+
+static size_t test_putFrame(uint8_t *out, const uint16_t *pm)
+{
+    uint16_t checksum = 0;
+    size_t i;
+
+    memset(out, 0, PSM_FRAME_SIZE);
+    out[0] = FIXED_CHAR0;
+    out[1] = FIXED_CHAR1;
+    out[3] = PSM_FRAME_LENGTH;
+    for (i=0;i<3;i++) {
+        out[4 + 2*i] = (uint8_t)(pm[i] >> 8);
+        out[5 + 2*i] = (uint8_t)(pm[i]);
+    }
+    for (i=0;i<PSM_FRAME_SIZE-2;i++) {
+        checksum += out[i];
+    }
+    out[PSM_FRAME_SIZE - 2] = (uint8_t)(checksum >> 8);
+    out[PSM_FRAME_SIZE - 1] = (uint8_t)(checksum);
+    return PSM_FRAME_SIZE;
+}
+
+/*!
+ * \brief test_putGlitchyFrame
+ * frame as sensor sent it, intact frames are expected from replay. Noise,
+ * corrupted and truncated frames are like ones of sensors on long cable.
+ */
+static size_t test_putGlitchyFrame(uint8_t *out)
+{
+    uint16_t pm[3];
+    size_t size = 0, i;
+
+    pm[0] = (uint16_t)(test_random() % 500);
+    pm[1] = (uint16_t)(pm[0] + test_random() % 200);
+    pm[2] = (uint16_t)(pm[1] + test_random() % 200);
+    switch (test_random() % 8) {
+        case 0:
+            // noise before frame, may have false frame start
+            for (i=test_random() % 16;i>0;i--) {
+                out[size++] = test_random() % 4 == 0 ? FIXED_CHAR0 : (uint8_t)(test_random());
+            }
+            break;
+        case 1:
+            // corrupted frame is dropped
+            test_putFrame(out, pm);
+            out[4 + test_random() % (PSM_FRAME_SIZE - 6)] ^= (uint8_t)(1 + test_random() % 255);
+            return PSM_FRAME_SIZE;
+        case 2:
+            // start of frame that was cut
+            size = test_putFrame(out, pm) - 1 - test_random() % (PSM_FRAME_SIZE - 2);
+            break;
+        default:
+            break;
+    }
+    size += test_putFrame(out + size, pm);
+    for (i=0;i<3;i++) {
+        test_expect((SensorType)(SensorTypePM10 + i), pm[i]);
+    }
+    return size;
+}
+
+/*!
+ * \brief test_capture
+ * readings of every sensor once per TEST_PERIOD_MS, UART data in random
+ * sized reads like UART driver events give it
+ */
+static bool test_capture(BusCapture *capture, uint32_t *spanMs)
+{
+    size_t streamSize = 0, streamSent = 0, part, device;
+    uint32_t timestamp = 0;
+    int reading;
+
+    CHECK(bus_capture_init(capture, &m_flashOps));
+    for (device=0;device<TEST_DEVICES;device++) {
+        CHECK(test_captureCalibration(capture, device, timestamp));
+    }
+    for (reading=0;reading<TEST_READINGS;reading++) {
+        timestamp += TEST_PERIOD_MS;
+        for (device=0;device<TEST_DEVICES;device++) {
+            CHECK(test_captureReading(capture, device, timestamp));
+        }
+        streamSize += test_putGlitchyFrame(m_stream + streamSize);
+        while (streamSent < streamSize) {
+            part = 1 + test_random() % 600;
+            if (part > streamSize - streamSent) {
+                part = streamSize - streamSent;
+            }
+            CHECK(bus_capture_uartRx(capture, m_stream + streamSent, part, timestamp));
+            streamSent += part;
+        }
+    }
+    *spanMs = timestamp;
+    return true;
+}
+
+static void test_replayI2cRead(void *context, uint8_t address, uint8_t reg, const uint8_t *data, size_t size,
+                               uint32_t timestamp)
+{
+    bme280_reader_feed(BUS_CAPTURE_I2C_PORT(address), address & 0x7F, reg, data, size);
+}
+
+static void test_replayUartRx(void *context, const uint8_t *data, size_t size, uint32_t timestamp)
+{
+    psm_reader_feed(data, size);
+}
+
+static double test_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static bool test_replay(void)
+{
+    const BusCaptureHandler handler = {
+        .i2cRead = test_replayI2cRead,
+        .uartRx = test_replayUartRx,
+        .context = NULL,
+    };
+    BusCapture capture;
+    uint32_t spanMs, records;
+    double start, seconds;
+    size_t type, i;
+
+    CHECK(bme280_reader_set_devices(m_devices, TEST_DEVICES));
+    CHECK(test_capture(&capture, &spanMs));
+    psm_init_parser();
+    start = test_seconds();
+    records = bus_capture_replay(&m_flashOps, &handler);
+    seconds = test_seconds() - start;
+    CHECK(records > TEST_READINGS * (TEST_DEVICES + 1));
+
+    for (type=0;type<SensorTypeBuiltinCount;type++) {
+        CHECK(m_expected[type].m_count == TEST_READINGS || type >= SensorTypePM10);
+        CHECK(m_replayed[type].m_count == m_expected[type].m_count);
+        for (i=0;i<m_expected[type].m_count;i++) {
+            CHECK(m_replayed[type].m_values[i] == m_expected[type].m_values[i]);
+        }
+    }
+    printf("replayed %" PRIu32 " records, %" PRIu32 " bytes, %zu frames of %" PRIu32 " s capture in %.1f ms, "
+           "%.0f times real time\n", records, capture.m_offset, m_expected[SensorTypePM10].m_count,
+           spanMs / 1000, seconds * 1000, (double)(spanMs) / 1000 / seconds);
+    return true;
+}
+
+int main(void)
+{
+    bool ok = test_replay();
+    printf("capture_replay_test %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
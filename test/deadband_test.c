@@ -0,0 +1,150 @@
+/*!
+ * \file
+ * \brief file deadband_test.c
+ *
+ * test of deadbands and heartbeat of sender
+ * Channels are registered with absolute deadband, relative (ppm)
+ * deadband, both and neither. New value must be sent when it differs from
+ * last sent value more than either deadband that is set, and unchanged
+ * value again after heartbeat. Values are set without sender task, so
+ * suppressed values are seen in runtime metrics.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sensor_registry.h"
+#include "tcpip_sender.h"
+#include "metrics.h"
+
+#define TEST_HEARTBEAT_MS   60000
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        return false; \
+    } \
+} while (0)
+
+static uint32_t m_timeMs = 1000;
+
+static SensorType test_register(int32_t deadband, uint32_t deadbandPpm)
+{
+    const SensorDescriptor descriptor = {
+        .m_code = 'x',
+        .m_unit = "",
+        .m_scale = 0,
+        .m_divisor = 1,
+        .m_samplePeriodMs = 1000,
+        .m_sendPeriodMs = 0,
+        .m_deadband = deadband,
+        .m_deadbandPpm = deadbandPpm,
+        .m_heartbeatMs = TEST_HEARTBEAT_MS,
+    };
+    return sensor_registry_register(&descriptor);
+}
+
+/*!
+ * \brief test_sent
+ * \return true if value was stored for sending, false if it was suppressed
+ */
+static bool test_sent(SensorType type, int32_t value)
+{
+    MetricsSnapshot before, after;
+
+    metrics_snapshot(&before);
+    m_timeMs += 10;
+    tcpip_setNewValueAt(type, value, (int64_t)(m_timeMs) * 1000);
+    metrics_snapshot(&after);
+    return after.m_counter[MetricValuesSuppressed] == before.m_counter[MetricValuesSuppressed];
+}
+
+static bool test_noDeadband(void)
+{
+    SensorType type = test_register(0, 0);
+
+    CHECK(type != SENSOR_TYPE_INVALID);
+    CHECK(test_sent(type, 100000));
+    CHECK(!test_sent(type, 100000));
+    CHECK(test_sent(type, 100001));
+    CHECK(test_sent(type, 100000));
+    return true;
+}
+
+static bool test_absolute(void)
+{
+    SensorType type = test_register(10, 0);
+
+    CHECK(type != SENSOR_TYPE_INVALID);
+    CHECK(test_sent(type, 100000));
+    CHECK(!test_sent(type, 100010));
+    CHECK(!test_sent(type, 99990));
+    CHECK(test_sent(type, 100011));
+    // deadband is around last sent value, 100011
+    CHECK(!test_sent(type, 100001));
+    CHECK(test_sent(type, 100000));
+    return true;
+}
+
+static bool test_relative(void)
+{
+    // 0.1 % of last sent value
+    SensorType type = test_register(0, 1000);
+
+    CHECK(type != SENSOR_TYPE_INVALID);
+    CHECK(test_sent(type, 100000));
+    CHECK(!test_sent(type, 100100));
+    CHECK(!test_sent(type, 99900));
+    CHECK(test_sent(type, 100101));
+    CHECK(test_sent(type, -1000));
+    CHECK(!test_sent(type, -1001));
+    CHECK(test_sent(type, -1002));
+    return true;
+}
+
+static bool test_either(void)
+{
+    SensorType type = test_register(10, 1000);
+
+    CHECK(type != SENSOR_TYPE_INVALID);
+    // large value: absolute deadband is exceeded first
+    CHECK(test_sent(type, 100000));
+    CHECK(!test_sent(type, 100010));
+    CHECK(test_sent(type, 100011));
+    // small value: relative deadband is exceeded first
+    CHECK(test_sent(type, 1000));
+    CHECK(!test_sent(type, 1001));
+    CHECK(test_sent(type, 1002));
+    // within both
+    CHECK(!test_sent(type, 1003));
+    return true;
+}
+
+static bool test_heartbeat(void)
+{
+    SensorType type = test_register(10, 0);
+
+    CHECK(type != SENSOR_TYPE_INVALID);
+    CHECK(test_sent(type, 500));
+    CHECK(!test_sent(type, 500));
+    m_timeMs += TEST_HEARTBEAT_MS;
+    CHECK(test_sent(type, 500));
+    CHECK(!test_sent(type, 505));
+    return true;
+}
+
+int main(void)
+{
+    bool ok = true;
+
+    ok &= test_noDeadband();
+    ok &= test_absolute();
+    ok &= test_relative();
+    ok &= test_either();
+    ok &= test_heartbeat();
+    printf("deadband_test %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
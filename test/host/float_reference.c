@@ -0,0 +1,69 @@
+/*!
+ * \file
+ * \brief file float_reference.c
+ *
+ * value path of firmware before fixed point values
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "float_reference.h"
+#include <stdio.h>
+#include <string.h>
+
+/*!
+ * \brief float_reference_value
+ * single precision value that compensation functions returned, e.g.
+ * temperature was (float)(0.01 C) / 100
+ */
+float float_reference_value(int32_t value, int32_t divisor)
+{
+    return (float)(value) / (float)(divisor);
+}
+
+/*!
+ * \brief float_reference_formatText
+ * formats line "I<c><value>\n" like tcpip_sendValue() did, trailing zeros of
+ * decimals are trimmed to one
+ *
+ * \param buffer output buffer, at least FLOAT_REFERENCE_LINE_SIZE
+ * \return length of line
+ */
+size_t float_reference_formatText(char *buffer, size_t size, char code, double value)
+{
+    size_t i, c;
+
+    memset(buffer, '\0', size*sizeof(char));
+    snprintf(buffer, size-4, "I%c%f", code, value);
+
+    c = strlen(buffer);
+    for (i=0;i<c;i++) {
+        if (buffer[i] == ',') {
+            buffer[i] = '.';
+        }
+    }
+    while (1) {
+        c = strlen(buffer);
+        if (c <= 5) {
+            break;
+        }
+        if (buffer[c-1] == '0' && buffer[c-2] != '.') {
+            buffer[c-1] = '\0';
+            continue;
+        }
+        break;
+    }
+    strcat(buffer, "\n");
+    return strlen(buffer);
+}
+
+int32_t float_reference_toFixedPoint(double value, uint8_t scale)
+{
+    uint8_t i;
+    for (i=0;i<scale;i++) {
+        value *= 10;
+    }
+    return (int32_t)(value >= 0 ? value + 0.5 : value - 0.5);
+}
@@ -0,0 +1,26 @@
+/*!
+ * \file
+ * \brief file float_reference.h
+ *
+ * value path of firmware before fixed point values: values as double,
+ * text formatted with "%f" and binary values rounded from double. Used as
+ * reference of integer formatter and as "before" of benchmarks.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef FLOAT_REFERENCE_H
+#define FLOAT_REFERENCE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define FLOAT_REFERENCE_LINE_SIZE   124
+
+float float_reference_value(int32_t value, int32_t divisor);
+size_t float_reference_formatText(char *buffer, size_t size, char code, double value);
+int32_t float_reference_toFixedPoint(double value, uint8_t scale);
+
+#endif // FLOAT_REFERENCE_H
@@ -0,0 +1,449 @@
+/*!
+ * \file
+ * \brief file host_esp.c
+ *
+ * ESP-IDF services used by firmware modules: esp_timer with one timer
+ * thread, NVS and data partitions in RAM, ROM CRC, random numbers, reset
+ * reason and Wi-Fi state that tests can change, lwIP send buffer size,
+ * power management that accepts every configuration
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "host_platform.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_heap_caps.h"
+#include "esp_pm.h"
+#include "esp_partition.h"
+#include "nvs.h"
+#include "lwip/sockets.h"
+#include "wifi_connect.h"
+
+#define HOST_MAX_TIMERS         16
+#define HOST_NVS_MAX_ENTRIES    16
+#define HOST_NVS_KEY_SIZE       32
+#define HOST_NVS_BLOB_SIZE      128
+
+struct HostTimer
+{
+    esp_timer_cb_t m_callback;
+    void *m_arg;
+    bool m_armed;
+    int64_t m_dueUs;
+    uint64_t m_periodUs;        // 0 = one shot
+};
+
+/*
+* NVS blob, namespace and key are stored as one key
+*/
+typedef struct
+{
+    char m_key[HOST_NVS_KEY_SIZE];
+    uint8_t m_data[HOST_NVS_BLOB_SIZE];
+    size_t m_size;
+} HostNvsEntry;
+
+int host_serverPort = 0;
+
+static struct timespec m_start;
+static struct HostTimer m_timers[HOST_MAX_TIMERS];
+static size_t m_timerCount = 0;
+static pthread_mutex_t m_timerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_timerChanged;
+static bool m_timerThreadStarted = false;
+static HostNvsEntry m_nvs[HOST_NVS_MAX_ENTRIES];
+static const char *m_nvsNamespace[HOST_NVS_MAX_ENTRIES];
+static size_t m_nvsNamespaceCount = 0;
+static pthread_mutex_t m_nvsLock = PTHREAD_MUTEX_INITIALIZER;
+// data partitions of partitions.csv
+static esp_partition_t m_partitions[] = {
+    { ESP_PARTITION_TYPE_DATA, 0x40, 0x110000, 0x60000, "samplelog", NULL },
+    { ESP_PARTITION_TYPE_DATA, 0x41, 0x170000, 0x90000, "capture", NULL },
+};
+static atomic_bool m_wifiConnected = true;
+static esp_reset_reason_t m_resetReason = ESP_RST_POWERON;
+
+__attribute__((constructor)) static void host_esp_init(void)
+{
+    pthread_condattr_t attr;
+
+    clock_gettime(CLOCK_MONOTONIC, &m_start);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_timerChanged, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - m_start.tv_sec) * 1000000 + (now.tv_nsec - m_start.tv_nsec) / 1000;
+}
+
+/*!
+ * \brief host_timerThread
+ * runs callbacks of due timers one at a time, like esp_timer task
+ */
+static void *host_timerThread(void *arg)
+{
+    struct HostTimer *due;
+    struct timespec deadline;
+    esp_timer_cb_t callback;
+    void *callbackArg;
+    int64_t now, next;
+    size_t i;
+
+    (void)arg;
+    pthread_mutex_lock(&m_timerLock);
+    while (1) {
+        now = esp_timer_get_time();
+        due = NULL;
+        next = INT64_MAX;
+        for (i=0;i<m_timerCount;i++) {
+            if (m_timers[i].m_armed && m_timers[i].m_dueUs < next) {
+                next = m_timers[i].m_dueUs;
+                due = &m_timers[i];
+            }
+        }
+        if (due == NULL) {
+            pthread_cond_wait(&m_timerChanged, &m_timerLock);
+            continue;
+        }
+        if (next > now) {
+            next += (int64_t)(m_start.tv_sec) * 1000000 + m_start.tv_nsec / 1000;
+            deadline.tv_sec = (time_t)(next / 1000000);
+            deadline.tv_nsec = (long)(next % 1000000) * 1000;
+            pthread_cond_timedwait(&m_timerChanged, &m_timerLock, &deadline);
+            continue;
+        }
+        if (due->m_periodUs > 0) {
+            due->m_dueUs = now + (int64_t)(due->m_periodUs);
+        } else {
+            due->m_armed = false;
+        }
+        callback = due->m_callback;
+        callbackArg = due->m_arg;
+        pthread_mutex_unlock(&m_timerLock);
+        callback(callbackArg);
+        pthread_mutex_lock(&m_timerLock);
+    }
+    return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *timerOut)
+{
+    pthread_t thread;
+    esp_err_t rc = ESP_OK;
+
+    pthread_mutex_lock(&m_timerLock);
+    if (!m_timerThreadStarted) {
+        m_timerThreadStarted = pthread_create(&thread, NULL, host_timerThread, NULL) == 0;
+        if (m_timerThreadStarted) {
+            pthread_detach(thread);
+        }
+    }
+    if (!m_timerThreadStarted || m_timerCount >= HOST_MAX_TIMERS) {
+        rc = ESP_ERR_NO_MEM;
+    } else {
+        m_timers[m_timerCount].m_callback = args->callback;
+        m_timers[m_timerCount].m_arg = args->arg;
+        *timerOut = &m_timers[m_timerCount++];
+    }
+    pthread_mutex_unlock(&m_timerLock);
+    return rc;
+}
+
+static esp_err_t host_timerStart(esp_timer_handle_t timer, uint64_t timeoutUs, uint64_t periodUs)
+{
+    esp_err_t rc = ESP_OK;
+
+    pthread_mutex_lock(&m_timerLock);
+    if (timer->m_armed) {
+        rc = ESP_ERR_INVALID_STATE;
+    } else {
+        timer->m_armed = true;
+        timer->m_dueUs = esp_timer_get_time() + (int64_t)(timeoutUs);
+        timer->m_periodUs = periodUs;
+        pthread_cond_signal(&m_timerChanged);
+    }
+    pthread_mutex_unlock(&m_timerLock);
+    return rc;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs)
+{
+    return host_timerStart(timer, timeoutUs, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodUs)
+{
+    return host_timerStart(timer, periodUs, periodUs);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    esp_err_t rc;
+
+    pthread_mutex_lock(&m_timerLock);
+    rc = timer->m_armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+    timer->m_armed = false;
+    pthread_mutex_unlock(&m_timerLock);
+    return rc;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    // slot is not reused, few timers are created at startup
+    return esp_timer_stop(timer) == ESP_OK ? ESP_ERR_INVALID_STATE : ESP_OK;
+}
+
+esp_err_t esp_pm_configure(const void *config)
+{
+    return config != NULL ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+uint32_t esp_random(void)
+{
+    return (uint32_t)(random()) ^ ((uint32_t)(random()) << 16);
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *data, uint32_t size)
+{
+    uint32_t i;
+    int bit;
+
+    crc = ~crc;
+    for (i=0;i<size;i++) {
+        crc ^= data[i];
+        for (bit=0;bit<8;bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return 0;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    return 0;
+}
+
+void esp_restart(void)
+{
+    printf("esp_restart() called, host process exits\n");
+    fflush(stdout);
+    exit(EXIT_FAILURE);
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return m_resetReason;
+}
+
+void host_setResetReason(esp_reset_reason_t reason)
+{
+    m_resetReason = reason;
+}
+
+#undef socket
+int host_socket(int domain, int type, int protocol)
+{
+    int sock = socket(domain, type, protocol);
+    int size = HOST_LWIP_TCP_SND_BUF;
+
+    if (sock >= 0 && type == SOCK_STREAM) {
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+    return sock;
+}
+
+void wifi_connect()
+{
+}
+
+int wifi_connect_get_connected()
+{
+    return atomic_load(&m_wifiConnected) ? 1 : 0;
+}
+
+void host_setWifiConnected(bool connected)
+{
+    atomic_store(&m_wifiConnected, connected);
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handleOut)
+{
+    esp_err_t rc = ESP_OK;
+    size_t i;
+
+    pthread_mutex_lock(&m_nvsLock);
+    for (i=0;i<m_nvsNamespaceCount;i++) {
+        if (strcmp(m_nvsNamespace[i], name) == 0) {
+            break;
+        }
+    }
+    if (i == m_nvsNamespaceCount) {
+        if (mode == NVS_READONLY) {
+            rc = ESP_ERR_NVS_NOT_FOUND;
+        } else {
+            m_nvsNamespace[m_nvsNamespaceCount++] = name;
+        }
+    }
+    *handleOut = (nvs_handle_t)(i);
+    pthread_mutex_unlock(&m_nvsLock);
+    return rc;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+static HostNvsEntry *host_nvsFind(nvs_handle_t handle, const char *key, bool add)
+{
+    char fullKey[HOST_NVS_KEY_SIZE];
+    size_t i;
+
+    snprintf(fullKey, sizeof(fullKey), "%u/%s", (unsigned int)(handle), key);
+    for (i=0;i<HOST_NVS_MAX_ENTRIES;i++) {
+        if (strcmp(m_nvs[i].m_key, fullKey) == 0) {
+            return &m_nvs[i];
+        }
+    }
+    for (i=0;i<HOST_NVS_MAX_ENTRIES && add;i++) {
+        if (m_nvs[i].m_key[0] == '\0') {
+            strcpy(m_nvs[i].m_key, fullKey);
+            return &m_nvs[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *data, size_t *size)
+{
+    HostNvsEntry *entry;
+    esp_err_t rc = ESP_OK;
+
+    pthread_mutex_lock(&m_nvsLock);
+    entry = host_nvsFind(handle, key, false);
+    if (entry == NULL) {
+        rc = ESP_ERR_NVS_NOT_FOUND;
+    } else if (*size < entry->m_size) {
+        rc = ESP_ERR_INVALID_SIZE;
+    } else {
+        memcpy(data, entry->m_data, entry->m_size);
+        *size = entry->m_size;
+    }
+    pthread_mutex_unlock(&m_nvsLock);
+    return rc;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *data, size_t size)
+{
+    HostNvsEntry *entry;
+    esp_err_t rc = ESP_OK;
+
+    if (size > HOST_NVS_BLOB_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    pthread_mutex_lock(&m_nvsLock);
+    entry = host_nvsFind(handle, key, true);
+    if (entry == NULL) {
+        rc = ESP_ERR_NO_MEM;
+    } else {
+        memcpy(entry->m_data, data, size);
+        entry->m_size = size;
+    }
+    pthread_mutex_unlock(&m_nvsLock);
+    return rc;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    esp_partition_t *partition;
+    size_t i;
+
+    for (i=0;i<sizeof(m_partitions)/sizeof(m_partitions[0]);i++) {
+        partition = &m_partitions[i];
+        if (partition->type != type || (subtype != ESP_PARTITION_SUBTYPE_ANY && partition->subtype != subtype)
+            || (label != NULL && strcmp(partition->label, label) != 0)) {
+            continue;
+        }
+        if (partition->data == NULL) {
+            partition->data = malloc(partition->size);
+            if (partition->data == NULL) {
+                return NULL;
+            }
+            memset(partition->data, 0xFF, partition->size);
+        }
+        return partition;
+    }
+    return NULL;
+}
+
+/*!
+ * \brief host_erasePartition
+ * erases whole partition, like flashing erased image before test
+ */
+void host_erasePartition(const char *label)
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                ESP_PARTITION_SUBTYPE_ANY, label);
+    if (partition != NULL) {
+        memset(partition->data, 0xFF, partition->size);
+    }
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *data, size_t size)
+{
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(data, partition->data + offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    size_t i;
+
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (i=0;i<size;i++) {
+        // NOR flash write can only clear bits
+        partition->data[offset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0 || offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(partition->data + offset, 0xFF, size);
+    return ESP_OK;
+}
@@ -0,0 +1,275 @@
+/*!
+ * \file
+ * \brief file host_freertos.c
+ *
+ * FreeRTOS tasks as POSIX threads. Priorities and cores are ignored, tick
+ * is 1 ms of monotonic clock. Notifications are counting semaphore per
+ * task like xTaskNotifyGive() and ulTaskNotifyTake(). Returns from blocking
+ * waits are counted as wakeups, per task and as ticks with any wakeup.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_timer.h"
+#include "host_platform.h"
+
+#define HOST_TASK_NAME_SIZE 16
+
+struct HostTask
+{
+    pthread_t m_thread;
+    char m_name[HOST_TASK_NAME_SIZE];
+    TaskFunction_t m_function;
+    void *m_arg;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_notified;
+    uint32_t m_notifyCount;
+    atomic_uint m_wakeups;
+};
+
+static __thread struct HostTask *m_current = NULL;
+static atomic_uint m_activeTicks;
+static atomic_llong m_lastActiveTick = -1;
+
+static struct HostTask *host_newTask(const char *name)
+{
+    struct HostTask *task = calloc(1, sizeof(struct HostTask));
+    pthread_condattr_t attr;
+
+    if (task == NULL) {
+        abort();
+    }
+    strncpy(task->m_name, name, HOST_TASK_NAME_SIZE - 1);
+    pthread_mutex_init(&task->m_lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&task->m_notified, &attr);
+    pthread_condattr_destroy(&attr);
+    return task;
+}
+
+static void *host_taskMain(void *arg)
+{
+    struct HostTask *task = arg;
+
+    m_current = task;
+    task->m_function(task->m_arg);
+    return NULL;
+}
+
+static TaskHandle_t host_startTask(TaskFunction_t function, const char *name, void *arg)
+{
+    struct HostTask *task = host_newTask(name);
+
+    task->m_function = function;
+    task->m_arg = arg;
+    if (pthread_create(&task->m_thread, NULL, host_taskMain, task) != 0) {
+        free(task);
+        return NULL;
+    }
+    pthread_detach(task->m_thread);
+    return task;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return 0;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackSize, void *arg,
+                       UBaseType_t priority, TaskHandle_t *taskOut)
+{
+    TaskHandle_t task = host_startTask(function, name, arg);
+
+    if (taskOut != NULL) {
+        *taskOut = task;
+    }
+    return task != NULL ? pdPASS : pdFAIL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackSize, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *taskOut, BaseType_t core)
+{
+    return xTaskCreate(function, name, stackSize, arg, priority, taskOut);
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char *name, uint32_t stackSize, void *arg,
+                               UBaseType_t priority, StackType_t *stack, StaticTask_t *task)
+{
+    return host_startTask(function, name, arg);
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t function, const char *name, uint32_t stackSize,
+                                           void *arg, UBaseType_t priority, StackType_t *stack,
+                                           StaticTask_t *task, BaseType_t core)
+{
+    return host_startTask(function, name, arg);
+}
+
+/*!
+ * \brief vTaskDelete
+ * only calling task can be deleted, task memory is left allocated because
+ * other tasks may still notify it
+ */
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == m_current) {
+        pthread_exit(NULL);
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec delay = {
+        .tv_sec = ticks / configTICK_RATE_HZ,
+        .tv_nsec = (long)(ticks % configTICK_RATE_HZ) * (1000000000L / configTICK_RATE_HZ),
+    };
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+    }
+    if (ticks > 0) {
+        host_countWakeup();
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() / (1000 * portTICK_PERIOD_MS));
+}
+
+/*!
+ * \brief xTaskGetCurrentTaskHandle
+ * threads not started with xTaskCreate get task on first call, so main()
+ * of host program can be notified too
+ */
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (m_current == NULL) {
+        m_current = host_newTask("main");
+        m_current->m_thread = pthread_self();
+    }
+    return m_current;
+}
+
+TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t core)
+{
+    return NULL;
+}
+
+const char *pcTaskGetName(TaskHandle_t task)
+{
+    return task != NULL ? task->m_name : "";
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    // thread stacks are not watched
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->m_lock);
+    task->m_notifyCount++;
+    pthread_cond_signal(&task->m_notified);
+    pthread_mutex_unlock(&task->m_lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    struct HostTask *task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    uint32_t count;
+    uint64_t ns;
+    bool blocked = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    ns = (uint64_t)(deadline.tv_nsec) + (uint64_t)(ticks) * portTICK_PERIOD_MS * 1000000;
+    deadline.tv_sec += (time_t)(ns / 1000000000);
+    deadline.tv_nsec = (long)(ns % 1000000000);
+
+    pthread_mutex_lock(&task->m_lock);
+    while (task->m_notifyCount == 0 && ticks > 0) {
+        blocked = true;
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&task->m_notified, &task->m_lock);
+        } else if (pthread_cond_timedwait(&task->m_notified, &task->m_lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    count = task->m_notifyCount;
+    if (count > 0) {
+        task->m_notifyCount = clearOnExit ? 0 : count - 1;
+    }
+    pthread_mutex_unlock(&task->m_lock);
+    if (blocked) {
+        host_countWakeup();
+    }
+    return count;
+}
+
+/*!
+ * \brief host_taskCpuUs
+ * \return CPU time used by thread of the task, -1 if it is not known
+ */
+int64_t host_taskCpuUs(TaskHandle_t task)
+{
+    struct timespec used;
+    clockid_t clock;
+
+    if (task == NULL || pthread_getcpuclockid(task->m_thread, &clock) != 0
+        || clock_gettime(clock, &used) != 0) {
+        return -1;
+    }
+    return (int64_t)(used.tv_sec) * 1000000 + used.tv_nsec / 1000;
+}
+
+int64_t host_threadCpuUs(void)
+{
+    struct timespec used;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &used);
+    return (int64_t)(used.tv_sec) * 1000000 + used.tv_nsec / 1000;
+}
+
+/*!
+ * \brief host_countWakeup
+ * counts return of calling task from blocking wait, and tick of it if no
+ * other wakeup was counted in same tick
+ */
+void host_countWakeup(void)
+{
+    long long tick = (long long)(esp_timer_get_time() / (1000 * portTICK_PERIOD_MS));
+
+    if (m_current != NULL) {
+        atomic_fetch_add_explicit(&m_current->m_wakeups, 1, memory_order_relaxed);
+    }
+    if (atomic_exchange_explicit(&m_lastActiveTick, tick, memory_order_relaxed) != tick) {
+        atomic_fetch_add_explicit(&m_activeTicks, 1, memory_order_relaxed);
+    }
+}
+
+uint32_t host_taskWakeups(TaskHandle_t task)
+{
+    return task != NULL ? atomic_load_explicit(&task->m_wakeups, memory_order_relaxed) : 0;
+}
+
+/*!
+ * \brief host_activeTicks
+ * \return ticks in which some task woke up, other ticks tickless idle
+ * could sleep through
+ */
+uint32_t host_activeTicks(void)
+{
+    return atomic_load_explicit(&m_activeTicks, memory_order_relaxed);
+}
@@ -0,0 +1,34 @@
+/*!
+ * \file
+ * \brief file host_platform.h
+ *
+ * controls of host stand-ins for FreeRTOS and ESP-IDF, used by host tests
+ * and benchmarks that run firmware modules as threads of one process
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_PLATFORM_H
+#define HOST_PLATFORM_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+
+// server port of CONFIG_WEATHER_SERVER_PORT, set before sender starts
+extern int host_serverPort;
+
+int64_t host_taskCpuUs(TaskHandle_t task);
+int64_t host_threadCpuUs(void);
+void host_countWakeup(void);
+uint32_t host_taskWakeups(TaskHandle_t task);
+uint32_t host_activeTicks(void);
+void host_setWifiConnected(bool connected);
+void host_setResetReason(esp_reset_reason_t reason);
+void host_erasePartition(const char *label);
+
+#endif // HOST_PLATFORM_H
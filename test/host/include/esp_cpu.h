@@ -0,0 +1,37 @@
+/*!
+ * \file
+ * \brief file esp_cpu.h
+ *
+ * host stand-in of CPU cycle counter, time stamp counter on x86 and
+ * nanoseconds elsewhere. Host cycles compare code paths, they are not
+ * Xtensa cycles.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_ESP_CPU_H
+#define HOST_ESP_CPU_H
+
+#include <inttypes.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+static inline esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (esp_cpu_cycle_count_t)(__rdtsc());
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (esp_cpu_cycle_count_t)(now.tv_sec * 1000000000ull + now.tv_nsec);
+#endif
+}
+
+#endif // HOST_ESP_CPU_H
@@ -0,0 +1,37 @@
+/*!
+ * \file
+ * \brief file esp_err.h
+ *
+ * host stand-in of ESP-IDF error codes
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_ESP_ERR_H
+#define HOST_ESP_ERR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK                      0
+#define ESP_FAIL                    -1
+#define ESP_ERR_NO_MEM              0x101
+#define ESP_ERR_INVALID_ARG         0x102
+#define ESP_ERR_INVALID_STATE       0x103
+#define ESP_ERR_INVALID_SIZE        0x104
+#define ESP_ERR_NOT_FOUND           0x105
+#define ESP_ERR_NVS_NOT_FOUND       0x1102
+
+#define ESP_ERROR_CHECK(x) do { \
+    esp_err_t rc_ = (x); \
+    if (rc_ != ESP_OK) { \
+        printf("%s:%d: %s failed %d\n", __FILE__, __LINE__, #x, rc_); \
+        abort(); \
+    } \
+} while (0)
+
+#endif // HOST_ESP_ERR_H
@@ -0,0 +1,23 @@
+/*!
+ * \file
+ * \brief file esp_heap_caps.h
+ *
+ * host stand-in of heap statistics, host heap is not counted
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_ESP_HEAP_CAPS_H
+#define HOST_ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+
+#endif // HOST_ESP_HEAP_CAPS_H
@@ -0,0 +1,28 @@
+/*!
+ * \file
+ * \brief file esp_pm.h
+ *
+ * host stand-in of power management, configuration is accepted and CPU
+ * frequency stays as it is
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_ESP_PM_H
+#define HOST_ESP_PM_H
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef struct
+{
+    int max_freq_mhz;
+    int min_freq_mhz;
+    bool light_sleep_enable;
+} esp_pm_config_t;
+
+esp_err_t esp_pm_configure(const void *config);
+
+#endif // HOST_ESP_PM_H
@@ -0,0 +1,19 @@
+/*!
+ * \file
+ * \brief file esp_random.h
+ *
+ * host stand-in of hardware random number generator
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_ESP_RANDOM_H
+#define HOST_ESP_RANDOM_H
+
+#include <inttypes.h>
+
+uint32_t esp_random(void);
+
+#endif // HOST_ESP_RANDOM_H
@@ -0,0 +1,19 @@
+/*!
+ * \file
+ * \brief file esp_rom_crc.h
+ *
+ * host stand-in of ROM CRC32, same result as esp_rom_crc32_le()
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_ESP_ROM_CRC_H
+#define HOST_ESP_ROM_CRC_H
+
+#include <inttypes.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *data, uint32_t size);
+
+#endif // HOST_ESP_ROM_CRC_H
@@ -0,0 +1,45 @@
+/*!
+ * \file
+ * \brief file FreeRTOS.h
+ *
+ * host stand-in of FreeRTOS types and macros used by firmware modules,
+ * tasks are threads and tick is 1 ms (see host_freertos.c)
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint8_t StackType_t;
+
+#define configTICK_RATE_HZ              1000
+#define portTICK_PERIOD_MS              (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY                   UINT32_MAX
+#define portNUM_PROCESSORS              2
+#define pdMS_TO_TICKS(ms)               ((TickType_t)((uint64_t)(ms) * configTICK_RATE_HZ / 1000))
+#define pdTRUE                          1
+#define pdFALSE                         0
+#define pdPASS                          pdTRUE
+#define pdFAIL                          pdFALSE
+
+// critical section of one mux, enough for short sections of firmware
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED    PTHREAD_MUTEX_INITIALIZER
+#define taskENTER_CRITICAL(mux)         pthread_mutex_lock(mux)
+#define taskEXIT_CRITICAL(mux)          pthread_mutex_unlock(mux)
+
+BaseType_t xPortGetCoreID(void);
+
+#endif // HOST_FREERTOS_H
@@ -0,0 +1,45 @@
+/*!
+ * \file
+ * \brief file task.h
+ *
+ * host stand-in of FreeRTOS tasks and direct to task notifications
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_TASK_H
+#define HOST_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct HostTask *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+// memory of static task is not used, thread has its own stack
+typedef struct
+{
+    uint8_t m_unused;
+} StaticTask_t;
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackSize, void *arg,
+                       UBaseType_t priority, TaskHandle_t *taskOut);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackSize, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *taskOut, BaseType_t core);
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char *name, uint32_t stackSize, void *arg,
+                               UBaseType_t priority, StackType_t *stack, StaticTask_t *task);
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t function, const char *name, uint32_t stackSize,
+                                           void *arg, UBaseType_t priority, StackType_t *stack,
+                                           StaticTask_t *task, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t core);
+const char *pcTaskGetName(TaskHandle_t task);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+
+#endif // HOST_TASK_H
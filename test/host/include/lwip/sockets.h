@@ -0,0 +1,31 @@
+/*!
+ * \file
+ * \brief file sockets.h
+ *
+ * host stand-in of lwIP sockets, POSIX sockets have same API. TCP sockets
+ * of firmware get send buffer of lwIP on ESP32, so send() blocks when
+ * server reads slower than values are sent, like on device.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_LWIP_SOCKETS_H
+#define HOST_LWIP_SOCKETS_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// CONFIG_LWIP_TCP_SND_BUF_DEFAULT of ESP-IDF
+#define HOST_LWIP_TCP_SND_BUF   5760
+
+int host_socket(int domain, int type, int protocol);
+#define socket host_socket
+
+#endif // HOST_LWIP_SOCKETS_H
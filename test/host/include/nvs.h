@@ -0,0 +1,33 @@
+/*!
+ * \file
+ * \brief file nvs.h
+ *
+ * host stand-in of NVS blobs, kept in RAM while process runs
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_NVS_H
+#define HOST_NVS_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum
+{
+    NVS_READONLY = 0,
+    NVS_READWRITE,
+} nvs_open_mode_t;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handleOut);
+void nvs_close(nvs_handle_t handle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *data, size_t *size);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *data, size_t size);
+esp_err_t nvs_commit(nvs_handle_t handle);
+
+#endif // HOST_NVS_H
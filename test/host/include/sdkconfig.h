@@ -0,0 +1,123 @@
+/*!
+ * \file
+ * \brief file sdkconfig.h
+ *
+ * Kconfig options of host build, defaults of main/Kconfig.projbuild except
+ * that server is on this host. Every option can be overridden with compile
+ * definition, booleans with 0.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+// sensors
+#ifndef CONFIG_WEATHER_SENSOR_BME280
+#define CONFIG_WEATHER_SENSOR_BME280                1
+#endif
+#ifndef CONFIG_WEATHER_BME280_ADDRESS
+#define CONFIG_WEATHER_BME280_ADDRESS               0x76
+#endif
+#ifndef CONFIG_WEATHER_BME280_SECOND
+#define CONFIG_WEATHER_BME280_SECOND                1
+#endif
+#ifndef CONFIG_WEATHER_BME280_SECOND_ADDRESS
+#define CONFIG_WEATHER_BME280_SECOND_ADDRESS        0x77
+#endif
+#ifndef CONFIG_WEATHER_BME280_SAMPLE_PERIOD_MS
+#define CONFIG_WEATHER_BME280_SAMPLE_PERIOD_MS      1000
+#endif
+#ifndef CONFIG_WEATHER_SENSOR_PMS5003
+#define CONFIG_WEATHER_SENSOR_PMS5003               1
+#endif
+#ifndef CONFIG_WEATHER_PMS5003_BAUD_RATE
+#define CONFIG_WEATHER_PMS5003_BAUD_RATE            9600
+#endif
+#ifndef CONFIG_WEATHER_PMS5003_SCHEDULE
+#define CONFIG_WEATHER_PMS5003_SCHEDULE             0
+#endif
+#ifndef CONFIG_WEATHER_PMS5003_PERIOD_MS
+#if CONFIG_WEATHER_PMS5003_SCHEDULE
+#define CONFIG_WEATHER_PMS5003_PERIOD_MS            60000
+#else
+#define CONFIG_WEATHER_PMS5003_PERIOD_MS            1000
+#endif
+#endif
+#ifndef CONFIG_WEATHER_PMS5003_ALL_FIELDS
+#define CONFIG_WEATHER_PMS5003_ALL_FIELDS           0
+#endif
+#ifndef CONFIG_WEATHER_SENSOR_REGISTERED_CHANNELS
+#define CONFIG_WEATHER_SENSOR_REGISTERED_CHANNELS   0
+#endif
+#ifndef CONFIG_WEATHER_HAL_CAPTURE_RECORD
+#define CONFIG_WEATHER_HAL_CAPTURE_RECORD           0
+#endif
+#ifndef CONFIG_WEATHER_HAL_CAPTURE_REPLAY
+#define CONFIG_WEATHER_HAL_CAPTURE_REPLAY           0
+#endif
+
+// network, server is sink of host test on loopback
+#define CONFIG_WEATHER_USE_DEFAULT_VALUES           0
+#define CONFIG_WEATHER_SERVER_ADDRESS               "127.0.0.1"
+extern int host_serverPort;
+#define CONFIG_WEATHER_SERVER_PORT                  host_serverPort
+#ifndef CONFIG_WEATHER_PROTOCOL_BINARY
+#define CONFIG_WEATHER_PROTOCOL_BINARY              0
+#endif
+#ifndef CONFIG_WEATHER_TRANSPORT_UDP
+#define CONFIG_WEATHER_TRANSPORT_UDP                0
+#endif
+#ifndef CONFIG_WEATHER_DATAGRAM_WINDOW
+#define CONFIG_WEATHER_DATAGRAM_WINDOW              4
+#endif
+#ifndef CONFIG_WEATHER_SEND_VALUES
+#define CONFIG_WEATHER_SEND_VALUES                  1
+#endif
+#ifndef CONFIG_WEATHER_SEND_SUMMARIES
+#define CONFIG_WEATHER_SEND_SUMMARIES               0
+#endif
+#ifndef CONFIG_WEATHER_AGGREGATE_SHORT_WINDOW_MS
+#define CONFIG_WEATHER_AGGREGATE_SHORT_WINDOW_MS    10000
+#endif
+#ifndef CONFIG_WEATHER_AGGREGATE_LONG_WINDOW_MS
+#define CONFIG_WEATHER_AGGREGATE_LONG_WINDOW_MS     60000
+#endif
+#ifndef CONFIG_WEATHER_AGGREGATE_EWMA_ALPHA
+#define CONFIG_WEATHER_AGGREGATE_EWMA_ALPHA         100
+#endif
+#ifndef CONFIG_WEATHER_CLOCK_SYNC
+#define CONFIG_WEATHER_CLOCK_SYNC                   0
+#endif
+#ifndef CONFIG_WEATHER_SEND_PERIOD_MS
+#define CONFIG_WEATHER_SEND_PERIOD_MS               0
+#endif
+#ifndef CONFIG_WEATHER_SEND_COALESCE_MS
+#define CONFIG_WEATHER_SEND_COALESCE_MS             20
+#endif
+#ifndef CONFIG_WEATHER_STATS_PERIOD_MS
+#define CONFIG_WEATHER_STATS_PERIOD_MS              60000
+#endif
+
+// power, power save selects power management and tickless idle
+#ifndef CONFIG_WEATHER_POWER_SAVE
+#define CONFIG_WEATHER_POWER_SAVE                   0
+#endif
+#define CONFIG_PM_ENABLE                            CONFIG_WEATHER_POWER_SAVE
+#define CONFIG_FREERTOS_USE_TICKLESS_IDLE           CONFIG_WEATHER_POWER_SAVE
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ             160
+
+// memory
+#define CONFIG_WEATHER_SENDER_STACK_SIZE            6144
+#define CONFIG_WEATHER_SENSOR_HUB_STACK_SIZE        3072
+#define CONFIG_WEATHER_CAPTURE_REPLAY_STACK_SIZE    4096
+#define CONFIG_WEATHER_UART_RX_BUFFER_SIZE          256
+#define CONFIG_WEATHER_PSM_RING_SIZE                128
+#define CONFIG_WEATHER_I2C_MAX_TRANSFERS            4
+#ifndef CONFIG_WEATHER_MEMORY_REPORT_PERIOD_MS
+#define CONFIG_WEATHER_MEMORY_REPORT_PERIOD_MS      0
+#endif
+
+#endif // HOST_SDKCONFIG_H
@@ -0,0 +1,145 @@
+/*!
+ * \file
+ * \brief file tcp_sink.c
+ *
+ * local server of host tests
+ * Messages are decoded with wire_decoder.c. Binary records carry sample
+ * time in ms of esp_timer, which is clock of this process too, so sample
+ * to receive latency is exact.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "tcp_sink.h"
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "esp_timer.h"
+#include "host_platform.h"
+#include "tcpip_protocol.h"
+
+static void tcp_sink_addLatency(TcpSink *sink, const WireReading *reading, uint32_t nowMs)
+{
+    uint32_t latency = nowMs - reading->m_timestamp;
+    uint_fast64_t max = atomic_load(&sink->m_latencyMaxMs);
+
+    atomic_fetch_add(&sink->m_latencySumMs, latency);
+    while (latency > max && !atomic_compare_exchange_weak(&sink->m_latencyMaxMs, &max, latency)) {
+    }
+}
+
+/*!
+ * \brief tcp_sink_message
+ * \return size of first complete message in buffer, 0 if it is not complete
+ */
+static size_t tcp_sink_message(TcpSink *sink, const uint8_t *data, size_t size)
+{
+    WireMessage message;
+    size_t length, count, i;
+    uint32_t nowMs;
+
+    length = wire_decode(data, size, &message, sink->m_readings, TCP_SINK_MAX_READINGS, &count);
+    switch (message) {
+        case WireMessageValues:
+            // only binary records have timestamp
+            if (data[0] == TCPIP_BINARY_MAGIC) {
+                nowMs = (uint32_t)(esp_timer_get_time() / 1000);
+                for (i=0;i<count && i<TCP_SINK_MAX_READINGS;i++) {
+                    tcp_sink_addLatency(sink, &sink->m_readings[i], nowMs);
+                }
+            }
+            atomic_fetch_add(&sink->m_values, count);
+            break;
+        case WireMessageReplay:
+            // timestamps are from earlier boot, no latency
+            atomic_fetch_add(&sink->m_replayed, count);
+            break;
+        case WireMessageSummaries:
+            atomic_fetch_add(&sink->m_summaries, count);
+            break;
+        case WireMessageStats:
+            atomic_fetch_add(&sink->m_stats, 1);
+            break;
+        default:
+            // clock request gets no reply, sender keeps running without offset
+            break;
+    }
+    return length;
+}
+
+static void tcp_sink_receive(TcpSink *sink, int sock)
+{
+    size_t used, length;
+    ssize_t rc;
+
+    sink->m_buffered = 0;
+    while ((rc = recv(sock, sink->m_buffer + sink->m_buffered, sizeof(sink->m_buffer) - sink->m_buffered, 0)) > 0) {
+        atomic_fetch_add(&sink->m_bytes, (uint_fast64_t)(rc));
+        sink->m_buffered += (size_t)(rc);
+        used = 0;
+        while (used < sink->m_buffered
+               && (length = tcp_sink_message(sink, sink->m_buffer + used, sink->m_buffered - used)) > 0) {
+            used += length;
+        }
+        memmove(sink->m_buffer, sink->m_buffer + used, sink->m_buffered - used);
+        sink->m_buffered -= used;
+        if (sink->m_buffered == sizeof(sink->m_buffer)) {
+            sink->m_buffered = 0;
+        }
+        atomic_store(&sink->m_cpuUs, host_threadCpuUs());
+    }
+}
+
+static void *tcp_sink_thread(void *arg)
+{
+    TcpSink *sink = arg;
+    int sock;
+
+    while (1) {
+        sock = accept(sink->m_listen, NULL, NULL);
+        if (sock < 0) {
+            continue;
+        }
+        atomic_fetch_add(&sink->m_connections, 1);
+        tcp_sink_receive(sink, sock);
+        close(sock);
+    }
+    return NULL;
+}
+
+/*!
+ * \brief tcp_sink_start
+ * listens on free loopback port, port is stored to m_port
+ */
+bool tcp_sink_start(TcpSink *sink)
+{
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+
+    memset(sink, 0, sizeof(TcpSink));
+    sink->m_listen = socket(AF_INET, SOCK_STREAM, 0);
+    if (sink->m_listen < 0) {
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    if (bind(sink->m_listen, (struct sockaddr *)&address, sizeof(address)) < 0
+        || listen(sink->m_listen, 1) < 0
+        || getsockname(sink->m_listen, (struct sockaddr *)&address, &length) < 0) {
+        close(sink->m_listen);
+        return false;
+    }
+    sink->m_port = ntohs(address.sin_port);
+    if (pthread_create(&sink->m_thread, NULL, tcp_sink_thread, sink) != 0) {
+        close(sink->m_listen);
+        return false;
+    }
+    pthread_detach(sink->m_thread);
+    return true;
+}
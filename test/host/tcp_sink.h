@@ -0,0 +1,48 @@
+/*!
+ * \file
+ * \brief file tcp_sink.h
+ *
+ * local server of host tests, accepts sender connections on loopback and
+ * counts messages of text and binary protocol (main/tcpip_protocol.h)
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef TCP_SINK_H
+#define TCP_SINK_H
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "wire_decoder.h"
+#include "tcpip_protocol.h"
+
+#define TCP_SINK_BUFFER_SIZE    4096
+#define TCP_SINK_MAX_READINGS   (TCP_SINK_BUFFER_SIZE / TCPIP_BINARY_RECORD_SIZE)
+
+typedef struct
+{
+    int m_listen;
+    int m_port;
+    pthread_t m_thread;
+    atomic_uint_fast64_t m_bytes;
+    atomic_uint_fast64_t m_values;          // value lines or records
+    atomic_uint_fast64_t m_replayed;        // records replayed from sample log
+    atomic_uint_fast64_t m_summaries;
+    atomic_uint_fast64_t m_stats;
+    atomic_uint_fast64_t m_connections;
+    atomic_uint_fast64_t m_latencySumMs;    // sample to receive of binary records
+    atomic_uint_fast64_t m_latencyMaxMs;
+    atomic_int_fast64_t m_cpuUs;            // CPU time of sink thread
+    // parser state of current connection, used only by sink thread
+    uint8_t m_buffer[TCP_SINK_BUFFER_SIZE];
+    size_t m_buffered;
+    WireReading m_readings[TCP_SINK_MAX_READINGS];
+} TcpSink;
+
+bool tcp_sink_start(TcpSink *sink);
+
+#endif // TCP_SINK_H
@@ -0,0 +1,206 @@
+/*!
+ * \file
+ * \brief file wire_decoder.c
+ *
+ * reference decoder of messages sent to server
+ * Decoder is written from format description of tcpip_protocol.h, it
+ * doesn't use encoder code or sensor registry.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include "wire_decoder.h"
+#include <string.h>
+#include "tcpip_protocol.h"
+
+#define WIRE_MICROS_DIGITS  6
+
+static uint16_t wire_get16(const uint8_t *data)
+{
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+static uint32_t wire_get32(const uint8_t *data)
+{
+    return ((uint32_t)(data[0]) << 24) | ((uint32_t)(data[1]) << 16) | ((uint32_t)(data[2]) << 8) | data[3];
+}
+
+/*!
+ * \brief wire_parseDecimal
+ * parses [-]digits[.digits] to millionths, extra decimals are truncated
+ */
+static bool wire_parseDecimal(const uint8_t *text, size_t size, int64_t *micros)
+{
+    bool negative = false, fraction = false;
+    int64_t value = 0;
+    int decimals = 0;
+    size_t i = 0;
+
+    if (size > 0 && text[0] == '-') {
+        negative = true;
+        i++;
+    }
+    if (i == size) {
+        return false;
+    }
+    for (;i<size;i++) {
+        if (text[i] == '.' && !fraction) {
+            fraction = true;
+        } else if (text[i] >= '0' && text[i] <= '9') {
+            if (decimals < WIRE_MICROS_DIGITS) {
+                value = value * 10 + (text[i] - '0');
+                decimals += fraction ? 1 : 0;
+            }
+        } else {
+            return false;
+        }
+    }
+    for (;decimals<WIRE_MICROS_DIGITS;decimals++) {
+        value *= 10;
+    }
+    *micros = negative ? -value : value;
+    return true;
+}
+
+static WireMessage wire_decodeLine(const uint8_t *line, size_t length, WireReading *readings,
+                                   size_t maxReadings, size_t *count)
+{
+    int64_t micros;
+
+    switch (line[0]) {
+        case 'I':
+            if (length < 3 || !wire_parseDecimal(line + 2, length - 2, &micros)) {
+                return WireMessageInvalid;
+            }
+            if (maxReadings > 0) {
+                memset(&readings[0], 0, sizeof(WireReading));
+                readings[0].m_code = (char)(line[1]);
+                readings[0].m_sensor = WIRE_NO_SENSOR;
+                readings[0].m_micros = micros;
+            }
+            *count = 1;
+            return WireMessageValues;
+        case 'A':
+            *count = 1;
+            return WireMessageSummaries;
+        case 'S':
+            *count = 1;
+            return WireMessageStats;
+        default:
+            return WireMessageInvalid;
+    }
+}
+
+static void wire_decodeRecord(const uint8_t *record, WireReading *reading)
+{
+    int64_t micros = (int32_t)(wire_get32(record + 8));
+    uint8_t scale = record[1];
+
+    reading->m_code = 0;
+    reading->m_sensor = record[0];
+    reading->m_sequence = wire_get16(record + 2);
+    reading->m_boot = 0;
+    reading->m_timestamp = wire_get32(record + 4);
+    for (;scale<WIRE_MICROS_DIGITS;scale++) {
+        micros *= 10;
+    }
+    reading->m_micros = micros;
+}
+
+/*!
+ * \brief wire_decode
+ * decodes first message of data
+ *
+ * \param message type of message, WireMessageIncomplete when data doesn't
+ *        have whole message yet
+ * \param readings values of message, at most maxReadings are stored
+ * \param count values in message, or summaries or stats messages
+ * \return size of message, 0 if it is incomplete
+ */
+size_t wire_decode(const uint8_t *data, size_t size, WireMessage *message,
+                   WireReading *readings, size_t maxReadings, size_t *count)
+{
+    const uint8_t *end;
+    uint16_t records;
+    size_t length, i;
+
+    *message = WireMessageIncomplete;
+    *count = 0;
+    if (size == 0) {
+        return 0;
+    }
+    // text lines are ASCII, binary magic bytes are not
+    if (data[0] < 0x80) {
+        end = memchr(data, '\n', size);
+        if (end == NULL) {
+            return 0;
+        }
+        *message = wire_decodeLine(data, (size_t)(end - data), readings, maxReadings, count);
+        return (size_t)(end - data) + 1;
+    }
+    if (size < TCPIP_BINARY_HEADER_SIZE) {
+        return 0;
+    }
+    records = wire_get16(data + 2);
+    switch (data[0]) {
+        case TCPIP_BINARY_MAGIC:
+            length = TCPIP_BINARY_HEADER_SIZE + (size_t)(records) * TCPIP_BINARY_RECORD_SIZE;
+            if (size < length) {
+                return 0;
+            }
+            if (data[1] != TCPIP_BINARY_VERSION) {
+                *message = WireMessageInvalid;
+                return length;
+            }
+            for (i=0;i<records && i<maxReadings;i++) {
+                wire_decodeRecord(data + TCPIP_BINARY_HEADER_SIZE + i * TCPIP_BINARY_RECORD_SIZE, &readings[i]);
+            }
+            *message = WireMessageValues;
+            *count = records;
+            return length;
+        case TCPIP_BINARY_REPLAY_MAGIC:
+            length = TCPIP_BINARY_REPLAY_HEADER_SIZE + (size_t)(records) * TCPIP_BINARY_RECORD_SIZE;
+            if (size < length) {
+                return 0;
+            }
+            if (data[1] != TCPIP_BINARY_VERSION) {
+                *message = WireMessageInvalid;
+                return length;
+            }
+            for (i=0;i<records && i<maxReadings;i++) {
+                wire_decodeRecord(data + TCPIP_BINARY_REPLAY_HEADER_SIZE + i * TCPIP_BINARY_RECORD_SIZE, &readings[i]);
+                readings[i].m_boot = wire_get32(data + 4);
+            }
+            *message = WireMessageReplay;
+            *count = records;
+            return length;
+        case TCPIP_BINARY_SUMMARY_MAGIC:
+            length = TCPIP_BINARY_HEADER_SIZE + (size_t)(records) * TCPIP_BINARY_SUMMARY_SIZE;
+            if (size < length) {
+                return 0;
+            }
+            *message = WireMessageSummaries;
+            *count = records;
+            return length;
+        case TCPIP_BINARY_STATS_MAGIC:
+            // count is payload size
+            length = TCPIP_BINARY_HEADER_SIZE + records;
+            if (size < length) {
+                return 0;
+            }
+            *message = WireMessageStats;
+            *count = 1;
+            return length;
+        case TCPIP_CLOCK_REQUEST_MAGIC:
+            if (size < TCPIP_CLOCK_REQUEST_SIZE) {
+                return 0;
+            }
+            *message = WireMessageClock;
+            return TCPIP_CLOCK_REQUEST_SIZE;
+        default:
+            *message = WireMessageInvalid;
+            return size;
+    }
+}
@@ -0,0 +1,53 @@
+/*!
+ * \file
+ * \brief file wire_decoder.h
+ *
+ * reference decoder of messages sent to server (main/tcpip_protocol.h)
+ * Text lines and binary messages are decoded to same readings, values in
+ * millionths of sensor unit, so both protocols can be compared.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#ifndef WIRE_DECODER_H
+#define WIRE_DECODER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// binary message has at most 0xFFFF records
+#define WIRE_MAX_READINGS   0xFFFF
+#define WIRE_NO_SENSOR      0xFF
+
+typedef enum
+{
+    WireMessageIncomplete = 0,  // more bytes are needed
+    WireMessageValues,          // text value line or binary value records
+    WireMessageReplay,          // binary records replayed from sample log
+    WireMessageSummaries,
+    WireMessageStats,
+    WireMessageClock,
+    WireMessageInvalid,         // unknown or broken message, stream can't be framed
+} WireMessage;
+
+/*
+* One decoded value. Text protocol has only code of sensor, binary only id,
+* sequence and timestamp.
+*/
+typedef struct
+{
+    char m_code;            // text, 0 for binary
+    uint8_t m_sensor;       // binary, WIRE_NO_SENSOR for text
+    uint16_t m_sequence;
+    uint32_t m_boot;        // replayed records, 0 for values of current boot
+    uint32_t m_timestamp;   // ms since boot when sample was taken
+    int64_t m_micros;       // value in millionths of sensor unit
+} WireReading;
+
+size_t wire_decode(const uint8_t *data, size_t size, WireMessage *message,
+                   WireReading *readings, size_t maxReadings, size_t *count);
+
+#endif // WIRE_DECODER_H
@@ -0,0 +1,161 @@
+/*!
+ * \file
+ * \brief file pipeline_bench.c
+ *
+ * host benchmark of whole acquisition and send pipeline
+ * Sensor hub task reads simulated BME280 and PMS5003 of hal_host.c, sender
+ * task sends values to local TCP sink like on device. Reports frames/s,
+ * readings/s and CPU time per reading of each stage:
+ *   acquire  sensor hub task: UART and I2C, parsing, compensation, slot writes
+ *   send     sender task: collecting slots, formatting, send()
+ *   receive  sink thread: recv() and framing of messages
+ * Values overwritten in slot before they are sent are counted only as
+ * acquired. Host CPU time shows relative cost of stages and protocols, not time on
+ * ESP32.
+ *
+ * usage: pipeline_bench [seconds] [PMS5003 frame period us] [BME280 period ms]
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "host_platform.h"
+#include "tcp_sink.h"
+#include "hal_host.h"
+#include "bme280_reader.h"
+#include "psm_reader.h"
+#include "sensor_hub.h"
+#include "tcpip_sender.h"
+#include "tcpip_protocol.h"
+#include "metrics.h"
+
+#define BENCH_WARMUP_MS         500
+#define BENCH_READINGS_PER_SAMPLE   3   // values of one BME280 measurement or PMS5003 frame
+
+/*
+* Counters at start and end of measurement
+*/
+typedef struct
+{
+    int64_t m_timeUs;
+    uint32_t m_frames;
+    uint32_t m_measurements;
+    uint64_t m_received;
+    uint64_t m_bytes;
+    uint64_t m_latencySumMs;
+    int64_t m_hubCpuUs;
+    int64_t m_senderCpuUs;
+    int64_t m_sinkCpuUs;
+    uint32_t m_suppressed;
+} BenchPoint;
+
+static TcpSink m_sink;
+static TaskHandle_t m_hubTask = NULL;
+static TaskHandle_t m_senderTask = NULL;
+static uint32_t m_bmePeriodMs = 20;
+
+static void bench_hubTask(void *arg)
+{
+    bme280_config config = {
+        .osrs_t = BME280_OVERSAMPLING_1,
+        .osrs_p = BME280_OVERSAMPLING_1,
+        .osrs_h = BME280_OVERSAMPLING_1,
+        .mode = BME280_MODE_FORCED,
+        .standby = BME280_STANDBY_0_5_MS,
+        .filter = BME280_FILTER_OFF,
+        .sample_period_ms = m_bmePeriodMs,
+    };
+
+    bme280_reader_set_config(&config);
+    bme280_reader_init();
+    bme280_reader_start();
+    psm_init();
+    psm_reader_start();
+    sensor_hub_run();
+}
+
+static void bench_senderTask(void *arg)
+{
+    tcpip_sender_init();
+}
+
+static void bench_point(BenchPoint *point)
+{
+    MetricsSnapshot stats;
+
+    metrics_snapshot(&stats);
+    point->m_timeUs = esp_timer_get_time();
+    point->m_frames = stats.m_counter[MetricPsmFrames];
+    point->m_measurements = hal_host_bme280Measurements();
+    point->m_suppressed = stats.m_counter[MetricValuesSuppressed];
+    point->m_received = atomic_load(&m_sink.m_values);
+    point->m_bytes = atomic_load(&m_sink.m_bytes);
+    point->m_latencySumMs = atomic_load(&m_sink.m_latencySumMs);
+    point->m_hubCpuUs = host_taskCpuUs(m_hubTask);
+    point->m_senderCpuUs = host_taskCpuUs(m_senderTask);
+    point->m_sinkCpuUs = atomic_load(&m_sink.m_cpuUs);
+}
+
+static double bench_perReading(int64_t cpuUs, uint64_t readings)
+{
+    return readings > 0 ? (double)(cpuUs) / (double)(readings) : 0.0;
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 5.0;
+    uint32_t framePeriodUs = argc > 2 ? (uint32_t)(atoi(argv[2])) : 2000;
+    BenchPoint start, end;
+    uint64_t acquired, received;
+    double elapsed;
+
+    if (argc > 3) {
+        m_bmePeriodMs = (uint32_t)(atoi(argv[3]));
+    }
+    if (!tcp_sink_start(&m_sink)) {
+        printf("sink failed\n");
+        return 1;
+    }
+    host_serverPort = m_sink.m_port;
+    hal_host_setPms5003FramePeriod(framePeriodUs);
+    // prints of firmware are not part of benchmark, results go to stderr
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        return 1;
+    }
+    xTaskCreate(bench_senderTask, "tcpip_sender_task", CONFIG_WEATHER_SENDER_STACK_SIZE, NULL, 3, &m_senderTask);
+    xTaskCreate(bench_hubTask, "sensor_hub_task", SENSOR_HUB_STACK_SIZE, NULL, 10, &m_hubTask);
+    vTaskDelay(pdMS_TO_TICKS(BENCH_WARMUP_MS));
+    bench_point(&start);
+    vTaskDelay(pdMS_TO_TICKS((uint32_t)(seconds * 1000)));
+    bench_point(&end);
+
+    elapsed = (double)(end.m_timeUs - start.m_timeUs) / 1e6;
+    acquired = (uint64_t)(end.m_frames - start.m_frames + end.m_measurements - start.m_measurements)
+        * BENCH_READINGS_PER_SAMPLE;
+    received = end.m_received - start.m_received;
+    fprintf(stderr, "protocol %s, coalesce %d ms, PMS5003 frame every %u us, BME280 x2 every %u ms, %.1f s\n",
+            TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY ? "binary" : "text", TCPIP_SEND_COALESCE_MS,
+            (unsigned int)(framePeriodUs), (unsigned int)(m_bmePeriodMs), elapsed);
+    fprintf(stderr, "  frames/s           %10.0f\n", (end.m_frames - start.m_frames) / elapsed);
+    fprintf(stderr, "  readings/s         %10.0f acquired, %.0f received, %.0f suppressed by deadband\n",
+            acquired / elapsed, received / elapsed, (end.m_suppressed - start.m_suppressed) / elapsed);
+    fprintf(stderr, "  bytes/reading      %10.1f\n", received > 0 ? (double)(end.m_bytes - start.m_bytes) / received : 0.0);
+    fprintf(stderr, "  CPU us/reading     %10.3f acquire, %.3f send, %.3f receive\n",
+            bench_perReading(end.m_hubCpuUs - start.m_hubCpuUs, acquired),
+            bench_perReading(end.m_senderCpuUs - start.m_senderCpuUs, received),
+            bench_perReading(end.m_sinkCpuUs - start.m_sinkCpuUs, received));
+    if (TCPIP_PROTOCOL == TCPIP_PROTOCOL_BINARY && received > 0) {
+        fprintf(stderr, "  sample to receive  %10.1f ms mean\n",
+                (double)(end.m_latencySumMs - start.m_latencySumMs) / received);
+    }
+    fflush(stderr);
+    // tasks never return, process ends here
+    exit(end.m_frames > start.m_frames && received > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
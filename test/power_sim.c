@@ -0,0 +1,152 @@
+/*!
+ * \file
+ * \brief file power_sim.c
+ *
+ * host simulation of duty cycle of firmware at device sample rates
+ * Tasks start like in app_main(), PMS5003 of hal_host.c streams a frame
+ * every second and both BME280 are read at Kconfig period. Reports per
+ * task wakeups/s and CPU duty, send() calls/s and idle percentage: share
+ * of 1 ms ticks in which no task woke up, which tickless idle and modem
+ * sleep could sleep through. Built with and without
+ * CONFIG_WEATHER_POWER_SAVE, so grouping to wake windows can be compared
+ * with send coalescing. Host CPU duty is not duty on ESP32, wakeups and
+ * idle ticks are.
+ *
+ * usage: power_sim [seconds]
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "host_platform.h"
+#include "tcp_sink.h"
+#include "hal_host.h"
+#include "bme280_reader.h"
+#include "psm_reader.h"
+#include "sensor_hub.h"
+#include "tcpip_sender.h"
+#include "power_manager.h"
+#include "metrics.h"
+
+#define SIM_WARMUP_MS           2000    // first wake windows and connection
+#define SIM_TASK_COUNT          2
+// PMS5003 streams at its own phase, not aligned to BME280 readings
+#define SIM_PMS5003_PHASE_MS    400
+// stats may fall into run, so one send more than wake windows is allowed
+#define SIM_EXTRA_SENDS         2
+
+/*
+* Counters at start and end of simulation
+*/
+typedef struct
+{
+    int64_t m_timeUs;
+    uint32_t m_wakeups[SIM_TASK_COUNT];
+    int64_t m_cpuUs[SIM_TASK_COUNT];
+    uint32_t m_activeTicks;
+    uint32_t m_sends;
+    uint64_t m_received;
+} SimPoint;
+
+static TcpSink m_sink;
+static TaskHandle_t m_task[SIM_TASK_COUNT];
+static const char *m_taskName[SIM_TASK_COUNT] = { "sensor hub", "sender" };
+
+static void sim_hubTask(void *arg)
+{
+    bme280_reader_init();
+    bme280_reader_start();
+    psm_init();
+    psm_reader_start();
+    sensor_hub_run();
+}
+
+static void sim_senderTask(void *arg)
+{
+    tcpip_sender_init();
+}
+
+static void sim_point(SimPoint *point)
+{
+    MetricsSnapshot stats;
+    size_t i;
+
+    metrics_snapshot(&stats);
+    point->m_timeUs = esp_timer_get_time();
+    for (i=0;i<SIM_TASK_COUNT;i++) {
+        point->m_wakeups[i] = host_taskWakeups(m_task[i]);
+        point->m_cpuUs[i] = host_taskCpuUs(m_task[i]);
+    }
+    point->m_activeTicks = host_activeTicks();
+    point->m_sends = 0;
+    for (i=0;i<METRICS_LATENCY_BUCKETS;i++) {
+        point->m_sends += stats.m_latency[MetricLatencySend][i];
+    }
+    point->m_received = atomic_load(&m_sink.m_values);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 10.0;
+    SimPoint start, end;
+    double elapsed, elapsedMs, wakeups = 0.0, duty = 0.0;
+    uint32_t sends;
+    size_t i;
+    bool ok;
+
+    if (!tcp_sink_start(&m_sink)) {
+        printf("sink failed\n");
+        return 1;
+    }
+    host_serverPort = m_sink.m_port;
+    // prints of firmware are not part of simulation, results go to stderr
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        return 1;
+    }
+    power_init();
+    xTaskCreate(sim_senderTask, "tcpip_sender_task", CONFIG_WEATHER_SENDER_STACK_SIZE, NULL, 3, &m_task[1]);
+    xTaskCreate(sim_hubTask, "sensor_hub_task", SENSOR_HUB_STACK_SIZE, NULL, 10, &m_task[0]);
+    vTaskDelay(pdMS_TO_TICKS(SIM_PMS5003_PHASE_MS));
+    hal_host_setPms5003FramePeriod(HAL_HOST_PMS5003_FRAME_PERIOD_US);
+    vTaskDelay(pdMS_TO_TICKS(SIM_WARMUP_MS));
+    sim_point(&start);
+    vTaskDelay(pdMS_TO_TICKS((uint32_t)(seconds * 1000)));
+    sim_point(&end);
+
+    elapsed = (double)(end.m_timeUs - start.m_timeUs) / 1e6;
+    elapsedMs = elapsed * 1000.0;
+    sends = end.m_sends - start.m_sends;
+    fprintf(stderr, "power save %s, PMS5003 frame every %d ms, BME280 x2 every %d ms, %.1f s\n",
+            POWER_SAVE ? "on, 1 s wake windows" : "off, coalescing", HAL_HOST_PMS5003_FRAME_PERIOD_US / 1000,
+            CONFIG_WEATHER_BME280_SAMPLE_PERIOD_MS, elapsed);
+    for (i=0;i<SIM_TASK_COUNT;i++) {
+        fprintf(stderr, "  %-12s %8.1f wakeups/s, CPU duty %.4f %%\n", m_taskName[i],
+                (end.m_wakeups[i] - start.m_wakeups[i]) / elapsed,
+                (double)(end.m_cpuUs[i] - start.m_cpuUs[i]) / (elapsed * 1e4));
+        wakeups += (end.m_wakeups[i] - start.m_wakeups[i]) / elapsed;
+        duty += (double)(end.m_cpuUs[i] - start.m_cpuUs[i]) / (elapsed * 1e4);
+    }
+    fprintf(stderr, "  %-12s %8.1f wakeups/s, CPU duty %.4f %%\n", "total", wakeups, duty);
+    fprintf(stderr, "  sends/s      %8.2f, %.1f values received/s\n", sends / elapsed,
+            (end.m_received - start.m_received) / elapsed);
+    fprintf(stderr, "  idle         %8.2f %% of ticks without wakeup\n",
+            100.0 * (1.0 - (end.m_activeTicks - start.m_activeTicks) / elapsedMs));
+    fflush(stderr);
+
+    ok = end.m_received > start.m_received;
+#if POWER_SAVE
+    // all values of a wake window go to one send
+    if (sends > (uint32_t)(elapsedMs / POWER_WAKE_PERIOD_MS) + SIM_EXTRA_SENDS) {
+        fprintf(stderr, "more sends than wake windows\n");
+        ok = false;
+    }
+#endif
+    // tasks never return, process ends here
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,125 @@
+/*!
+ * \file
+ * \brief file protocol_bench.c
+ *
+ * host benchmark of text and binary protocol
+ * Readings of all built-in sensors are encoded to one send buffer like
+ * sender does and decoded with reference decoder. Reports bytes and CPU
+ * time per reading of both protocols. Host numbers only tell relative
+ * cost of protocols, not time on ESP32.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "tcpip_protocol.h"
+#include "wire_decoder.h"
+
+#define BENCH_BATCHES       200000
+#define BENCH_SETS          256
+#define BENCH_BUFFER_SIZE   (SensorTypeBuiltinCount * TCPIP_TEXT_LINE_SIZE + TCPIP_BINARY_HEADER_SIZE)
+
+typedef size_t (*BenchEncode)(uint8_t *buffer, const ClientSideValue *values, size_t count);
+
+// readings of every built-in sensor, in sensor units
+static const int32_t m_typical[] = { 21, 45, 101300, 10, 15, 20, 8, 80, 101300 };
+_Static_assert(sizeof(m_typical) / sizeof(m_typical[0]) == SensorTypeBuiltinCount, "typical reading of every sensor");
+static ClientSideValue m_values[BENCH_SETS][SensorTypeBuiltinCount];
+static uint8_t m_encoded[BENCH_SETS][BENCH_BUFFER_SIZE];
+static size_t m_encodedSize[BENCH_SETS];
+static uint32_t m_seed = 1;
+// keeps compiler from dropping decoding
+static volatile int64_t m_sink;
+
+static uint32_t bench_random(void)
+{
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+static double bench_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static size_t bench_encodeText(uint8_t *buffer, const ClientSideValue *values, size_t count)
+{
+    size_t size = 0, i;
+
+    for (i=0;i<count;i++) {
+        size += tcpip_protocol_formatText((char *)buffer + size, TCPIP_TEXT_LINE_SIZE, &values[i]);
+    }
+    return size;
+}
+
+static size_t bench_encodeBinary(uint8_t *buffer, const ClientSideValue *values, size_t count)
+{
+    size_t size = tcpip_protocol_writeBinaryHeader(buffer, (uint16_t)(count));
+    size_t i;
+
+    for (i=0;i<count;i++) {
+        size += tcpip_protocol_writeBinaryRecord(buffer + size, &values[i]);
+    }
+    return size;
+}
+
+static void bench_run(const char *name, BenchEncode encode)
+{
+    WireReading readings[SensorTypeBuiltinCount];
+    WireMessage message;
+    uint64_t bytes = 0;
+    size_t used, length, count, set;
+    double start, encodeTime, decodeTime;
+    int i;
+
+    start = bench_seconds();
+    for (i=0;i<BENCH_BATCHES;i++) {
+        set = (size_t)(i) % BENCH_SETS;
+        m_encodedSize[set] = encode(m_encoded[set], m_values[set], SensorTypeBuiltinCount);
+        bytes += m_encodedSize[set];
+    }
+    encodeTime = bench_seconds() - start;
+
+    start = bench_seconds();
+    for (i=0;i<BENCH_BATCHES;i++) {
+        set = (size_t)(i) % BENCH_SETS;
+        for (used=0;used<m_encodedSize[set];used+=length) {
+            length = wire_decode(m_encoded[set] + used, m_encodedSize[set] - used, &message,
+                                 readings, SensorTypeBuiltinCount, &count);
+            m_sink += readings[0].m_micros;
+        }
+    }
+    decodeTime = bench_seconds() - start;
+
+    count = (size_t)(BENCH_BATCHES) * SensorTypeBuiltinCount;
+    printf("%-6s %5.1f bytes/reading, encode %6.1f ns/reading, decode %6.1f ns/reading\n", name,
+           (double)bytes / count, encodeTime * 1e9 / count, decodeTime * 1e9 / count);
+}
+
+int main(void)
+{
+    int32_t divisor;
+    size_t i, j;
+
+    for (i=0;i<BENCH_SETS;i++) {
+        for (j=0;j<SensorTypeBuiltinCount;j++) {
+            divisor = tcpip_protocol_getValueDivisor((SensorType)(j));
+            m_values[i][j].m_type = (SensorType)(j);
+            m_values[i][j].m_value = m_typical[j] * divisor + (int32_t)(bench_random() % (uint32_t)(4 * divisor));
+            m_values[i][j].m_sequence = (uint16_t)(i);
+            m_values[i][j].m_timestamp = (uint32_t)(i * 1000);
+        }
+    }
+    printf("%d sends of %d readings\n", BENCH_BATCHES, SensorTypeBuiltinCount);
+    bench_run("text", bench_encodeText);
+    bench_run("binary", bench_encodeBinary);
+    return 0;
+}
@@ -0,0 +1,190 @@
+/*!
+ * \file
+ * \brief file protocol_test.c
+ *
+ * round trip test of text and binary protocol
+ * Values of every built-in sensor are encoded with tcpip_protocol.c and
+ * decoded with reference decoder, decoded values must be within rounding
+ * of the protocol from exact value / divisor. Messages split at any byte
+ * must decode only when they are complete.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tcpip_protocol.h"
+#include "wire_decoder.h"
+
+#define TEST_ROUNDS         20000
+// values of sensors are well within this, e.g. 110000 Pa is 2^24.7 in Q24.8
+#define TEST_VALUE_LIMIT    (1 << 26)
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        return false; \
+    } \
+} while (0)
+
+static uint32_t m_seed = 1;
+
+static uint32_t test_random(void)
+{
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+static int32_t test_randomValue(void)
+{
+    switch (test_random() % 4) {
+        case 0:
+            // small values have most decimals
+            return (int32_t)(test_random() % 2001) - 1000;
+        default:
+            return (int32_t)(test_random() % (2 * TEST_VALUE_LIMIT + 1)) - TEST_VALUE_LIMIT;
+    }
+}
+
+/*!
+ * \brief test_exactMicros
+ * value / divisor in millionths, rounded toward zero
+ */
+static int64_t test_exactMicros(const ClientSideValue *value)
+{
+    return (int64_t)(value->m_value) * 1000000 / tcpip_protocol_getValueDivisor(value->m_type);
+}
+
+static int64_t test_abs(int64_t value)
+{
+    return value < 0 ? -value : value;
+}
+
+static bool test_text(const ClientSideValue *value)
+{
+    char line[TCPIP_TEXT_LINE_SIZE];
+    WireReading reading;
+    WireMessage message;
+    size_t length, count, i;
+    int64_t exact = test_exactMicros(value);
+
+    length = tcpip_protocol_formatText(line, sizeof(line), value);
+    CHECK(length > 0 && line[length - 1] == '\n');
+    for (i=0;i<length;i++) {
+        CHECK(wire_decode((const uint8_t *)line, i, &message, &reading, 1, &count) == 0);
+        CHECK(message == WireMessageIncomplete);
+    }
+    CHECK(wire_decode((const uint8_t *)line, length, &message, &reading, 1, &count) == length);
+    CHECK(message == WireMessageValues && count == 1);
+    CHECK(reading.m_code == tcpip_protocol_getSensorTypeChar(value->m_type));
+    // float has 24 bit mantissa, %f rounds to micro
+    if (test_abs(reading.m_micros - exact) > test_abs(exact) / (1 << 23) + 1) {
+        printf("text %.*s of %" PRId32 " is %" PRId64 " micros off\n", (int)(length - 1), line,
+               value->m_value, reading.m_micros - exact);
+        return false;
+    }
+    return true;
+}
+
+static bool test_binary(const ClientSideValue *values, size_t count)
+{
+    uint8_t message[TCPIP_BINARY_HEADER_SIZE + SensorTypeBuiltinCount * TCPIP_BINARY_RECORD_SIZE];
+    WireReading readings[SensorTypeBuiltinCount];
+    WireMessage type;
+    size_t size, decoded, i;
+    int64_t unit, exact;
+
+    size = tcpip_protocol_writeBinaryHeader(message, (uint16_t)(count));
+    for (i=0;i<count;i++) {
+        size += tcpip_protocol_writeBinaryRecord(message + size, &values[i]);
+    }
+    for (i=0;i<size;i++) {
+        CHECK(wire_decode(message, i, &type, readings, count, &decoded) == 0);
+    }
+    CHECK(wire_decode(message, size, &type, readings, count, &decoded) == size);
+    CHECK(type == WireMessageValues && decoded == count);
+    for (i=0;i<count;i++) {
+        CHECK(readings[i].m_sensor == values[i].m_type);
+        CHECK(readings[i].m_sequence == values[i].m_sequence);
+        CHECK(readings[i].m_timestamp == values[i].m_timestamp);
+        // binary value is rounded to nearest unit of scale
+        unit = 1;
+        for (size_t j=tcpip_protocol_getBinaryScale(values[i].m_type);j<6;j++) {
+            unit *= 10;
+        }
+        exact = test_exactMicros(&values[i]);
+        CHECK(test_abs(readings[i].m_micros - exact) <= unit / 2 + 1);
+    }
+    return true;
+}
+
+static bool test_roundTrip(void)
+{
+    ClientSideValue values[SensorTypeBuiltinCount];
+    int round;
+    size_t i;
+
+    for (round=0;round<TEST_ROUNDS;round++) {
+        for (i=0;i<SensorTypeBuiltinCount;i++) {
+            values[i].m_type = (SensorType)(i);
+            values[i].m_value = round == 0 ? 0 : test_randomValue();
+            values[i].m_sequence = (uint16_t)(test_random());
+            values[i].m_timestamp = test_random();
+            CHECK(test_text(&values[i]));
+        }
+        CHECK(test_binary(values, 1 + test_random() % SensorTypeBuiltinCount));
+    }
+    return true;
+}
+
+static bool test_replay(void)
+{
+    uint8_t message[TCPIP_BINARY_REPLAY_HEADER_SIZE + 2 * TCPIP_BINARY_RECORD_SIZE];
+    WireReading readings[2];
+    WireMessage type;
+    size_t size, decoded, i;
+
+    size = tcpip_protocol_writeBinaryReplayHeader(message, 2, 7, 9);
+    size += tcpip_protocol_writeBinaryFields(message + size, SensorTypeTemperature, 0, 123456, -2150);
+    size += tcpip_protocol_writeBinaryFields(message + size, SensorTypeHumid, 0, 0xFFFFFFF0, 48000);
+    for (i=0;i<size;i++) {
+        CHECK(wire_decode(message, i, &type, readings, 2, &decoded) == 0);
+    }
+    CHECK(wire_decode(message, size, &type, readings, 2, &decoded) == size);
+    CHECK(type == WireMessageReplay && decoded == 2);
+    CHECK(readings[0].m_boot == 7 && readings[1].m_boot == 7);
+    CHECK(readings[0].m_sensor == SensorTypeTemperature && readings[0].m_sequence == 0);
+    CHECK(readings[0].m_timestamp == 123456 && readings[1].m_timestamp == 0xFFFFFFF0);
+    return true;
+}
+
+static bool test_invalid(void)
+{
+    static const uint8_t badVersion[] = { TCPIP_BINARY_MAGIC, TCPIP_BINARY_VERSION + 1, 0, 0 };
+    static const char badLine[] = "It12x.5\n";
+    WireReading reading;
+    WireMessage message;
+    size_t count;
+
+    CHECK(wire_decode(badVersion, sizeof(badVersion), &message, &reading, 1, &count) == sizeof(badVersion));
+    CHECK(message == WireMessageInvalid);
+    CHECK(wire_decode((const uint8_t *)badLine, strlen(badLine), &message, &reading, 1, &count) == strlen(badLine));
+    CHECK(message == WireMessageInvalid);
+    return true;
+}
+
+int main(void)
+{
+    bool ok = true;
+
+    ok &= test_roundTrip();
+    ok &= test_replay();
+    ok &= test_invalid();
+    printf("protocol_test %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
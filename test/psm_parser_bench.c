@@ -0,0 +1,134 @@
+/*!
+ * \file
+ * \brief file psm_parser_bench.c
+ *
+ * host throughput benchmark of pms5003 stream parser
+ * Parses clean stream and stream with noise between frames in reads of
+ * different size, reports bytes/s and frames/s. Host numbers only tell
+ * relative cost of read sizes and noise, not time on ESP32.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "psm_parser.h"
+
+#define BENCH_STREAM_SIZE   (1 << 20)
+#define BENCH_REPEAT        20
+
+static uint8_t m_stream[BENCH_STREAM_SIZE];
+static uint32_t m_seed = 1;
+
+static uint32_t bench_random(void)
+{
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+static double bench_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static size_t bench_putFrame(uint8_t *out)
+{
+    uint16_t checksum = 0;
+    size_t i;
+
+    out[0] = FIXED_CHAR0;
+    out[1] = FIXED_CHAR1;
+    out[2] = 0;
+    out[3] = PSM_FRAME_LENGTH;
+    for (i=4;i<PSM_FRAME_SIZE-2;i++) {
+        out[i] = (uint8_t)(bench_random());
+    }
+    for (i=0;i<PSM_FRAME_SIZE-2;i++) {
+        checksum += out[i];
+    }
+    out[PSM_FRAME_SIZE - 2] = (uint8_t)(checksum >> 8);
+    out[PSM_FRAME_SIZE - 1] = (uint8_t)(checksum);
+    return PSM_FRAME_SIZE;
+}
+
+/*!
+ * \brief bench_makeStream
+ * frames with noiseBytes of random bytes and false frame start between them
+ */
+static size_t bench_makeStream(size_t noiseBytes)
+{
+    size_t used = 0, i;
+
+    while (used + PSM_FRAME_SIZE + noiseBytes + 2 <= BENCH_STREAM_SIZE) {
+        used += bench_putFrame(m_stream + used);
+        if (noiseBytes > 0) {
+            m_stream[used++] = FIXED_CHAR0;
+            m_stream[used++] = FIXED_CHAR1;
+            for (i=0;i<noiseBytes;i++) {
+                m_stream[used++] = (uint8_t)(bench_random());
+            }
+        }
+    }
+    return used;
+}
+
+static void bench_run(const char *name, size_t size, size_t readSize)
+{
+    static PsmRingBuffer ring;
+    PsmParser parser;
+    struct PMSData frame;
+    uint8_t *writable;
+    size_t used, part;
+    uint32_t frames = 0;
+    double start, elapsed;
+    int repeat;
+
+    start = bench_seconds();
+    for (repeat=0;repeat<BENCH_REPEAT;repeat++) {
+        psm_ring_init(&ring);
+        psm_parser_init(&parser);
+        used = 0;
+        while (used < size) {
+            part = psm_ring_getWritable(&ring, &writable);
+            if (part > readSize) {
+                part = readSize;
+            }
+            if (part > size - used) {
+                part = size - used;
+            }
+            memcpy(writable, m_stream + used, part);
+            psm_ring_commit(&ring, part);
+            used += part;
+            while (psm_parser_parse(&parser, &ring, &frame)) {
+                frames++;
+            }
+        }
+    }
+    elapsed = bench_seconds() - start;
+    printf("%-8s read %3u: %8.1f MB/s %10.0f frames/s %6.1f ns/byte\n", name, (unsigned int)(readSize),
+           (double)size * BENCH_REPEAT / elapsed / 1e6, frames / elapsed,
+           elapsed * 1e9 / ((double)size * BENCH_REPEAT));
+}
+
+int main(void)
+{
+    static const size_t readSizes[] = { 1, 8, 32, 64 };
+    size_t size, i;
+
+    size = bench_makeStream(0);
+    for (i=0;i<sizeof(readSizes)/sizeof(readSizes[0]);i++) {
+        bench_run("clean", size, readSizes[i]);
+    }
+    size = bench_makeStream(16);
+    for (i=0;i<sizeof(readSizes)/sizeof(readSizes[0]);i++) {
+        bench_run("noise", size, readSizes[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,302 @@
+/*!
+ * \file
+ * \brief file psm_parser_test.c
+ *
+ * fuzz test of pms5003 stream parser
+ * Random streams of frames, command replies, noise, false frame starts,
+ * corrupted and truncated frames are fed to parser in random sized reads.
+ * Frames parsed must equal frames of reference scan that tries every byte
+ * offset, and feeding byte by byte must give same result as bulk feeding.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psm_parser.h"
+
+#define TEST_STREAM_SIZE    4096
+#define TEST_MAX_FRAMES     (TEST_STREAM_SIZE / PSM_REPLY_BODY_SIZE)
+#define TEST_ROUNDS         2000
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        return false; \
+    } \
+} while (0)
+
+/*
+* Result of parsing one stream
+*/
+typedef struct
+{
+    size_t m_frameCount;
+    struct PMSData m_frames[TEST_MAX_FRAMES];
+    uint32_t m_replyCount;
+    uint32_t m_discarded;
+    uint32_t m_checksumFails;
+} TestResult;
+
+static uint32_t m_seed = 1;
+
+static uint32_t test_random(void)
+{
+    // xorshift32, same sequence on every host
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+static size_t test_putFrame(uint8_t *out, uint16_t length, const uint16_t *words)
+{
+    size_t size = 4 + length;
+    uint16_t checksum = 0;
+    size_t i;
+
+    out[0] = FIXED_CHAR0;
+    out[1] = FIXED_CHAR1;
+    out[2] = (uint8_t)(length >> 8);
+    out[3] = (uint8_t)(length);
+    for (i=0;i<(size_t)(length/2 - 1);i++) {
+        out[4 + 2*i] = (uint8_t)(words[i] >> 8);
+        out[5 + 2*i] = (uint8_t)(words[i]);
+    }
+    for (i=0;i<size-2;i++) {
+        checksum += out[i];
+    }
+    out[size - 2] = (uint8_t)(checksum >> 8);
+    out[size - 1] = (uint8_t)(checksum);
+    return size;
+}
+
+static size_t test_putDataFrame(uint8_t *out)
+{
+    uint16_t words[PSM_FRAME_LENGTH/2 - 1];
+    size_t i;
+
+    for (i=0;i<sizeof(words)/sizeof(words[0]);i++) {
+        // values that contain frame start bytes too
+        words[i] = (test_random() & 3) == 0 ? 0x424D : (uint16_t)(test_random());
+    }
+    return test_putFrame(out, PSM_FRAME_LENGTH, words);
+}
+
+static size_t test_putReply(uint8_t *out)
+{
+    const uint16_t words[] = { (uint16_t)((PSM_COMMAND_MODE << 8) | PSM_MODE_PASSIVE) };
+    return test_putFrame(out, PSM_REPLY_LENGTH, words);
+}
+
+/*!
+ * \brief test_makeStream
+ * random mix of frames, replies, noise, false frame starts and broken frames
+ */
+static size_t test_makeStream(uint8_t *out, size_t size)
+{
+    uint8_t frame[PSM_FRAME_SIZE];
+    size_t used = 0, frameSize, cut;
+
+    while (used + 2 * PSM_FRAME_SIZE < size) {
+        switch (test_random() % 8) {
+            case 0:
+                out[used++] = (uint8_t)(test_random());
+                break;
+            case 1:
+                out[used++] = FIXED_CHAR0;
+                out[used++] = FIXED_CHAR1;
+                break;
+            case 2:
+                used += test_putReply(out + used);
+                break;
+            case 3:
+                // corrupted frame
+                frameSize = test_putDataFrame(out + used);
+                out[used + test_random() % frameSize] ^= (uint8_t)(1 + test_random() % 255);
+                used += frameSize;
+                break;
+            case 4:
+                // truncated frame, next bytes start something else
+                frameSize = test_putDataFrame(frame);
+                cut = 1 + test_random() % (frameSize - 1);
+                memcpy(out + used, frame, cut);
+                used += cut;
+                break;
+            default:
+                used += test_putDataFrame(out + used);
+                break;
+        }
+    }
+    return used;
+}
+
+/*!
+ * \brief test_referenceScan
+ * tries frame at every offset, frame that is found is skipped as whole
+ */
+static void test_referenceScan(const uint8_t *data, size_t size, TestResult *result)
+{
+    size_t position = 0, bodySize, i;
+    uint16_t length, checksum;
+
+    memset(result, 0, sizeof(TestResult));
+    while (position + 4 <= size) {
+        length = (uint16_t)((data[position + 2] << 8) | data[position + 3]);
+        bodySize = length == PSM_REPLY_LENGTH ? PSM_REPLY_BODY_SIZE : PSM_FRAME_BODY_SIZE;
+        if (data[position] != FIXED_CHAR0 || data[position + 1] != FIXED_CHAR1
+            || (length != PSM_FRAME_LENGTH && length != PSM_REPLY_LENGTH)) {
+            position++;
+            continue;
+        }
+        if (position + 2 + bodySize > size) {
+            // stream parser waits for rest of frame too
+            break;
+        }
+        checksum = 0;
+        for (i=0;i<bodySize;i++) {
+            checksum += data[position + i];
+        }
+        if (checksum != (uint16_t)((data[position + bodySize] << 8) | data[position + bodySize + 1])) {
+            position++;
+            continue;
+        }
+        if (length == PSM_REPLY_LENGTH) {
+            result->m_replyCount++;
+        } else {
+            for (i=0;i<PSM_FRAME_BODY_SIZE/2;i++) {
+                ((uint16_t *)&result->m_frames[result->m_frameCount])[i] =
+                    (uint16_t)((data[position + 2 + 2*i] << 8) | data[position + 3 + 2*i]);
+            }
+            result->m_frameCount++;
+        }
+        position += 2 + bodySize;
+    }
+}
+
+/*!
+ * \brief test_parse
+ * feeds stream through ring in reads of 1..maxRead bytes
+ */
+static void test_parse(const uint8_t *data, size_t size, size_t maxRead, TestResult *result)
+{
+    static PsmRingBuffer ring;
+    PsmParser parser;
+    struct PMSData frame;
+    uint8_t *writable;
+    size_t used = 0, part;
+
+    memset(result, 0, sizeof(TestResult));
+    psm_ring_init(&ring);
+    psm_parser_init(&parser);
+    while (used < size) {
+        part = psm_ring_getWritable(&ring, &writable);
+        if (part > size - used) {
+            part = size - used;
+        }
+        if (part > maxRead) {
+            part = 1 + test_random() % maxRead;
+        }
+        memcpy(writable, data + used, part);
+        psm_ring_commit(&ring, part);
+        used += part;
+        while (psm_parser_parse(&parser, &ring, &frame)) {
+            frame.timestamp_us = 0;
+            result->m_frames[result->m_frameCount++] = frame;
+        }
+    }
+    result->m_replyCount = parser.m_replyCount;
+    result->m_discarded = parser.m_discardedByteCount;
+    result->m_checksumFails = parser.m_checksumFailCount;
+}
+
+static bool test_sameFrames(const TestResult *a, const TestResult *b)
+{
+    size_t i;
+
+    CHECK(a->m_frameCount == b->m_frameCount);
+    CHECK(a->m_replyCount == b->m_replyCount);
+    for (i=0;i<a->m_frameCount;i++) {
+        CHECK(memcmp(&a->m_frames[i], &b->m_frames[i], PSM_FRAME_BODY_SIZE) == 0);
+    }
+    return true;
+}
+
+/*!
+ * \brief test_falseStartBeforeFrame
+ * frame start bytes right before real frame must not hide the frame
+ */
+static bool test_falseStartBeforeFrame(void)
+{
+    static uint8_t stream[3 * PSM_FRAME_SIZE];
+    static TestResult result;
+    size_t size = 0;
+
+    stream[size++] = FIXED_CHAR0;
+    stream[size++] = FIXED_CHAR1;
+    size += test_putDataFrame(stream + size);
+    // false start with frame length, broken by real frame
+    stream[size++] = FIXED_CHAR0;
+    stream[size++] = FIXED_CHAR1;
+    stream[size++] = 0x00;
+    stream[size++] = PSM_FRAME_LENGTH;
+    size += test_putDataFrame(stream + size);
+
+    test_parse(stream, size, size, &result);
+    CHECK(result.m_frameCount == 2);
+    CHECK(result.m_discarded == 6);
+    return true;
+}
+
+static bool test_cleanStream(void)
+{
+    static uint8_t stream[TEST_STREAM_SIZE];
+    static TestResult result;
+    size_t size = 0, frames = 0;
+
+    while (size + PSM_FRAME_SIZE <= sizeof(stream)) {
+        size += test_putDataFrame(stream + size);
+        frames++;
+    }
+    test_parse(stream, size, 7, &result);
+    CHECK(result.m_frameCount == frames);
+    CHECK(result.m_discarded == 0);
+    CHECK(result.m_checksumFails == 0);
+    return true;
+}
+
+static bool test_fuzz(void)
+{
+    static uint8_t stream[TEST_STREAM_SIZE];
+    static TestResult reference, bulk, bytes;
+    size_t size;
+    int round;
+
+    for (round=0;round<TEST_ROUNDS;round++) {
+        size = test_makeStream(stream, sizeof(stream));
+        test_referenceScan(stream, size, &reference);
+        test_parse(stream, size, PSM_RING_BUF_SIZE, &bulk);
+        test_parse(stream, size, 1, &bytes);
+        if (!test_sameFrames(&reference, &bulk) || !test_sameFrames(&bulk, &bytes)) {
+            printf("round %d differs, seed state %08x\n", round, (unsigned int)(m_seed));
+            return false;
+        }
+        CHECK(bulk.m_discarded == bytes.m_discarded);
+        CHECK(bulk.m_checksumFails == bytes.m_checksumFails);
+    }
+    return true;
+}
+
+int main(void)
+{
+    bool ok = true;
+
+    ok &= test_falseStartBeforeFrame();
+    ok &= test_cleanStream();
+    ok &= test_fuzz();
+    printf("psm_parser_test %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
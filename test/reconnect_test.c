@@ -0,0 +1,345 @@
+/*!
+ * \file
+ * \brief file reconnect_test.c
+ *
+ * fault injection test of server connection of sender
+ * Local server resets the connection, closes it, or goes down so that
+ * connects are refused, while a producer sets new values every
+ * RECONNECT_VALUE_PERIOD_MS. Time to recover is from fault (from listener
+ * being up again when server was down) to first bytes on new connection,
+ * and must stay within reconnect backoff of tcpip_connection.h. Socket
+ * descriptors must not leak over failed connects.
+ *
+ * usage: reconnect_test [outage ms]
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "host_platform.h"
+#include "tcpip_sender.h"
+#include "tcpip_connection.h"
+
+#define RECONNECT_VALUE_PERIOD_MS   10
+#define RECONNECT_POLL_MS           1
+#define RECONNECT_BUFFER_SIZE       1024
+#define RECONNECT_WAIT_MS           20000
+// detection and one reconnect after backoff reset, scheduling slack included
+#define RECONNECT_LIMIT_MS          (TCPIP_BACKOFF_MIN_MS + 500)
+
+typedef enum
+{
+    FaultNone = 0,
+    FaultReset,     // RST to sender
+    FaultClose,     // FIN to sender
+    FaultDown,      // connection reset and listener closed, connects are refused
+    FaultUp,        // listener again on same port
+} FaultCommand;
+
+/*
+* Server that injects faults, socket calls are made only by its thread
+*/
+typedef struct
+{
+    int m_listen;
+    int m_client;
+    uint16_t m_port;
+    pthread_t m_thread;
+    atomic_int m_command;
+    atomic_uint m_connections;
+    atomic_llong m_firstDataUs;     // first bytes of newest connection, 0 before them
+    atomic_uint_fast64_t m_bytes;
+    bool m_clientData;
+} FaultServer;
+
+static FaultServer m_server;
+static atomic_bool m_producing = true;
+
+static bool fault_listen(FaultServer *server)
+{
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    const int enable = 1;
+
+    server->m_listen = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->m_listen < 0) {
+        return false;
+    }
+    setsockopt(server->m_listen, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(server->m_port);
+    if (bind(server->m_listen, (struct sockaddr *)&address, sizeof(address)) < 0
+        || listen(server->m_listen, 1) < 0
+        || getsockname(server->m_listen, (struct sockaddr *)&address, &length) < 0) {
+        close(server->m_listen);
+        server->m_listen = -1;
+        return false;
+    }
+    server->m_port = ntohs(address.sin_port);
+    return true;
+}
+
+static void fault_closeClient(FaultServer *server, bool reset)
+{
+    const struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+
+    if (server->m_client < 0) {
+        return;
+    }
+    if (reset) {
+        setsockopt(server->m_client, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    }
+    close(server->m_client);
+    server->m_client = -1;
+}
+
+static void fault_run(FaultServer *server, FaultCommand command)
+{
+    switch (command) {
+        case FaultReset:
+            fault_closeClient(server, true);
+            break;
+        case FaultClose:
+            fault_closeClient(server, false);
+            break;
+        case FaultDown:
+            fault_closeClient(server, true);
+            close(server->m_listen);
+            server->m_listen = -1;
+            break;
+        case FaultUp:
+            if (!fault_listen(server)) {
+                fprintf(stderr, "listen on port %u failed\n", (unsigned int)(server->m_port));
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*!
+ * \brief fault_thread
+ * accepts one connection at a time and reads it, runs fault commands
+ * between polls
+ */
+static void *fault_thread(void *arg)
+{
+    FaultServer *server = arg;
+    struct pollfd fds[2];
+    uint8_t buffer[RECONNECT_BUFFER_SIZE];
+    FaultCommand command;
+    nfds_t count;
+    ssize_t rc;
+    int sock;
+
+    while (1) {
+        command = (FaultCommand)(atomic_exchange(&server->m_command, FaultNone));
+        fault_run(server, command);
+        count = 0;
+        if (server->m_listen >= 0) {
+            fds[count].fd = server->m_listen;
+            fds[count++].events = POLLIN;
+        }
+        if (server->m_client >= 0) {
+            fds[count].fd = server->m_client;
+            fds[count++].events = POLLIN;
+        }
+        if (poll(fds, count, RECONNECT_POLL_MS) <= 0) {
+            continue;
+        }
+        if (server->m_listen >= 0 && (fds[0].revents & POLLIN) != 0) {
+            sock = accept(server->m_listen, NULL, NULL);
+            if (sock >= 0) {
+                // sender has given up old connection when it connects again
+                fault_closeClient(server, false);
+                server->m_client = sock;
+                server->m_clientData = false;
+                atomic_fetch_add(&server->m_connections, 1);
+            }
+            continue;
+        }
+        if (server->m_client >= 0 && fds[count - 1].revents != 0) {
+            rc = recv(server->m_client, buffer, sizeof(buffer), 0);
+            if (rc <= 0) {
+                fault_closeClient(server, false);
+                continue;
+            }
+            atomic_fetch_add(&server->m_bytes, (uint_fast64_t)(rc));
+            if (!server->m_clientData) {
+                server->m_clientData = true;
+                atomic_store(&server->m_firstDataUs, esp_timer_get_time());
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool fault_start(FaultServer *server)
+{
+    memset(server, 0, sizeof(FaultServer));
+    server->m_client = -1;
+    if (!fault_listen(server)) {
+        return false;
+    }
+    if (pthread_create(&server->m_thread, NULL, fault_thread, server) != 0) {
+        return false;
+    }
+    pthread_detach(server->m_thread);
+    return true;
+}
+
+/*!
+ * \brief fault_inject
+ * runs command in server thread and waits until it is done
+ */
+static void fault_inject(FaultServer *server, FaultCommand command)
+{
+    atomic_store(&server->m_firstDataUs, 0);
+    atomic_store(&server->m_command, command);
+    while (atomic_load(&server->m_command) != FaultNone) {
+        usleep(RECONNECT_POLL_MS * 1000);
+    }
+}
+
+/*!
+ * \brief fault_waitRecovery
+ * \return ms from sinceUs to first bytes of a connection made after
+ * connections count, -1 if sender did not recover
+ */
+static int64_t fault_waitRecovery(FaultServer *server, unsigned int connections, int64_t sinceUs)
+{
+    int64_t deadline = sinceUs + (int64_t)(RECONNECT_WAIT_MS) * 1000;
+    int64_t firstData;
+
+    while (esp_timer_get_time() < deadline) {
+        firstData = atomic_load(&server->m_firstDataUs);
+        if (atomic_load(&server->m_connections) > connections && firstData > 0) {
+            return (firstData - sinceUs) / 1000;
+        }
+        usleep(RECONNECT_POLL_MS * 1000);
+    }
+    return -1;
+}
+
+static int reconnect_openDescriptors(void)
+{
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+    int count = 0;
+
+    if (dir == NULL) {
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            count++;
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+static void *reconnect_producer(void *arg)
+{
+    int32_t value = 0;
+
+    while (atomic_load(&m_producing)) {
+        tcpip_setNewValue(SensorTypeTemperature, value++);
+        usleep(RECONNECT_VALUE_PERIOD_MS * 1000);
+    }
+    return NULL;
+}
+
+static void reconnect_senderTask(void *arg)
+{
+    tcpip_sender_init();
+}
+
+static bool reconnect_check(const char *name, int64_t recoverMs, int64_t limitMs)
+{
+    bool ok = recoverMs >= 0 && recoverMs <= limitMs;
+
+    fprintf(stderr, "  %-8s recovered in %5" PRId64 " ms, limit %" PRId64 " ms%s\n", name, recoverMs, limitMs,
+            ok ? "" : "  FAILED");
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t outageMs = argc > 1 ? (uint32_t)(atoi(argv[1])) : 2000;
+    pthread_t producer;
+    unsigned int connections;
+    int64_t start, recover;
+    int descriptors, leaked;
+    bool ok = true;
+
+    if (!fault_start(&m_server)) {
+        printf("server failed\n");
+        return 1;
+    }
+    host_serverPort = m_server.m_port;
+    // prints of firmware are not part of test, results go to stderr
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        return 1;
+    }
+    xTaskCreate(reconnect_senderTask, "tcpip_sender_task", CONFIG_WEATHER_SENDER_STACK_SIZE, NULL, 3, NULL);
+    pthread_create(&producer, NULL, reconnect_producer, NULL);
+    if (fault_waitRecovery(&m_server, 0, esp_timer_get_time()) < 0) {
+        fprintf(stderr, "sender did not connect\n");
+        return 1;
+    }
+    fprintf(stderr, "reconnect after fault, backoff %d..%d ms, outage %u ms\n", TCPIP_BACKOFF_MIN_MS,
+            TCPIP_BACKOFF_MAX_MS, (unsigned int)(outageMs));
+
+    connections = atomic_load(&m_server.m_connections);
+    start = esp_timer_get_time();
+    fault_inject(&m_server, FaultReset);
+    ok &= reconnect_check("reset", fault_waitRecovery(&m_server, connections, start), RECONNECT_LIMIT_MS);
+
+    connections = atomic_load(&m_server.m_connections);
+    start = esp_timer_get_time();
+    fault_inject(&m_server, FaultClose);
+    ok &= reconnect_check("close", fault_waitRecovery(&m_server, connections, start), RECONNECT_LIMIT_MS);
+
+    // refused connects double the backoff, so delay running when server
+    // comes back is at most about twice the outage
+    descriptors = reconnect_openDescriptors();
+    connections = atomic_load(&m_server.m_connections);
+    fault_inject(&m_server, FaultDown);
+    usleep(outageMs * 1000);
+    start = esp_timer_get_time();
+    fault_inject(&m_server, FaultUp);
+    recover = fault_waitRecovery(&m_server, connections, start);
+    ok &= reconnect_check("down", recover, 2 * (int64_t)(outageMs) + RECONNECT_LIMIT_MS);
+    leaked = descriptors >= 0 ? reconnect_openDescriptors() - descriptors : 0;
+    if (leaked > 0) {
+        fprintf(stderr, "  %d socket descriptors leaked\n", leaked);
+        ok = false;
+    }
+
+    atomic_store(&m_producing, false);
+    pthread_join(producer, NULL);
+    fprintf(stderr, "%u connections, %" PRIu64 " bytes\n", atomic_load(&m_server.m_connections),
+            (uint64_t)(atomic_load(&m_server.m_bytes)));
+    fprintf(stderr, "reconnect_test %s\n", ok ? "passed" : "FAILED");
+    // sender task never returns
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,86 @@
+/*!
+ * \file
+ * \brief file registry_test.c
+ *
+ * test of sensor ids and slots of sensor registry
+ * Built without PMS5003 and with two registered channels. Built-in ids
+ * must stay fixed, disabled sensor must have no slot, and slots of enabled
+ * and registered channels must be dense.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sensor_registry.h"
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        return false; \
+    } \
+} while (0)
+
+_Static_assert(SENSOR_REGISTRY_MAX == 6 + 2, "slots of two BME280 and two registered channels");
+
+static bool test_builtin(void)
+{
+    const SensorDescriptor *descriptor;
+
+    CHECK(sensor_registry_count() == 6);
+    CHECK(sensor_registry_slot(SensorTypePM10) == SENSOR_SLOT_NONE);
+    CHECK(sensor_registry_slot(SensorTypePM25) == SENSOR_SLOT_NONE);
+    CHECK(sensor_registry_slot(SensorTypePM100) == SENSOR_SLOT_NONE);
+    CHECK(sensor_registry_get(SensorTypePM10) == NULL);
+    CHECK(sensor_registry_slot(SensorTypeTemperature) == 0);
+    CHECK(sensor_registry_slot(SensorTypePresure) == 2);
+    // second BME280 keeps ids 6-8 in slots right after first one
+    CHECK(sensor_registry_slot(SensorTypeTemperature2) == 3);
+    CHECK(sensor_registry_slot(SensorTypePresure2) == 5);
+    descriptor = sensor_registry_get(SensorTypeHumid2);
+    CHECK(descriptor != NULL && descriptor->m_id == SensorTypeHumid2 && descriptor->m_code == 'H');
+    return true;
+}
+
+static bool test_registered(void)
+{
+    const SensorDescriptor descriptor = { .m_code = 'x', .m_unit = "", .m_divisor = 1 };
+    SensorType first, second;
+
+    CHECK(sensor_registry_slot(SensorTypeBuiltinCount) == SENSOR_SLOT_NONE);
+    first = sensor_registry_register(&descriptor);
+    second = sensor_registry_register(&descriptor);
+    CHECK(first == SensorTypeBuiltinCount && second == SensorTypeBuiltinCount + 1);
+    CHECK(sensor_registry_register(&descriptor) == SENSOR_TYPE_INVALID);
+    CHECK(sensor_registry_slot(first) == 6 && sensor_registry_slot(second) == 7);
+    CHECK(sensor_registry_get(second)->m_id == second);
+    CHECK(sensor_registry_slot(SensorTypeBuiltinCount + 2) == SENSOR_SLOT_NONE);
+    CHECK(sensor_registry_count() == SENSOR_REGISTRY_MAX);
+    return true;
+}
+
+static bool test_slots(void)
+{
+    const SensorDescriptor *descriptor;
+    size_t slot;
+
+    for (slot=0;slot<sensor_registry_count();slot++) {
+        descriptor = sensor_registry_getSlot(slot);
+        CHECK(descriptor != NULL && sensor_registry_slot(descriptor->m_id) == slot);
+    }
+    CHECK(sensor_registry_getSlot(sensor_registry_count()) == NULL);
+    return true;
+}
+
+int main(void)
+{
+    bool ok = true;
+
+    ok &= test_builtin();
+    ok &= test_registered();
+    ok &= test_slots();
+    printf("registry_test %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
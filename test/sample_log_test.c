@@ -0,0 +1,339 @@
+/*!
+ * \file
+ * \brief file sample_log_test.c
+ *
+ * test of sample log on file-backed flash image
+ * Flash image behaves like NOR flash: programming only clears bits and
+ * erase sets 4kB sector to 0xFF. Tests fill log over wraparound, replay
+ * while appending and cut power in the middle of programming, after which
+ * log is opened again like after reboot.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sample_log.h"
+
+#define TEST_SECTOR_COUNT   6
+#define TEST_FLASH_SIZE     (TEST_SECTOR_COUNT * SAMPLE_LOG_SECTOR_SIZE)
+// every record of log is one of these
+#define TEST_MAX_APPENDS    40000
+#define TEST_SENSORS        9
+#define TEST_POWER_LOSSES   300
+#define TEST_BATCH_SIZE     64
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        return false; \
+    } \
+} while (0)
+
+/*
+* Flash image file, writes can be cut to simulate power loss
+*/
+typedef struct
+{
+    FILE *m_file;
+    long m_bytesToPowerLoss;    // -1 = no power loss
+    bool m_powerLost;
+} TestFlash;
+
+static TestFlash m_flash;
+static SampleLogRecord m_appended[TEST_MAX_APPENDS];
+static size_t m_appendCount;
+static uint32_t m_seed = 1;
+
+static uint32_t test_random(void)
+{
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+static bool test_flashRead(void *context, uint32_t address, void *data, size_t size)
+{
+    TestFlash *flash = context;
+    if (address + size > TEST_FLASH_SIZE || fseek(flash->m_file, (long)(address), SEEK_SET) != 0) {
+        return false;
+    }
+    return fread(data, 1, size, flash->m_file) == size;
+}
+
+/*!
+ * \brief test_flashWrite
+ * programs bytes by clearing bits, power loss stops programming after
+ * m_bytesToPowerLoss bytes and makes later accesses fail
+ */
+static bool test_flashWrite(void *context, uint32_t address, const void *data, size_t size)
+{
+    TestFlash *flash = context;
+    uint8_t old[SAMPLE_LOG_SECTOR_SIZE];
+    size_t i, programmed = size;
+
+    if (flash->m_powerLost || address + size > TEST_FLASH_SIZE || size > sizeof(old)
+        || !test_flashRead(context, address, old, size)) {
+        return false;
+    }
+    if (flash->m_bytesToPowerLoss >= 0 && (long)(size) > flash->m_bytesToPowerLoss) {
+        programmed = (size_t)(flash->m_bytesToPowerLoss);
+        flash->m_powerLost = true;
+    }
+    if (flash->m_bytesToPowerLoss >= 0) {
+        flash->m_bytesToPowerLoss -= (long)(programmed);
+    }
+    for (i=0;i<programmed;i++) {
+        old[i] &= ((const uint8_t *)data)[i];
+    }
+    fseek(flash->m_file, (long)(address), SEEK_SET);
+    fwrite(old, 1, programmed, flash->m_file);
+    fflush(flash->m_file);
+    return !flash->m_powerLost;
+}
+
+static bool test_flashErase(void *context, uint32_t address, size_t size)
+{
+    TestFlash *flash = context;
+    uint8_t erased[SAMPLE_LOG_SECTOR_SIZE];
+    size_t done;
+
+    if (flash->m_powerLost || address % SAMPLE_LOG_SECTOR_SIZE != 0 || size % SAMPLE_LOG_SECTOR_SIZE != 0
+        || address + size > TEST_FLASH_SIZE) {
+        return false;
+    }
+    memset(erased, 0xFF, sizeof(erased));
+    fseek(flash->m_file, (long)(address), SEEK_SET);
+    for (done=0;done<size;done+=sizeof(erased)) {
+        fwrite(erased, 1, sizeof(erased), flash->m_file);
+    }
+    fflush(flash->m_file);
+    return true;
+}
+
+static const SampleLogFlash m_flashOps = {
+    .read = test_flashRead,
+    .write = test_flashWrite,
+    .erase = test_flashErase,
+    .context = &m_flash,
+    .size = TEST_FLASH_SIZE,
+};
+
+static bool test_eraseAll(void)
+{
+    m_flash.m_bytesToPowerLoss = -1;
+    m_flash.m_powerLost = false;
+    m_appendCount = 0;
+    return test_flashErase(&m_flash, 0, TEST_FLASH_SIZE);
+}
+
+/*!
+ * \brief test_append
+ * appends random record, timestamps have both small steps and long gaps
+ */
+static bool test_append(SampleLog *log, uint32_t *time)
+{
+    SampleLogRecord *record = &m_appended[m_appendCount];
+
+    *time += (test_random() % 16) == 0 ? 70000 + test_random() % 100000 : test_random() % 2000;
+    record->m_sensor = (uint8_t)(test_random() % TEST_SENSORS);
+    record->m_boot = sample_log_boot(log);
+    record->m_timestamp = *time;
+    record->m_value = (test_random() % 4) == 0 ? (int32_t)(test_random()) : (int32_t)(test_random() % 200) - 100;
+    if (!sample_log_append(log, record->m_sensor, record->m_timestamp, record->m_value)) {
+        return false;
+    }
+    m_appendCount++;
+    return true;
+}
+
+static bool test_sameRecord(const SampleLogRecord *a, const SampleLogRecord *b)
+{
+    return a->m_sensor == b->m_sensor && a->m_boot == b->m_boot && a->m_timestamp == b->m_timestamp
+        && a->m_value == b->m_value;
+}
+
+/*!
+ * \brief test_findAppended
+ * \return index of appended record equal to record from first index, -1
+ * if there is none
+ */
+static long test_findAppended(const SampleLogRecord *record, size_t first)
+{
+    size_t i;
+    for (i=first;i<m_appendCount;i++) {
+        if (test_sameRecord(record, &m_appended[i])) {
+            return (long)(i);
+        }
+    }
+    return -1;
+}
+
+/*!
+ * \brief test_wraparound
+ * log that is not replayed keeps newest records, oldest sectors are dropped
+ */
+static bool test_wraparound(void)
+{
+    static SampleLogRecord records[TEST_BATCH_SIZE];
+    SampleLog log;
+    uint32_t time = 0;
+    size_t count, i, next;
+    long first;
+
+    CHECK(test_eraseAll());
+    CHECK(sample_log_init(&log, &m_flashOps));
+    CHECK(sample_log_isEmpty(&log));
+    for (i=0;i<3 * TEST_SECTOR_COUNT * SAMPLE_LOG_SECTOR_SIZE / SAMPLE_LOG_RECORD_SIZE;i++) {
+        CHECK(test_append(&log, &time));
+    }
+    CHECK(log.m_droppedSectorCount > 0);
+
+    // replay is contiguous run of newest records up to last one
+    count = sample_log_read(&log, records, TEST_BATCH_SIZE);
+    CHECK(count > 0);
+    first = test_findAppended(&records[0], 0);
+    CHECK(first > 0);
+    next = (size_t)(first);
+    do {
+        for (i=0;i<count;i++) {
+            CHECK(next < m_appendCount && test_sameRecord(&records[i], &m_appended[next]));
+            next++;
+        }
+        sample_log_consume(&log);
+    } while ((count = sample_log_read(&log, records, TEST_BATCH_SIZE)) > 0);
+    CHECK(next == m_appendCount);
+    // all but one sector of newest records are kept
+    CHECK(m_appendCount - (size_t)(first) >= (TEST_SECTOR_COUNT - 2) * (SAMPLE_LOG_SECTOR_SIZE / SAMPLE_LOG_RECORD_SIZE - 3));
+    CHECK(sample_log_isEmpty(&log));
+    return true;
+}
+
+/*!
+ * \brief test_replayWhileAppending
+ * every record is replayed once and in order when reading keeps up
+ */
+static bool test_replayWhileAppending(void)
+{
+    static SampleLogRecord records[TEST_BATCH_SIZE];
+    SampleLog log;
+    uint32_t time = 0;
+    size_t count, i, next = 0, round;
+
+    CHECK(test_eraseAll());
+    CHECK(sample_log_init(&log, &m_flashOps));
+    for (round=0;round<2000;round++) {
+        for (i=test_random() % 40;i>0;i--) {
+            CHECK(test_append(&log, &time));
+        }
+        count = sample_log_read(&log, records, 1 + test_random() % TEST_BATCH_SIZE);
+        for (i=0;i<count;i++) {
+            CHECK(test_sameRecord(&records[i], &m_appended[next]));
+            next++;
+        }
+        // send fails sometimes, same records are read again
+        if (test_random() % 8 == 0) {
+            next -= count;
+        } else {
+            sample_log_consume(&log);
+        }
+    }
+    CHECK(log.m_droppedSectorCount == 0);
+    return true;
+}
+
+/*!
+ * \brief test_powerLoss
+ * power is cut while record is programmed. After reboot log must give
+ * records in order without corrupted ones: from at most one sector before
+ * first unconsumed record to last whole record before power loss. Boot of
+ * new records is one more than before.
+ */
+static bool test_powerLoss(void)
+{
+    static SampleLogRecord records[TEST_BATCH_SIZE];
+    SampleLog log;
+    uint32_t time = 0, bootBefore;
+    size_t count, i, unconsumed = 0, next, appendedBefore, recordsPerSector;
+    long first;
+    int cut;
+
+    recordsPerSector = (SAMPLE_LOG_SECTOR_SIZE - SAMPLE_LOG_HEADER_SIZE) / SAMPLE_LOG_RECORD_SIZE;
+    CHECK(test_eraseAll());
+    CHECK(sample_log_init(&log, &m_flashOps));
+    for (cut=0;cut<TEST_POWER_LOSSES && m_appendCount + 100 < TEST_MAX_APPENDS;cut++) {
+        // replay some, then run until power loss
+        count = sample_log_read(&log, records, 1 + test_random() % TEST_BATCH_SIZE);
+        sample_log_consume(&log);
+        if (count > 0) {
+            first = test_findAppended(&records[count - 1], unconsumed);
+            CHECK(first >= 0);
+            unconsumed = (size_t)(first) + 1;
+        }
+        bootBefore = sample_log_boot(&log);
+        appendedBefore = m_appendCount;
+        m_flash.m_bytesToPowerLoss = (long)(test_random() % (20 * SAMPLE_LOG_RECORD_SIZE));
+        while (test_append(&log, &time)) {
+        }
+
+        // reboot
+        m_flash.m_bytesToPowerLoss = -1;
+        m_flash.m_powerLost = false;
+        CHECK(sample_log_init(&log, &m_flashOps));
+        count = sample_log_read(&log, records, TEST_BATCH_SIZE);
+        next = unconsumed;
+        if (count > 0) {
+            first = test_findAppended(&records[0], unconsumed > recordsPerSector ? unconsumed - recordsPerSector : 0);
+            CHECK(first >= 0 && (size_t)(first) <= unconsumed);
+            next = (size_t)(first);
+        }
+        while (count > 0) {
+            for (i=0;i<count;i++) {
+                CHECK(records[i].m_boot == records[0].m_boot);
+                CHECK(next <= m_appendCount && test_sameRecord(&records[i], &m_appended[next]));
+                next++;
+            }
+            sample_log_consume(&log);
+            count = sample_log_read(&log, records, TEST_BATCH_SIZE);
+        }
+        // torn record is there when its missing bytes were 0xFF anyway
+        CHECK(next == m_appendCount || next == m_appendCount + 1);
+        m_appendCount = next;
+        unconsumed = next;
+
+        // values after reboot belong to next boot
+        if (m_appendCount > appendedBefore) {
+            CHECK(sample_log_boot(&log) == bootBefore + 1);
+        } else {
+            CHECK(sample_log_boot(&log) == bootBefore || sample_log_boot(&log) == bootBefore + 1);
+        }
+        CHECK(test_append(&log, &time));
+        count = sample_log_read(&log, records, TEST_BATCH_SIZE);
+        CHECK(count == 1 && test_sameRecord(&records[0], &m_appended[m_appendCount - 1]));
+        sample_log_consume(&log);
+        unconsumed = m_appendCount;
+    }
+    CHECK(cut == TEST_POWER_LOSSES);
+    return true;
+}
+
+int main(void)
+{
+    bool ok = true;
+
+    m_flash.m_file = tmpfile();
+    if (m_flash.m_file == NULL) {
+        printf("flash image file can't be created\n");
+        return 1;
+    }
+    ok &= test_wraparound();
+    ok &= test_replayWhileAppending();
+    ok &= test_powerLoss();
+    fclose(m_flash.m_file);
+    printf("sample_log_test %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
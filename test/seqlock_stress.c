@@ -0,0 +1,322 @@
+/*!
+ * \file
+ * \brief file seqlock_stress.c
+ *
+ * concurrent stress test of value slots of sender
+ * Producer threads set values of their own sensors every
+ * STRESS_PRODUCER_PERIOD_US, much faster than real sensors, while sender task sends them to server that first reads fast and then
+ * slowly, so that send() blocks. Value of every record is function of its
+ * sequence number, so torn slot reads are seen by server. Reports latency
+ * of tcpip_setNewValueAt() in both phases, producer must not wait for
+ * sender or socket.
+ *
+ * usage: seqlock_stress [seconds of each phase]
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "host_platform.h"
+#include "wire_decoder.h"
+#include "tcpip_sender.h"
+#include "tcpip_protocol.h"
+#include "metrics.h"
+
+#define STRESS_PRODUCER_COUNT   3
+// producers leave CPU to sender also on single core host
+#define STRESS_PRODUCER_PERIOD_US   100
+#define STRESS_LATENCY_BUCKETS  32      // log2 of ns
+#define STRESS_SLOW_READ_SIZE   256
+#define STRESS_SLOW_READ_MS     5
+#define STRESS_BUFFER_SIZE      8192
+#define STRESS_LONG_SEND_US     1000
+
+/*
+* Producer thread and sensors it owns, each slot has one writer
+*/
+typedef struct
+{
+    pthread_t m_thread;
+    SensorType m_types[2];
+    size_t m_typeCount;
+    uint64_t m_calls;
+    // latency histogram of current phase, read after phase
+    uint64_t m_latency[2][STRESS_LATENCY_BUCKETS];
+    int64_t m_maxNs[2];
+} StressProducer;
+
+// sensors whose binary value equals native value, so server can check it
+static StressProducer m_producers[STRESS_PRODUCER_COUNT] = {
+    { .m_types = { SensorTypeTemperature, SensorTypeTemperature2 }, .m_typeCount = 2 },
+    { .m_types = { SensorTypePM10, SensorTypePM25 }, .m_typeCount = 2 },
+    { .m_types = { SensorTypePM100 }, .m_typeCount = 1 },
+};
+static atomic_int m_phase = 0;      // 0 fast server, 1 slow server, 2 done
+static atomic_uint_fast64_t m_records;
+static atomic_uint_fast64_t m_torn;
+static atomic_uint_fast64_t m_replayed;
+static int m_listen;
+
+static int64_t stress_nowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/*!
+ * \brief stress_value
+ * value that producer sets with sequence number slot gives it
+ */
+static int32_t stress_value(SensorType type, uint16_t sequence)
+{
+    return (int32_t)(((uint32_t)(sequence) * 7919u + type * 131u) & 0xFFFFFF);
+}
+
+static void *stress_producer(void *arg)
+{
+    StressProducer *producer = arg;
+    uint16_t sequence[2] = { 0, 0 };
+    int64_t start, elapsed;
+    int phase, bucket;
+    size_t i;
+
+    while ((phase = atomic_load(&m_phase)) < 2) {
+        for (i=0;i<producer->m_typeCount;i++) {
+            // slot numbers values from 1, 0 is for replayed values
+            sequence[i] = (uint16_t)(sequence[i] + 1) == 0 ? 1 : (uint16_t)(sequence[i] + 1);
+            start = stress_nowNs();
+            tcpip_setNewValueAt(producer->m_types[i], stress_value(producer->m_types[i], sequence[i]), start / 1000);
+            elapsed = stress_nowNs() - start;
+            bucket = 0;
+            while (bucket < STRESS_LATENCY_BUCKETS - 1 && elapsed >= (2ll << bucket)) {
+                bucket++;
+            }
+            producer->m_latency[phase][bucket]++;
+            if (elapsed > producer->m_maxNs[phase]) {
+                producer->m_maxNs[phase] = elapsed;
+            }
+            producer->m_calls++;
+        }
+        usleep(STRESS_PRODUCER_PERIOD_US);
+    }
+    return NULL;
+}
+
+static void stress_checkRecords(const WireReading *readings, size_t count)
+{
+    int64_t unit;
+    size_t i;
+    uint8_t scale;
+
+    for (i=0;i<count;i++) {
+        if (readings[i].m_sequence == 0) {
+            atomic_fetch_add(&m_replayed, 1);
+            continue;
+        }
+        unit = 1;
+        for (scale=tcpip_protocol_getBinaryScale(readings[i].m_sensor);scale<6;scale++) {
+            unit *= 10;
+        }
+        if (readings[i].m_micros != stress_value(readings[i].m_sensor, readings[i].m_sequence) * unit) {
+            atomic_fetch_add(&m_torn, 1);
+        }
+        atomic_fetch_add(&m_records, 1);
+    }
+}
+
+/*!
+ * \brief stress_server
+ * reads and checks records, reads slowly in phase 1 so send buffers fill
+ */
+static void *stress_server(void *arg)
+{
+    static uint8_t buffer[STRESS_BUFFER_SIZE];
+    static WireReading readings[STRESS_BUFFER_SIZE / TCPIP_BINARY_RECORD_SIZE];
+    WireMessage message;
+    size_t buffered, used, length, count, readSize;
+    ssize_t rc;
+    int sock;
+
+    while (1) {
+        sock = accept(m_listen, NULL, NULL);
+        if (sock < 0) {
+            continue;
+        }
+        buffered = 0;
+        while (1) {
+            readSize = atomic_load(&m_phase) == 1 ? STRESS_SLOW_READ_SIZE : sizeof(buffer);
+            if (readSize > sizeof(buffer) - buffered) {
+                readSize = sizeof(buffer) - buffered;
+            }
+            rc = recv(sock, buffer + buffered, readSize, 0);
+            if (rc <= 0) {
+                break;
+            }
+            buffered += (size_t)(rc);
+            used = 0;
+            while (used < buffered && (length = wire_decode(buffer + used, buffered - used, &message, readings,
+                                                            sizeof(readings) / sizeof(readings[0]), &count)) > 0) {
+                if (message == WireMessageValues) {
+                    stress_checkRecords(readings, count);
+                }
+                used += length;
+            }
+            memmove(buffer, buffer + used, buffered - used);
+            buffered -= used;
+            if (atomic_load(&m_phase) == 1) {
+                usleep(STRESS_SLOW_READ_MS * 1000);
+            }
+        }
+        close(sock);
+    }
+    return NULL;
+}
+
+static void stress_senderTask(void *arg)
+{
+    tcpip_sender_init();
+}
+
+static bool stress_startServer(void)
+{
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    pthread_t thread;
+    int size = STRESS_BUFFER_SIZE;
+
+    m_listen = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listen < 0) {
+        return false;
+    }
+    // small receive window, accepted socket inherits it
+    setsockopt(m_listen, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(m_listen, (struct sockaddr *)&address, sizeof(address)) < 0
+        || listen(m_listen, 1) < 0
+        || getsockname(m_listen, (struct sockaddr *)&address, &length) < 0) {
+        return false;
+    }
+    host_serverPort = ntohs(address.sin_port);
+    if (pthread_create(&thread, NULL, stress_server, NULL) != 0) {
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+static int64_t stress_percentileNs(int phase, double fraction)
+{
+    uint64_t total = 0, counted = 0, count;
+    int bucket;
+    size_t i;
+
+    for (i=0;i<STRESS_PRODUCER_COUNT;i++) {
+        for (bucket=0;bucket<STRESS_LATENCY_BUCKETS;bucket++) {
+            total += m_producers[i].m_latency[phase][bucket];
+        }
+    }
+    for (bucket=0;bucket<STRESS_LATENCY_BUCKETS;bucket++) {
+        count = 0;
+        for (i=0;i<STRESS_PRODUCER_COUNT;i++) {
+            count += m_producers[i].m_latency[phase][bucket];
+        }
+        counted += count;
+        if (counted >= (uint64_t)(fraction * (double)(total))) {
+            // upper bound of bucket
+            return 2ll << bucket;
+        }
+    }
+    return 2ll << (STRESS_LATENCY_BUCKETS - 1);
+}
+
+static void stress_report(int phase, const char *name, uint64_t records, uint32_t longSends)
+{
+    int64_t maxNs = 0;
+    size_t i;
+
+    for (i=0;i<STRESS_PRODUCER_COUNT;i++) {
+        if (m_producers[i].m_maxNs[phase] > maxNs) {
+            maxNs = m_producers[i].m_maxNs[phase];
+        }
+    }
+    fprintf(stderr, "%s server: %" PRIu64 " records, %u sends over %d us, set value p50 < %" PRId64 " ns, "
+            "p99.9 < %" PRId64 " ns, max %" PRId64 " ns\n", name, records, (unsigned int)(longSends),
+            STRESS_LONG_SEND_US, stress_percentileNs(phase, 0.5), stress_percentileNs(phase, 0.999), maxNs);
+}
+
+/*!
+ * \brief stress_longSends
+ * \return send() calls that took at least STRESS_LONG_SEND_US
+ */
+static uint32_t stress_longSends(void)
+{
+    MetricsSnapshot stats;
+    uint32_t count = 0;
+    int bucket;
+
+    metrics_snapshot(&stats);
+    // bucket b > 0 has latencies from base << (b - 1)
+    for (bucket=1;bucket<METRICS_LATENCY_BUCKETS;bucket++) {
+        if (((uint32_t)(METRICS_LATENCY_BASE_SEND_US) << (bucket - 1)) >= STRESS_LONG_SEND_US) {
+            count += stats.m_latency[MetricLatencySend][bucket];
+        }
+    }
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+    uint64_t records, calls = 0;
+    uint32_t longSends;
+    size_t i;
+
+    if (!stress_startServer()) {
+        printf("server failed\n");
+        return 1;
+    }
+    // prints of firmware are not part of test, results go to stderr
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        return 1;
+    }
+    xTaskCreate(stress_senderTask, "tcpip_sender_task", CONFIG_WEATHER_SENDER_STACK_SIZE, NULL, 3, NULL);
+    for (i=0;i<STRESS_PRODUCER_COUNT;i++) {
+        pthread_create(&m_producers[i].m_thread, NULL, stress_producer, &m_producers[i]);
+    }
+    usleep((useconds_t)(seconds * 1e6));
+    records = atomic_load(&m_records);
+    longSends = stress_longSends();
+    atomic_store(&m_phase, 1);
+    usleep((useconds_t)(seconds * 1e6));
+    atomic_store(&m_phase, 2);
+    for (i=0;i<STRESS_PRODUCER_COUNT;i++) {
+        pthread_join(m_producers[i].m_thread, NULL);
+        calls += m_producers[i].m_calls;
+    }
+
+    fprintf(stderr, "%" PRIu64 " values set by %d producers\n", calls, STRESS_PRODUCER_COUNT);
+    stress_report(0, "fast", records, longSends);
+    stress_report(1, "slow", atomic_load(&m_records) - records, stress_longSends() - longSends);
+    fprintf(stderr, "%" PRIu64 " torn records, %" PRIu64 " replayed from log\n", atomic_load(&m_torn),
+           atomic_load(&m_replayed));
+    fprintf(stderr, "seqlock_stress %s\n", atomic_load(&m_torn) == 0 && records > 0 ? "passed" : "FAILED");
+    // sender task never returns
+    exit(atomic_load(&m_torn) == 0 && records > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
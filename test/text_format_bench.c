@@ -0,0 +1,97 @@
+/*!
+ * \file
+ * \brief file text_format_bench.c
+ *
+ * host microbenchmark of text line formatting
+ * Typical readings of all built-in sensors are formatted with integer
+ * formatter of tcpip_protocol.c and with float formatter of
+ * float_reference.c it replaced. Reports ns per line of both. Host numbers
+ * only tell relative cost, ESP32 has no double precision FPU and its gap
+ * is larger.
+ *
+ * usage: text_format_bench [lines]
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "tcpip_protocol.h"
+#include "float_reference.h"
+
+#define BENCH_SETS          256
+
+// readings of every built-in sensor, in sensor units
+static const int32_t m_typical[] = { 21, 45, 101300, 10, 15, 20, 8, 80, 101300 };
+_Static_assert(sizeof(m_typical) / sizeof(m_typical[0]) == SensorTypeBuiltinCount, "typical reading of every sensor");
+static ClientSideValue m_values[BENCH_SETS][SensorTypeBuiltinCount];
+static uint32_t m_seed = 1;
+// keeps compiler from dropping formatting
+static volatile size_t m_sink;
+
+static uint32_t bench_random(void)
+{
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+static double bench_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static size_t bench_integer(char *line, const ClientSideValue *value)
+{
+    return tcpip_protocol_formatText(line, TCPIP_TEXT_LINE_SIZE, value);
+}
+
+static size_t bench_float(char *line, const ClientSideValue *value)
+{
+    return float_reference_formatText(line, FLOAT_REFERENCE_LINE_SIZE, tcpip_protocol_getSensorTypeChar(value->m_type),
+                                      float_reference_value(value->m_value,
+                                                            tcpip_protocol_getValueDivisor(value->m_type)));
+}
+
+static double bench_run(size_t (*format)(char *line, const ClientSideValue *value), long lines)
+{
+    char line[FLOAT_REFERENCE_LINE_SIZE];
+    size_t bytes = 0;
+    double start;
+    long i;
+
+    start = bench_seconds();
+    for (i=0;i<lines;i++) {
+        bytes += format(line, &m_values[(i / SensorTypeBuiltinCount) % BENCH_SETS][i % SensorTypeBuiltinCount]);
+    }
+    m_sink = bytes;
+    return (bench_seconds() - start) * 1e9 / (double)(lines);
+}
+
+int main(int argc, char **argv)
+{
+    long lines = argc > 1 ? atol(argv[1]) : 2000000;
+    double integerNs, floatNs;
+    int32_t divisor;
+    size_t i, j;
+
+    for (i=0;i<BENCH_SETS;i++) {
+        for (j=0;j<SensorTypeBuiltinCount;j++) {
+            divisor = tcpip_protocol_getValueDivisor((SensorType)(j));
+            m_values[i][j].m_type = (SensorType)(j);
+            m_values[i][j].m_value = m_typical[j] * divisor + (int32_t)(bench_random() % (uint32_t)(4 * divisor));
+        }
+    }
+    floatNs = bench_run(bench_float, lines);
+    integerNs = bench_run(bench_integer, lines);
+    printf("%ld lines\n", lines);
+    printf("float   %7.1f ns/line\n", floatNs);
+    printf("integer %7.1f ns/line, %.1fx faster\n", integerNs, integerNs > 0.0 ? floatNs / integerNs : 0.0);
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*!
+ * \file
+ * \brief file text_format_test.c
+ *
+ * equivalence test of integer text formatter and float formatter it
+ * replaced
+ * Every line of tcpip_protocol_formatText() must be byte for byte the line
+ * that float_reference.c gives for single precision value / divisor, for
+ * every built-in sensor: all values near zero, values around multiples of
+ * divisor, powers of two, int32 limits and random values of whole range.
+ * Exhaustive run checks also every value of physical range of each sensor,
+ * 20.5M values of each pressure channel, and is a separate ctest labelled
+ * exhaustive.
+ *
+ * usage: text_format_test [exhaustive]
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tcpip_protocol.h"
+#include "float_reference.h"
+
+#define TEST_NEAR_ZERO      100000
+#define TEST_MULTIPLES      2000
+#define TEST_RANDOM_ROUNDS  300000
+
+/*
+* Physical range of sensor in native fixed point units
+*/
+typedef struct
+{
+    int32_t m_min;
+    int32_t m_max;
+} TestRange;
+
+static const TestRange m_range[SensorTypeBuiltinCount] = {
+    [SensorTypeTemperature]  = { -40 * 100, 85 * 100 },         // -40..85 C in 0.01 C
+    [SensorTypeHumid]        = { 0, 100 * 1024 },               // 0..100 %RH in Q22.10
+    [SensorTypePresure]      = { 30000 * 256, 110000 * 256 },   // 300..1100 hPa in Q24.8
+    [SensorTypePM10]         = { 0, UINT16_MAX },               // ug/m3 of 16 bit frame field
+    [SensorTypePM25]         = { 0, UINT16_MAX },
+    [SensorTypePM100]        = { 0, UINT16_MAX },
+    [SensorTypeTemperature2] = { -40 * 100, 85 * 100 },
+    [SensorTypeHumid2]       = { 0, 100 * 1024 },
+    [SensorTypePresure2]     = { 30000 * 256, 110000 * 256 },
+};
+static uint32_t m_seed = 1;
+static uint64_t m_checked = 0;
+
+static uint32_t test_random(void)
+{
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+static bool test_value(SensorType type, int32_t value)
+{
+    const ClientSideValue clientValue = { .m_type = type, .m_value = value };
+    char line[TCPIP_TEXT_LINE_SIZE];
+    char reference[FLOAT_REFERENCE_LINE_SIZE];
+    size_t length, referenceLength;
+
+    length = tcpip_protocol_formatText(line, sizeof(line), &clientValue);
+    referenceLength = float_reference_formatText(reference, sizeof(reference),
+                                                 tcpip_protocol_getSensorTypeChar(type),
+                                                 float_reference_value(value,
+                                                                       tcpip_protocol_getValueDivisor(type)));
+    m_checked++;
+    if (length != referenceLength || strcmp(line, reference) != 0) {
+        printf("sensor %d value %" PRId32 ": \"%.*s\", float formatter \"%.*s\"\n", (int)(type), value,
+               (int)(length > 0 ? length - 1 : 0), line, (int)(referenceLength - 1), reference);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief test_range
+ * checks every value of physical range of sensor
+ */
+static bool test_range(SensorType type)
+{
+    int32_t value;
+
+    for (value=m_range[type].m_min;value<=m_range[type].m_max;value++) {
+        if (!test_value(type, value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool test_sensor(SensorType type)
+{
+    int32_t divisor = tcpip_protocol_getValueDivisor(type);
+    int32_t value, multiple;
+    int bit;
+    int i;
+
+    for (value=-TEST_NEAR_ZERO;value<=TEST_NEAR_ZERO;value++) {
+        if (!test_value(type, value)) {
+            return false;
+        }
+    }
+    // decimals roll over at multiples of divisor
+    for (i=-TEST_MULTIPLES;i<=TEST_MULTIPLES;i++) {
+        multiple = i * 1000 * divisor;
+        for (value=multiple-2;value<=multiple+2;value++) {
+            if (!test_value(type, value)) {
+                return false;
+            }
+        }
+    }
+    // float rounding changes at powers of two
+    for (bit=0;bit<31;bit++) {
+        value = (int32_t)(1u << bit);
+        if (!test_value(type, value) || !test_value(type, value - 1) || !test_value(type, value + 1)
+            || !test_value(type, -value) || !test_value(type, -value + 1) || !test_value(type, -value - 1)) {
+            return false;
+        }
+    }
+    if (!test_value(type, INT32_MAX) || !test_value(type, INT32_MIN) || !test_value(type, INT32_MIN + 1)) {
+        return false;
+    }
+    for (i=0;i<TEST_RANDOM_ROUNDS;i++) {
+        if (!test_value(type, (int32_t)(test_random()))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    bool exhaustive = argc > 1 && strcmp(argv[1], "exhaustive") == 0;
+    time_t start = time(NULL);
+    bool ok = true;
+    int type;
+
+    for (type=0;type<SensorTypeBuiltinCount;type++) {
+        ok &= test_sensor((SensorType)(type));
+        if (exhaustive) {
+            ok &= test_range((SensorType)(type));
+        }
+    }
+    printf("%" PRIu64 " values checked%s in %ld s\n", m_checked, exhaustive ? " with physical ranges" : "",
+           (long)(time(NULL) - start));
+    printf("text_format_test %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
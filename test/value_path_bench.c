@@ -0,0 +1,201 @@
+/*!
+ * \file
+ * \brief file value_path_bench.c
+ *
+ * host benchmark of BME280 value path before and after fixed point values
+ * Before: compensation result as float and double, text with "%f" and
+ * binary value rounded from double (host/float_reference.c). After: firmware
+ * code, integers from compensation to wire. Cycles are read with
+ * esp_cpu_get_cycle_count() around conversion and formatting of a batch of
+ * readings, like BME280_PRINT_CYCLES does on device. On host the counter is
+ * x86 time stamp counter and double math is in hardware, so the gain on
+ * ESP32 where double is emulated in software is larger than shown here.
+ *
+ * Copyright of Timo Hannukkala. All rights reserved.
+ *
+ * \author Timo Hannukkala <timohannukkala@hotmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_cpu.h"
+#include "bme280_reader.h"
+#include "tcpip_protocol.h"
+#include "float_reference.h"
+
+#define BENCH_READINGS      1000
+#define BENCH_ROUNDS        200
+#define BENCH_CHANNELS      3
+
+static const SensorType m_types[BENCH_CHANNELS] = { SensorTypeTemperature, SensorTypeHumid, SensorTypePresure };
+// calibration of datasheet compensation example, same as hal_host.c
+static const bme280_calib_data m_calib = {
+    .dig_T1 = 27504, .dig_T2 = 26435, .dig_T3 = -1000,
+    .dig_P1 = 36477, .dig_P2 = -10685, .dig_P3 = 3024, .dig_P4 = 2855, .dig_P5 = 140,
+    .dig_P6 = -7, .dig_P7 = 15500, .dig_P8 = -14600, .dig_P9 = 6000,
+    .dig_H1 = 75, .dig_H2 = 362, .dig_H3 = 0, .dig_H4 = 324, .dig_H5 = 50, .dig_H6 = 30,
+};
+static bme280_raw_data m_raw[BENCH_READINGS];
+static double m_before[BENCH_READINGS][BENCH_CHANNELS];
+static ClientSideValue m_after[BENCH_READINGS][BENCH_CHANNELS];
+static char m_textBefore[BENCH_READINGS][BENCH_CHANNELS][FLOAT_REFERENCE_LINE_SIZE];
+static char m_textAfter[BENCH_READINGS][BENCH_CHANNELS][TCPIP_TEXT_LINE_SIZE];
+static int32_t m_binaryBefore[BENCH_READINGS][BENCH_CHANNELS];
+static int32_t m_binaryAfter[BENCH_READINGS][BENCH_CHANNELS];
+static uint32_t m_seed = 1;
+
+/*
+* Cycles of one stage summed over rounds
+*/
+typedef struct
+{
+    uint64_t m_conversion;
+    uint64_t m_text;
+    uint64_t m_binary;
+} BenchCycles;
+
+static uint32_t bench_random(void)
+{
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+/*!
+ * \brief bench_makeReadings
+ * raw values around datasheet example, about 0..50 C, 900..1100 hPa and
+ * 0..100 %RH
+ */
+static void bench_makeReadings(void)
+{
+    size_t i;
+    for (i=0;i<BENCH_READINGS;i++) {
+        m_raw[i].temperature = 440000 + bench_random() % 160000;
+        m_raw[i].pressure = 330000 + bench_random() % 160000;
+        m_raw[i].humidity = 20000 + bench_random() % 30000;
+    }
+}
+
+static void bench_before(BenchCycles *cycles)
+{
+    bme280_values values;
+    uint32_t start;
+    size_t i, c;
+
+    start = esp_cpu_get_cycle_count();
+    for (i=0;i<BENCH_READINGS;i++) {
+        bme280_reader_compensate(&m_calib, &m_raw[i], &values);
+        // float results of compensation functions, passed on as double
+        m_before[i][0] = (double)((float)(values.temperature) / 100);
+        m_before[i][1] = (double)((float)((double)(values.humidity) / 1024.0));
+        m_before[i][2] = (double)((float)(values.pressure) / 256);
+    }
+    cycles->m_conversion += esp_cpu_get_cycle_count() - start;
+
+    start = esp_cpu_get_cycle_count();
+    for (i=0;i<BENCH_READINGS;i++) {
+        for (c=0;c<BENCH_CHANNELS;c++) {
+            float_reference_formatText(m_textBefore[i][c], FLOAT_REFERENCE_LINE_SIZE,
+                                       tcpip_protocol_getSensorTypeChar(m_types[c]), m_before[i][c]);
+        }
+    }
+    cycles->m_text += esp_cpu_get_cycle_count() - start;
+
+    start = esp_cpu_get_cycle_count();
+    for (i=0;i<BENCH_READINGS;i++) {
+        for (c=0;c<BENCH_CHANNELS;c++) {
+            m_binaryBefore[i][c] = float_reference_toFixedPoint(m_before[i][c], tcpip_protocol_getBinaryScale(m_types[c]));
+        }
+    }
+    cycles->m_binary += esp_cpu_get_cycle_count() - start;
+}
+
+static void bench_after(BenchCycles *cycles)
+{
+    bme280_values values;
+    uint32_t start;
+    size_t i, c;
+
+    start = esp_cpu_get_cycle_count();
+    for (i=0;i<BENCH_READINGS;i++) {
+        bme280_reader_compensate(&m_calib, &m_raw[i], &values);
+        m_after[i][0].m_value = values.temperature;
+        m_after[i][1].m_value = values.humidity;
+        m_after[i][2].m_value = values.pressure;
+    }
+    cycles->m_conversion += esp_cpu_get_cycle_count() - start;
+
+    start = esp_cpu_get_cycle_count();
+    for (i=0;i<BENCH_READINGS;i++) {
+        for (c=0;c<BENCH_CHANNELS;c++) {
+            tcpip_protocol_formatText(m_textAfter[i][c], TCPIP_TEXT_LINE_SIZE, &m_after[i][c]);
+        }
+    }
+    cycles->m_text += esp_cpu_get_cycle_count() - start;
+
+    start = esp_cpu_get_cycle_count();
+    for (i=0;i<BENCH_READINGS;i++) {
+        for (c=0;c<BENCH_CHANNELS;c++) {
+            m_binaryAfter[i][c] = tcpip_protocol_getBinaryValue(&m_after[i][c]);
+        }
+    }
+    cycles->m_binary += esp_cpu_get_cycle_count() - start;
+}
+
+/*!
+ * \brief bench_sameText
+ * \return true when both paths gave same text lines, binary pressure may
+ * differ by rounding of float mantissa before
+ */
+static bool bench_sameText(void)
+{
+    size_t i, c;
+    for (i=0;i<BENCH_READINGS;i++) {
+        for (c=0;c<BENCH_CHANNELS;c++) {
+            if (strcmp(m_textBefore[i][c], m_textAfter[i][c]) != 0) {
+                printf("text differs: %s vs %s", m_textBefore[i][c], m_textAfter[i][c]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void bench_print(const char *name, const BenchCycles *cycles)
+{
+    double readings = (double)(BENCH_READINGS) * BENCH_ROUNDS;
+
+    printf("%-7s conversion %6.1f  text %7.1f  binary %5.1f  text path %7.1f cycles/reading\n", name,
+           (double)(cycles->m_conversion) / readings, (double)(cycles->m_text) / readings,
+           (double)(cycles->m_binary) / readings, (double)(cycles->m_conversion + cycles->m_text) / readings);
+}
+
+int main(void)
+{
+    BenchCycles before, after;
+    size_t i, c;
+    int round;
+
+    memset(&before, 0, sizeof(before));
+    memset(&after, 0, sizeof(after));
+    for (i=0;i<BENCH_READINGS;i++) {
+        for (c=0;c<BENCH_CHANNELS;c++) {
+            m_after[i][c].m_type = m_types[c];
+        }
+    }
+    // rounds interleave paths, so frequency changes hit both
+    for (round=0;round<BENCH_ROUNDS;round++) {
+        bench_makeReadings();
+        bench_before(&before);
+        bench_after(&after);
+        if (!bench_sameText()) {
+            return 1;
+        }
+    }
+    printf("BME280 reading (temperature, humidity, pressure), host cycles\n");
+    bench_print("before", &before);
+    bench_print("after", &after);
+    return 0;
+}
@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""Stand-in server of binary protocol over TCP (TCPIP_PROTOCOL_BINARY).
+
+Accepts connection of the device, frames its messages, answers clock sync
+requests (TCPIP_CLOCK_SYNC) and reports sample-to-receive latency of values
+as histogram. Message formats are in main/tcpip_protocol.h.
+
+Latency needs offset of device clock, which device computes from sync
+exchange and sends in next sync request. Values received before that are
+counted but not in latency. Replayed values of sample log (sequence 0) are
+left out, their latency is time device was offline.
+
+Copyright of Timo Hannukkala. All rights reserved.
+Author Timo Hannukkala <timohannukkala@hotmail.com>
+"""
+
+import argparse
+import socket
+import struct
+import time
+
+VALUES_MAGIC = 0xA5
+SUMMARY_MAGIC = 0xA6
+STATS_MAGIC = 0xA7
+CLOCK_REQUEST_MAGIC = 0xA8
+CLOCK_REPLY_MAGIC = 0xA9
+REPLAY_MAGIC = 0xAA
+HEADER = struct.Struct(">BBH")
+REPLAY_HEADER = struct.Struct(">BBHII")
+RECORD = struct.Struct(">BBHIi")
+SUMMARY_SIZE = 30
+CLOCK_REQUEST = struct.Struct(">BBHQqI")
+CLOCK_REPLY = struct.Struct(">BBHQQQ")
+# bucket i counts latencies below BASE_MS << i, last one the rest
+BASE_MS = 16
+BUCKETS = 8
+
+
+def now_us():
+    return time.monotonic_ns() // 1000
+
+
+class Latency:
+    def __init__(self):
+        self.buckets = [0] * BUCKETS
+        self.latencies = []
+        self.unsynced = 0
+        self.replayed = 0
+
+    def add(self, ms):
+        bucket = 0
+        while bucket < BUCKETS - 1 and ms >= BASE_MS << bucket:
+            bucket += 1
+        self.buckets[bucket] += 1
+        self.latencies.append(ms)
+
+    def report(self):
+        print("values without clock offset %d, replayed %d" % (self.unsynced, self.replayed))
+        if not self.latencies:
+            return
+        latencies = sorted(self.latencies)
+        count = len(latencies)
+        print("sample to receive ms: mean %.1f p50 %.1f p95 %.1f max %.1f"
+              % (sum(latencies) / count, latencies[count // 2], latencies[min(count - 1, count * 95 // 100)],
+                 latencies[-1]))
+        for i, value in enumerate(self.buckets):
+            label = ("< %d" % (BASE_MS << i)) if i < BUCKETS - 1 else (">= %d" % (BASE_MS << (i - 1)))
+            print("  %8s ms %6d %s" % (label, value, "#" * (60 * value // max(self.buckets))))
+
+
+class Connection:
+    def __init__(self, sock, args, latency):
+        self.sock = sock
+        self.args = args
+        self.latency = latency
+        self.buffer = b""
+        self.offset_us = None
+
+    def message_size(self):
+        """Size of first message in buffer, None if header is not complete."""
+        if len(self.buffer) < HEADER.size:
+            return None
+        magic, version, count = HEADER.unpack_from(self.buffer)
+        if magic == VALUES_MAGIC:
+            return HEADER.size + count * RECORD.size
+        if magic == REPLAY_MAGIC:
+            return REPLAY_HEADER.size + count * RECORD.size
+        if magic == SUMMARY_MAGIC:
+            return HEADER.size + count * SUMMARY_SIZE
+        if magic == STATS_MAGIC:
+            return HEADER.size + count
+        if magic == CLOCK_REQUEST_MAGIC:
+            return CLOCK_REQUEST.size
+        raise ValueError("unknown message 0x%02X, text protocol?" % magic)
+
+    def receive(self, data, received_us):
+        self.buffer += data
+        while True:
+            size = self.message_size()
+            if size is None or len(self.buffer) < size:
+                return
+            message, self.buffer = self.buffer[:size], self.buffer[size:]
+            self.handle(message, received_us)
+
+    def handle(self, message, received_us):
+        magic, version, count = HEADER.unpack_from(message)
+        if magic == CLOCK_REQUEST_MAGIC:
+            _, _, _, sent_us, offset_us, round_trip_us = CLOCK_REQUEST.unpack(message)
+            self.sock.sendall(CLOCK_REPLY.pack(CLOCK_REPLY_MAGIC, 1, 0, sent_us, received_us, now_us()))
+            if round_trip_us > 0:
+                self.offset_us = offset_us
+                if not self.args.quiet:
+                    print("clock offset %d us, round trip %d us" % (offset_us, round_trip_us))
+        elif magic == VALUES_MAGIC:
+            for i in range(count):
+                sensor, scale, sequence, timestamp, value = RECORD.unpack_from(message, HEADER.size + RECORD.size * i)
+                if self.offset_us is None:
+                    self.latency.unsynced += 1
+                else:
+                    self.latency.add((received_us - (timestamp * 1000 + self.offset_us)) / 1000.0)
+                if not self.args.quiet:
+                    print("sensor %d seq %d t %d value %s" % (sensor, sequence, timestamp, value / 10 ** scale))
+        elif magic == REPLAY_MAGIC:
+            # timestamps are ms since start of that boot
+            _, _, _, boot, current_boot = REPLAY_HEADER.unpack_from(message)
+            self.latency.replayed += count
+            if not self.args.quiet:
+                print("replay of boot %d (now boot %d)" % (boot, current_boot))
+                for i in range(count):
+                    sensor, scale, _, timestamp, value = RECORD.unpack_from(message, REPLAY_HEADER.size + RECORD.size * i)
+                    print("  sensor %d t %d value %s" % (sensor, timestamp, value / 10 ** scale))
+        elif not self.args.quiet:
+            print("message 0x%02X, %d bytes" % (magic, len(message)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", type=int, default=7000)
+    parser.add_argument("--report", type=float, default=60.0, help="report interval in s")
+    parser.add_argument("--quiet", action="store_true", help="don't print values")
+    args = parser.parse_args()
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(("", args.port))
+    server.listen(1)
+    latency = Latency()
+    try:
+        while True:
+            sock, address = server.accept()
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            sock.settimeout(1.0)
+            print("connection from %s" % address[0])
+            connection = Connection(sock, args, latency)
+            next_report = time.monotonic() + args.report
+            while True:
+                if time.monotonic() >= next_report:
+                    latency.report()
+                    next_report = time.monotonic() + args.report
+                try:
+                    data = sock.recv(4096)
+                except socket.timeout:
+                    continue
+                except OSError:
+                    data = b""
+                if not data:
+                    break
+                try:
+                    connection.receive(data, now_us())
+                except ValueError as error:
+                    print(error)
+                    break
+            sock.close()
+            print("connection closed")
+            latency.report()
+    except KeyboardInterrupt:
+        pass
+    latency.report()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""Reference receiver of UDP transport (TCPIP_TRANSPORT_UDP).
+
+Receives datagrams of the device, acks them when device asks for it and
+reports loss, reordering, duplicates and latency. Datagram format is in
+main/tcpip_protocol.h.
+
+Latency is one way latency above the fastest datagram seen: device clock is
+ms since boot, so offset of the clocks is taken from the datagram with the
+smallest arrival - send time. Retransmitted datagrams keep time of first
+send, so their latency includes the retransmit delay.
+
+--drop simulates packet loss on the receiving side, datagrams are dropped
+before they are acked or counted, to compare transports under loss.
+
+Copyright of Timo Hannukkala. All rights reserved.
+Author Timo Hannukkala <timohannukkala@hotmail.com>
+"""
+
+import argparse
+import random
+import socket
+import struct
+import time
+
+DATAGRAM_MAGIC = 0xB5
+ACK_MAGIC = 0xB6
+HEADER = struct.Struct(">BBHII")
+ACK = struct.Struct(">BBHII")
+FLAG_ACK = 0x01
+FLAG_RETRANSMIT = 0x02
+# sequence going back more than this is reboot of device
+RESTART_DISTANCE = 10000
+
+
+class Stats:
+    def __init__(self):
+        self.reset()
+
+    def reset(self):
+        self.first = None
+        self.highest = None
+        self.received = set()
+        self.datagrams = 0
+        self.duplicates = 0
+        self.reordered = 0
+        self.retransmits = 0
+        self.offset = None
+        self.latencies = []
+
+    def add(self, sequence, timestamp, flags, arrival_ms):
+        if self.highest is not None and sequence + RESTART_DISTANCE < self.highest:
+            print("device restarted, statistics are reset")
+            self.report()
+            self.reset()
+        self.datagrams += 1
+        if flags & FLAG_RETRANSMIT:
+            self.retransmits += 1
+        if sequence in self.received:
+            self.duplicates += 1
+            return
+        if self.first is None or sequence < self.first:
+            self.first = sequence
+        if self.highest is not None and sequence < self.highest:
+            self.reordered += 1
+        if self.highest is None or sequence > self.highest:
+            self.highest = sequence
+        self.received.add(sequence)
+        offset = arrival_ms - timestamp
+        if self.offset is None or offset < self.offset:
+            self.offset = offset
+        self.latencies.append(offset)
+
+    def ack_mask(self, sequence):
+        mask = 0
+        for i in range(32):
+            if sequence - 1 - i in self.received:
+                mask |= 1 << i
+        return mask
+
+    def report(self):
+        if self.highest is None:
+            print("no datagrams")
+            return
+        expected = self.highest - self.first + 1
+        lost = expected - len(self.received)
+        latencies = sorted(l - self.offset for l in self.latencies)
+        count = len(latencies)
+        print("datagrams %d unique %d lost %d (%.2f %%) reordered %d duplicates %d retransmits %d"
+              % (self.datagrams, len(self.received), lost, 100.0 * lost / expected, self.reordered,
+                 self.duplicates, self.retransmits))
+        print("latency above minimum ms: mean %.1f p50 %d p95 %d max %d"
+              % (sum(latencies) / count, latencies[count // 2], latencies[min(count - 1, count * 95 // 100)],
+                 latencies[-1]))
+
+
+def print_payload(payload):
+    if payload and payload[0] in (0xA5, 0xA6, 0xA7, 0xAA):
+        magic, version, count = struct.unpack_from(">BBH", payload)
+        print("  message 0x%02X, count %d, %d bytes" % (magic, count, len(payload)))
+        offset = 4
+        if magic == 0xAA:
+            boot, current_boot = struct.unpack_from(">II", payload, 4)
+            print("  replay of boot %d (now boot %d)" % (boot, current_boot))
+            offset = 12
+        if magic in (0xA5, 0xAA):
+            for i in range(count):
+                sensor, scale, sequence, timestamp, value = struct.unpack_from(">BBHIi", payload, offset + 12 * i)
+                print("    sensor %d seq %d t %d value %s" % (sensor, sequence, timestamp, value / 10 ** scale))
+    else:
+        for line in payload.decode("ascii", "replace").splitlines():
+            print("  " + line)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", type=int, default=7000)
+    parser.add_argument("--drop", type=float, default=0.0, help="fraction of datagrams to drop")
+    parser.add_argument("--report", type=float, default=10.0, help="report interval in s")
+    parser.add_argument("--quiet", action="store_true", help="don't print payloads")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("", args.port))
+    sock.settimeout(1.0)
+    stats = Stats()
+    start = time.monotonic()
+    next_report = start + args.report
+    try:
+        while True:
+            now = time.monotonic()
+            if now >= next_report:
+                stats.report()
+                next_report = now + args.report
+            try:
+                data, address = sock.recvfrom(2048)
+            except socket.timeout:
+                continue
+            if len(data) < HEADER.size or data[0] != DATAGRAM_MAGIC:
+                continue
+            if args.drop > 0 and random.random() < args.drop:
+                continue
+            magic, flags, size, sequence, timestamp = HEADER.unpack_from(data)
+            stats.add(sequence, timestamp, flags, int((time.monotonic() - start) * 1000))
+            if flags & FLAG_ACK:
+                sock.sendto(ACK.pack(ACK_MAGIC, 0, 0, sequence, stats.ack_mask(sequence)), address)
+            if not args.quiet:
+                print("datagram %d from %s%s" % (sequence, address[0],
+                                                 " (retransmit)" if flags & FLAG_RETRANSMIT else ""))
+                print_payload(data[HEADER.size:HEADER.size + size])
+    except KeyboardInterrupt:
+        pass
+    stats.report()
+
+
+if __name__ == "__main__":
+    main()